@@ -0,0 +1,217 @@
+#include "bloom.h"
+#include <string.h>
+#include <errno.h>
+
+#define BLOOM_MAGIC          0x4d4c4242 //"BBLM"
+#define BLOOM_BITS_PER_KEY   12
+#define BLOOM_WORDS_PER_BLOCK 8 //8 * 64 bits = one 64-byte cache line
+#define BLOOM_BLOCK_BYTES    (BLOOM_WORDS_PER_BLOCK * sizeof(uint64_t))
+
+struct BloomHeader {
+    uint32_t magic;
+    uint32_t dirty;
+    uint64_t num_blocks;
+    uint64_t num_keys;
+};
+
+//odd multipliers, one per word of a block
+static const uint32_t SALT[BLOOM_WORDS_PER_BLOCK] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t bloom_hash(const void *key, size_t key_size) {
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ key_size;
+    uint64_t word;
+    while (key_size >= sizeof(uint64_t)) {
+        memcpy(&word, p, sizeof(uint64_t));
+        h = mix(h ^ word);
+        p += sizeof(uint64_t);
+        key_size -= sizeof(uint64_t);
+    }
+    if (key_size) {
+        word = 0;
+        memcpy(&word, p, key_size);
+        h = mix(h ^ word);
+    }
+    return h;
+}
+
+static uint64_t *bloom_block(PBloom bloom, uint64_t h) {
+    //upper 32 bits choose the block, lower 32 bits choose the bits in it
+    uint64_t block = ((h >> 32) * bloom->num_blocks) >> 32;
+    return bloom->bits + block * BLOOM_WORDS_PER_BLOCK;
+}
+
+static uint64_t num_blocks_for(size_t expected_keys) {
+    uint64_t num_bits = (uint64_t)expected_keys * BLOOM_BITS_PER_KEY;
+    uint64_t num_blocks = (num_bits + BLOOM_BLOCK_BYTES * 8 - 1) / (BLOOM_BLOCK_BYTES * 8);
+    return num_blocks ? num_blocks : 1;
+}
+
+static uint64_t *bits_create(uint64_t num_blocks) {
+    uint64_t *bits = aligned_alloc(BLOOM_BLOCK_BYTES, num_blocks * BLOOM_BLOCK_BYTES);
+    if (bits == NULL)
+        return NULL;
+    memset(bits, 0, num_blocks * BLOOM_BLOCK_BYTES);
+    return bits;
+}
+
+static int write_header(PBloom bloom, uint32_t dirty) {
+    struct BloomHeader header;
+    header.magic = BLOOM_MAGIC;
+    header.dirty = dirty;
+    header.num_blocks = bloom->num_blocks;
+    header.num_keys = bloom->num_keys;
+    fseek(bloom->file, 0, SEEK_SET);
+    if (fwrite(&header, sizeof(header), 1, bloom->file) != 1)
+        return -1;
+    return 0;
+}
+
+PBloom bloom_create(const char *pathname, size_t expected_keys) {
+    FILE *file = fopen(pathname, "w+");
+    if (file == NULL) {
+        perror("fopen()");
+        return NULL;
+    }
+    PBloom bloom = malloc(sizeof(struct Bloom));
+    if (bloom == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    bloom->file = file;
+    bloom->num_blocks = num_blocks_for(expected_keys);
+    bloom->num_keys = 0;
+    bloom->dirty = true;
+    bloom->stale = false;
+    bloom->bits = bits_create(bloom->num_blocks);
+    if (bloom->bits == NULL) {
+        fclose(file);
+        free(bloom);
+        return NULL;
+    }
+    write_header(bloom, 1);
+    fflush(file);
+    return bloom;
+}
+
+PBloom bloom_open(const char *pathname) {
+    FILE *file = fopen(pathname, "r+");
+    if (file == NULL)
+        return NULL;
+    struct BloomHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != BLOOM_MAGIC || header.num_blocks == 0) {
+        fclose(file);
+        errno = EINVAL;
+        return NULL;
+    }
+    PBloom bloom = malloc(sizeof(struct Bloom));
+    if (bloom == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    bloom->file = file;
+    bloom->num_blocks = header.num_blocks;
+    bloom->num_keys = header.num_keys;
+    bloom->dirty = false;
+    bloom->stale = header.dirty != 0;
+    bloom->bits = bits_create(bloom->num_blocks);
+    if (bloom->bits == NULL) {
+        fclose(file);
+        free(bloom);
+        return NULL;
+    }
+    if (fread(bloom->bits, BLOOM_BLOCK_BYTES, bloom->num_blocks, file) != bloom->num_blocks)
+        bloom->stale = true; //truncated file, contents can not be trusted
+    return bloom;
+}
+
+void bloom_close(PBloom bloom) {
+    if (bloom == NULL)
+        return;
+    bloom_flush(bloom);
+    fclose(bloom->file);
+    free(bloom->bits);
+    free(bloom);
+}
+
+int bloom_reset(PBloom bloom, size_t expected_keys) {
+    if (bloom == NULL)
+        return EINVAL;
+    uint64_t num_blocks = num_blocks_for(expected_keys);
+    uint64_t *bits = bits_create(num_blocks);
+    if (bits == NULL)
+        return ENOMEM;
+    free(bloom->bits);
+    bloom->bits = bits;
+    bloom->num_blocks = num_blocks;
+    bloom->num_keys = 0;
+    bloom->stale = false;
+    bloom->dirty = true;
+    return 0;
+}
+
+size_t bloom_capacity(PBloom bloom) {
+    return bloom->num_blocks * BLOOM_BLOCK_BYTES * 8 / BLOOM_BITS_PER_KEY;
+}
+
+int bloom_add(PBloom bloom, const void *key, size_t key_size) {
+    if (bloom == NULL || key == NULL)
+        return EINVAL;
+    if (!bloom->dirty) {
+        //record on disk that the filter is changing, so that a crash before
+        //bloom_flush is detected by bloom_open instead of giving false negatives
+        if (write_header(bloom, 1) != 0)
+            return EIO;
+        fflush(bloom->file);
+        bloom->dirty = true;
+    }
+    uint64_t h = bloom_hash(key, key_size);
+    uint64_t *block = bloom_block(bloom, h);
+    uint32_t x = (uint32_t)h;
+    for (int i = 0; i < BLOOM_WORDS_PER_BLOCK; i++)
+        block[i] |= (uint64_t)1 << ((x * SALT[i]) >> 26);
+    bloom->num_keys++;
+    return 0;
+}
+
+bool bloom_may_contain(PBloom bloom, const void *key, size_t key_size) {
+    if (bloom == NULL || bloom->stale)
+        return true;
+    uint64_t h = bloom_hash(key, key_size);
+    const uint64_t *block = bloom_block(bloom, h);
+    uint32_t x = (uint32_t)h;
+    uint64_t missing = 0;
+    for (int i = 0; i < BLOOM_WORDS_PER_BLOCK; i++)
+        missing |= ~block[i] & ((uint64_t)1 << ((x * SALT[i]) >> 26));
+    return missing == 0;
+}
+
+int bloom_flush(PBloom bloom) {
+    if (bloom == NULL)
+        return EINVAL;
+    if (!bloom->dirty)
+        return 0;
+    if (write_header(bloom, 1) != 0)
+        return EIO;
+    if (fwrite(bloom->bits, BLOOM_BLOCK_BYTES, bloom->num_blocks, bloom->file) != bloom->num_blocks)
+        return EIO;
+    fflush(bloom->file);
+    //bits are on disk, now mark the file clean
+    if (write_header(bloom, 0) != 0)
+        return EIO;
+    fflush(bloom->file);
+    bloom->dirty = false;
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef BLOOM_H__
+#define BLOOM_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BLOOM_SUFFIX ".blm"
+
+/* Blocked Bloom filter. Every key maps to one 64-byte block (a single cache
+   line) and sets one bit in each of the 8 words of that block, so a probe
+   touches exactly one cache line. */
+typedef struct Bloom {
+    FILE *file;
+    uint64_t num_blocks;
+    uint64_t num_keys;
+    bool dirty; //the file on disk is older than 'bits'
+    bool stale; //set by bloom_open if the file was not closed cleanly
+    uint64_t *bits;
+} *PBloom;
+
+PBloom bloom_create(const char *pathname, size_t expected_keys);
+/* Opens a persisted filter. If the filter was not flushed after its last
+   modification 'stale' is set, and the caller must rebuild it with
+   bloom_reset + bloom_add before trusting bloom_may_contain. */
+PBloom bloom_open(const char *pathname);
+/* Flushes the filter to disk and frees it. */
+void bloom_close(PBloom bloom);
+
+/* Clears all bits and resizes the filter for 'expected_keys' keys. */
+int bloom_reset(PBloom bloom, size_t expected_keys);
+/* Number of keys the filter was sized for. */
+size_t bloom_capacity(PBloom bloom);
+
+int bloom_add(PBloom bloom, const void *key, size_t key_size);
+/* Returns false only if 'key' was never added. */
+bool bloom_may_contain(PBloom bloom, const void *key, size_t key_size);
+
+/* Writes the filter to disk and marks the file clean. Returns 0 if success. */
+int bloom_flush(PBloom bloom);
+
+#endif
@@ -19,6 +19,7 @@ typedef struct Node *PNode;
 static const uint8_t OPT_NONE  = 0x00;
 static const uint8_t OPT_EMPTY_KEY = 0x01;
 static const uint8_t OPT_INFINITY_KEY = 0x02;
+static const uint8_t OPT_DELETED = 0x04; //leaf entry removed by btree_remove, kept as a tombstone
 
 static size_t get_node_size(size_t key_type_size) {
     return sizeof(struct Node) + (NODE_MAX_DEGREE + 1) * key_type_size;
@@ -32,18 +33,18 @@ static PNode node_create(size_t key_type_size) {
     return node;
 }
 
-static char *get_disk_pathname(const char *path, const char *table_name, const char *idx_col_name) {
+static char *get_disk_pathname(const char *path, const char *table_name, const char *idx_col_name, const char *suffix) {
     size_t path_len = strlen(path);
     size_t table_name_len = strlen(table_name);
     size_t idx_col_name_len = strlen(idx_col_name);
-    size_t idx_suffix_len = strlen(INDEX_SUFFIX);
+    size_t suffix_len = strlen(suffix);
     size_t EOF_SIZE = 1; // space for '\0'
-    char *disk_path = malloc((path_len + table_name_len + 1 + idx_col_name_len + idx_suffix_len + EOF_SIZE) * sizeof(char));
+    char *disk_path = malloc((path_len + table_name_len + 1 + idx_col_name_len + suffix_len + EOF_SIZE) * sizeof(char));
     strcpy(disk_path, path);
     strcpy(disk_path + path_len, table_name);
     disk_path[path_len + table_name_len] = '_';
     strcpy(disk_path + path_len + table_name_len + 1, idx_col_name);
-    strcpy(disk_path + path_len + table_name_len + 1 + idx_col_name_len, INDEX_SUFFIX);
+    strcpy(disk_path + path_len + table_name_len + 1 + idx_col_name_len, suffix);
     return disk_path;
 }
 
@@ -60,39 +61,47 @@ struct key_st {
     uint8_t key_opt;
 };
 static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, struct key_st *key_pos, struct key_st *key_data, struct key_st *parent_key, record_t record);
+static void btree_open_bloom(PBTree btree);
 
-PBTree btree_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+//Creates the index file with its root block allocated but not written
+static PBTree btree_init(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
     PBTree btree = malloc(sizeof(struct BTree));
     if (btree == NULL)
         return NULL;
     btree->p_key_type = p_key_type;
+    btree->bloom = NULL;
     size_t node_size = get_node_size(p_key_type->get_type_size());
-    btree->disk = dcreate(get_disk_pathname(path, table_name, idx_col_name), node_size);
+    char *disk_pathname = get_disk_pathname(path, table_name, idx_col_name, INDEX_SUFFIX);
+    btree->disk = dcreate(disk_pathname, node_size);
+    free(disk_pathname);
     if (btree->disk == NULL) {
         free(btree);
         return NULL;
     }
-    PNode node = node_create(p_key_type->get_type_size());
-    if (node == NULL) {
-        dclose(btree->disk);
-        free(btree);
-        return NULL;
-    }
-    node->flag_is_leaf = true;
-    node->num = 0;
-    node->last_pointer = DNULL;
     if (dalloc_first_block(btree->disk) != 0) {
         dclose(btree->disk);
         free(btree);
         return NULL;
     }
     btree->root = first_block(btree->disk);
-    if (btree->root == DNULL) {
-        dclose(btree->disk);
-        free(btree);
-        free(node);
+    btree->bloom_pathname = get_disk_pathname(path, table_name, idx_col_name, BLOOM_SUFFIX);
+    remove(btree->bloom_pathname); //a filter left by an older index of the same name
+    return btree;
+}
+
+PBTree btree_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    PBTree btree = btree_init(path, table_name, idx_col_name, p_key_type);
+    if (btree == NULL)
+        return NULL;
+    size_t node_size = btree->disk->block_size;
+    PNode node = node_create(p_key_type->get_type_size());
+    if (node == NULL) {
+        btree_close(btree);
         return NULL;
     }
+    node->flag_is_leaf = true;
+    node->num = 0;
+    node->last_pointer = DNULL;
     copy_to_disk(node, node_size, btree->disk, btree->root);
     free(node);
     //insert an infinity key
@@ -102,6 +111,7 @@ PBTree btree_create(const char *path, const char *table_name, const char *idx_co
     }
     key_st->key_pointer = NULL;
     key_st->key_opt = OPT_INFINITY_KEY;
+    errno = 0; //btree_insert_re checks errno
     btree_insert_re(btree, btree->root, key_st, key_st, NULL, DNULL);
     return btree;
 }
@@ -110,17 +120,25 @@ PBTree btree_open(const char *path, const char *table_name, const char *idx_col_
     PBTree btree = malloc(sizeof(struct BTree));
     if (btree == NULL)
         return NULL;
-    btree->disk = dopen(get_disk_pathname(path, table_name, idx_col_name));
+    char *disk_pathname = get_disk_pathname(path, table_name, idx_col_name, INDEX_SUFFIX);
+    btree->disk = dopen(disk_pathname);
+    free(disk_pathname);
     if (btree->disk == NULL) {
         free(btree);
         return NULL;
     }
     btree->p_key_type = p_key_type;
     btree->root = first_block(btree->disk);
+    btree->bloom = NULL;
+    btree->bloom_pathname = get_disk_pathname(path, table_name, idx_col_name, BLOOM_SUFFIX);
+    btree_open_bloom(btree);
     return btree;
 }
 
 void btree_close(PBTree btree) {
+    if (btree->bloom)
+        bloom_close(btree->bloom);
+    free(btree->bloom_pathname);
     dclose(btree->disk);
     free(btree);
 }
@@ -197,7 +215,7 @@ static PNode cell_insert(PNode node, int pos, disk_pointer pointer, struct key_s
             memcpy(split->key_data, node->key_data + split_start * key_type_size, (pos - split_start) * key_type_size);
         }
         //insert pointer and key into split
-        if (node->flag_is_leaf || pos < num)
+        if (node->flag_is_leaf || pos <= num)
             split->pointers[pos - split_start] = pointer;
         else {
             split->pointers[pos - split_start] = split->last_pointer;
@@ -206,8 +224,8 @@ static PNode cell_insert(PNode node, int pos, disk_pointer pointer, struct key_s
         split->opt[pos - split_start] = key->key_opt;
         if ( !(key->key_opt & OPT_EMPTY_KEY) && !(key->key_opt & OPT_INFINITY_KEY))
             memcpy(split->key_data + (pos - split_start) * key_type_size, key->key_pointer, key_type_size);
-        //copy the rest to split
-        if (num > pos) {
+        //copy the rest to split, a non-leaf node still has the key of last_pointer if pos == num
+        if (num > pos || (!node->flag_is_leaf && num == pos)) {
             memcpy(&split->pointers[pos - split_start + 1], &node->pointers[pos], (num - pos) * sizeof(disk_pointer));
             /*
             Non-leaf node have one more key at the begin
@@ -234,6 +252,21 @@ static struct  Split_res *split_res_create() {
     return res;
 }
 
+/* Returns a key_st holding a copy of the key. The keys of a Split_res must not
+   point into node buffers, they are freed before the parent reads the result. */
+static struct key_st *key_st_copy(const void *key_pointer, uint8_t key_opt, size_t key_type_size) {
+    struct key_st *key_st = (struct key_st *)malloc(sizeof(struct key_st) + key_type_size);
+    if (key_st == NULL)
+        return NULL;
+    key_st->key_opt = key_opt & ~OPT_DELETED; //separators never carry the tombstone of a leaf entry
+    key_st->key_pointer = NULL;
+    if (key_pointer != NULL && !(key_opt & OPT_EMPTY_KEY) && !(key_opt & OPT_INFINITY_KEY)) {
+        key_st->key_pointer = (char *)(key_st + 1);
+        memcpy(key_st->key_pointer, key_pointer, key_type_size);
+    }
+    return key_st;
+}
+
 static void split_res_destroy(struct Split_res *res) {
     if (res == NULL)
         return;
@@ -250,7 +283,7 @@ static void split_res_destroy(struct Split_res *res) {
 static int first_new_key_index(PBTree btree, PNode node, PNode split, size_t key_type_size) {
     //look for the index of the first new key in 'split'('node' and 'split' are leaf nodes)
     for (int i = 0; i < split->num; i++)
-        if (btree->p_key_type->compare(
+        if ((split->opt[i] & OPT_INFINITY_KEY) || btree->p_key_type->compare(
             split->key_data + i * key_type_size,
             node->key_data + (node->num - 1) * key_type_size
             ) != 0)
@@ -402,19 +435,14 @@ static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, s
 					p_key_data = node->key_data;
                     pos = 0;
                 }
-                free(tmp_buffer);
                 res = split_res_create();
-                if (res == NULL) {
-                    errno = ENOMEM;
-                    goto ERR;
-                }
-                res->actual_key_pos = (struct key_st *)malloc(sizeof(struct key_st));
-                if (res->actual_key_pos == NULL) {
+                if (res != NULL) //copy the key before freeing the node it is in
+                    res->actual_key_pos = key_st_copy(p_key_data + pos * key_type_size, node->opt[pos], key_type_size);
+                free(tmp_buffer);
+                if (res == NULL || res->actual_key_pos == NULL) {
                     errno = ENOMEM;
                     goto ERR;
                 }
-                res->actual_key_pos->key_pointer = p_key_data + pos * key_type_size;
-                res->actual_key_pos->key_opt = node->opt[pos];
                 res->this_node_key = NULL;
                 res->new_node_key = NULL;
                 res->new_node_pointer = DNULL;
@@ -488,20 +516,15 @@ static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, s
             copy_to_disk(split, disk->block_size, disk, tmp_pointer); //write new node to disk
             node->last_pointer = tmp_pointer; //'last_pointer' of leaf node points to the next node
             res->new_node_pointer = tmp_pointer;
-            res->new_node_key = (struct key_st *)malloc(sizeof(struct key_st));
+            key_index = first_new_key_index(btree, node, split, key_type_size);
+            if (key_index >= 0)
+                res->new_node_key = key_st_copy(split->key_data + key_index * key_type_size, split->opt[key_index], key_type_size);
+            else
+                res->new_node_key = key_st_copy(NULL, OPT_EMPTY_KEY, key_type_size);
             if (res->new_node_key == NULL) {
                 errno = ENOMEM;
                 goto ERR;
             }
-            key_index = first_new_key_index(btree, node, split, key_type_size);
-            if (key_index >= 0) {
-                res->new_node_key->key_pointer = split->key_data + key_index * key_type_size;
-                res->new_node_key->key_opt = split->opt[key_index];
-            }
-            else {
-                res->new_node_key->key_pointer = NULL;
-                res->new_node_key->key_opt = OPT_EMPTY_KEY;
-            }
             free(split);
             if (parent_key && node_first_new_key_index >= node->num) {
                 if (res->this_node_key == NULL) {
@@ -525,11 +548,12 @@ static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, s
                 node->flag_is_leaf = false;
                 node->num = 1;
                 node->pointers[0] = tmp_pointer;
-                memcpy(node->key_data + key_type_size, res->new_node_key->key_pointer, key_type_size); //node->key_data remains the same
-                node->opt[1] = res->new_node_key->key_opt; //node->opt[0] remains the same
+                node->opt[1] = res->new_node_key->key_opt; //node->key_data and node->opt[0] remain the same
+                if (!(node->opt[1] & OPT_EMPTY_KEY) && !(node->opt[1] & OPT_INFINITY_KEY))
+                    memcpy(node->key_data + key_type_size, res->new_node_key->key_pointer, key_type_size);
                 node->last_pointer = res->new_node_pointer;
                 copy_to_disk(node, disk->block_size, disk, btree->root); //btree->root remains unchanged
-                free(res);
+                split_res_destroy(res);
                 res = NULL;
             }
             goto END;
@@ -585,15 +609,16 @@ static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, s
                     copy_to_disk((void *)split, disk->block_size, disk, tmp_pointer); //write mew node to disk
                     res->new_node_pointer = tmp_pointer;
                     key_index = first_nonempty_key_index(split, key_type_size);
-                    if (key_index >= 0) {
-                        res->new_node_key->key_pointer = split->key_data + key_index * key_type_size;
-                        res->new_node_key->key_opt = split->opt[key_index];
-                    }
-                    else {
-                        res->new_node_key->key_pointer = NULL;
-                        res->new_node_key->key_opt = OPT_EMPTY_KEY;
-                    }
+                    free(res->new_node_key);
+                    if (key_index >= 0)
+                        res->new_node_key = key_st_copy(split->key_data + key_index * key_type_size, split->opt[key_index], key_type_size);
+                    else
+                        res->new_node_key = key_st_copy(NULL, OPT_EMPTY_KEY, key_type_size);
                     free(split);
+                    if (res->new_node_key == NULL) {
+                        errno = ENOMEM;
+                        goto ERR;
+                    }
                     node->num--;
                 } 
             } //if res->new_node_pointer != DNULL
@@ -614,13 +639,13 @@ static struct Split_res *btree_insert_re(PBTree btree, disk_pointer disk_node, s
                 res->this_node_key = NULL;
             }
             else {
-                res->this_node_key = (struct key_st *)malloc(sizeof(struct key_st));
+                if (res->this_node_key)
+                    free(res->this_node_key);
+                res->this_node_key = key_st_copy(key_to_compare->key_pointer, key_to_compare->key_opt, key_type_size);
                 if (res->this_node_key == NULL) {
                     errno = ENOMEM;
                     goto ERR;
                 }
-                res->this_node_key->key_pointer = key_to_compare->key_pointer;
-                res->this_node_key->key_opt = key_to_compare->key_opt;
             }
 
             if (res->new_node_key == NULL) {
@@ -690,6 +715,8 @@ int btree_insert(PBTree btree, void *key, record_t record) {
         if (errno)
             goto ERR;
     }
+    if (btree->bloom)
+        bloom_add(btree->bloom, key, btree->p_key_type->get_type_size());
     
 ERR:
     return errno;
@@ -752,14 +779,18 @@ static vector_t *btree_select_static(PBTree btree, struct key_st *key_start, str
             continue;
         }
         //Leaf node for the rest of while loop
-        pos = -1;
-        for (i = 0; i < node->num; i++) {
-            key_to_compare->key_pointer = p_key_data + i * key_type_size;
-            key_to_compare->key_opt = node->opt[i];
-            if (compare_key_st(key_start, key_to_compare, compare) <= 0) {
-                pos = i; //first key larger than or equal to key_start
-                break;
+        while (1) {
+            for (pos = 0; pos < node->num; pos++) {
+                key_to_compare->key_pointer = p_key_data + pos * key_type_size;
+                key_to_compare->key_opt = node->opt[pos];
+                if (compare_key_st(key_start, key_to_compare, compare) <= 0)
+                    break; //first key larger than or equal to key_start
             }
+            if (pos < node->num || node->last_pointer == DNULL)
+                break;
+            //all keys of the leaf are smaller than key_start, the leaves after a run of duplicates have no key in the parent
+            disk_node = node->last_pointer;
+            copy_to_memory(disk, disk_node, buffer);
         }
         //Looking for keys in interval [key_start, key_end]
         while (1) {
@@ -767,10 +798,10 @@ static vector_t *btree_select_static(PBTree btree, struct key_st *key_start, str
                 key_to_compare->key_pointer = p_key_data + pos * key_type_size; 
 //printf(" -- %d -- %d\n", *(int *)(p_key_data+pos*key_type_size), *(int *)(p_key_data+(pos+1)*key_type_size));
                 key_to_compare->key_opt = node->opt[pos];
-                if (compare_key_st(key_to_compare, key_end, compare) <= 0)
-                    vector_push(results, &node->pointers[pos]);
-                else 
+                if (compare_key_st(key_to_compare, key_end, compare) > 0)
                     break;
+                if (!(node->opt[pos] & OPT_DELETED))
+                    vector_push(results, &node->pointers[pos]);
             }
             if (pos < node->num)
                 break;
@@ -793,6 +824,12 @@ vector_t *btree_select(PBTree btree, const void *key_start, const void *key_end)
         errno = EINVAL;
         return NULL;
     }
+    if (btree->p_key_type->compare(key_start, key_end) == 0 && !btree_may_contain(btree, key_start)) {
+        //point lookup answered by the bloom filter, no node is read
+        vector_t *results = vector_create(0);
+        vector_set_type_size(results, sizeof(disk_pointer));
+        return results;
+    }
     struct key_st *key_st_start = (struct key_st *)malloc(sizeof(struct key_st));
     if (key_st_start == NULL) {
         errno = ENOMEM;
@@ -812,3 +849,426 @@ vector_t *btree_select(PBTree btree, const void *key_start, const void *key_end)
     free(key_st_end);
     return results;
 }
+
+
+/*
+    Remove
+*/
+
+int btree_remove(PBTree btree, const void *key, record_t record) {
+    if (btree == NULL || key == NULL)
+        return EINVAL;
+    DISK *disk = btree->disk;
+    size_t key_type_size = btree->p_key_type->get_type_size();
+    int (*compare)(const void *, const void *) = btree->p_key_type->compare;
+    void *buffer = malloc(disk->block_size);
+    if (buffer == NULL)
+        return ENOMEM;
+    PNode node = (PNode)buffer;
+    struct key_st key_st, key_to_compare;
+    key_st.key_pointer = (void *)key;
+    key_st.key_opt = OPT_NONE;
+    disk_pointer disk_node = btree->root;
+    int pos, i, compare_res;
+    //descend to the leaf of the first key larger than or equal to 'key', as btree_select_static
+    while (1) {
+        copy_to_memory(disk, disk_node, buffer);
+        if (node->flag_is_leaf)
+            break;
+        pos = -1;
+        for (i = 0; i <= node->num; i++) {
+            if (node->opt[i] & OPT_EMPTY_KEY)
+                continue;
+            key_to_compare.key_pointer = node->key_data + i * key_type_size;
+            key_to_compare.key_opt = node->opt[i];
+            compare_res = compare_key_st(&key_st, &key_to_compare, compare);
+            if (compare_res >= 0)
+                pos = i;
+            if (compare_res <= 0)
+                break;
+        }
+        if (pos == -1)
+            pos = 0;
+        disk_node = pos < node->num ? node->pointers[pos] : node->last_pointer;
+    }
+    //the entries of 'key' may span several leaves, the entry of 'record' is marked deleted
+    int ret = ENOENT;
+    pos = 0;
+    while (1) {
+        for (; pos < node->num; pos++) {
+            key_to_compare.key_pointer = node->key_data + pos * key_type_size;
+            key_to_compare.key_opt = node->opt[pos];
+            compare_res = compare_key_st(&key_st, &key_to_compare, compare);
+            if (compare_res < 0)
+                break;
+            if (compare_res == 0 && node->pointers[pos] == record && !(node->opt[pos] & OPT_DELETED)) {
+                node->opt[pos] |= OPT_DELETED;
+                ret = copy_to_disk(node, disk->block_size, disk, disk_node) < 0 ? EIO : 0;
+                break;
+            }
+        }
+        if (pos < node->num || node->last_pointer == DNULL)
+            break;
+        disk_node = node->last_pointer;
+        copy_to_memory(disk, disk_node, buffer);
+        pos = 0;
+    }
+    free(buffer);
+    return ret;
+}
+
+/*
+    Bulk load
+*/
+
+#define BULK_LEAF_FILL     90 //entries per leaf, room is left for later inserts
+#define BULK_NON_LEAF_FILL 91 //children per non-leaf node
+
+//separator of a node in its parent
+struct bulk_child {
+    disk_pointer pointer;
+    uint8_t key_opt;
+    char key[1];
+};
+
+struct bulk_level {
+    char *children; //array of struct bulk_child of 'child_size' bytes
+    size_t child_size;
+    size_t num;
+    size_t capacity;
+};
+
+static int bulk_level_push(struct bulk_level *level, disk_pointer pointer, const void *key, uint8_t key_opt, size_t key_type_size) {
+    if (level->num == level->capacity) {
+        size_t capacity = level->capacity ? level->capacity * 2 : 64;
+        char *children = realloc(level->children, capacity * level->child_size);
+        if (children == NULL)
+            return ENOMEM;
+        level->children = children;
+        level->capacity = capacity;
+    }
+    struct bulk_child *child = (struct bulk_child *)(level->children + level->num * level->child_size);
+    child->pointer = pointer;
+    child->key_opt = key_opt;
+    if (key != NULL)
+        memcpy(child->key, key, key_type_size);
+    else
+        memset(child->key, 0, key_type_size);
+    level->num++;
+    return 0;
+}
+
+/* Writes the non-leaf levels above the nodes in 'level', one level at a time,
+   until the children fit in the root. The nodes of a level are equally full. */
+static int bulk_build_non_leaf(PBTree btree, struct bulk_level *level, disk_pointer *p_end, PNode node) {
+    DISK *disk = btree->disk;
+    size_t key_type_size = btree->p_key_type->get_type_size();
+    struct bulk_level parent = { NULL, level->child_size, 0, 0 };
+    int ret = 0;
+    while (1) {
+        size_t num_nodes = (level->num + BULK_NON_LEAF_FILL - 1) / BULK_NON_LEAF_FILL;
+        size_t next = 0;
+        for (size_t i = 0; i < num_nodes; i++) {
+            size_t num_children = level->num / num_nodes + (i < level->num % num_nodes ? 1 : 0);
+            memset(node, 0, disk->block_size);
+            node->flag_is_leaf = false;
+            node->num = num_children - 1;
+            int first_nonempty = -1;
+            for (size_t j = 0; j < num_children; j++) {
+                struct bulk_child *child = (struct bulk_child *)(level->children + (next + j) * level->child_size);
+                if (j < num_children - 1)
+                    node->pointers[j] = child->pointer;
+                else
+                    node->last_pointer = child->pointer;
+                node->opt[j] = child->key_opt;
+                memcpy(node->key_data + j * key_type_size, child->key, key_type_size);
+                if (first_nonempty < 0 && !(child->key_opt & OPT_EMPTY_KEY))
+                    first_nonempty = j;
+            }
+            next += num_children;
+            if (num_nodes == 1) {
+                copy_to_disk(node, disk->block_size, disk, btree->root);
+                goto END;
+            }
+            disk_pointer dp = *p_end;
+            *p_end = next_pointer(disk, dp);
+            copy_to_disk(node, disk->block_size, disk, dp);
+            if (first_nonempty >= 0)
+                ret = bulk_level_push(&parent, dp, node->key_data + first_nonempty * key_type_size, node->opt[first_nonempty], key_type_size);
+            else
+                ret = bulk_level_push(&parent, dp, NULL, OPT_EMPTY_KEY, key_type_size);
+            if (ret != 0)
+                goto END;
+        }
+        //the parents become the level to build on
+        struct bulk_level tmp = *level;
+        *level = parent;
+        parent = tmp;
+        parent.num = 0;
+    }
+END:
+    free(parent.children);
+    return ret;
+}
+
+PBTree btree_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, index_entry_source next, void *arg) {
+    PBTree btree = btree_init(path, table_name, idx_col_name, p_key_type);
+    if (btree == NULL)
+        return NULL;
+    DISK *disk = btree->disk;
+    size_t key_type_size = p_key_type->get_type_size();
+    int (*compare)(const void *, const void *) = p_key_type->compare;
+    PNode leaf = node_create(key_type_size);
+    PNode node = node_create(key_type_size);
+    void *last_key = malloc(key_type_size); //last key of the previous leaf
+    //children are kept aligned for their disk_pointer
+    size_t child_align = _Alignof(struct bulk_child);
+    struct bulk_level level = { NULL, (sizeof(struct bulk_child) + key_type_size + child_align - 1) / child_align * child_align, 0, 0 };
+    int ret = 0;
+    if (leaf == NULL || node == NULL || last_key == NULL) {
+        ret = ENOMEM;
+        goto END;
+    }
+    //leaves are written in key order right after the root, each one links to the next block
+    disk_pointer end = next_pointer(disk, btree->root);
+    disk_pointer leaf_pointer = end;
+    end = next_pointer(disk, end);
+    memset(leaf, 0, disk->block_size);
+    leaf->flag_is_leaf = true;
+    int separator = -1; //index of the first key of the leaf that is new to the previous leaves
+    const void *key;
+    record_t record;
+    while (next(arg, &key, &record)) {
+        if (leaf->num == BULK_LEAF_FILL) {
+            leaf->last_pointer = end;
+            copy_to_disk(leaf, disk->block_size, disk, leaf_pointer);
+            if (separator >= 0)
+                ret = bulk_level_push(&level, leaf_pointer, leaf->key_data + separator * key_type_size, OPT_NONE, key_type_size);
+            else
+                ret = bulk_level_push(&level, leaf_pointer, NULL, OPT_EMPTY_KEY, key_type_size);
+            if (ret != 0)
+                goto END;
+            memcpy(last_key, leaf->key_data + (leaf->num - 1) * key_type_size, key_type_size);
+            leaf_pointer = end;
+            end = next_pointer(disk, end);
+            memset(leaf, 0, disk->block_size);
+            leaf->flag_is_leaf = true;
+            separator = -1;
+        }
+        if (separator < 0 && (level.num == 0 || compare(key, last_key) != 0))
+            separator = leaf->num;
+        leaf->pointers[leaf->num] = record;
+        leaf->opt[leaf->num] = OPT_NONE;
+        memcpy(leaf->key_data + leaf->num * key_type_size, key, key_type_size);
+        leaf->num++;
+    }
+    //the last leaf ends with the infinity key
+    leaf->pointers[leaf->num] = DNULL;
+    leaf->opt[leaf->num] = OPT_INFINITY_KEY;
+    leaf->num++;
+    leaf->last_pointer = DNULL;
+    if (level.num == 0) {
+        //a single leaf is the root
+        copy_to_disk(leaf, disk->block_size, disk, btree->root);
+        goto END;
+    }
+    copy_to_disk(leaf, disk->block_size, disk, leaf_pointer);
+    if (separator >= 0)
+        ret = bulk_level_push(&level, leaf_pointer, leaf->key_data + separator * key_type_size, OPT_NONE, key_type_size);
+    else //the infinity key is the first new key
+        ret = bulk_level_push(&level, leaf_pointer, NULL, OPT_INFINITY_KEY, key_type_size);
+    if (ret == 0)
+        ret = bulk_build_non_leaf(btree, &level, &end, node);
+END:
+    fflush(disk->file);
+    free(leaf);
+    free(node);
+    free(last_key);
+    free(level.children);
+    if (ret != 0) {
+        errno = ret;
+        btree_close(btree);
+        return NULL;
+    }
+    return btree;
+}
+
+/*
+    Bloom filter
+*/
+
+static disk_pointer leftmost_leaf(PBTree btree, void *buffer) {
+    disk_pointer disk_node = btree->root;
+    PNode node = (PNode)buffer;
+    while (1) {
+        copy_to_memory(btree->disk, disk_node, buffer);
+        if (node->flag_is_leaf)
+            return disk_node;
+        disk_node = node->num > 0 ? node->pointers[0] : node->last_pointer;
+    }
+}
+
+//calls 'visit' on every key of the index in key order
+static int walk_leaves(PBTree btree, void (*visit)(const void *key, record_t record, void *arg), void *arg) {
+    DISK *disk = btree->disk;
+    size_t key_type_size = btree->p_key_type->get_type_size();
+    void *buffer = malloc(disk->block_size);
+    if (buffer == NULL)
+        return ENOMEM;
+    PNode node = (PNode)buffer;
+    disk_pointer disk_node = leftmost_leaf(btree, buffer);
+    //walk the leaf chain, the leftmost leaf is already in buffer
+    while (1) {
+        for (int i = 0; i < node->num; i++) {
+            if (node->opt[i] & (OPT_EMPTY_KEY | OPT_INFINITY_KEY | OPT_DELETED))
+                continue;
+            visit(node->key_data + i * key_type_size, node->pointers[i], arg);
+        }
+        disk_node = node->last_pointer;
+        if (disk_node == DNULL)
+            break;
+        copy_to_memory(disk, disk_node, buffer);
+    }
+    free(buffer);
+    return 0;
+}
+
+static void visit_count(const void *key, record_t record, void *arg) {
+    (*(size_t *)arg)++;
+}
+
+struct bloom_fill_arg {
+    PBloom bloom;
+    size_t key_type_size;
+};
+
+static void visit_bloom_add(const void *key, record_t record, void *arg) {
+    struct bloom_fill_arg *fill = (struct bloom_fill_arg *)arg;
+    bloom_add(fill->bloom, key, fill->key_type_size);
+}
+
+static int btree_fill_bloom(PBTree btree, PBloom bloom) {
+    struct bloom_fill_arg fill;
+    fill.bloom = bloom;
+    fill.key_type_size = btree->p_key_type->get_type_size();
+    return walk_leaves(btree, visit_bloom_add, &fill);
+}
+
+static void btree_open_bloom(PBTree btree) {
+    FILE *file = fopen(btree->bloom_pathname, "r");
+    if (file == NULL)
+        return; //no bloom filter for this index
+    fclose(file);
+    PBloom bloom = bloom_open(btree->bloom_pathname);
+    if (bloom == NULL) {
+        //unreadable filter, build a new one
+        btree_enable_bloom(btree, 0);
+        return;
+    }
+    if (bloom->stale || bloom->num_keys > 2 * bloom_capacity(bloom)) {
+        //not closed cleanly, or too full to be useful
+        size_t expected_keys = bloom->num_keys > bloom_capacity(bloom) ? bloom->num_keys : bloom_capacity(bloom);
+        bloom_reset(bloom, 2 * expected_keys);
+        btree_fill_bloom(btree, bloom);
+        bloom_flush(bloom);
+    }
+    btree->bloom = bloom;
+}
+
+int btree_enable_bloom(PBTree btree, size_t expected_keys) {
+    if (btree == NULL)
+        return EINVAL;
+    int ret;
+    if (expected_keys == 0) {
+        //size the filter for the keys already in the index
+        if ((ret = walk_leaves(btree, visit_count, &expected_keys)) != 0)
+            return ret;
+    }
+    if (btree->bloom)
+        ret = bloom_reset(btree->bloom, expected_keys);
+    else {
+        btree->bloom = bloom_create(btree->bloom_pathname, expected_keys);
+        ret = btree->bloom == NULL ? errno : 0;
+    }
+    if (ret != 0)
+        return ret;
+    if ((ret = btree_fill_bloom(btree, btree->bloom)) != 0)
+        return ret;
+    return bloom_flush(btree->bloom);
+}
+
+bool btree_may_contain(PBTree btree, const void *key) {
+    if (btree == NULL || btree->bloom == NULL)
+        return true;
+    return bloom_may_contain(btree->bloom, key, btree->p_key_type->get_type_size());
+}
+
+/*
+    Smallest and largest keys
+*/
+
+int btree_first_key(PBTree btree, void *key) {
+    DISK *disk = btree->disk;
+    size_t key_type_size = btree->p_key_type->get_type_size();
+    void *buffer = malloc(disk->block_size);
+    if (buffer == NULL)
+        return ENOMEM;
+    PNode node = (PNode)buffer;
+    leftmost_leaf(btree, buffer);
+    int ret = ENOENT;
+    while (1) {
+        for (int i = 0; i < node->num && ret != 0; i++)
+            if (!(node->opt[i] & (OPT_EMPTY_KEY | OPT_INFINITY_KEY | OPT_DELETED))) {
+                memcpy(key, node->key_data + i * key_type_size, key_type_size);
+                ret = 0;
+            }
+        if (ret == 0 || node->last_pointer == DNULL)
+            break;
+        copy_to_memory(disk, node->last_pointer, buffer);
+    }
+    free(buffer);
+    return ret;
+}
+
+struct last_key_arg {
+    void *key;
+    size_t key_type_size;
+    bool found;
+};
+
+static void visit_last_key(const void *key, record_t record, void *arg) {
+    struct last_key_arg *last = (struct last_key_arg *)arg;
+    memcpy(last->key, key, last->key_type_size);
+    last->found = true;
+}
+
+int btree_last_key(PBTree btree, void *key) {
+    DISK *disk = btree->disk;
+    size_t key_type_size = btree->p_key_type->get_type_size();
+    void *buffer = malloc(disk->block_size);
+    if (buffer == NULL)
+        return ENOMEM;
+    PNode node = (PNode)buffer;
+    //the rightmost child of every non-leaf node leads to the last leaf
+    disk_pointer disk_node = btree->root;
+    while (1) {
+        copy_to_memory(disk, disk_node, buffer);
+        if (node->flag_is_leaf)
+            break;
+        disk_node = node->last_pointer;
+    }
+    int ret = ENOENT;
+    for (int i = (int)node->num - 1; i >= 0 && ret != 0; i--)
+        if (!(node->opt[i] & (OPT_EMPTY_KEY | OPT_INFINITY_KEY | OPT_DELETED))) {
+            memcpy(key, node->key_data + i * key_type_size, key_type_size);
+            ret = 0;
+        }
+    free(buffer);
+    if (ret == 0)
+        return 0;
+    //the last leaf only holds the infinity key, leaves are not linked backwards
+    struct last_key_arg last = { key, key_type_size, false };
+    if ((ret = walk_leaves(btree, visit_last_key, &last)) != 0)
+        return ret;
+    return last.found ? 0 : ENOENT;
+}
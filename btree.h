@@ -4,20 +4,39 @@
 #include "disk.h"
 #include "datatype.h"
 #include "vector.h"
+#include "bloom.h"
+#include "index.h"
 
 typedef struct BTree/*Index*/ {
     DISK *disk;
     DataType *p_key_type;
     disk_pointer root;
+    PBloom bloom; //optional, NULL if the index has no bloom filter
+    char *bloom_pathname;
 } *PBTree;
 
-typedef disk_pointer record_t;
-
 PBTree btree_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
 PBTree btree_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
 void btree_close(PBTree btree);
 int btree_insert(PBTree btree, void *key, record_t record);
 vector_t *btree_select(PBTree btree, const void *key_start, const void *key_end);
-//remove
+/* Creates the index from the entries returned by 'next', writing the leaves
+   left to right and then the levels above them instead of inserting the
+   entries one by one. Leaves are left 90% full for later inserts. */
+PBTree btree_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, index_entry_source next, void *arg);
+/* Builds a bloom filter sized for 'expected_keys' from the keys already in the
+   index and keeps it up to date on every btree_insert. The filter is persisted
+   next to the index file and loaded again by btree_open. Returns 0 if success. */
+int btree_enable_bloom(PBTree btree, size_t expected_keys);
+/* Returns false if 'key' is definitely not in the index. */
+bool btree_may_contain(PBTree btree, const void *key);
+/* Copies the smallest key, from the first leaf, or the largest key, from the
+   last leaf, to 'key'. Returns 0, or ENOENT if the index is empty. */
+int btree_first_key(PBTree btree, void *key);
+int btree_last_key(PBTree btree, void *key);
+/* Marks the entry of 'key' pointing to 'record' as deleted; the tombstone is
+   skipped by btree_select and reclaimed when the index is rebuilt. Returns 0,
+   or ENOENT if there is no such entry. */
+int btree_remove(PBTree btree, const void *key, record_t record);
 
 #endif
@@ -0,0 +1,578 @@
+#include "cowbtree.h"
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#define COW_MAGIC           0x574f4342 //"BCOW"
+#define COW_MAX_DEGREE      128
+#define COW_MAX_HEIGHT      32
+#define COW_PINNING         1 //reader slot value while the reader picks its version
+#define COW_FIRST_VERSION   2
+
+struct CowNode {
+    uint32_t is_leaf;
+    uint32_t num; //leaf: number of entries, non-leaf: number of children
+    disk_pointer pointers[COW_MAX_DEGREE]; //leaf: records, non-leaf: children
+    record_t sep_records[COW_MAX_DEGREE]; //non-leaf: records of the separators
+    /* leaf: 'num' keys
+       non-leaf: 'num' - 1 separators, separator i is the smallest entry of child i + 1 */
+    char keys[1];
+}__attribute__((packed));
+typedef struct CowNode *PCowNode;
+
+struct CowMeta {
+    uint32_t magic;
+    uint32_t key_size;
+    unsigned long long version;
+    disk_pointer root;
+    unsigned long long num_keys;
+    disk_pointer free_head; //free pages are chained through their first bytes
+};
+
+static size_t get_node_size(size_t key_size) {
+    return sizeof(struct CowNode) + COW_MAX_DEGREE * key_size;
+}
+
+static char *get_disk_pathname(const char *path, const char *table_name, const char *idx_col_name) {
+    size_t path_len = strlen(path);
+    size_t table_name_len = strlen(table_name);
+    size_t idx_col_name_len = strlen(idx_col_name);
+    size_t cow_suffix_len = strlen(COW_SUFFIX);
+    size_t EOF_SIZE = 1; // space for '\0'
+    char *disk_path = malloc(path_len + table_name_len + 1 + idx_col_name_len + cow_suffix_len + EOF_SIZE);
+    strcpy(disk_path, path);
+    strcpy(disk_path + path_len, table_name);
+    disk_path[path_len + table_name_len] = '_';
+    strcpy(disk_path + path_len + table_name_len + 1, idx_col_name);
+    strcpy(disk_path + path_len + table_name_len + 1 + idx_col_name_len, COW_SUFFIX);
+    return disk_path;
+}
+
+static void *node_key(PCowBTree btree, PCowNode node, int i) {
+    return node->keys + i * btree->key_size;
+}
+
+//Entries are ordered by key, equal keys by record with the newest (largest) record first
+static int compare_entry(PCowBTree btree, const void *key_a, record_t record_a, const void *key_b, record_t record_b) {
+    int res = btree->p_key_type->compare(key_a, key_b);
+    if (res != 0)
+        return res;
+    if (record_a == record_b)
+        return 0;
+    return record_a < record_b ? 1 : -1;
+}
+
+//Index of the child of non-leaf 'node' that may hold the entry
+static int child_index(PCowBTree btree, PCowNode node, const void *key, record_t record) {
+    //number of separators not greater than the entry
+    int left = 0, right = node->num - 1;
+    while (left < right) {
+        int mid = left + (right - left) / 2;
+        if (compare_entry(btree, node_key(btree, node, mid), node->sep_records[mid], key, record) <= 0)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left;
+}
+
+//Index of the first entry of leaf 'node' not less than the entry
+static int lower_bound(PCowBTree btree, PCowNode node, const void *key, record_t record) {
+    int left = 0, right = node->num;
+    while (left < right) {
+        int mid = left + (right - left) / 2;
+        if (compare_entry(btree, node_key(btree, node, mid), node->pointers[mid], key, record) < 0)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left;
+}
+
+static int read_node(PCowBTree btree, disk_pointer page, PCowNode node) {
+    return copy_to_memory_r(btree->disk, page, node) == 1 ? 0 : EIO;
+}
+
+static int write_node(PCowBTree btree, PCowNode node, disk_pointer page) {
+    return copy_to_disk_r(node, btree->disk->block_size, btree->disk, page) == 1 ? 0 : EIO;
+}
+
+static int write_meta(PCowBTree btree, unsigned long long version, disk_pointer root, size_t num_keys, disk_pointer free_head) {
+    struct CowMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.magic = COW_MAGIC;
+    meta.key_size = btree->key_size;
+    meta.version = version;
+    meta.root = root;
+    meta.num_keys = num_keys;
+    meta.free_head = free_head;
+    return copy_to_disk_r(&meta, sizeof(meta), btree->disk, first_block(btree->disk)) == 1 ? 0 : EIO;
+}
+
+static PCowVersion version_create(unsigned long long version, disk_pointer root) {
+    PCowVersion v = malloc(sizeof(struct CowVersion));
+    if (v == NULL)
+        return NULL;
+    v->version = version;
+    v->root = root;
+    v->older = NULL;
+    return v;
+}
+
+/*
+    Pages, only used by the writer
+*/
+
+static disk_pointer alloc_page(PCowBTree btree) {
+    if (btree->num_free > 0)
+        return btree->free_pages[--btree->num_free];
+    disk_pointer page = btree->end;
+    btree->end = next_pointer(btree->disk, btree->end);
+    return page;
+}
+
+static int push_free(PCowBTree btree, disk_pointer page) {
+    if (btree->num_free == btree->free_capacity) {
+        size_t capacity = btree->free_capacity ? btree->free_capacity * 2 : 64;
+        disk_pointer *free_pages = realloc(btree->free_pages, capacity * sizeof(disk_pointer));
+        if (free_pages == NULL)
+            return ENOMEM;
+        btree->free_pages = free_pages;
+        btree->free_capacity = capacity;
+    }
+    btree->free_pages[btree->num_free++] = page;
+    return 0;
+}
+
+static int retire_page(PCowBTree btree, disk_pointer page, unsigned long long version) {
+    if (btree->num_retired == btree->retired_capacity) {
+        size_t capacity = btree->retired_capacity ? btree->retired_capacity * 2 : 64;
+        struct CowRetired *retired = realloc(btree->retired, capacity * sizeof(struct CowRetired));
+        if (retired == NULL)
+            return ENOMEM;
+        btree->retired = retired;
+        btree->retired_capacity = capacity;
+    }
+    btree->retired[btree->num_retired].page = page;
+    btree->retired[btree->num_retired].version = version;
+    btree->num_retired++;
+    return 0;
+}
+
+//The oldest version any reader may be using
+static unsigned long long min_pinned(PCowBTree btree) {
+    unsigned long long min = ULLONG_MAX;
+    for (int i = 0; i < COW_MAX_READERS; i++) {
+        unsigned long long version = atomic_load(&btree->readers[i]);
+        if (version != 0 && version < min)
+            min = version;
+    }
+    return min;
+}
+
+//Reuses pages and frees versions that no snapshot can reach anymore
+static void reclaim(PCowBTree btree) {
+    unsigned long long min = min_pinned(btree);
+    size_t num = 0;
+    for (size_t i = 0; i < btree->num_retired; i++) {
+        //a page replaced by version v is only visible to versions older than v
+        if (btree->retired[i].version <= min)
+            push_free(btree, btree->retired[i].page);
+        else
+            btree->retired[num++] = btree->retired[i];
+    }
+    btree->num_retired = num;
+    PCowVersion *p_version = &btree->old_versions;
+    while (*p_version) {
+        PCowVersion version = *p_version;
+        if (version->version < min) {
+            *p_version = version->older;
+            free(version);
+        }
+        else
+            p_version = &version->older;
+    }
+}
+
+/*
+    Create, open and close
+*/
+
+static PCowBTree cowbtree_init(DISK *disk, DataType *p_key_type) {
+    PCowBTree btree = malloc(sizeof(struct CowBTree));
+    if (btree == NULL)
+        return NULL;
+    btree->disk = disk;
+    btree->p_key_type = p_key_type;
+    btree->key_size = p_key_type->get_type_size();
+    atomic_init(&btree->current, NULL);
+    for (int i = 0; i < COW_MAX_READERS; i++)
+        atomic_init(&btree->readers[i], 0);
+    pthread_mutex_init(&btree->writer, NULL);
+    btree->end = DNULL;
+    btree->num_keys = 0;
+    btree->old_versions = NULL;
+    btree->retired = NULL;
+    btree->num_retired = btree->retired_capacity = 0;
+    btree->free_pages = NULL;
+    btree->num_free = btree->free_capacity = 0;
+    return btree;
+}
+
+static void cowbtree_free(PCowBTree btree) {
+    PCowVersion version = atomic_load(&btree->current);
+    free(version);
+    while (btree->old_versions) {
+        version = btree->old_versions;
+        btree->old_versions = version->older;
+        free(version);
+    }
+    free(btree->retired);
+    free(btree->free_pages);
+    pthread_mutex_destroy(&btree->writer);
+    dclose(btree->disk);
+    free(btree);
+}
+
+PCowBTree cowbtree_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    size_t node_size = get_node_size(p_key_type->get_type_size());
+    char *disk_pathname = get_disk_pathname(path, table_name, idx_col_name);
+    DISK *disk = dcreate(disk_pathname, node_size);
+    free(disk_pathname);
+    if (disk == NULL)
+        return NULL;
+    fflush(disk->file); //all later I/O is positional
+    PCowBTree btree = cowbtree_init(disk, p_key_type);
+    if (btree == NULL) {
+        dclose(disk);
+        return NULL;
+    }
+    //first block holds the meta data, an empty leaf is the first root
+    disk_pointer root = next_pointer(disk, first_block(disk));
+    btree->end = next_pointer(disk, root);
+    PCowNode node = calloc(1, node_size);
+    node->is_leaf = 1;
+    node->num = 0;
+    int ret = write_node(btree, node, root);
+    free(node);
+    PCowVersion version = version_create(COW_FIRST_VERSION, root);
+    if (ret != 0 || version == NULL || write_meta(btree, COW_FIRST_VERSION, root, btree->num_keys, DNULL) != 0) {
+        free(version);
+        cowbtree_free(btree);
+        return NULL;
+    }
+    atomic_store(&btree->current, version);
+    return btree;
+}
+
+PCowBTree cowbtree_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    char *disk_pathname = get_disk_pathname(path, table_name, idx_col_name);
+    DISK *disk = dopen(disk_pathname);
+    free(disk_pathname);
+    if (disk == NULL)
+        return NULL;
+    PCowBTree btree = cowbtree_init(disk, p_key_type);
+    if (btree == NULL) {
+        dclose(disk);
+        return NULL;
+    }
+    void *buffer = malloc(disk->block_size);
+    struct CowMeta *meta = (struct CowMeta *)buffer;
+    if (copy_to_memory_r(disk, first_block(disk), buffer) != 1 || meta->magic != COW_MAGIC || meta->key_size != btree->key_size) {
+        fprintf(stderr, "Invalid copy-on-write index file\n");
+        free(buffer);
+        cowbtree_free(btree);
+        return NULL;
+    }
+    btree->num_keys = meta->num_keys;
+    atomic_store(&btree->current, version_create(meta->version, meta->root));
+    fseek(disk->file, 0, SEEK_END);
+    btree->end = (disk_pointer)ftell(disk->file);
+    //load the free page chain
+    disk_pointer page = meta->free_head;
+    while (page != DNULL) {
+        push_free(btree, page);
+        copy_to_memory_r(disk, page, buffer);
+        memcpy(&page, buffer, sizeof(disk_pointer));
+    }
+    free(buffer);
+    return btree;
+}
+
+void cowbtree_close(PCowBTree btree) {
+    if (btree == NULL)
+        return;
+    pthread_mutex_lock(&btree->writer);
+    //no snapshots are left, every retired page is free
+    for (size_t i = 0; i < btree->num_retired; i++)
+        push_free(btree, btree->retired[i].page);
+    btree->num_retired = 0;
+    disk_pointer free_head = DNULL;
+    for (size_t i = 0; i < btree->num_free; i++) {
+        copy_to_disk_r(&free_head, sizeof(disk_pointer), btree->disk, btree->free_pages[i]);
+        free_head = btree->free_pages[i];
+    }
+    PCowVersion current = atomic_load(&btree->current);
+    write_meta(btree, current->version, current->root, btree->num_keys, free_head);
+    pthread_mutex_unlock(&btree->writer);
+    cowbtree_free(btree);
+}
+
+/*
+    Insert
+*/
+
+//Moves the upper half of full 'node' to 'right'. The separator between them is returned by 'sep_key' and 'sep_record'.
+static void split_node(PCowBTree btree, PCowNode node, PCowNode right, void *sep_key, record_t *sep_record) {
+    size_t key_size = btree->key_size;
+    int num = node->num;
+    int half = num / 2;
+    right->is_leaf = node->is_leaf;
+    if (node->is_leaf) {
+        right->num = num - half;
+        memcpy(right->pointers, &node->pointers[half], right->num * sizeof(disk_pointer));
+        memcpy(right->keys, node_key(btree, node, half), right->num * key_size);
+        node->num = half;
+        memcpy(sep_key, right->keys, key_size);
+        *sep_record = right->pointers[0];
+    }
+    else {
+        //children [0, half) stay, separator half - 1 moves up, children [half, num) move
+        right->num = num - half;
+        memcpy(right->pointers, &node->pointers[half], right->num * sizeof(disk_pointer));
+        memcpy(right->sep_records, &node->sep_records[half], (right->num - 1) * sizeof(record_t));
+        memcpy(right->keys, node_key(btree, node, half), (right->num - 1) * key_size);
+        memcpy(sep_key, node_key(btree, node, half - 1), key_size);
+        *sep_record = node->sep_records[half - 1];
+        node->num = half;
+    }
+}
+
+int cowbtree_insert(PCowBTree btree, void *key, record_t record) {
+    if (btree == NULL || key == NULL)
+        return EINVAL;
+    size_t key_size = btree->key_size;
+    size_t node_size = btree->disk->block_size;
+    PCowNode path[COW_MAX_HEIGHT];
+    disk_pointer pages[COW_MAX_HEIGHT];
+    disk_pointer new_pages[2 * COW_MAX_HEIGHT + 1]; //pages written by this insert
+    int indices[COW_MAX_HEIGHT];
+    int depth = 0, num_new_pages = 0, ret = 0, i;
+
+    pthread_mutex_lock(&btree->writer);
+    PCowVersion current = atomic_load(&btree->current);
+    unsigned long long version = current->version + 1;
+    //read the root path
+    disk_pointer page = current->root;
+    while (1) {
+        path[depth] = malloc(node_size);
+        pages[depth] = page;
+        if ((ret = read_node(btree, page, path[depth])) != 0)
+            goto END;
+        if (path[depth]->is_leaf)
+            break;
+        indices[depth] = child_index(btree, path[depth], key, record);
+        page = path[depth]->pointers[indices[depth]];
+        if (++depth == COW_MAX_HEIGHT) {
+            depth--;
+            ret = EINVAL;
+            goto END;
+        }
+    }
+    PCowNode leaf = path[depth];
+    int pos = lower_bound(btree, leaf, key, record);
+    if (pos < leaf->num && compare_entry(btree, node_key(btree, leaf, pos), leaf->pointers[pos], key, record) == 0)
+        goto END; //already there
+    memmove(&leaf->pointers[pos + 1], &leaf->pointers[pos], (leaf->num - pos) * sizeof(disk_pointer));
+    memmove(node_key(btree, leaf, pos + 1), node_key(btree, leaf, pos), (leaf->num - pos) * key_size);
+    leaf->pointers[pos] = record;
+    memcpy(node_key(btree, leaf, pos), key, key_size);
+    leaf->num++;
+
+    //write new copies of the path bottom-up, nodes of 'current' are never overwritten
+    PCowNode right = malloc(node_size);
+    void *sep_key = malloc(key_size);
+    record_t sep_record = DNULL;
+    disk_pointer child = DNULL, child_right = DNULL;
+    for (int level = depth; level >= 0; level--) {
+        PCowNode node = path[level];
+        if (level < depth) {
+            int idx = indices[level];
+            node->pointers[idx] = child;
+            if (child_right != DNULL) {
+                //the child was split, its upper half follows it
+                memmove(&node->pointers[idx + 2], &node->pointers[idx + 1], (node->num - idx - 1) * sizeof(disk_pointer));
+                memmove(&node->sep_records[idx + 1], &node->sep_records[idx], (node->num - 1 - idx) * sizeof(record_t));
+                memmove(node_key(btree, node, idx + 1), node_key(btree, node, idx), (node->num - 1 - idx) * key_size);
+                node->pointers[idx + 1] = child_right;
+                node->sep_records[idx] = sep_record;
+                memcpy(node_key(btree, node, idx), sep_key, key_size);
+                node->num++;
+            }
+        }
+        child_right = DNULL;
+        if (node->num == COW_MAX_DEGREE) {
+            split_node(btree, node, right, sep_key, &sep_record);
+            child_right = new_pages[num_new_pages++] = alloc_page(btree);
+            if ((ret = write_node(btree, right, child_right)) != 0)
+                break;
+        }
+        child = new_pages[num_new_pages++] = alloc_page(btree);
+        if ((ret = write_node(btree, node, child)) != 0)
+            break;
+    }
+    if (ret == 0 && child_right != DNULL) {
+        //the root was split, the tree grows by one level
+        memset(right, 0, node_size);
+        right->is_leaf = 0;
+        right->num = 2;
+        right->pointers[0] = child;
+        right->pointers[1] = child_right;
+        right->sep_records[0] = sep_record;
+        memcpy(right->keys, sep_key, key_size);
+        child = new_pages[num_new_pages++] = alloc_page(btree);
+        ret = write_node(btree, right, child);
+    }
+    free(right);
+    free(sep_key);
+    if (ret != 0)
+        goto END;
+
+    //commit, then publish the new root to readers
+    PCowVersion new_version = version_create(version, child);
+    if (new_version == NULL || (ret = write_meta(btree, version, child, btree->num_keys + 1, DNULL)) != 0) {
+        free(new_version);
+        ret = ret ? ret : ENOMEM;
+        goto END;
+    }
+    btree->num_keys++;
+    atomic_store(&btree->current, new_version);
+    current->older = btree->old_versions;
+    btree->old_versions = current;
+    //the replaced pages are only retired once 'version' is published, a failed insert keeps them in use
+    for (i = 0; i <= depth; i++)
+        retire_page(btree, pages[i], version);
+    reclaim(btree);
+
+END:
+    if (ret != 0) //nothing refers to the pages written so far
+        for (i = 0; i < num_new_pages; i++)
+            push_free(btree, new_pages[i]);
+    for (i = 0; i <= depth; i++)
+        free(path[i]);
+    pthread_mutex_unlock(&btree->writer);
+    return ret;
+}
+
+/*
+    Snapshots
+*/
+
+PCowSnapshot cowbtree_snapshot(PCowBTree btree) {
+    if (btree == NULL)
+        return NULL;
+    int slot;
+    for (slot = 0; slot < COW_MAX_READERS; slot++) {
+        unsigned long long expected = 0;
+        //while COW_PINNING is announced the writer keeps every version
+        if (atomic_compare_exchange_strong(&btree->readers[slot], &expected, COW_PINNING))
+            break;
+    }
+    if (slot == COW_MAX_READERS) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    PCowVersion version;
+    while (1) {
+        version = atomic_load(&btree->current);
+        atomic_store(&btree->readers[slot], version->version);
+        //still current after the announcement, so it can not be reclaimed anymore
+        if (atomic_load(&btree->current) == version)
+            break;
+    }
+    PCowSnapshot snapshot = malloc(sizeof(struct CowSnapshot));
+    if (snapshot == NULL) {
+        atomic_store(&btree->readers[slot], 0);
+        return NULL;
+    }
+    snapshot->btree = btree;
+    snapshot->slot = slot;
+    snapshot->version = version;
+    return snapshot;
+}
+
+void cowbtree_release(PCowSnapshot snapshot) {
+    if (snapshot == NULL)
+        return;
+    atomic_store(&snapshot->btree->readers[snapshot->slot], 0);
+    free(snapshot);
+}
+
+vector_t *cowbtree_snapshot_select(PCowSnapshot snapshot, const void *key_start, const void *key_end) {
+    if (snapshot == NULL || key_start == NULL || key_end == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    PCowBTree btree = snapshot->btree;
+    int (*compare)(const void *, const void *) = btree->p_key_type->compare;
+    size_t node_size = btree->disk->block_size;
+    PCowNode path[COW_MAX_HEIGHT];
+    int indices[COW_MAX_HEIGHT];
+    int depth = 0, level, pos;
+    vector_t *results = vector_create(0);
+    vector_set_type_size(results, sizeof(record_t));
+    //(key_start, largest record) is the first entry with key_start
+    disk_pointer page = snapshot->version->root;
+    while (1) {
+        path[depth] = malloc(node_size);
+        if (read_node(btree, page, path[depth]) != 0)
+            goto END;
+        if (path[depth]->is_leaf)
+            break;
+        indices[depth] = child_index(btree, path[depth], key_start, (record_t)UINT64_MAX);
+        page = path[depth]->pointers[indices[depth]];
+        if (++depth == COW_MAX_HEIGHT) {
+            depth--;
+            goto END;
+        }
+    }
+    pos = lower_bound(btree, path[depth], key_start, (record_t)UINT64_MAX);
+    while (1) {
+        PCowNode leaf = path[depth];
+        for (; pos < leaf->num; pos++) {
+            if (compare(node_key(btree, leaf, pos), key_end) > 0)
+                goto END;
+            vector_push(results, &leaf->pointers[pos]);
+        }
+        //no sibling links, the next leaf is found through the path
+        for (level = depth - 1; level >= 0 && indices[level] + 1 >= path[level]->num; level--)
+            ;
+        if (level < 0)
+            break;
+        indices[level]++;
+        page = path[level]->pointers[indices[level]];
+        for (level++; level <= depth; level++) {
+            if (read_node(btree, page, path[level]) != 0)
+                goto END;
+            if (level < depth) {
+                indices[level] = 0;
+                page = path[level]->pointers[0];
+            }
+        }
+        pos = 0;
+    }
+END:
+    for (level = 0; level <= depth; level++)
+        free(path[level]);
+    return results;
+}
+
+vector_t *cowbtree_select(PCowBTree btree, const void *key_start, const void *key_end) {
+    PCowSnapshot snapshot = cowbtree_snapshot(btree);
+    if (snapshot == NULL)
+        return NULL;
+    vector_t *results = cowbtree_snapshot_select(snapshot, key_start, key_end);
+    cowbtree_release(snapshot);
+    return results;
+}
@@ -0,0 +1,72 @@
+#ifndef COWBTREE_H__
+#define COWBTREE_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "disk.h"
+#include "datatype.h"
+#include "vector.h"
+#include "index.h"
+
+#define COW_SUFFIX       ".cow"
+#define COW_MAX_READERS  64
+
+/* A committed version of the tree. Versions are never changed, an insert
+   writes new copies of the nodes on the root path and publishes a new version. */
+typedef struct CowVersion {
+    unsigned long long version;
+    disk_pointer root;
+    struct CowVersion *older;
+} *PCowVersion;
+
+/* Page that was replaced by 'version' and is still visible to older snapshots */
+struct CowRetired {
+    disk_pointer page;
+    unsigned long long version;
+};
+
+/* Copy-on-write B+ tree.
+   One writer at a time (inserts are serialized by 'writer'). Readers never
+   block: a snapshot pins the current version by announcing it in a reader
+   slot, and sees that version unchanged until it is released. Pages replaced
+   by newer versions are reused once no slot announces an older version. */
+typedef struct CowBTree {
+    DISK *disk;
+    DataType *p_key_type;
+    size_t key_size;
+    _Atomic(PCowVersion) current;
+    _Atomic unsigned long long readers[COW_MAX_READERS]; //pinned versions, 0 if the slot is free
+    pthread_mutex_t writer;
+    //the rest is only used by the writer
+    disk_pointer end; //next page appended to the file
+    size_t num_keys;
+    PCowVersion old_versions; //superseded versions, newest first
+    struct CowRetired *retired;
+    size_t num_retired, retired_capacity;
+    disk_pointer *free_pages;
+    size_t num_free, free_capacity;
+} *PCowBTree;
+
+typedef struct CowSnapshot {
+    PCowBTree btree;
+    int slot;
+    PCowVersion version;
+} *PCowSnapshot;
+
+PCowBTree cowbtree_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
+PCowBTree cowbtree_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
+/* All snapshots must be released before closing. */
+void cowbtree_close(PCowBTree btree);
+
+/* Safe to call while other threads read from snapshots. */
+int cowbtree_insert(PCowBTree btree, void *key, record_t record);
+
+/* Pins the current version. Returns NULL if all reader slots are in use. */
+PCowSnapshot cowbtree_snapshot(PCowBTree btree);
+void cowbtree_release(PCowSnapshot snapshot);
+/* Records with keys in [key_start, key_end] as of the snapshot, in key order. */
+vector_t *cowbtree_snapshot_select(PCowSnapshot snapshot, const void *key_start, const void *key_end);
+/* Same as cowbtree_snapshot_select on a snapshot taken for this call. */
+vector_t *cowbtree_select(PCowBTree btree, const void *key_start, const void *key_end);
+
+#endif
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE //memmem
+#include "csv.h"
+#include <string.h>
+#include <errno.h>
+
+#define CSV_CHUNK_SIZE   (1 << 20) //bytes read or written by one IO
+#define CSV_BATCH_BYTES  (4 << 20) //bytes of rows inserted by one table_append_rows
+
+/*
+
+  Import
+
+*/
+struct csv_import {
+    Table *table;
+    Column **fields;   //column of each field of a line
+    size_t num_fields;
+    void *rows;        //rows parsed and not inserted yet
+    size_t num_rows;
+    size_t batch_rows;
+    size_t line_no;
+    bool header;       //the header line is not read yet
+    size_t num_values; //fields of the current line
+};
+
+/* Splits 'line' of 'len' bytes into fields, calling 'field' for each one with
+   the quotes removed and 'quoted' set if it had them. Doubled quotes inside a quoted field are kept doubled,
+   which never happens for numbers, and are undoubled by row_field for text.
+   Returns 0, EILSEQ for text after a closing quote or a quote that is not
+   closed, reported for line 'line_no', or the first error of 'field'. */
+static int split_line(const char *line, size_t len, size_t line_no, int (*field)(void *arg, size_t i, const char *str, size_t len, bool quoted), void *arg) {
+    size_t i = 0, pos = 0;
+    while (1) {
+        const char *str = line + pos;
+        size_t field_len;
+        bool quoted = pos < len && *str == '"';
+        if (quoted) {
+            const char *end = str + 1;
+            while (end < line + len && !(end[0] == '"' && (end + 1 == line + len || end[1] != '"')))
+                end += end[0] == '"' ? 2 : 1;
+            if (end == line + len) {
+                fprintf(stderr, "Line %zu: unterminated quote\n", line_no);
+                return EILSEQ;
+            }
+            str++;
+            field_len = end - str;
+            pos = end + 1 - line; //after the closing quote
+            if (pos < len && line[pos] != ',') {
+                fprintf(stderr, "Line %zu: text after a closing quote\n", line_no);
+                return EILSEQ;
+            }
+        }
+        else {
+            const char *end = memchr(str, ',', len - pos);
+            field_len = end ? (size_t)(end - str) : len - pos;
+            pos += field_len;
+        }
+        int ret = field(arg, i++, str, field_len, quoted);
+        if (ret != 0)
+            return ret;
+        if (pos >= len)
+            return 0;
+        pos++; //the ','
+    }
+}
+
+static int header_field(void *arg, size_t i, const char *str, size_t len, bool quoted) {
+    struct csv_import *import = arg;
+    Column *column = NULL;
+    for (size_t k = 0; k < import->table->num_columns; k++) {
+        const char *name = import->table->columns[k].name;
+        if (strlen(name) == len && memcmp(name, str, len) == 0)
+            column = &import->table->columns[k];
+    }
+    if (column == NULL) {
+        fprintf(stderr, "Unknown column \'%.*s\' in CSV header\n", (int)len, str);
+        return EINVAL;
+    }
+    for (size_t k = 0; k < import->num_fields; k++)
+        if (import->fields[k] == column) {
+            fprintf(stderr, "Column \'%s\' appears twice in CSV header\n", column->name);
+            return EINVAL;
+        }
+    import->fields[import->num_fields++] = column;
+    return 0;
+}
+
+static int row_field(void *arg, size_t i, const char *str, size_t len, bool quoted) {
+    struct csv_import *import = arg;
+    if (i >= import->num_fields) {
+        fprintf(stderr, "Line %zu: more than %zu fields\n", import->line_no, import->num_fields);
+        return EINVAL;
+    }
+    import->num_values = i + 1;
+    Column *column = import->fields[i];
+    void *row = import->rows + import->num_rows * import->table->row_size;
+    //an empty field is NULL, unless it is quoted or the column is NOT NULL
+    bool is_null = !quoted && len == 0 && column->null_bit >= 0;
+    column_set_null(column, row, is_null);
+    if (is_null)
+        return 0;
+    char *text = NULL;
+    if (column->heap != NULL && memmem(str, len, "\"\"", 2) != NULL) {
+        text = (char *)malloc(len);
+        size_t text_len = 0;
+        for (size_t k = 0; k < len; k++) {
+            text[text_len++] = str[k];
+            if (str[k] == '"' && k + 1 < len && str[k + 1] == '"')
+                k++;
+        }
+        str = text;
+        len = text_len;
+    }
+    int ret = column->type->parse(row + column->offset, str, len);
+    if (ret != 0)
+        fprintf(stderr, "Line %zu: invalid value \'%.*s\' for column \'%s\'\n", import->line_no, (int)len, str, column->name);
+    //the value refers to the line, it is stored before the line is read over
+    else if ((ret = column_store(column, row + column->offset)) != 0)
+        fprintf(stderr, "Line %zu: invalid value for column \'%s\'\n", import->line_no, column->name);
+    free(text);
+    return ret;
+}
+
+static int flush_rows(struct csv_import *import) {
+    int ret = table_append_rows(import->table, import->rows, import->num_rows);
+    import->num_rows = 0;
+    return ret;
+}
+
+static int import_line(struct csv_import *import, const char *line, size_t len) {
+    import->line_no++;
+    if (len > 0 && line[len - 1] == '\r')
+        len--;
+    if (len == 0)
+        return 0; //blank lines are skipped
+    if (import->header) {
+        import->header = false;
+        int ret = split_line(line, len, import->line_no, header_field, import);
+        if (ret == 0 && import->num_fields < import->table->num_columns) {
+            fprintf(stderr, "CSV header has %zu of the %zu columns\n", import->num_fields, import->table->num_columns);
+            ret = EINVAL;
+        }
+        return ret ? EINVAL : 0;
+    }
+    import->num_values = 0;
+    int ret = split_line(line, len, import->line_no, row_field, import);
+    if (ret == EILSEQ)
+        return EINVAL;
+    if (ret != 0)
+        return ret;
+    if (import->num_values < import->num_fields) {
+        fprintf(stderr, "Line %zu: %zu fields instead of %zu\n", import->line_no, import->num_values, import->num_fields);
+        return EINVAL;
+    }
+    if (++import->num_rows == import->batch_rows)
+        return flush_rows(import);
+    return 0;
+}
+
+int table_import_csv(Table *table, FILE *in, bool header) {
+    size_t row_size = table->row_size;
+    struct csv_import import;
+    import.table = table;
+    import.fields = (Column **)malloc((table->num_columns ? table->num_columns : 1) * sizeof(Column *));
+    import.num_fields = 0;
+    import.header = header;
+    if (!header)
+        for (size_t k = 0; k < table->num_columns; k++)
+            import.fields[import.num_fields++] = &table->columns[k];
+    import.batch_rows = CSV_BATCH_BYTES / row_size ? CSV_BATCH_BYTES / row_size : 1;
+    import.rows = calloc(import.batch_rows, row_size);
+    import.num_rows = 0;
+    import.line_no = 0;
+    size_t capacity = CSV_CHUNK_SIZE;
+    char *buffer = malloc(capacity);
+    if (import.fields == NULL || import.rows == NULL || buffer == NULL) {
+        free(import.fields);
+        free(import.rows);
+        free(buffer);
+        return ENOMEM;
+    }
+
+    int ret = 0;
+    size_t len = 0; //bytes in 'buffer', the start of a line that is not complete
+    while (ret == 0) {
+        if (len == capacity) {
+            //a line longer than the buffer
+            char *larger = realloc(buffer, capacity * 2);
+            if (larger == NULL) {
+                ret = ENOMEM;
+                break;
+            }
+            buffer = larger;
+            capacity *= 2;
+        }
+        size_t num_read = fread(buffer + len, 1, capacity - len, in);
+        if (num_read == 0) {
+            if (ferror(in))
+                ret = EIO;
+            else if (len > 0)
+                ret = import_line(&import, buffer, len); //the last line has no line break
+            break;
+        }
+        size_t end = len + num_read, pos = 0, search = len; //the first 'len' bytes have no line break
+        char *line_end;
+        while (ret == 0 && (line_end = memchr(buffer + search, '\n', end - search)) != NULL) {
+            ret = import_line(&import, buffer + pos, line_end - (buffer + pos));
+            pos = search = line_end + 1 - buffer;
+        }
+        len = end - pos;
+        memmove(buffer, buffer + pos, len);
+    }
+    //the rows before an error are kept
+    int flush_ret = flush_rows(&import);
+    if (ret == 0)
+        ret = flush_ret;
+    free(buffer);
+    free(import.rows);
+    free(import.fields);
+    return ret;
+}
+
+/*
+
+  Export
+
+*/
+int table_export_csv(Table *table, FILE *out, bool header) {
+    size_t row_size = table->row_size;
+    size_t chunk_rows = CSV_CHUNK_SIZE / row_size ? CSV_CHUNK_SIZE / row_size : 1;
+    void *rows = malloc(chunk_rows * row_size);
+    size_t line_max = table->num_columns * (MAX_FORMAT_LEN + 1) + 1;
+    size_t capacity = CSV_CHUNK_SIZE > line_max ? CSV_CHUNK_SIZE : line_max;
+    char *buffer = malloc(capacity);
+    char *text = NULL; //value of a text column, before its quotes are doubled
+    size_t text_capacity = 0;
+    if (rows == NULL || buffer == NULL) {
+        free(rows);
+        free(buffer);
+        return ENOMEM;
+    }
+    int ret = 0;
+    if (header) {
+        for (size_t k = 0; k < table->num_columns; k++)
+            fprintf(out, "%s%s", k ? "," : "", table->columns[k].name);
+        fputc('\n', out);
+    }
+
+    size_t len = 0;
+    size_t row_no = 0;
+    while (ret == 0) {
+        int num_read = table_read_rows(table, row_no, chunk_rows, rows);
+        if (num_read < 0) {
+            ret = EIO;
+            break;
+        }
+        for (int i = 0; i < num_read; i++) {
+            const void *row = rows + i * row_size;
+            if (table_row_deleted(table, row_no + i))
+                continue;
+            //text is quoted, each of its quotes doubled
+            size_t row_max = line_max;
+            for (size_t k = 0; k < table->num_columns; k++)
+                if (table->columns[k].heap != NULL)
+                    row_max += 2 * text_cell_len(row + table->columns[k].offset) + 2;
+            if (capacity - len < row_max) {
+                if (fwrite(buffer, 1, len, out) != len) {
+                    ret = EIO;
+                    break;
+                }
+                len = 0;
+            }
+            if (capacity < row_max) {
+                char *larger = realloc(buffer, row_max);
+                if (larger == NULL) {
+                    ret = ENOMEM;
+                    break;
+                }
+                buffer = larger;
+                capacity = row_max;
+            }
+            for (size_t k = 0; k < table->num_columns; k++) {
+                Column *column = &table->columns[k];
+                if (k)
+                    buffer[len++] = ',';
+                if (column_is_null(column, row))
+                    continue; //an empty field
+                if (column->heap == NULL) {
+                    len += column->type->format(row + column->offset, buffer + len);
+                    continue;
+                }
+                size_t text_len = text_cell_len(row + column->offset);
+                if (text_len > text_capacity) {
+                    free(text);
+                    text_capacity = text_len;
+                    text = malloc(text_capacity);
+                }
+                column_text(column, row, text, text_len);
+                buffer[len++] = '"';
+                for (size_t c = 0; c < text_len; c++) {
+                    if (text[c] == '"')
+                        buffer[len++] = '"';
+                    buffer[len++] = text[c];
+                }
+                buffer[len++] = '"';
+            }
+            buffer[len++] = '\n';
+        }
+        if (num_read < chunk_rows)
+            break;
+        row_no += chunk_rows;
+    }
+    if (ret == 0 && fwrite(buffer, 1, len, out) != len)
+        ret = EIO;
+    free(rows);
+    free(buffer);
+    free(text);
+    return ret;
+}
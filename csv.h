@@ -0,0 +1,26 @@
+#ifndef CSV_H__
+#define CSV_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "table.h"
+
+/* Bulk import and export of tables in CSV format (RFC 4180, fields separated
+   by ',' and rows by "\n" or "\r\n"). Both read and write the file in large
+   chunks and convert fields directly between text and the row layout. */
+
+/* Appends the rows of 'in' to 'table'. With 'header', the first line names the
+   column of each field, otherwise the fields are in the order of the columns.
+   Fields may be quoted, quoted fields must not contain line breaks. An empty
+   field that is not quoted is NULL for a nullable column. Rows are
+   inserted in batches as they are parsed, so on an error the rows before the
+   bad line are kept. Returns 0 if success. */
+int table_import_csv(Table *table, FILE *in, bool header);
+
+/* Writes all rows of 'table' to 'out', after a line of column names if
+   'header'. Values of text columns are quoted, their quotes doubled; a value
+   with a line break can't be imported again. NULLs are empty fields.
+   Returns 0 if success. */
+int table_export_csv(Table *table, FILE *out, bool header);
+
+#endif
@@ -1,8 +1,63 @@
 #include "datatype.h"
+#include "filter.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <errno.h>
 #include <limits.h>
 #include <string.h>
+#include <stdbool.h>
+
+/*
+
+  Text conversion without a terminating '\0', for bulk import and export
+
+*/
+static int parse_integer(const char *str, size_t len, long long min, long long max, long long *p_val) {
+    size_t i = 0;
+    while (i < len && (str[i] == ' ' || str[i] == '\t'))
+        i++;
+    while (len > i && (str[len - 1] == ' ' || str[len - 1] == '\t'))
+        len--;
+    bool negative = false;
+    if (i < len && (str[i] == '-' || str[i] == '+'))
+        negative = str[i++] == '-';
+    if (i == len)
+        return EINVAL;
+    //accumulated as a negative number, whose range includes LLONG_MIN
+    long long val = 0;
+    for (; i < len; i++) {
+        if (str[i] < '0' || str[i] > '9')
+            return EINVAL;
+        int digit = str[i] - '0';
+        if (val < (LLONG_MIN + digit) / 10)
+            return ERANGE;
+        val = val * 10 - digit;
+    }
+    if (!negative) {
+        if (val < -max)
+            return ERANGE;
+        val = -val;
+    }
+    else if (val < min)
+        return ERANGE;
+    *p_val = val;
+    return 0;
+}
+
+static size_t format_integer(long long val, char *buf) {
+    char digits[MAX_FORMAT_LEN];
+    size_t n = 0, len = 0;
+    unsigned long long u = val < 0 ? 0ULL - (unsigned long long)val : (unsigned long long)val;
+    do {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (val < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = digits[--n];
+    return len;
+}
 
 /*
 
@@ -18,7 +73,10 @@ static size_t int_get_type_size(void) {
 }
 
 static int int_compare(const void *a, const void *b) {
-    return *((int *)a) - *((int *)b);
+    int x, y; //rows are not aligned
+    memcpy(&x, a, sizeof(int));
+    memcpy(&y, b, sizeof(int));
+    return (x > y) - (x < y);
 }
 
 static void *int_convert_to_val(const char *intstr) {
@@ -63,6 +121,54 @@ static void int_print(const void *memory) {
     free(m);
 }
 
+static const void *int_min_val(void) {
+    static const int min = INT_MIN;
+    return &min;
+}
+
+static const void *int_max_val(void) {
+    static const int max = INT_MAX;
+    return &max;
+}
+
+static int int_parse(void *memory, const char *str, size_t len) {
+    long long val;
+    int ret = parse_integer(str, len, INT_MIN, INT_MAX, &val);
+    if (ret == 0) {
+        int x = (int)val;
+        memcpy(memory, &x, sizeof(int));
+    }
+    return ret;
+}
+
+static size_t int_format(const void *memory, char *buf) {
+    int x;
+    memcpy(&x, memory, sizeof(int));
+    return format_integer(x, buf);
+}
+
+static void int_filter(const void *values, size_t stride, size_t num, CompareOp op, const void *constant, const void *constant2, uint64_t *bitmap) {
+    int a, b = 0;
+    memcpy(&a, constant, sizeof(int));
+    if (op == OP_BETWEEN)
+        memcpy(&b, constant2, sizeof(int));
+    //every operator is an interval, strict bounds are moved by one
+    long long low = INT_MIN, high = INT_MAX;
+    switch (op) {
+        case OP_EQ: low = high = a; break;
+        case OP_LT: high = (long long)a - 1; break;
+        case OP_LE: high = a; break;
+        case OP_GT: low = (long long)a + 1; break;
+        case OP_GE: low = a; break;
+        case OP_BETWEEN: low = a; high = b; break;
+        default: break;
+    }
+    if (low > high)
+        memset(bitmap, 0, BITMAP_WORDS(num) * sizeof(uint64_t));
+    else
+        filter_range_int32(values, stride, num, (int32_t)low, (int32_t)high, bitmap);
+}
+
 //constructor
 static DataType *new_int_data_type() {
     DataType *type = (DataType *)malloc(sizeof(DataType));
@@ -72,6 +178,11 @@ static DataType *new_int_data_type() {
     type->convert_to_val = int_convert_to_val;
     type->cpy_to_memory  = int_cpy_to_memory;
     type->print          = int_print;
+    type->min_val        = int_min_val;
+    type->max_val        = int_max_val;
+    type->parse          = int_parse;
+    type->format         = int_format;
+    type->filter         = int_filter;
     return type;
 }
 static DataType *int_data_type_; //singleton
@@ -105,7 +216,10 @@ static size_t bigint_get_type_size(void) {
 }
 
 static int bigint_compare(const void *a, const void *b) {
-    return *((long long *)a) - *((long long *)b);
+    long long x, y; //rows are not aligned
+    memcpy(&x, a, sizeof(long long));
+    memcpy(&y, b, sizeof(long long));
+    return (x > y) - (x < y);
 }
 
 static void *bigint_convert_to_val(const char *bigintstr) {
@@ -142,6 +256,54 @@ static void bigint_print(const void *memory) {
     free(m);
 }
 
+static const void *bigint_min_val(void) {
+    static const long long min = LLONG_MIN;
+    return &min;
+}
+
+static const void *bigint_max_val(void) {
+    static const long long max = LLONG_MAX;
+    return &max;
+}
+
+static int bigint_parse(void *memory, const char *str, size_t len) {
+    long long val;
+    int ret = parse_integer(str, len, LLONG_MIN, LLONG_MAX, &val);
+    if (ret == 0) {
+        long long x = (long long)val;
+        memcpy(memory, &x, sizeof(long long));
+    }
+    return ret;
+}
+
+static size_t bigint_format(const void *memory, char *buf) {
+    long long x;
+    memcpy(&x, memory, sizeof(long long));
+    return format_integer(x, buf);
+}
+
+static void bigint_filter(const void *values, size_t stride, size_t num, CompareOp op, const void *constant, const void *constant2, uint64_t *bitmap) {
+    long long a, b = 0;
+    memcpy(&a, constant, sizeof(long long));
+    if (op == OP_BETWEEN)
+        memcpy(&b, constant2, sizeof(long long));
+    long long low = LLONG_MIN, high = LLONG_MAX;
+    bool empty = false;
+    switch (op) {
+        case OP_EQ: low = high = a; break;
+        case OP_LT: empty = a == LLONG_MIN; high = a - !empty; break;
+        case OP_LE: high = a; break;
+        case OP_GT: empty = a == LLONG_MAX; low = a + !empty; break;
+        case OP_GE: low = a; break;
+        case OP_BETWEEN: low = a; high = b; break;
+        default: break;
+    }
+    if (empty || low > high)
+        memset(bitmap, 0, BITMAP_WORDS(num) * sizeof(uint64_t));
+    else
+        filter_range_int64(values, stride, num, low, high, bitmap);
+}
+
 //constructor
 static DataType *new_bigint_data_type() {
     DataType *type = (DataType *)malloc(sizeof(DataType));
@@ -151,6 +313,11 @@ static DataType *new_bigint_data_type() {
     type->convert_to_val = bigint_convert_to_val;
     type->cpy_to_memory  = bigint_cpy_to_memory;
     type->print          = bigint_print;
+    type->min_val        = bigint_min_val;
+    type->max_val        = bigint_max_val;
+    type->parse          = bigint_parse;
+    type->format         = bigint_format;
+    type->filter         = bigint_filter;
     return type;
 }
 static DataType *bigint_data_type_; //singleton
@@ -172,16 +339,133 @@ void free_bigint_data_type() {
 
 /*
 
+  Data type for text, blob and varchar(n)
+
 */
+void text_cell_set(void *memory, const void *data, size_t len) {
+    TextCell cell;
+    memset(&cell, 0, sizeof(cell));
+    cell.len = (uint32_t)len;
+    if (len <= TEXT_INLINE_LEN)
+        memcpy((char *)&cell + offsetof(TextCell, prefix), data, len); //runs into 'ref'
+    else {
+        cell.len |= TEXT_IN_MEMORY;
+        memcpy(cell.prefix, data, sizeof(cell.prefix));
+        cell.ref = (uint64_t)(uintptr_t)data;
+    }
+    memcpy(memory, &cell, sizeof(cell));
+}
+
+size_t text_cell_len(const void *memory) {
+    uint32_t len;
+    memcpy(&len, memory, sizeof(len));
+    return len & ~TEXT_IN_MEMORY;
+}
+
+static const char *text_get_type_name(void) {
+    return "text";
+}
+
+static size_t text_get_type_size(void) {
+    return TEXT_CELL_SIZE;
+}
+
+//The value and its cell are allocated at once, freed with the cell
+static void *text_convert_to_val(const char *str) {
+    size_t len = strlen(str);
+    char *memory = (char *)malloc(TEXT_CELL_SIZE + len + 1);
+    memcpy(memory + TEXT_CELL_SIZE, str, len + 1);
+    text_cell_set(memory, memory + TEXT_CELL_SIZE, len);
+    return memory;
+}
+
+static void text_cpy_to_memory(void *memory, const char *str) {
+    text_cell_set(memory, str, strlen(str));
+}
+
+static const void *text_min_val(void) {
+    static const TextCell empty;
+    return &empty;
+}
+
+//Strings have no largest value, ranges of text are not bounded
+static const void *text_max_val(void) {
+    return NULL;
+}
+
+static int text_parse(void *memory, const char *str, size_t len) {
+    if (len > TEXT_MAX_LEN)
+        return ERANGE;
+    text_cell_set(memory, str, len);
+    return 0;
+}
+
+//constructor
+static DataType *new_text_data_type() {
+    DataType *type = (DataType *)malloc(sizeof(DataType));
+    type->get_type_name  = text_get_type_name;
+    type->get_type_size  = text_get_type_size;
+    type->compare        = NULL; //values stored in the heap are compared by varheap_compare
+    type->convert_to_val = text_convert_to_val;
+    type->cpy_to_memory  = text_cpy_to_memory;
+    type->print          = NULL; //and read by varheap_load
+    type->min_val        = text_min_val;
+    type->max_val        = text_max_val;
+    type->parse          = text_parse;
+    type->format         = NULL;
+    type->filter         = NULL;
+    return type;
+}
+static DataType *text_data_type_; //singleton
+
+DataType *text_data_type() {
+    //NO multi-thread at this time
+    if (text_data_type_ == NULL) {
+        text_data_type_ = new_text_data_type();
+    }
+    return text_data_type_;
+}
+
+void free_text_data_type() {
+    if (text_data_type_ == NULL)
+        return;
+    free(text_data_type_);
+    text_data_type_ = NULL;
+}
+
+/*
+
+*/
+
+//Returns n of "varchar(n)", 0 if 'type_name' is not a varchar
+static size_t varchar_len(const char *type_name) {
+    const char *prefix = "varchar(";
+    if (strncmp(type_name, prefix, strlen(prefix)) != 0)
+        return 0;
+    long long n;
+    const char *digits = type_name + strlen(prefix), *end = strchr(digits, ')');
+    if (end == NULL || end[1] != '\0' || parse_integer(digits, end - digits, 1, VARCHAR_MAX_LEN, &n) != 0)
+        return 0;
+    return (size_t)n;
+}
 
 DataType *get_data_type(const char *type_name) {
     if (strcmp(int_data_type()->get_type_name(), type_name) == 0)
         return int_data_type();
     else if (strcmp(bigint_data_type()->get_type_name(), type_name) == 0)
         return bigint_data_type();
+    else if (strcmp(type_name, "text") == 0 || strcmp(type_name, "blob") == 0 || varchar_len(type_name) > 0)
+        return text_data_type();
     return NULL;
 }
 
+size_t type_max_len(const char *type_name) {
+    if (get_data_type(type_name) != text_data_type())
+        return 0;
+    size_t n = varchar_len(type_name);
+    return n > 0 ? n : TEXT_MAX_LEN;
+}
+
 size_t type_size(const char *type_name) {
     return get_data_type(type_name)->get_type_size();
 }
@@ -1,28 +1,91 @@
 #ifndef DATATYPE_H__
 #define DATATYPE_H__
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 //The data types will later be replaced by enum
 size_t type_size(const char *type_name);
 
 int is_valid_datatype(const char *type_name);
 
+typedef enum {
+    OP_EQ,      //column = value
+    OP_LT,      //column < value
+    OP_LE,      //column <= value
+    OP_GT,      //column > value
+    OP_GE,      //column >= value
+    OP_BETWEEN, //value <= column <= value2
+    //tests of the null bitmap of a row, with no value; no filter of a type is called for them
+    OP_IS_NULL,
+    OP_IS_NOT_NULL,
+} CompareOp;
+
 typedef struct {
     //virtual functions
     const char *(*get_type_name)(void);
     size_t (*get_type_size)(void);
-    int (*compare)(const void *, const void *);
+    int (*compare)(const void *, const void *); //NULL for text
     void *(*convert_to_val)(const char *);
     void (*cpy_to_memory)(void *, const char *);
-    void (*print)(const void *);
+    void (*print)(const void *); //NULL for text
+    //smallest and largest values, bounds of open-ended ranges
+    const void *(*min_val)(void);
+    const void *(*max_val)(void);
+    //text of 'len' bytes, not terminated, to memory; returns 0 or EINVAL/ERANGE
+    int (*parse)(void *, const char *, size_t);
+    //memory to text, not terminated, at most MAX_FORMAT_LEN bytes; returns the length; NULL for text
+    size_t (*format)(const void *, char *);
+    //batch predicate: sets bit i of the bitmap if 'value i op constant' holds for
+    //'num' values 'stride' bytes apart, the second constant is the upper bound of OP_BETWEEN;
+    //NULL for text
+    void (*filter)(const void *values, size_t stride, size_t num, CompareOp op, const void *constant, const void *constant2, uint64_t *bitmap);
 } DataType;
 
+#define MAX_FORMAT_LEN 24
+
 DataType *int_data_type();
 void free_int_data_type();
 
 DataType *bigint_data_type();
 void free_bigint_data_type();
 
+/* Variable-length types: text and blob, of at most TEXT_MAX_LEN bytes, and
+   varchar(n), of at most n <= VARCHAR_MAX_LEN bytes, all compared as bytes.
+   A value takes TEXT_CELL_SIZE bytes in a row: its length, then the value
+   itself if it has at most TEXT_INLINE_LEN bytes, so short strings keep rows
+   small and are compared without reading anything else. A longer value keeps
+   its first 4 bytes in the cell, which decide most comparisons, and a
+   reference to the rest: its slot in the heap file of the table (see
+   varheap.h), or, until it is stored there, its address in memory. Values
+   are compared, read and filtered through the heap of their table
+   (varheap_compare, varheap_load), so the type has no compare, print,
+   format or filter function. */
+#define TEXT_CELL_SIZE  16
+#define TEXT_INLINE_LEN 12
+#define TEXT_MAX_LEN    0x7fffffff
+#define VARCHAR_MAX_LEN 65535
+#define TEXT_IN_MEMORY  0x80000000 //flag in the length of a cell referring to memory
+
+typedef struct {
+    uint32_t len;    //length of the value, with TEXT_IN_MEMORY
+    char prefix[4];  //first bytes, or with 'ref' the TEXT_INLINE_LEN bytes of an inline value
+    uint64_t ref;    //heap slot, or the address of the value
+} TextCell;
+
+DataType *text_data_type();
+void free_text_data_type();
+
+/* Sets 'cell' to the value of 'len' bytes at 'data', inline or referring to
+   'data', which must outlive the cell until it is stored. */
+void text_cell_set(void *cell, const void *data, size_t len);
+/* Length of the value of 'cell'. */
+size_t text_cell_len(const void *cell);
+/* Longest value of the type named 'type_name', 0 for fixed-size types. */
+size_t type_max_len(const char *type_name);
+
+/* Returns the type named 'type_name', text_data_type() for text, blob and
+   varchar(n), or NULL if there is none. */
 DataType *get_data_type(const char *type_name);
 
 #endif
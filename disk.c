@@ -1,5 +1,7 @@
 #include "disk.h"
 #include <errno.h>
+#include <unistd.h>
+#include <string.h>
 
 DISK *dopen(const char *pathname) {
 	FILE *file = fopen(pathname, "r+");
@@ -52,12 +54,38 @@ DISK *dcreate(const char *pathname, disk_t blocksize) {
 	return disk;
 }
 
+DISK *dtmp(disk_t blocksize) {
+	FILE *file = tmpfile();
+	if (file == NULL) {
+		perror("tmpfile()");
+		return NULL;
+	}
+	DISK *disk = (DISK *)malloc(sizeof(DISK));
+	disk->file = file;
+	if (fseek(file, BLOCK_SIZE_OFFSET, SEEK_SET) != 0 || fwrite(&blocksize, BLOCK_SIZE_SIZE, 1, file) != 1) {
+		fclose(file);
+		free(disk);
+		return NULL;
+	}
+	disk->block_size = blocksize;
+	return disk;
+}
+
 void dclose(DISK *disk) {
 	if (disk->file != NULL) 
 		fclose(disk->file);
 	free(disk);
 }
 
+int dmove(const char *pathname, const char *new_pathname) {
+	int ret = new_pathname ? rename(pathname, new_pathname) : remove(pathname);
+	if (ret != 0 && errno != ENOENT) {
+		perror(new_pathname ? "rename()" : "remove()");
+		return EIO;
+	}
+	return 0;
+}
+
 disk_pointer next_pointer(DISK *disk, disk_pointer dp) {
     return dp + disk->block_size;
 }
@@ -127,3 +155,59 @@ int copy_to_disk(void *src, size_t size, DISK *disk, disk_pointer des) {
 	}
 	return 1;
 }
+
+int copy_to_disk_s(void *src, size_t num_blocks, DISK *disk, disk_pointer des) {
+	FILE *file = disk->file;
+	long offset = des;
+	fseek(file, offset, SEEK_SET);
+	if (fwrite(src, disk->block_size, num_blocks, file) != num_blocks) {
+		return -1;
+	}
+	return num_blocks;
+}
+
+int copy_to_memory_r(DISK *disk, disk_pointer src, void *des) {
+	ssize_t size = pread(fileno(disk->file), des, disk->block_size, (off_t)src);
+	if (size < 0)
+		return -1;
+	if (size < disk->block_size) {
+		//partial last block
+		memset((char *)des + size, 0, disk->block_size - size);
+		return size > 0 ? 1 : 0;
+	}
+	return 1;
+}
+
+int copy_to_memory_rs(DISK *disk, disk_pointer src, size_t num_blocks, void *des) {
+	size_t size = num_blocks * disk->block_size;
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pread(fileno(disk->file), (char *)des + done, size - done, (off_t)(src + done));
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break; //end of the disk
+		done += ret;
+	}
+	return done / disk->block_size;
+}
+
+ssize_t copy_bytes_to_memory_r(DISK *disk, disk_pointer src, size_t size, void *des) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = pread(fileno(disk->file), (char *)des + done, size - done, (off_t)(src + done));
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break; //end of the disk
+		done += ret;
+	}
+	return done;
+}
+
+int copy_to_disk_r(void *src, size_t size, DISK *disk, disk_pointer des) {
+	if (size > disk->block_size) size = disk->block_size;
+	if (pwrite(fileno(disk->file), src, size, (off_t)des) != (ssize_t)size)
+		return -1;
+	return 1;
+}
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #define BLOCK_SIZE_OFFSET 0
 typedef unsigned long long disk_t;
@@ -16,7 +17,13 @@ typedef struct {
 
 DISK *dopen(const char *pathname);
 DISK *dcreate(const char *pathname, disk_t blocksize);
+/* Creates an anonymous temporary disk, removed when it is closed. */
+DISK *dtmp(disk_t blocksize);
 void dclose(DISK *disk);
+/* Renames the file 'pathname' to 'new_pathname', or removes it if
+   'new_pathname' is NULL. A missing file counts as moved already, so an
+   interrupted set of moves can be done again. Returns 0 if success. */
+int dmove(const char *pathname, const char *new_pathname);
 
 typedef disk_t disk_pointer;
 #define DNULL 0x0
@@ -50,5 +57,24 @@ int copy_to_memory(DISK *disk, disk_pointer src, void *des);
 /* Copies data of 'size' bytes from memory area 'src' to disk area 'des'. 
    If 'size' is larger than one block_size, then the memory is truncated. */
 int copy_to_disk(void *src, size_t size, DISK *disk, disk_pointer des);
+/* Copies 'num_blocks' whole blocks from memory area 'src' to disk area 'des'
+   with one write. Returns 'num_blocks' on success, otherwise a negative number. */
+int copy_to_disk_s(void *src, size_t num_blocks, DISK *disk, disk_pointer des);
+
+/* Positional versions of copy_to_memory and copy_to_disk. They do not use the
+   FILE buffer or move the file position, so several threads may call them on
+   the same disk at once. Data written by the buffered functions must be
+   flushed with fflush(disk->file) before it is visible to copy_to_memory_r.
+   Returns 1 if one block was copied, 0 at the end of the disk and a negative
+   number on error. */
+int copy_to_memory_r(DISK *disk, disk_pointer src, void *des);
+int copy_to_disk_r(void *src, size_t size, DISK *disk, disk_pointer des);
+/* Positional version of copy_to_memory_s. Returns the number of whole blocks
+   copied, or a negative number on error. */
+int copy_to_memory_rs(DISK *disk, disk_pointer src, size_t num_blocks, void *des);
+/* Positional read of 'size' bytes at 'src', for parts of a block. Returns the
+   number of bytes copied, less at the end of the disk, or a negative number
+   on error. */
+ssize_t copy_bytes_to_memory_r(DISK *disk, disk_pointer src, size_t size, void *des);
 
 #endif
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE //qsort_r
+#include "extsort.h"
+#include "disk.h"
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#define EXTSORT_BLOCK_SIZE (64 * 1024)
+
+/* A writer generates its runs by replacement selection: its records form a
+   heap ordered by (run, record). Once the heap is full, each new record
+   replaces the smallest one, which is written to the current run; the new
+   record goes to the next run if it is smaller than the record written. Runs
+   are about twice as long as the heap on random input, and the whole input
+   is one run if it comes in order. */
+struct SortWriter {
+    char *buffer;       //records of the heap, one per slot
+    size_t *heap;       //slots, by run then record
+    size_t *run_of;     //run number of the record of each slot
+    size_t num;
+    size_t capacity;
+    size_t run;         //number of the run being written
+    struct SortRun *output; //run being written to disk, NULL if none
+    char *block;        //last block of 'output'
+    size_t num_block;   //records in 'block'
+};
+
+/* A sorted run, either spilled to a temporary disk or left in memory */
+struct SortRun {
+    DISK *disk; //NULL for a run in memory
+    char *buffer;
+    size_t num_records; //records in the run
+    size_t num_read;    //records returned by the merge
+    size_t pos;         //position in 'buffer'
+    size_t num_buffered;
+    disk_pointer next;  //next block to read
+};
+
+struct ExtSort {
+    size_t record_size;
+    int (*compare)(const void *, const void *, void *);
+    void *arg;
+    struct SortWriter *writers;
+    int num_writers;
+    struct SortRun **runs;
+    size_t num_runs;
+    size_t runs_capacity;
+    pthread_mutex_t mutex; //protects 'runs' while writers spill
+    size_t *tree; //loser tree of the merge, tree[0] is the run of the next record
+    bool pending; //the record of tree[0] was returned
+    size_t total;
+};
+
+static size_t records_per_block(PExtSort sort) {
+    return EXTSORT_BLOCK_SIZE / sort->record_size;
+}
+
+PExtSort extsort_create(size_t record_size, int (*compare)(const void *, const void *, void *), void *arg, size_t memory_budget, int num_writers) {
+    if (record_size == 0 || record_size > EXTSORT_BLOCK_SIZE || num_writers <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    PExtSort sort = malloc(sizeof(struct ExtSort));
+    if (sort == NULL)
+        return NULL;
+    sort->record_size = record_size;
+    sort->compare = compare;
+    sort->arg = arg;
+    sort->num_writers = num_writers;
+    sort->writers = calloc(num_writers, sizeof(struct SortWriter));
+    //the heap of a writer costs two indices per record besides the record
+    size_t capacity = memory_budget / num_writers / (record_size + 2 * sizeof(size_t));
+    if (capacity < records_per_block(sort))
+        capacity = records_per_block(sort);
+    for (int i = 0; i < num_writers; i++)
+        sort->writers[i].capacity = capacity; //buffers are allocated on first use
+    sort->runs = NULL;
+    sort->num_runs = sort->runs_capacity = 0;
+    pthread_mutex_init(&sort->mutex, NULL);
+    sort->tree = NULL;
+    sort->pending = false;
+    sort->total = 0;
+    return sort;
+}
+
+static void run_destroy(struct SortRun *run) {
+    if (run->disk)
+        dclose(run->disk);
+    free(run->buffer);
+    free(run);
+}
+
+static void writer_free(struct SortWriter *writer) {
+    free(writer->buffer);
+    free(writer->heap);
+    free(writer->run_of);
+    free(writer->block);
+    if (writer->output)
+        run_destroy(writer->output);
+    writer->buffer = writer->block = NULL;
+    writer->heap = writer->run_of = NULL;
+    writer->output = NULL;
+    writer->num = writer->num_block = 0;
+}
+
+void extsort_destroy(PExtSort sort) {
+    if (sort == NULL)
+        return;
+    for (int i = 0; i < sort->num_writers; i++)
+        writer_free(&sort->writers[i]);
+    free(sort->writers);
+    for (size_t i = 0; i < sort->num_runs; i++)
+        run_destroy(sort->runs[i]);
+    free(sort->runs);
+    free(sort->tree);
+    pthread_mutex_destroy(&sort->mutex);
+    free(sort);
+}
+
+static int add_run(PExtSort sort, struct SortRun *run) {
+    int ret = 0;
+    pthread_mutex_lock(&sort->mutex);
+    if (sort->num_runs == sort->runs_capacity) {
+        size_t capacity = sort->runs_capacity ? sort->runs_capacity * 2 : 16;
+        struct SortRun **runs = realloc(sort->runs, capacity * sizeof(struct SortRun *));
+        if (runs == NULL)
+            ret = ENOMEM;
+        else {
+            sort->runs = runs;
+            sort->runs_capacity = capacity;
+        }
+    }
+    if (ret == 0) {
+        sort->runs[sort->num_runs++] = run;
+        sort->total += run->num_records;
+    }
+    pthread_mutex_unlock(&sort->mutex);
+    return ret;
+}
+
+/*
+    Run generation
+*/
+
+static const void *slot_record(PExtSort sort, struct SortWriter *writer, size_t slot) {
+    return writer->buffer + slot * sort->record_size;
+}
+
+static int slot_compare(PExtSort sort, struct SortWriter *writer, size_t a, size_t b) {
+    if (writer->run_of[a] != writer->run_of[b])
+        return writer->run_of[a] < writer->run_of[b] ? -1 : 1;
+    return sort->compare(slot_record(sort, writer, a), slot_record(sort, writer, b), sort->arg);
+}
+
+static void writer_sift_up(PExtSort sort, struct SortWriter *writer, size_t i) {
+    size_t *heap = writer->heap;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (slot_compare(sort, writer, heap[parent], heap[i]) <= 0)
+            return;
+        size_t tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+static void writer_sift_down(PExtSort sort, struct SortWriter *writer, size_t i) {
+    size_t *heap = writer->heap;
+    while (1) {
+        size_t left = 2 * i + 1, right = left + 1, min = i;
+        if (left < writer->num && slot_compare(sort, writer, heap[left], heap[min]) < 0)
+            min = left;
+        if (right < writer->num && slot_compare(sort, writer, heap[right], heap[min]) < 0)
+            min = right;
+        if (min == i)
+            return;
+        size_t tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static int write_block(struct SortWriter *writer, PExtSort sort) {
+    //whole blocks, dalloc does not extend the file and the next block starts where this one ends
+    disk_pointer dp = dalloc(writer->output->disk);
+    if (copy_to_disk(writer->block, EXTSORT_BLOCK_SIZE, writer->output->disk, dp) < 0)
+        return EIO;
+    writer->num_block = 0;
+    return 0;
+}
+
+//Appends 'record' to the run the writer is spilling, started on a new temporary disk if needed
+static int run_append(PExtSort sort, struct SortWriter *writer, const void *record) {
+    if (writer->output == NULL) {
+        writer->output = calloc(1, sizeof(struct SortRun));
+        if (writer->output == NULL)
+            return ENOMEM;
+        if ((writer->output->disk = dtmp(EXTSORT_BLOCK_SIZE)) == NULL)
+            return EIO;
+    }
+    if (writer->block == NULL && (writer->block = malloc(EXTSORT_BLOCK_SIZE)) == NULL)
+        return ENOMEM;
+    memcpy(writer->block + writer->num_block++ * sort->record_size, record, sort->record_size);
+    writer->output->num_records++;
+    if (writer->num_block == records_per_block(sort))
+        return write_block(writer, sort);
+    return 0;
+}
+
+//Ends the run the writer is spilling and hands it to the merge
+static int run_close(PExtSort sort, struct SortWriter *writer) {
+    struct SortRun *run = writer->output;
+    int ret;
+    if (run == NULL)
+        return 0;
+    if (writer->num_block > 0 && (ret = write_block(writer, sort)) != 0)
+        return ret;
+    fflush(run->disk->file);
+    run->next = first_block(run->disk);
+    writer->output = NULL;
+    if ((ret = add_run(sort, run)) != 0)
+        run_destroy(run);
+    return ret;
+}
+
+int extsort_add(PExtSort sort, int writer_id, const void *record) {
+    struct SortWriter *writer = &sort->writers[writer_id];
+    if (writer->buffer == NULL) {
+        writer->buffer = malloc(writer->capacity * sort->record_size);
+        writer->heap = malloc(writer->capacity * sizeof(size_t));
+        writer->run_of = malloc(writer->capacity * sizeof(size_t));
+        if (writer->buffer == NULL || writer->heap == NULL || writer->run_of == NULL)
+            return ENOMEM;
+    }
+    if (writer->num < writer->capacity) {
+        size_t slot = writer->num;
+        memcpy(writer->buffer + slot * sort->record_size, record, sort->record_size);
+        writer->run_of[slot] = writer->run;
+        writer->heap[writer->num++] = slot;
+        writer_sift_up(sort, writer, slot);
+        return 0;
+    }
+    //the heap is full: the smallest record is written out and its slot takes the new one
+    int ret;
+    size_t slot = writer->heap[0];
+    if (writer->run_of[slot] != writer->run) {
+        if ((ret = run_close(sort, writer)) != 0)
+            return ret;
+        writer->run = writer->run_of[slot];
+    }
+    const void *smallest = slot_record(sort, writer, slot);
+    if ((ret = run_append(sort, writer, smallest)) != 0)
+        return ret;
+    bool next_run = sort->compare(record, smallest, sort->arg) < 0;
+    memcpy(writer->buffer + slot * sort->record_size, record, sort->record_size);
+    writer->run_of[slot] = writer->run + next_run;
+    writer_sift_down(sort, writer, 0);
+    return 0;
+}
+
+size_t extsort_size(PExtSort sort) {
+    return sort->total;
+}
+
+/* Writes the records of the current run left in the heap of 'writer' to
+   disk, and keeps the records of the next run in memory as a last run. */
+static int writer_finish(PExtSort sort, struct SortWriter *writer) {
+    int ret;
+    struct SortRun *run;
+    if (writer->output == NULL && writer->num > 0) {
+        //nothing was spilled, the slots in use are the first ones
+        if ((run = calloc(1, sizeof(struct SortRun))) == NULL)
+            return ENOMEM;
+        qsort_r(writer->buffer, writer->num, sort->record_size, sort->compare, sort->arg);
+        run->buffer = writer->buffer;
+        run->num_records = run->num_buffered = writer->num;
+        writer->buffer = NULL;
+        writer->num = 0;
+        if ((ret = add_run(sort, run)) != 0)
+            run_destroy(run);
+        return ret;
+    }
+    while (writer->num > 0 && writer->run_of[writer->heap[0]] == writer->run) {
+        if ((ret = run_append(sort, writer, slot_record(sort, writer, writer->heap[0]))) != 0)
+            return ret;
+        writer->heap[0] = writer->heap[--writer->num];
+        writer_sift_down(sort, writer, 0);
+    }
+    if ((ret = run_close(sort, writer)) != 0 || writer->num == 0)
+        return ret;
+    //the next run is sorted by popping the heap into memory
+    if ((run = calloc(1, sizeof(struct SortRun))) == NULL || (run->buffer = malloc(writer->num * sort->record_size)) == NULL) {
+        free(run);
+        return ENOMEM;
+    }
+    run->num_records = run->num_buffered = writer->num;
+    for (size_t i = 0; writer->num > 0; i++) {
+        memcpy(run->buffer + i * sort->record_size, slot_record(sort, writer, writer->heap[0]), sort->record_size);
+        writer->heap[0] = writer->heap[--writer->num];
+        writer_sift_down(sort, writer, 0);
+    }
+    if ((ret = add_run(sort, run)) != 0)
+        run_destroy(run);
+    return ret;
+}
+
+/*
+    Merge
+
+    The runs are merged through a loser tree: leaf i, at node num_runs + i, is
+    run i, and each inner node holds the run that lost the comparison of its
+    subtree. Moving to the next record replays one path from a leaf to the
+    root, log2(num_runs) comparisons, each against the loser stored there.
+*/
+
+static const void *run_current(PExtSort sort, struct SortRun *run) {
+    return run->buffer + run->pos * sort->record_size;
+}
+
+//Moves 'run' to its next record, returns false at the end of the run
+static bool run_advance(PExtSort sort, struct SortRun *run) {
+    run->num_read++;
+    run->pos++;
+    if (run->num_read >= run->num_records)
+        return false;
+    if (run->pos < run->num_buffered)
+        return true;
+    //load the next block of a spilled run
+    copy_to_memory(run->disk, run->next, run->buffer);
+    run->next = next_pointer(run->disk, run->next);
+    run->pos = 0;
+    run->num_buffered = records_per_block(sort);
+    return true;
+}
+
+static bool run_done(struct SortRun *run) {
+    return run->num_read >= run->num_records;
+}
+
+//Returns true if the current record of run 'a' comes before that of run 'b', finished runs last
+static bool run_before(PExtSort sort, size_t a, size_t b) {
+    struct SortRun *x = sort->runs[a], *y = sort->runs[b];
+    if (run_done(x) || run_done(y))
+        return !run_done(x) || (run_done(y) && a < b);
+    int res = sort->compare(run_current(sort, x), run_current(sort, y), sort->arg);
+    return res < 0 || (res == 0 && a < b);
+}
+
+//Fills the losers of the subtree of 'node', returns its winner
+static size_t tree_build(PExtSort sort, size_t node) {
+    if (node >= sort->num_runs)
+        return node - sort->num_runs;
+    size_t left = tree_build(sort, 2 * node), right = tree_build(sort, 2 * node + 1);
+    bool left_wins = run_before(sort, left, right);
+    sort->tree[node] = left_wins ? right : left;
+    return left_wins ? left : right;
+}
+
+//Plays the matches from the leaf of run 'winner', after it moved to its next record
+static void tree_replay(PExtSort sort, size_t winner) {
+    for (size_t node = (winner + sort->num_runs) / 2; node > 0; node /= 2) {
+        if (run_before(sort, sort->tree[node], winner)) {
+            size_t loser = winner;
+            winner = sort->tree[node];
+            sort->tree[node] = loser;
+        }
+    }
+    sort->tree[0] = winner;
+}
+
+int extsort_finish(PExtSort sort) {
+    int ret;
+    for (int i = 0; i < sort->num_writers; i++) {
+        struct SortWriter *writer = &sort->writers[i];
+        ret = writer_finish(sort, writer);
+        writer_free(writer);
+        if (ret != 0)
+            return ret;
+    }
+    sort->tree = malloc((sort->num_runs ? sort->num_runs : 1) * sizeof(size_t));
+    if (sort->tree == NULL)
+        return ENOMEM;
+    for (size_t i = 0; i < sort->num_runs; i++) {
+        struct SortRun *run = sort->runs[i];
+        if (run->disk) {
+            run->buffer = malloc(EXTSORT_BLOCK_SIZE);
+            if (run->buffer == NULL)
+                return ENOMEM;
+            copy_to_memory(run->disk, run->next, run->buffer);
+            run->next = next_pointer(run->disk, run->next);
+            run->num_buffered = records_per_block(sort);
+        }
+    }
+    if (sort->num_runs > 0)
+        sort->tree[0] = sort->num_runs == 1 ? 0 : tree_build(sort, 1);
+    return 0;
+}
+
+const void *extsort_next(PExtSort sort) {
+    if (sort->tree == NULL || sort->num_runs == 0)
+        return NULL;
+    //the record returned last time is consumed only now, so it stays valid until this call
+    if (sort->pending) {
+        run_advance(sort, sort->runs[sort->tree[0]]);
+        tree_replay(sort, sort->tree[0]);
+    }
+    struct SortRun *run = sort->runs[sort->tree[0]];
+    sort->pending = !run_done(run);
+    return run_done(run) ? NULL : run_current(sort, run);
+}
@@ -0,0 +1,30 @@
+#ifndef EXTSORT_H__
+#define EXTSORT_H__
+
+#include <stdlib.h>
+
+/* External merge sort of fixed-size records.
+   Records are added through 'num_writers' independent writers, each owned by
+   one thread, so that producers can sort in parallel. A writer keeps a heap
+   of its share of 'memory_budget' bytes and generates sorted runs on
+   temporary DISKs by replacement selection, runs twice that size on average.
+   extsort_finish keeps the last run of each writer in memory, after which
+   extsort_next returns the records in order through a k-way merge of all
+   runs with a loser tree. Nothing is written to disk if the records fit in
+   the budget. */
+typedef struct ExtSort *PExtSort;
+
+PExtSort extsort_create(size_t record_size, int (*compare)(const void *, const void *, void *), void *arg, size_t memory_budget, int num_writers);
+void extsort_destroy(PExtSort sort);
+
+/* Only one thread may use a given 'writer' at a time. Returns 0 if success. */
+int extsort_add(PExtSort sort, int writer, const void *record);
+/* Call once, after all writers are done. Returns 0 if success. */
+int extsort_finish(PExtSort sort);
+/* Returns the next record in order, NULL after the last one. The record is
+   valid until the next call. */
+const void *extsort_next(PExtSort sort);
+/* Number of records added. */
+size_t extsort_size(PExtSort sort);
+
+#endif
@@ -0,0 +1,160 @@
+#include "filter.h"
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILTER_X86
+#include <immintrin.h>
+#endif
+
+/* A word kernel tests the 64 values of one word of the bitmap. */
+typedef uint64_t (*word_int32_fn)(const char *values, size_t stride, int32_t low, int32_t high);
+typedef uint64_t (*word_int64_fn)(const char *values, size_t stride, int64_t low, int64_t high);
+
+//scalar kernels, for the last word and the CPUs without SIMD kernels
+static uint64_t word_int32(const char *values, size_t stride, size_t num, int32_t low, int32_t high) {
+    uint64_t word = 0;
+    for (size_t i = 0; i < num; i++) {
+        int32_t x;
+        memcpy(&x, values + i * stride, sizeof(x));
+        word |= (uint64_t)(x >= low && x <= high) << i;
+    }
+    return word;
+}
+
+static uint64_t word_int64(const char *values, size_t stride, size_t num, int64_t low, int64_t high) {
+    uint64_t word = 0;
+    for (size_t i = 0; i < num; i++) {
+        int64_t x;
+        memcpy(&x, values + i * stride, sizeof(x));
+        word |= (uint64_t)(x >= low && x <= high) << i;
+    }
+    return word;
+}
+
+#ifdef FILTER_X86
+
+/* A lane is out of range if low > x or x > high; the movemask of the result
+   has one bit per lane, inverted into the bits of the matching values. */
+
+__attribute__((target("avx2")))
+static uint64_t word_int32_avx2(const char *values, size_t stride, int32_t low, int32_t high) {
+    __m256i lo = _mm256_set1_epi32(low), hi = _mm256_set1_epi32(high);
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(values + j * sizeof(int32_t)));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, x), _mm256_cmpgt_epi32(x, hi));
+        word |= (uint64_t)(~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff) << j;
+    }
+    return word;
+}
+
+__attribute__((target("avx2")))
+static uint64_t word_int32_avx2_gather(const char *values, size_t stride, int32_t low, int32_t high) {
+    __m256i lo = _mm256_set1_epi32(low), hi = _mm256_set1_epi32(high);
+    __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 8) {
+        __m256i x = _mm256_i32gather_epi32((const int *)(values + j * stride), index, 1);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, x), _mm256_cmpgt_epi32(x, hi));
+        word |= (uint64_t)(~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff) << j;
+    }
+    return word;
+}
+
+__attribute__((target("sse2")))
+static uint64_t word_int32_sse(const char *values, size_t stride, int32_t low, int32_t high) {
+    __m128i lo = _mm_set1_epi32(low), hi = _mm_set1_epi32(high);
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(values + j * sizeof(int32_t)));
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi32(lo, x), _mm_cmpgt_epi32(x, hi));
+        word |= (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf) << j;
+    }
+    return word;
+}
+
+__attribute__((target("avx2")))
+static uint64_t word_int64_avx2(const char *values, size_t stride, int64_t low, int64_t high) {
+    __m256i lo = _mm256_set1_epi64x(low), hi = _mm256_set1_epi64x(high);
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(values + j * sizeof(int64_t)));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(lo, x), _mm256_cmpgt_epi64(x, hi));
+        word |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf) << j;
+    }
+    return word;
+}
+
+__attribute__((target("avx2")))
+static uint64_t word_int64_avx2_gather(const char *values, size_t stride, int64_t low, int64_t high) {
+    __m256i lo = _mm256_set1_epi64x(low), hi = _mm256_set1_epi64x(high);
+    __m128i index = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32((int)stride));
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 4) {
+        __m256i x = _mm256_i32gather_epi64((const long long *)(values + j * stride), index, 1);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(lo, x), _mm256_cmpgt_epi64(x, hi));
+        word |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xf) << j;
+    }
+    return word;
+}
+
+__attribute__((target("sse4.2")))
+static uint64_t word_int64_sse(const char *values, size_t stride, int64_t low, int64_t high) {
+    __m128i lo = _mm_set1_epi64x(low), hi = _mm_set1_epi64x(high);
+    uint64_t word = 0;
+    for (int j = 0; j < 64; j += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(values + j * sizeof(int64_t)));
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi64(lo, x), _mm_cmpgt_epi64(x, hi));
+        word |= (uint64_t)(~_mm_movemask_pd(_mm_castsi128_pd(out)) & 0x3) << j;
+    }
+    return word;
+}
+
+#endif
+
+//Returns the word kernel for values 'stride' bytes apart, NULL for the scalar one
+static word_int32_fn select_int32(size_t stride) {
+#ifdef FILTER_X86
+    bool gather = stride <= INT_MAX / 64; //byte offsets of a word fit in the 32 bit indices
+    if (__builtin_cpu_supports("avx2") && (stride == sizeof(int32_t) || gather))
+        return stride == sizeof(int32_t) ? word_int32_avx2 : word_int32_avx2_gather;
+    if (__builtin_cpu_supports("sse2") && stride == sizeof(int32_t))
+        return word_int32_sse;
+#endif
+    return NULL;
+}
+
+static word_int64_fn select_int64(size_t stride) {
+#ifdef FILTER_X86
+    bool gather = stride <= INT_MAX / 64;
+    if (__builtin_cpu_supports("avx2") && (stride == sizeof(int64_t) || gather))
+        return stride == sizeof(int64_t) ? word_int64_avx2 : word_int64_avx2_gather;
+    if (__builtin_cpu_supports("sse4.2") && stride == sizeof(int64_t))
+        return word_int64_sse;
+#endif
+    return NULL;
+}
+
+void filter_range_int32(const void *values, size_t stride, size_t num, int32_t low, int32_t high, uint64_t *bitmap) {
+    const char *p = (const char *)values;
+    word_int32_fn word = select_int32(stride);
+    size_t i = 0;
+    if (word != NULL)
+        for (; i + 64 <= num; i += 64)
+            bitmap[i / 64] = word(p + i * stride, stride, low, high);
+    for (; i < num; i += 64)
+        bitmap[i / 64] = word_int32(p + i * stride, stride, num - i < 64 ? num - i : 64, low, high);
+}
+
+void filter_range_int64(const void *values, size_t stride, size_t num, int64_t low, int64_t high, uint64_t *bitmap) {
+    const char *p = (const char *)values;
+    word_int64_fn word = select_int64(stride);
+    size_t i = 0;
+    if (word != NULL)
+        for (; i + 64 <= num; i += 64)
+            bitmap[i / 64] = word(p + i * stride, stride, low, high);
+    for (; i < num; i += 64)
+        bitmap[i / 64] = word_int64(p + i * stride, stride, num - i < 64 ? num - i : 64, low, high);
+}
@@ -0,0 +1,19 @@
+#ifndef FILTER_H__
+#define FILTER_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Batch predicate kernels. A kernel tests 'num' values, 'stride' bytes apart
+   and not necessarily aligned, and sets bit i of 'bitmap' if value i is in
+   [low, high]; the bits past 'num' in the last word are cleared. Contiguous
+   values are compared 256 bits at a time with AVX2, or 128 bits at a time
+   with SSE, and strided values are loaded with AVX2 gathers. The instruction
+   set is chosen once at run time, the scalar kernels are used elsewhere. */
+
+#define BITMAP_WORDS(num) (((num) + 63) / 64)
+
+void filter_range_int32(const void *values, size_t stride, size_t num, int32_t low, int32_t high, uint64_t *bitmap);
+void filter_range_int64(const void *values, size_t stride, size_t num, int64_t low, int64_t high, uint64_t *bitmap);
+
+#endif
@@ -14,5 +14,11 @@
 #define FRM_COL_TYPE_OFFSET(i)          (FRM_COL_NAME_OFFSET(i) + FRM_COL_NAME_SIZE)
 #define FRM_COL_INDEX_FLAG_OFFSET(i)    (FRM_COL_TYPE_OFFSET(i) + FRM_COL_TYPE_SIZE)
 #define FRM_SIZE(num_cols)              (FRM_FIRST_COL_OFFSET + num_cols * FRM_COL_SIZE)
+//DataLayout of the data file, after the columns; frames without it are LAYOUT_ROW
+#define FRM_LAYOUT_OFFSET(num_cols)     FRM_SIZE(num_cols)
+#define FRM_LAYOUT_SIZE                 1
+//One flag per column after the layout, 1 if the column is nullable; frames without them have no nullable column
+#define FRM_NULLABLE_OFFSET(num_cols)   (FRM_LAYOUT_OFFSET(num_cols) + FRM_LAYOUT_SIZE)
+#define FRM_NULLABLE_SIZE(num_cols)     (num_cols)
 
 #endif
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE //qsort_r
+#include "index.h"
+#include "btree.h"
+#include "lsm.h"
+#include "cowbtree.h"
+#include "table.h"
+#include <errno.h>
+#include <string.h>
+
+/*
+
+  B+ tree
+
+*/
+static int btree_insert_impl(void *impl, void *key, record_t record) {
+    return btree_insert((PBTree)impl, key, record);
+}
+
+static vector_t *btree_select_impl(void *impl, const void *key_start, const void *key_end) {
+    return btree_select((PBTree)impl, key_start, key_end);
+}
+
+static bool btree_may_contain_impl(void *impl, const void *key) {
+    return btree_may_contain((PBTree)impl, key);
+}
+
+static int btree_first_key_impl(void *impl, void *key) {
+    return btree_first_key((PBTree)impl, key);
+}
+
+static int btree_last_key_impl(void *impl, void *key) {
+    return btree_last_key((PBTree)impl, key);
+}
+
+static int btree_remove_impl(void *impl, const void *key, record_t record) {
+    return btree_remove((PBTree)impl, key, record);
+}
+
+static void btree_close_impl(void *impl) {
+    btree_close((PBTree)impl);
+}
+
+/*
+
+  LSM tree
+
+*/
+static int lsm_insert_impl(void *impl, void *key, record_t record) {
+    return lsm_insert((PLsm)impl, key, record);
+}
+
+static vector_t *lsm_select_impl(void *impl, const void *key_start, const void *key_end) {
+    return lsm_select((PLsm)impl, key_start, key_end);
+}
+
+static bool lsm_may_contain_impl(void *impl, const void *key) {
+    return lsm_may_contain((PLsm)impl, key);
+}
+
+static void lsm_close_impl(void *impl) {
+    lsm_close((PLsm)impl);
+}
+
+/*
+
+  Copy-on-write B+ tree
+
+*/
+static int cowbtree_insert_impl(void *impl, void *key, record_t record) {
+    return cowbtree_insert((PCowBTree)impl, key, record);
+}
+
+static vector_t *cowbtree_select_impl(void *impl, const void *key_start, const void *key_end) {
+    return cowbtree_select((PCowBTree)impl, key_start, key_end);
+}
+
+static bool cowbtree_may_contain_impl(void *impl, const void *key) {
+    return true;
+}
+
+static void cowbtree_close_impl(void *impl) {
+    cowbtree_close((PCowBTree)impl);
+}
+
+/*
+
+*/
+
+//constructor
+static PIndex new_index(IndexKind kind, DataType *p_key_type, void *impl) {
+    if (impl == NULL)
+        return NULL;
+    PIndex index = (PIndex)malloc(sizeof(struct Index));
+    if (index == NULL)
+        return NULL;
+    index->kind = kind;
+    index->p_key_type = p_key_type;
+    index->impl = impl;
+    index->first_key = index->last_key = NULL;
+    index->remove = NULL;
+    switch (kind) {
+    case INDEX_BTREE:
+        index->insert      = btree_insert_impl;
+        index->select      = btree_select_impl;
+        index->may_contain = btree_may_contain_impl;
+        index->first_key   = btree_first_key_impl;
+        index->last_key    = btree_last_key_impl;
+        index->remove      = btree_remove_impl;
+        index->close       = btree_close_impl;
+        break;
+    case INDEX_LSM:
+        index->insert      = lsm_insert_impl;
+        index->select      = lsm_select_impl;
+        index->may_contain = lsm_may_contain_impl;
+        index->close       = lsm_close_impl;
+        break;
+    case INDEX_COW:
+        index->insert      = cowbtree_insert_impl;
+        index->select      = cowbtree_select_impl;
+        index->may_contain = cowbtree_may_contain_impl;
+        index->close       = cowbtree_close_impl;
+        break;
+    default:
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+PIndex index_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind) {
+    switch (kind) {
+    case INDEX_BTREE:
+        return new_index(kind, p_key_type, btree_create(path, table_name, idx_col_name, p_key_type));
+    case INDEX_LSM:
+        return new_index(kind, p_key_type, lsm_create(path, table_name, idx_col_name, p_key_type));
+    case INDEX_COW:
+        return new_index(kind, p_key_type, cowbtree_create(path, table_name, idx_col_name, p_key_type));
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+}
+
+PIndex index_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind) {
+    switch (kind) {
+    case INDEX_BTREE:
+        return new_index(kind, p_key_type, btree_open(path, table_name, idx_col_name, p_key_type));
+    case INDEX_LSM:
+        return new_index(kind, p_key_type, lsm_open(path, table_name, idx_col_name, p_key_type));
+    case INDEX_COW:
+        return new_index(kind, p_key_type, cowbtree_open(path, table_name, idx_col_name, p_key_type));
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+}
+
+PIndex index_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind, index_entry_source next, void *arg, size_t num_entries) {
+    switch (kind) {
+    case INDEX_BTREE:
+        return new_index(kind, p_key_type, btree_bulk_load(path, table_name, idx_col_name, p_key_type, next, arg));
+    case INDEX_LSM:
+        return new_index(kind, p_key_type, lsm_bulk_load(path, table_name, idx_col_name, p_key_type, next, arg, num_entries));
+    default:
+        break;
+    }
+    PIndex index = index_create(path, table_name, idx_col_name, p_key_type, kind);
+    if (index == NULL)
+        return NULL;
+    const void *key;
+    record_t record;
+    while (next(arg, &key, &record)) {
+        if (index_insert(index, (void *)key, record) != 0) {
+            index_close(index);
+            return NULL;
+        }
+    }
+    return index;
+}
+
+static char *index_pathname(const char *path, const char *table_name, const char *idx_col_name, const char *suffix) {
+    char *pathname = malloc(strlen(path) + strlen(table_name) + 1 + strlen(idx_col_name) + strlen(suffix) + 1);
+    sprintf(pathname, "%s%s_%s%s", path, table_name, idx_col_name, suffix);
+    return pathname;
+}
+
+//Moves the file of the index with 'suffix', see index_move
+static int move_index_file(const char *path, const char *table_name, const char *idx_col_name, const char *suffix, const char *new_table_name) {
+    char *pathname = index_pathname(path, table_name, idx_col_name, suffix);
+    char *new_pathname = new_table_name ? index_pathname(path, new_table_name, idx_col_name, suffix) : NULL;
+    int ret = dmove(pathname, new_pathname);
+    free(pathname);
+    free(new_pathname);
+    return ret;
+}
+
+int index_move(const char *path, const char *table_name, const char *idx_col_name, IndexKind kind, const char *new_table_name) {
+    int ret;
+    switch (kind) {
+    case INDEX_BTREE:
+        //a bloom filter is a file of its own
+        ret = move_index_file(path, table_name, idx_col_name, BLOOM_SUFFIX, new_table_name);
+        return ret ? ret : move_index_file(path, table_name, idx_col_name, INDEX_SUFFIX, new_table_name);
+    case INDEX_LSM:
+        return lsm_move(path, table_name, idx_col_name, new_table_name);
+    case INDEX_COW:
+        return move_index_file(path, table_name, idx_col_name, COW_SUFFIX, new_table_name);
+    default:
+        return EINVAL;
+    }
+}
+
+void index_close(PIndex index) {
+    if (index == NULL)
+        return;
+    index->close(index->impl);
+    free(index);
+}
+
+int index_insert(PIndex index, void *key, record_t record) {
+    return index->insert(index->impl, key, record);
+}
+
+struct batch_entry {
+    const void *key;
+    record_t record;
+};
+
+static int compare_batch_entry(const void *a, const void *b, void *arg) {
+    const struct batch_entry *x = a, *y = b;
+    int cmp = ((PIndex)arg)->p_key_type->compare(x->key, y->key);
+    if (cmp != 0)
+        return cmp;
+    return (x->record > y->record) - (x->record < y->record);
+}
+
+int index_insert_batch(PIndex index, const void *keys, size_t stride, const record_t *records, size_t num) {
+    struct batch_entry *entries = (struct batch_entry *)malloc((num ? num : 1) * sizeof(struct batch_entry));
+    if (entries == NULL)
+        return ENOMEM;
+    for (size_t i = 0; i < num; i++) {
+        entries[i].key = keys + i * stride;
+        entries[i].record = records[i];
+    }
+    qsort_r(entries, num, sizeof(struct batch_entry), compare_batch_entry, index);
+    int ret = 0;
+    for (size_t i = 0; i < num && ret == 0; i++)
+        ret = index->insert(index->impl, (void *)entries[i].key, entries[i].record);
+    free(entries);
+    return ret;
+}
+
+vector_t *index_select(PIndex index, const void *key_start, const void *key_end) {
+    return index->select(index->impl, key_start, key_end);
+}
+
+bool index_may_contain(PIndex index, const void *key) {
+    return index->may_contain(index->impl, key);
+}
+
+int index_first_key(PIndex index, void *key) {
+    if (index->first_key == NULL)
+        return ENOTSUP;
+    return index->first_key(index->impl, key);
+}
+
+int index_last_key(PIndex index, void *key) {
+    if (index->last_key == NULL)
+        return ENOTSUP;
+    return index->last_key(index->impl, key);
+}
+
+int index_remove(PIndex index, const void *key, record_t record) {
+    if (index->remove == NULL)
+        return ENOTSUP;
+    return index->remove(index->impl, key, record);
+}
@@ -0,0 +1,70 @@
+#ifndef INDEX_H__
+#define INDEX_H__
+
+#include <stdbool.h>
+#include "disk.h"
+#include "datatype.h"
+#include "vector.h"
+
+typedef disk_pointer record_t;
+
+/* Storage engines for an index. The kind is stored in the frame file as the
+   index flag of the column, 0 means the column is not indexed. */
+typedef enum {
+    INDEX_NONE  = 0,
+    INDEX_BTREE = 1, //B+ tree updated in place, see btree.h
+    INDEX_LSM   = 2, //log-structured merge tree for write-heavy tables, see lsm.h
+    INDEX_COW   = 3, //copy-on-write B+ tree, readers see snapshots, see cowbtree.h
+} IndexKind;
+
+/* Source of the entries of a bulk load, in key order with the newest (largest)
+   record first among equal keys. Returns false after the last entry. */
+typedef bool (*index_entry_source)(void *arg, const void **key, record_t *record);
+
+typedef struct Index {
+    IndexKind kind;
+    DataType *p_key_type;
+    void *impl; //PBTree, PLsm, PCowBTree
+    //virtual functions
+    int (*insert)(void *impl, void *key, record_t record);
+    vector_t *(*select)(void *impl, const void *key_start, const void *key_end);
+    bool (*may_contain)(void *impl, const void *key);
+    int (*first_key)(void *impl, void *key); //NULL if the engine needs a scan to find it
+    int (*last_key)(void *impl, void *key);
+    int (*remove)(void *impl, const void *key, record_t record); //NULL if entries are only dropped by a rebuild
+    void (*close)(void *impl);
+} *PIndex;
+
+PIndex index_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind);
+PIndex index_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind);
+/* Creates an index holding the entries returned by 'next'. The btree and the
+   LSM tree are built bottom-up from the sorted entries, other kinds insert
+   them one by one. 'num_entries' is a hint for sizing. */
+PIndex index_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, IndexKind kind, index_entry_source next, void *arg, size_t num_entries);
+void index_close(PIndex index);
+/* Renames the files of the closed index on 'idx_col_name' of 'table_name' to
+   those of 'new_table_name', or removes them if it is NULL. Files moved
+   already are skipped, so an interrupted move can be done again. Returns 0
+   if success. */
+int index_move(const char *path, const char *table_name, const char *idx_col_name, IndexKind kind, const char *new_table_name);
+
+int index_insert(PIndex index, void *key, record_t record);
+/* Inserts 'num' entries, the i-th key at keys + i * stride. The entries are
+   sorted first so that the index is updated in key order, entries with equal
+   keys smallest record first as if inserted one by one. Returns 0 if success. */
+int index_insert_batch(PIndex index, const void *keys, size_t stride, const record_t *records, size_t num);
+/* Returns a vector of record_t with keys in [key_start, key_end], in key order. */
+vector_t *index_select(PIndex index, const void *key_start, const void *key_end);
+/* Returns false if 'key' is definitely not in the index. */
+bool index_may_contain(PIndex index, const void *key);
+/* Copies the smallest (largest) key of the index to 'key' without reading the
+   whole index. Returns 0, ENOENT if the index is empty, or ENOTSUP if the
+   engine has no such shortcut. */
+int index_first_key(PIndex index, void *key);
+int index_last_key(PIndex index, void *key);
+/* Removes the entry of 'key' pointing to 'record'. Returns 0, ENOENT if there
+   is no such entry, or ENOTSUP if the engine cannot remove entries; their
+   stale entries are dropped when the table is compacted. */
+int index_remove(PIndex index, const void *key, record_t record);
+
+#endif
@@ -0,0 +1,986 @@
+#include "lsm.h"
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#define LSM_MAGIC               0x4d534c00 //"\0LSM"
+#define LSM_LOG_MAGIC           0x474f4c00 //"\0LOG"
+#define LSM_PAGE_SIZE           4096
+#define LSM_MEMTABLE_ENTRIES    16384
+#define LSM_RUNS_PER_LEVEL      4
+
+struct ManifestHeader {
+    uint32_t magic;
+    uint32_t key_size;
+    unsigned long long next_run_id;
+    unsigned long long log_generation;
+    unsigned long long num_runs;
+};
+
+struct LogHeader {
+    uint32_t magic;
+    unsigned long long generation;
+};
+
+struct ManifestRun {
+    unsigned long long id;
+    unsigned long long level;
+    unsigned long long num_entries;
+    unsigned long long num_pages;
+};
+
+/*
+    Entries: key followed by its record
+*/
+
+static record_t entry_record(PLsm lsm, const void *entry) {
+    record_t record;
+    memcpy(&record, entry + lsm->key_size, sizeof(record_t));
+    return record;
+}
+
+static int compare_entry(PLsm lsm, const void *a, const void *b) {
+    int res = lsm->p_key_type->compare(a, b);
+    if (res != 0)
+        return res;
+    //equal keys: newest (largest) record first, the order btree_insert gives duplicates
+    record_t ra = entry_record(lsm, a), rb = entry_record(lsm, b);
+    if (ra == rb)
+        return 0;
+    return ra < rb ? 1 : -1;
+}
+
+//memtable element, carries the lsm so that the rbtree comparator can reach the key type
+struct MemEntry {
+    PLsm lsm;
+    char entry[1];
+};
+
+static int compare_mem_entry(const void *a, const void *b) {
+    const struct MemEntry *ea = (const struct MemEntry *)a;
+    const struct MemEntry *eb = (const struct MemEntry *)b;
+    return compare_entry(ea->lsm, ea->entry, eb->entry);
+}
+
+static struct MemEntry *mem_entry_create(PLsm lsm, const void *key, record_t record) {
+    struct MemEntry *mem_entry = malloc(sizeof(struct MemEntry) + lsm->entry_size);
+    if (mem_entry == NULL)
+        return NULL;
+    mem_entry->lsm = lsm;
+    memcpy(mem_entry->entry, key, lsm->key_size);
+    memcpy(mem_entry->entry + lsm->key_size, &record, sizeof(record_t));
+    return mem_entry;
+}
+
+static rbtree_t *memtable_create() {
+    return rbtree_create(compare_mem_entry, NULL, sizeof(struct MemEntry), RBT_SHALLOW_COPY);
+}
+
+static int memtable_put(PLsm lsm, const void *entry) {
+    struct MemEntry *mem_entry = mem_entry_create(lsm, entry, entry_record(lsm, entry));
+    if (mem_entry == NULL)
+        return ENOMEM;
+    if (rbtree_search(lsm->memtable, mem_entry) != NULL) {
+        free(mem_entry); //already there
+        return 0;
+    }
+    return rbtree_insert(lsm->memtable, mem_entry);
+}
+
+/*
+    File names
+*/
+
+static char *get_prefix(const char *path, const char *table_name, const char *idx_col_name) {
+    size_t path_len = strlen(path);
+    size_t table_name_len = strlen(table_name);
+    size_t idx_col_name_len = strlen(idx_col_name);
+    size_t EOF_SIZE = 1; // space for '\0'
+    char *prefix = malloc(path_len + table_name_len + 1 + idx_col_name_len + EOF_SIZE);
+    strcpy(prefix, path);
+    strcpy(prefix + path_len, table_name);
+    prefix[path_len + table_name_len] = '_';
+    strcpy(prefix + path_len + table_name_len + 1, idx_col_name);
+    return prefix;
+}
+
+static char *get_lsm_pathname(PLsm lsm, const char *suffix) {
+    char *pathname = malloc(strlen(lsm->prefix) + strlen(suffix) + 1);
+    strcpy(pathname, lsm->prefix);
+    strcat(pathname, suffix);
+    return pathname;
+}
+
+static char *get_run_pathname(PLsm lsm, unsigned long long id, const char *suffix) {
+    char *pathname = malloc(strlen(lsm->prefix) + 32 + strlen(suffix));
+    sprintf(pathname, "%s_%llu%s", lsm->prefix, id, suffix);
+    return pathname;
+}
+
+static char *get_run_bloom_pathname(PRun run) {
+    char *pathname = malloc(strlen(run->pathname) + strlen(BLOOM_SUFFIX) + 1);
+    strcpy(pathname, run->pathname);
+    strcat(pathname, BLOOM_SUFFIX);
+    return pathname;
+}
+
+/*
+    Runs
+*/
+
+static size_t entries_per_page(PLsm lsm) {
+    return LSM_PAGE_SIZE / lsm->entry_size;
+}
+
+static size_t num_fence_blocks(PLsm lsm, size_t num_pages) {
+    return (num_pages * lsm->key_size + LSM_PAGE_SIZE - 1) / LSM_PAGE_SIZE;
+}
+
+static void run_destroy(PRun run, bool remove_files) {
+    if (run == NULL)
+        return;
+    if (run->disk)
+        dclose(run->disk);
+    if (run->bloom) {
+        char *bloom_pathname = get_run_bloom_pathname(run);
+        bloom_close(run->bloom);
+        if (remove_files)
+            remove(bloom_pathname);
+        free(bloom_pathname);
+    }
+    if (remove_files)
+        remove(run->pathname);
+    free(run->pathname);
+    free(run->fences);
+    free(run);
+}
+
+//Drops one reference, caller holds lsm->mutex
+static void run_unref(PRun run) {
+    if (--run->refs == 0)
+        run_destroy(run, run->obsolete);
+}
+
+static void *fence(PLsm lsm, PRun run, size_t page) {
+    return run->fences + page * lsm->key_size;
+}
+
+//Sequential writer of a new run, entries must be added in order
+struct RunWriter {
+    PLsm lsm;
+    PRun run;
+    void *page;
+    size_t num_in_page;
+    size_t fences_capacity;
+};
+
+static struct RunWriter *run_writer_create(PLsm lsm, unsigned long long id, int level, size_t expected_entries) {
+    struct RunWriter *writer = malloc(sizeof(struct RunWriter));
+    PRun run = malloc(sizeof(struct Run));
+    writer->lsm = lsm;
+    writer->run = run;
+    writer->page = malloc(LSM_PAGE_SIZE);
+    writer->num_in_page = 0;
+    writer->fences_capacity = expected_entries / entries_per_page(lsm) + 1;
+    run->id = id;
+    run->level = level;
+    run->num_entries = 0;
+    run->num_pages = 0;
+    run->compacting = false;
+    run->refs = 1;
+    run->obsolete = false;
+    run->pathname = get_run_pathname(lsm, id, LSM_RUN_SUFFIX);
+    run->fences = malloc(writer->fences_capacity * lsm->key_size);
+    run->disk = dcreate(run->pathname, LSM_PAGE_SIZE);
+    char *bloom_pathname = get_run_bloom_pathname(run);
+    run->bloom = bloom_create(bloom_pathname, expected_entries);
+    free(bloom_pathname);
+    if (run->disk == NULL || run->bloom == NULL || writer->page == NULL || run->fences == NULL) {
+        run_destroy(run, true);
+        free(writer->page);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static int run_writer_write_page(struct RunWriter *writer) {
+    PLsm lsm = writer->lsm;
+    PRun run = writer->run;
+    if (run->num_pages == writer->fences_capacity) {
+        writer->fences_capacity *= 2;
+        void *fences = realloc(run->fences, writer->fences_capacity * lsm->key_size);
+        if (fences == NULL)
+            return ENOMEM;
+        run->fences = fences;
+    }
+    memcpy(fence(lsm, run, run->num_pages), writer->page, lsm->key_size);
+    disk_pointer dp = dalloc(run->disk);
+    if (copy_to_disk(writer->page, LSM_PAGE_SIZE, run->disk, dp) < 0)
+        return EIO;
+    run->num_pages++;
+    writer->num_in_page = 0;
+    return 0;
+}
+
+static int run_writer_add(struct RunWriter *writer, const void *entry) {
+    PLsm lsm = writer->lsm;
+    memcpy(writer->page + writer->num_in_page * lsm->entry_size, entry, lsm->entry_size);
+    writer->num_in_page++;
+    writer->run->num_entries++;
+    bloom_add(writer->run->bloom, entry, lsm->key_size);
+    if (writer->num_in_page == entries_per_page(lsm))
+        return run_writer_write_page(writer);
+    return 0;
+}
+
+//Writes the last page and the fence pointers, returns the finished run
+static PRun run_writer_finish(struct RunWriter *writer) {
+    PLsm lsm = writer->lsm;
+    PRun run = writer->run;
+    int ret = 0;
+    if (writer->num_in_page > 0)
+        ret = run_writer_write_page(writer);
+    //fence pointers follow the last page
+    size_t num_blocks = num_fence_blocks(lsm, run->num_pages);
+    size_t fences_size = run->num_pages * lsm->key_size;
+    for (size_t i = 0; ret == 0 && i < num_blocks; i++) {
+        size_t size = fences_size - i * LSM_PAGE_SIZE;
+        if (size > LSM_PAGE_SIZE)
+            size = LSM_PAGE_SIZE;
+        disk_pointer dp = dalloc(run->disk);
+        if (copy_to_disk(run->fences + i * LSM_PAGE_SIZE, size, run->disk, dp) < 0)
+            ret = EIO;
+    }
+    fflush(run->disk->file);
+    bloom_flush(run->bloom);
+    free(writer->page);
+    free(writer);
+    if (ret != 0) {
+        run_destroy(run, true);
+        return NULL;
+    }
+    return run;
+}
+
+static PRun run_open(PLsm lsm, struct ManifestRun *manifest_run) {
+    PRun run = malloc(sizeof(struct Run));
+    if (run == NULL)
+        return NULL;
+    run->id = manifest_run->id;
+    run->level = (int)manifest_run->level;
+    run->num_entries = manifest_run->num_entries;
+    run->num_pages = manifest_run->num_pages;
+    run->compacting = false;
+    run->refs = 1;
+    run->obsolete = false;
+    run->pathname = get_run_pathname(lsm, run->id, LSM_RUN_SUFFIX);
+    run->bloom = NULL;
+    run->fences = NULL;
+    run->disk = dopen(run->pathname);
+    if (run->disk == NULL) {
+        run_destroy(run, false);
+        return NULL;
+    }
+    size_t num_blocks = num_fence_blocks(lsm, run->num_pages);
+    void *buffer = malloc((num_blocks ? num_blocks : 1) * LSM_PAGE_SIZE);
+    disk_pointer dp = next_n_pointer(run->disk, data_start_pos(), run->num_pages);
+    if (copy_to_memory_s(run->disk, dp, num_blocks, buffer) < 0) {
+        free(buffer);
+        run_destroy(run, false);
+        return NULL;
+    }
+    run->fences = buffer;
+    char *bloom_pathname = get_run_bloom_pathname(run);
+    run->bloom = bloom_open(bloom_pathname);
+    free(bloom_pathname);
+    //a missing or stale filter is ignored, bloom_may_contain then answers true
+    return run;
+}
+
+//Forward reader over the entries of a run
+struct RunCursor {
+    PLsm lsm;
+    PRun run;
+    DISK *disk;
+    void *page;
+    size_t page_no;
+    size_t index; //index of the entry in page
+    size_t pos;   //index of the entry in run
+};
+
+//positional read, selects read a run while the lock is not held
+static void run_cursor_read_page(struct RunCursor *cursor) {
+    copy_to_memory_r(cursor->disk, next_n_pointer(cursor->disk, data_start_pos(), cursor->page_no), cursor->page);
+}
+
+static struct RunCursor *run_cursor_create(PLsm lsm, PRun run, DISK *disk, size_t page_no) {
+    struct RunCursor *cursor = malloc(sizeof(struct RunCursor));
+    cursor->lsm = lsm;
+    cursor->run = run;
+    cursor->disk = disk;
+    cursor->page = malloc(LSM_PAGE_SIZE);
+    cursor->page_no = page_no;
+    cursor->index = 0;
+    cursor->pos = page_no * entries_per_page(lsm);
+    if (cursor->pos < run->num_entries)
+        run_cursor_read_page(cursor);
+    return cursor;
+}
+
+static void run_cursor_destroy(struct RunCursor *cursor) {
+    free(cursor->page);
+    free(cursor);
+}
+
+//Returns the current entry, NULL at the end of the run
+static void *run_cursor_current(struct RunCursor *cursor) {
+    if (cursor->pos >= cursor->run->num_entries)
+        return NULL;
+    return cursor->page + cursor->index * cursor->lsm->entry_size;
+}
+
+static void run_cursor_next(struct RunCursor *cursor) {
+    cursor->pos++;
+    cursor->index++;
+    if (cursor->index == entries_per_page(cursor->lsm) && cursor->pos < cursor->run->num_entries) {
+        cursor->page_no++;
+        cursor->index = 0;
+        run_cursor_read_page(cursor);
+    }
+}
+
+//Returns the page where entries with keys not less than 'key' start
+static size_t run_seek_page(PLsm lsm, PRun run, const void *key) {
+    //the last page whose first key is less than 'key', duplicates of 'key' may start there
+    size_t left = 0, right = run->num_pages;
+    while (left < right) {
+        size_t mid = left + (right - left) / 2;
+        if (lsm->p_key_type->compare(fence(lsm, run, mid), key) < 0)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left > 0 ? left - 1 : 0;
+}
+
+/*
+    Manifest and log
+*/
+
+static int write_manifest(PLsm lsm) {
+    char *pathname = get_lsm_pathname(lsm, LSM_MANIFEST_SUFFIX);
+    char *tmp_pathname = get_lsm_pathname(lsm, LSM_MANIFEST_SUFFIX ".tmp");
+    FILE *file = fopen(tmp_pathname, "w");
+    if (file == NULL) {
+        perror("fopen()");
+        free(pathname);
+        free(tmp_pathname);
+        return EIO;
+    }
+    struct ManifestHeader header;
+    header.magic = LSM_MAGIC;
+    header.key_size = lsm->key_size;
+    header.next_run_id = lsm->next_run_id;
+    header.log_generation = lsm->log_generation;
+    header.num_runs = lsm->num_runs;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < lsm->num_runs; i++) {
+        struct ManifestRun manifest_run;
+        manifest_run.id = lsm->runs[i]->id;
+        manifest_run.level = lsm->runs[i]->level;
+        manifest_run.num_entries = lsm->runs[i]->num_entries;
+        manifest_run.num_pages = lsm->runs[i]->num_pages;
+        ok = fwrite(&manifest_run, sizeof(manifest_run), 1, file) == 1;
+    }
+    if (fclose(file) != 0)
+        ok = false;
+    //rename is atomic, a crash leaves either the old or the new manifest
+    int ret = ok && rename(tmp_pathname, pathname) == 0 ? 0 : EIO;
+    if (ret != 0)
+        remove(tmp_pathname);
+    free(pathname);
+    free(tmp_pathname);
+    return ret;
+}
+
+static int add_run(PLsm lsm, PRun run) {
+    if (lsm->num_runs == lsm->runs_capacity) {
+        size_t capacity = lsm->runs_capacity ? lsm->runs_capacity * 2 : 8;
+        PRun *runs = realloc(lsm->runs, capacity * sizeof(PRun));
+        if (runs == NULL)
+            return ENOMEM;
+        lsm->runs = runs;
+        lsm->runs_capacity = capacity;
+    }
+    lsm->runs[lsm->num_runs++] = run;
+    return 0;
+}
+
+//Starts an empty log of the current generation
+static int truncate_log(PLsm lsm) {
+    char *pathname = get_lsm_pathname(lsm, LSM_LOG_SUFFIX);
+    if (lsm->log)
+        fclose(lsm->log);
+    lsm->log = fopen(pathname, "w");
+    free(pathname);
+    if (lsm->log == NULL)
+        return EIO;
+    struct LogHeader header;
+    header.magic = LSM_LOG_MAGIC;
+    header.generation = lsm->log_generation;
+    if (fwrite(&header, sizeof(header), 1, lsm->log) != 1 || fflush(lsm->log) != 0)
+        return EIO;
+    return 0;
+}
+
+//Caller holds lsm->mutex
+static int flush_locked(PLsm lsm) {
+    size_t num_entries = rbtree_size(lsm->memtable);
+    if (num_entries == 0)
+        return 0;
+    struct RunWriter *writer = run_writer_create(lsm, lsm->next_run_id++, 0, num_entries);
+    if (writer == NULL)
+        return EIO;
+    rbtree_iterator_t *it = rbtree_iterator_create(lsm->memtable);
+    int ret = 0;
+    while (ret == 0) {
+        struct MemEntry *mem_entry = rbtree_iterator_current(it);
+        ret = run_writer_add(writer, mem_entry->entry);
+        if (!rbtree_iterator_next(it))
+            break;
+    }
+    rbtree_iterator_destroy(it);
+    PRun run = run_writer_finish(writer);
+    if (ret != 0 || run == NULL) {
+        if (run)
+            run_destroy(run, true);
+        return ret ? ret : EIO;
+    }
+    if ((ret = add_run(lsm, run)) != 0) {
+        run_destroy(run, true);
+        return ret;
+    }
+    //once the manifest names the run, the log entries are of an older generation and are not replayed
+    lsm->log_generation++;
+    if ((ret = write_manifest(lsm)) != 0) {
+        lsm->log_generation--;
+        lsm->num_runs--;
+        run_destroy(run, true);
+        return ret;
+    }
+    //the entries are in a run now, drop them from the log and the memtable
+    truncate_log(lsm);
+    rbtree_destroy(lsm->memtable);
+    lsm->memtable = memtable_create();
+    pthread_cond_signal(&lsm->cond);
+    return 0;
+}
+
+/*
+    Compaction
+*/
+
+//Picks the oldest LSM_RUNS_PER_LEVEL runs of the lowest full level. Returns the number of runs picked.
+static size_t pick_compaction(PLsm lsm, PRun *inputs, int *p_level) {
+    for (int level = 0; ; level++) {
+        size_t num = 0;
+        bool level_exists = false;
+        for (size_t i = 0; i < lsm->num_runs; i++) {
+            if (lsm->runs[i]->level < level)
+                continue;
+            level_exists = true;
+            if (lsm->runs[i]->level == level && !lsm->runs[i]->compacting && num < LSM_RUNS_PER_LEVEL)
+                inputs[num++] = lsm->runs[i];
+        }
+        if (!level_exists)
+            return 0;
+        if (num == LSM_RUNS_PER_LEVEL) {
+            for (size_t i = 0; i < num; i++)
+                inputs[i]->compacting = true;
+            *p_level = level;
+            return num;
+        }
+    }
+}
+
+//k-way merge of 'inputs' into a new run, runs without holding lsm->mutex
+static PRun merge_runs(PLsm lsm, PRun *inputs, size_t num_inputs, unsigned long long id, int level) {
+    struct RunCursor *cursors[LSM_RUNS_PER_LEVEL];
+    size_t expected_entries = 0;
+    for (size_t i = 0; i < num_inputs; i++) {
+        //own file handles, readers keep using run->disk
+        DISK *disk = dopen(inputs[i]->pathname);
+        if (disk == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                dclose(cursors[j]->disk);
+                run_cursor_destroy(cursors[j]);
+            }
+            return NULL;
+        }
+        cursors[i] = run_cursor_create(lsm, inputs[i], disk, 0);
+        expected_entries += inputs[i]->num_entries;
+    }
+    struct RunWriter *writer = run_writer_create(lsm, id, level, expected_entries);
+    int ret = writer == NULL ? EIO : 0;
+    while (ret == 0) {
+        void *min_entry = NULL;
+        size_t min_index = 0;
+        for (size_t i = 0; i < num_inputs; i++) {
+            void *entry = run_cursor_current(cursors[i]);
+            if (entry && (min_entry == NULL || compare_entry(lsm, entry, min_entry) < 0)) {
+                min_entry = entry;
+                min_index = i;
+            }
+        }
+        if (min_entry == NULL)
+            break;
+        ret = run_writer_add(writer, min_entry);
+        run_cursor_next(cursors[min_index]);
+    }
+    for (size_t i = 0; i < num_inputs; i++) {
+        dclose(cursors[i]->disk);
+        run_cursor_destroy(cursors[i]);
+    }
+    if (writer == NULL)
+        return NULL;
+    PRun run = run_writer_finish(writer);
+    if (ret != 0 && run != NULL) {
+        run_destroy(run, true);
+        return NULL;
+    }
+    return run;
+}
+
+//Replaces 'inputs' by 'output', caller holds lsm->mutex.
+//On failure the runs and the manifest are left as they were and 'output' is removed.
+static int install_compaction(PLsm lsm, PRun *inputs, size_t num_inputs, PRun output) {
+    PRun *runs = malloc(lsm->runs_capacity * sizeof(PRun));
+    if (runs == NULL) {
+        run_destroy(output, true);
+        return ENOMEM;
+    }
+    size_t num = 0;
+    for (size_t i = 0; i < lsm->num_runs; i++) {
+        bool is_input = false;
+        for (size_t j = 0; j < num_inputs; j++)
+            if (lsm->runs[i] == inputs[j])
+                is_input = true;
+        if (!is_input)
+            runs[num++] = lsm->runs[i];
+    }
+    runs[num++] = output;
+    PRun *old_runs = lsm->runs;
+    size_t old_num_runs = lsm->num_runs;
+    lsm->runs = runs;
+    lsm->num_runs = num;
+    int ret = write_manifest(lsm);
+    if (ret != 0) {
+        lsm->runs = old_runs;
+        lsm->num_runs = old_num_runs;
+        free(runs);
+        run_destroy(output, true);
+        return ret;
+    }
+    free(old_runs);
+    //selects still reading an input keep it until they are done
+    for (size_t i = 0; i < num_inputs; i++) {
+        inputs[i]->obsolete = true;
+        run_unref(inputs[i]);
+    }
+    return 0;
+}
+
+static void *compactor_main(void *arg) {
+    PLsm lsm = (PLsm)arg;
+    PRun inputs[LSM_RUNS_PER_LEVEL];
+    int level;
+    size_t num_inputs;
+    pthread_mutex_lock(&lsm->mutex);
+    while (1) {
+        while (!lsm->stop && (num_inputs = pick_compaction(lsm, inputs, &level)) == 0)
+            pthread_cond_wait(&lsm->cond, &lsm->mutex);
+        if (lsm->stop)
+            break;
+        unsigned long long id = lsm->next_run_id++;
+        pthread_mutex_unlock(&lsm->mutex);
+        PRun output = merge_runs(lsm, inputs, num_inputs, id, level + 1);
+        pthread_mutex_lock(&lsm->mutex);
+        if (output == NULL || install_compaction(lsm, inputs, num_inputs, output) != 0) {
+            fprintf(stderr, "Error in compaction, level %d is not compacted\n", level);
+            for (size_t i = 0; i < num_inputs; i++)
+                inputs[i]->compacting = false;
+            break;
+        }
+    }
+    //inputs picked but not merged before stop stay as they are
+    for (size_t i = 0; i < lsm->num_runs; i++)
+        lsm->runs[i]->compacting = false;
+    pthread_mutex_unlock(&lsm->mutex);
+    return NULL;
+}
+
+/*
+    Lsm
+*/
+
+static PLsm lsm_init(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    PLsm lsm = malloc(sizeof(struct Lsm));
+    if (lsm == NULL)
+        return NULL;
+    lsm->p_key_type = p_key_type;
+    lsm->key_size = p_key_type->get_type_size();
+    lsm->entry_size = lsm->key_size + sizeof(record_t);
+    lsm->prefix = get_prefix(path, table_name, idx_col_name);
+    lsm->log = NULL;
+    lsm->log_generation = 0;
+    lsm->memtable = memtable_create();
+    lsm->runs = NULL;
+    lsm->num_runs = lsm->runs_capacity = 0;
+    lsm->next_run_id = 1;
+    lsm->stop = false;
+    pthread_mutex_init(&lsm->mutex, NULL);
+    pthread_cond_init(&lsm->cond, NULL);
+    return lsm;
+}
+
+static void lsm_free(PLsm lsm) {
+    for (size_t i = 0; i < lsm->num_runs; i++)
+        run_destroy(lsm->runs[i], false);
+    free(lsm->runs);
+    if (lsm->log)
+        fclose(lsm->log);
+    rbtree_destroy(lsm->memtable);
+    pthread_mutex_destroy(&lsm->mutex);
+    pthread_cond_destroy(&lsm->cond);
+    free(lsm->prefix);
+    free(lsm);
+}
+
+static int lsm_start(PLsm lsm) {
+    if (pthread_create(&lsm->compactor, NULL, compactor_main, lsm) != 0) {
+        perror("pthread_create()");
+        return EAGAIN;
+    }
+    return 0;
+}
+
+PLsm lsm_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    PLsm lsm = lsm_init(path, table_name, idx_col_name, p_key_type);
+    if (lsm == NULL)
+        return NULL;
+    if (write_manifest(lsm) != 0 || truncate_log(lsm) != 0 || lsm_start(lsm) != 0) {
+        lsm_free(lsm);
+        return NULL;
+    }
+    return lsm;
+}
+
+PLsm lsm_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type) {
+    PLsm lsm = lsm_init(path, table_name, idx_col_name, p_key_type);
+    if (lsm == NULL)
+        return NULL;
+    char *pathname = get_lsm_pathname(lsm, LSM_MANIFEST_SUFFIX);
+    FILE *file = fopen(pathname, "r");
+    free(pathname);
+    if (file == NULL) {
+        perror("fopen()");
+        lsm_free(lsm);
+        return NULL;
+    }
+    struct ManifestHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != LSM_MAGIC || header.key_size != lsm->key_size) {
+        fprintf(stderr, "Invalid lsm manifest for \'%s\'\n", lsm->prefix);
+        fclose(file);
+        lsm_free(lsm);
+        return NULL;
+    }
+    lsm->next_run_id = header.next_run_id;
+    lsm->log_generation = header.log_generation;
+    for (unsigned long long i = 0; i < header.num_runs; i++) {
+        struct ManifestRun manifest_run;
+        PRun run = NULL;
+        if (fread(&manifest_run, sizeof(manifest_run), 1, file) == 1)
+            run = run_open(lsm, &manifest_run);
+        if (run == NULL) {
+            fprintf(stderr, "Error in run_open() for \'%s\'\n", lsm->prefix);
+            fclose(file);
+            lsm_free(lsm);
+            return NULL;
+        }
+        add_run(lsm, run);
+    }
+    fclose(file);
+
+    //replay the entries that were not flushed to a run
+    pathname = get_lsm_pathname(lsm, LSM_LOG_SUFFIX);
+    lsm->log = fopen(pathname, "a+");
+    free(pathname);
+    if (lsm->log == NULL) {
+        perror("fopen()");
+        lsm_free(lsm);
+        return NULL;
+    }
+    fseek(lsm->log, 0, SEEK_SET);
+    struct LogHeader log_header;
+    bool replay = fread(&log_header, sizeof(log_header), 1, lsm->log) == 1 && log_header.magic == LSM_LOG_MAGIC
+        && log_header.generation == lsm->log_generation;
+    void *entry = malloc(lsm->entry_size);
+    while (replay && fread(entry, lsm->entry_size, 1, lsm->log) == 1)
+        memtable_put(lsm, entry);
+    free(entry);
+    //a log of an older generation was flushed to a run before a crash
+    int ret = replay ? 0 : truncate_log(lsm);
+    if (ret != 0 || lsm_start(lsm) != 0) {
+        lsm_free(lsm);
+        return NULL;
+    }
+    return lsm;
+}
+
+PLsm lsm_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, index_entry_source next, void *arg, size_t num_entries) {
+    PLsm lsm = lsm_init(path, table_name, idx_col_name, p_key_type);
+    if (lsm == NULL)
+        return NULL;
+    int level = 0;
+    for (size_t size = LSM_MEMTABLE_ENTRIES; size < num_entries; size *= LSM_RUNS_PER_LEVEL)
+        level++;
+    struct RunWriter *writer = run_writer_create(lsm, lsm->next_run_id++, level, num_entries);
+    if (writer == NULL) {
+        lsm_free(lsm);
+        return NULL;
+    }
+    void *entry = malloc(lsm->entry_size);
+    const void *key;
+    record_t record;
+    int ret = entry == NULL ? ENOMEM : 0;
+    while (ret == 0 && next(arg, &key, &record)) {
+        memcpy(entry, key, lsm->key_size);
+        memcpy(entry + lsm->key_size, &record, sizeof(record_t));
+        ret = run_writer_add(writer, entry);
+    }
+    free(entry);
+    PRun run = run_writer_finish(writer);
+    if (ret != 0 || run == NULL) {
+        if (run)
+            run_destroy(run, true);
+        lsm_free(lsm);
+        return NULL;
+    }
+    if (run->num_entries == 0)
+        run_destroy(run, true);
+    else if (add_run(lsm, run) != 0) {
+        run_destroy(run, true);
+        lsm_free(lsm);
+        return NULL;
+    }
+    if (write_manifest(lsm) != 0 || truncate_log(lsm) != 0 || lsm_start(lsm) != 0) {
+        lsm_free(lsm);
+        return NULL;
+    }
+    return lsm;
+}
+
+//Moves the file 'prefix' + 'suffix' to 'new_prefix' + 'suffix', see dmove
+static int move_file(const char *prefix, const char *new_prefix, const char *suffix) {
+    char *pathname = malloc(strlen(prefix) + strlen(suffix) + 1);
+    sprintf(pathname, "%s%s", prefix, suffix);
+    char *new_pathname = NULL;
+    if (new_prefix) {
+        new_pathname = malloc(strlen(new_prefix) + strlen(suffix) + 1);
+        sprintf(new_pathname, "%s%s", new_prefix, suffix);
+    }
+    int ret = dmove(pathname, new_pathname);
+    free(pathname);
+    free(new_pathname);
+    return ret;
+}
+
+int lsm_move(const char *path, const char *table_name, const char *idx_col_name, const char *new_table_name) {
+    char *prefix = get_prefix(path, table_name, idx_col_name);
+    char *new_prefix = new_table_name ? get_prefix(path, new_table_name, idx_col_name) : NULL;
+    char *pathname = malloc(strlen(prefix) + strlen(LSM_MANIFEST_SUFFIX) + 1);
+    sprintf(pathname, "%s%s", prefix, LSM_MANIFEST_SUFFIX);
+    FILE *file = fopen(pathname, "r"); //missing once the index is moved
+    free(pathname);
+    int ret = 0;
+    if (file != NULL) {
+        struct ManifestHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != LSM_MAGIC)
+            ret = EIO;
+        for (unsigned long long i = 0; ret == 0 && i < header.num_runs; i++) {
+            struct ManifestRun manifest_run;
+            char suffix[64];
+            if (fread(&manifest_run, sizeof(manifest_run), 1, file) != 1) {
+                ret = EIO;
+                break;
+            }
+            sprintf(suffix, "_%llu%s%s", manifest_run.id, LSM_RUN_SUFFIX, BLOOM_SUFFIX);
+            ret = move_file(prefix, new_prefix, suffix);
+            sprintf(suffix, "_%llu%s", manifest_run.id, LSM_RUN_SUFFIX);
+            if (ret == 0)
+                ret = move_file(prefix, new_prefix, suffix);
+        }
+        fclose(file);
+    }
+    else if (errno != ENOENT)
+        ret = EIO;
+    //the manifest goes last, a move done again finds the runs in it
+    if (ret == 0)
+        ret = move_file(prefix, new_prefix, LSM_LOG_SUFFIX);
+    if (ret == 0)
+        ret = move_file(prefix, new_prefix, LSM_MANIFEST_SUFFIX);
+    free(prefix);
+    free(new_prefix);
+    return ret;
+}
+
+void lsm_close(PLsm lsm) {
+    if (lsm == NULL)
+        return;
+    pthread_mutex_lock(&lsm->mutex);
+    lsm->stop = true;
+    pthread_cond_broadcast(&lsm->cond);
+    pthread_mutex_unlock(&lsm->mutex);
+    pthread_join(lsm->compactor, NULL);
+    pthread_mutex_lock(&lsm->mutex);
+    flush_locked(lsm);
+    pthread_mutex_unlock(&lsm->mutex);
+    lsm_free(lsm);
+}
+
+int lsm_insert(PLsm lsm, void *key, record_t record) {
+    if (lsm == NULL || key == NULL)
+        return EINVAL;
+    struct MemEntry *mem_entry = mem_entry_create(lsm, key, record);
+    if (mem_entry == NULL)
+        return ENOMEM;
+    int ret = 0;
+    pthread_mutex_lock(&lsm->mutex);
+    //sequential write to the log, the memtable absorbs the ordering.
+    //the log is flushed on every insert, a crash of the process loses no acknowledged entry
+    if (fwrite(mem_entry->entry, lsm->entry_size, 1, lsm->log) != 1 || fflush(lsm->log) != 0) {
+        free(mem_entry);
+        ret = EIO;
+    }
+    else if (rbtree_search(lsm->memtable, mem_entry) != NULL)
+        free(mem_entry);
+    else
+        ret = rbtree_insert(lsm->memtable, mem_entry);
+    if (ret == 0 && rbtree_size(lsm->memtable) >= LSM_MEMTABLE_ENTRIES)
+        ret = flush_locked(lsm);
+    pthread_mutex_unlock(&lsm->mutex);
+    return ret;
+}
+
+int lsm_flush(PLsm lsm) {
+    if (lsm == NULL)
+        return EINVAL;
+    pthread_mutex_lock(&lsm->mutex);
+    int ret = flush_locked(lsm);
+    pthread_mutex_unlock(&lsm->mutex);
+    return ret;
+}
+
+static vector_t *entry_vector_create(PLsm lsm) {
+    vector_t *vector = vector_create(0);
+    vector_set_type_size(vector, lsm->entry_size);
+    return vector;
+}
+
+vector_t *lsm_select(PLsm lsm, const void *key_start, const void *key_end) {
+    if (lsm == NULL || key_start == NULL || key_end == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int (*compare)(const void *, const void *) = lsm->p_key_type->compare;
+    bool point_lookup = compare(key_start, key_end) == 0;
+    pthread_mutex_lock(&lsm->mutex);
+    //one sorted vector of entries per source, memtable first
+    size_t num_sources = lsm->num_runs + 1;
+    vector_t **sources = malloc(num_sources * sizeof(vector_t *));
+    sources[0] = entry_vector_create(lsm);
+    struct MemEntry *start = mem_entry_create(lsm, key_start, (record_t)UINT64_MAX); //sorts first among equal keys
+    rbtree_iterator_t *it = rbtree_iterator_create_from(lsm->memtable, start);
+    free(start);
+    struct MemEntry *mem_entry;
+    while ((mem_entry = rbtree_iterator_current(it)) != NULL && compare(mem_entry->entry, key_end) <= 0) {
+        vector_push(sources[0], mem_entry->entry);
+        if (!rbtree_iterator_next(it))
+            break;
+    }
+    rbtree_iterator_destroy(it);
+    //the runs are immutable, a reference keeps them after a compaction replaces them
+    PRun *runs = malloc(num_sources * sizeof(PRun));
+    for (size_t i = 0; i < lsm->num_runs; i++) {
+        runs[i] = lsm->runs[i];
+        runs[i]->refs++;
+    }
+    pthread_mutex_unlock(&lsm->mutex);
+
+    for (size_t i = 0; i < num_sources - 1; i++) {
+        PRun run = runs[i];
+        sources[i + 1] = entry_vector_create(lsm);
+        if (run->num_entries == 0 || (point_lookup && !bloom_may_contain(run->bloom, key_start, lsm->key_size)))
+            continue;
+        //fence pointers locate the first page, then read pages sequentially
+        struct RunCursor *cursor = run_cursor_create(lsm, run, run->disk, run_seek_page(lsm, run, key_start));
+        void *entry;
+        while ((entry = run_cursor_current(cursor)) != NULL && compare(entry, key_end) <= 0) {
+            if (compare(entry, key_start) >= 0)
+                vector_push(sources[i + 1], entry);
+            run_cursor_next(cursor);
+        }
+        run_cursor_destroy(cursor);
+    }
+    pthread_mutex_lock(&lsm->mutex);
+    for (size_t i = 0; i < num_sources - 1; i++)
+        run_unref(runs[i]);
+    pthread_mutex_unlock(&lsm->mutex);
+    free(runs);
+
+    //merge the sources into key order
+    vector_t *results = vector_create(0);
+    vector_set_type_size(results, sizeof(record_t));
+    size_t *positions = calloc(num_sources, sizeof(size_t));
+    while (1) {
+        void *min_entry = NULL;
+        size_t min_index = 0;
+        for (size_t i = 0; i < num_sources; i++) {
+            void *entry = vector_get(sources[i], positions[i]);
+            if (entry && (min_entry == NULL || compare_entry(lsm, entry, min_entry) < 0)) {
+                min_entry = entry;
+                min_index = i;
+            }
+        }
+        if (min_entry == NULL)
+            break;
+        record_t record = entry_record(lsm, min_entry);
+        vector_push(results, &record);
+        positions[min_index]++;
+    }
+    for (size_t i = 0; i < num_sources; i++)
+        vector_destroy(sources[i]);
+    free(sources);
+    free(positions);
+    return results;
+}
+
+bool lsm_may_contain(PLsm lsm, const void *key) {
+    if (lsm == NULL)
+        return true;
+    bool res = false;
+    pthread_mutex_lock(&lsm->mutex);
+    struct MemEntry *start = mem_entry_create(lsm, key, (record_t)UINT64_MAX);
+    rbtree_iterator_t *it = rbtree_iterator_create_from(lsm->memtable, start);
+    free(start);
+    struct MemEntry *mem_entry = rbtree_iterator_current(it);
+    if (mem_entry && lsm->p_key_type->compare(mem_entry->entry, key) == 0)
+        res = true;
+    rbtree_iterator_destroy(it);
+    for (size_t i = 0; !res && i < lsm->num_runs; i++)
+        if (lsm->runs[i]->num_entries > 0 && bloom_may_contain(lsm->runs[i]->bloom, key, lsm->key_size))
+            res = true;
+    pthread_mutex_unlock(&lsm->mutex);
+    return res;
+}
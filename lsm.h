@@ -0,0 +1,75 @@
+#ifndef LSM_H__
+#define LSM_H__
+
+#include <pthread.h>
+#include "disk.h"
+#include "datatype.h"
+#include "vector.h"
+#include "rbtree.h"
+#include "bloom.h"
+#include "index.h"
+
+#define LSM_MANIFEST_SUFFIX ".lsm"
+#define LSM_LOG_SUFFIX      ".log"
+#define LSM_RUN_SUFFIX      ".run"
+
+/* An immutable sorted run of (key, record) entries, stored in pages of one
+   DISK block each, followed by the fence pointers (first key of every page). */
+typedef struct Run {
+    unsigned long long id;
+    int level;
+    size_t num_entries;
+    size_t num_pages;
+    DISK *disk;
+    char *pathname;
+    void *fences; //num_pages keys
+    PBloom bloom;
+    bool compacting;
+    int refs;      //lsm->runs and the selects reading the run, protected by the lsm mutex
+    bool obsolete; //replaced by a compaction, the files go with the last reference
+} *PRun;
+
+/* Log-structured merge tree index.
+   Inserts go to the write-ahead log and the in-memory memtable (a red-black
+   tree). A full memtable is flushed to a new run of level 0 with one sequential
+   write, and the log starts a new generation. The manifest records the current
+   generation, so a log left behind by a crash after a flush is not replayed. A background thread merges LSM_RUNS_PER_LEVEL runs of one level into a
+   single run of the next level (tiered compaction). */
+typedef struct Lsm {
+    DataType *p_key_type;
+    size_t key_size;
+    size_t entry_size;
+    char *prefix; //pathname of the index without suffix
+    FILE *log;
+    unsigned long long log_generation; //of the entries in the log, the runs hold all older generations
+    rbtree_t *memtable;
+    PRun *runs; //oldest first
+    size_t num_runs;
+    size_t runs_capacity;
+    unsigned long long next_run_id;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t compactor;
+    bool stop;
+} *PLsm;
+
+PLsm lsm_create(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
+PLsm lsm_open(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type);
+/* Flushes the memtable and waits for the compaction thread before closing. */
+void lsm_close(PLsm lsm);
+/* Creates the index with the entries returned by 'next' written straight into
+   one run, on the level a run of 'num_entries' entries would reach by compaction. */
+PLsm lsm_bulk_load(const char *path, const char *table_name, const char *idx_col_name, DataType *p_key_type, index_entry_source next, void *arg, size_t num_entries);
+/* Renames the files of the closed index to those of 'new_table_name', or
+   removes them if it is NULL. The manifest goes last, so an interrupted move
+   can be done again. Returns 0 if success. */
+int lsm_move(const char *path, const char *table_name, const char *idx_col_name, const char *new_table_name);
+
+int lsm_insert(PLsm lsm, void *key, record_t record);
+vector_t *lsm_select(PLsm lsm, const void *key_start, const void *key_end);
+bool lsm_may_contain(PLsm lsm, const void *key);
+
+/* Writes the memtable to a new run. Returns 0 if success. */
+int lsm_flush(PLsm lsm);
+
+#endif
@@ -1,6 +1,137 @@
 #include "disk.h"
+#include "table.h"
+#include "csv.h"
+#include "sql.h"
 #include <string.h>
+#include <unistd.h>
+#include <ctype.h>
 
-int main() {
-	exit(0);
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s import <path> <table> <file.csv>\n", name);
+	fprintf(stderr, "       %s export <path> <table> [<file.csv>]\n", name);
+	fprintf(stderr, "       %s sql [-t] <path> [<script.sql>]\n", name);
+	fprintf(stderr, "<path> is prefixed to the table files, e.g. \"./\"\n");
+	fprintf(stderr, "Without a script, sql reads statements from the standard input; -t prints their time\n");
+}
+
+//Loads or dumps a table in CSV format with a header line
+static int csv_command(int argc, char *argv[]) {
+	bool import = strcmp(argv[1], "import") == 0;
+	if (import ? argc != 5 : argc != 4 && argc != 5) {
+		usage(argv[0]);
+		return 1;
+	}
+	Table *table = table_open(argv[2], argv[3]);
+	if (table == NULL) {
+		fprintf(stderr, "Can't open table \'%s\'\n", argv[3]);
+		return 1;
+	}
+	FILE *file = argc == 5 ? fopen(argv[4], import ? "r" : "w") : stdout;
+	if (file == NULL) {
+		perror(argv[4]);
+		table_close(table);
+		return 1;
+	}
+	int ret = import ? table_import_csv(table, file, true) : table_export_csv(table, file, true);
+	if (file != stdout)
+		fclose(file);
+	table_close(table);
+	if (ret != 0) {
+		fprintf(stderr, "%s failed: %s\n", argv[1], strerror(ret));
+		return 1;
+	}
+	return 0;
+}
+
+//Reads all of 'file', NULL on error
+static char *read_file(FILE *file) {
+	size_t len = 0, capacity = 1 << 16;
+	char *text = (char *)malloc(capacity);
+	size_t n;
+	while ((n = fread(text + len, 1, capacity - len - 1, file)) > 0) {
+		len += n;
+		if (capacity - len == 1)
+			text = (char *)realloc(text, capacity *= 2);
+	}
+	if (ferror(file)) {
+		free(text);
+		return NULL;
+	}
+	text[len] = '\0';
+	return text;
+}
+
+//Executes the statements of the standard input, each once its ';' is read
+static int repl(PSqlSession session) {
+	bool prompt = isatty(STDIN_FILENO);
+	char *line = NULL, *text = NULL;
+	size_t line_capacity = 0, len = 0;
+	ssize_t n;
+	int ret = 0;
+	if (prompt) printf("db> ");
+	fflush(stdout);
+	while ((n = getline(&line, &line_capacity, stdin)) > 0) {
+		text = (char *)realloc(text, len + n + 1);
+		memcpy(text + len, line, n + 1);
+		len += n;
+		size_t end = len;
+		while (end > 0 && isspace((unsigned char)text[end - 1]))
+			end--;
+		if (end == 0)
+			len = 0; //blank lines
+		else if (text[end - 1] == ';') {
+			int err = sql_exec(session, text);
+			ret = ret ? ret : err;
+			len = 0;
+		}
+		if (prompt) printf(len > 0 ? "  -> " : "db> ");
+		fflush(stdout);
+	}
+	if (len > 0) {
+		int err = sql_exec(session, text);
+		ret = ret ? ret : err;
+	}
+	free(line);
+	free(text);
+	return ret;
+}
+
+static int sql_command(int argc, char *argv[]) {
+	int arg = 2;
+	bool timing = argc > arg && strcmp(argv[arg], "-t") == 0;
+	if (timing)
+		arg++;
+	if (argc != arg + 1 && argc != arg + 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	int ret;
+	PSqlSession session = sql_open(argv[arg]);
+	sql_set_timing(session, timing);
+	if (argc == arg + 2) {
+		FILE *file = fopen(argv[arg + 1], "r");
+		char *text = file ? read_file(file) : NULL;
+		if (file)
+			fclose(file);
+		if (text == NULL) {
+			perror(argv[arg + 1]);
+			sql_close(session);
+			return 1;
+		}
+		ret = sql_exec(session, text);
+		free(text);
+	}
+	else
+		ret = repl(session);
+	sql_close(session);
+	return ret != 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc >= 2 && (strcmp(argv[1], "import") == 0 || strcmp(argv[1], "export") == 0))
+		exit(csv_command(argc, argv));
+	if (argc >= 2 && strcmp(argv[1], "sql") == 0)
+		exit(sql_command(argc, argv));
+	usage(argv[0]);
+	exit(1);
 }
@@ -237,6 +237,8 @@ int map_sort(map_t *ptr, void **key_arr, void **value_arr) {
     if (ptr == NULL)
         return EINVAL;
     PMap map = (PMap)ptr;
+    if (rbtree_size(map->rbtree) == 0)
+        return 0;
 
     rbtree_iterator_t *it = rbtree_iterator_create(map->rbtree);
     size_t index = 0;
@@ -565,6 +565,7 @@ rbtree_iterator_t *rbtree_iterator_create(rbtree_t *ptr) {
     if (node == NULL) {
         iterator->current = NULL;
         iterator->next = NULL;
+        iterator->stack = NULL;
         goto END;
     }
     while (node->left) {
@@ -577,6 +578,40 @@ END:
     return iterator;
 }
 
+rbtree_iterator_t *rbtree_iterator_create_from(rbtree_t *ptr, void *key) {
+    if (ptr == NULL)
+        return NULL;
+    PRBTree rbtree = (PRBTree)ptr;
+    PIterator iterator = malloc(sizeof(struct Iterator));
+    if (iterator == NULL)
+        return NULL;
+    iterator->stack = stack_create(0, STACK_REFERENCE_COPY);
+    //The stack holds the ancestors whose right subtree contains the current
+    //node, nearest on top, which is what rbtree_iterator_has_next expects
+    PTNode node = rbtree->root, candidate = NULL;
+    size_t candidate_depth = 0;
+    int compare_res;
+    while (node) {
+        compare_res = rbtree->compare(key, node->key);
+        if (compare_res > 0) {
+            stack_push(iterator->stack, node);
+            node = node->right;
+        }
+        else {
+            candidate = node;
+            candidate_depth = stack_size(iterator->stack);
+            if (compare_res == 0)
+                break;
+            node = node->left;
+        }
+    }
+    while (stack_size(iterator->stack) > candidate_depth)
+        stack_pop(iterator->stack);
+    iterator->current = candidate;
+    iterator->next = candidate;
+    return iterator;
+}
+
 void rbtree_iterator_destroy(rbtree_iterator_t *ptr) {
     if (ptr == NULL)
         return;
@@ -586,7 +621,7 @@ void rbtree_iterator_destroy(rbtree_iterator_t *ptr) {
 }
 
 void *rbtree_iterator_current(rbtree_iterator_t *ptr) {
-    if (ptr == NULL)
+    if (ptr == NULL || ((PIterator)ptr)->current == NULL)
         return NULL;
     return ((PIterator)ptr)->current->key;
 }
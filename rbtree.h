@@ -22,6 +22,9 @@ size_t rbtree_size(rbtree_t *);
 typedef void rbtree_iterator_t;
 
 rbtree_iterator_t *rbtree_iterator_create(rbtree_t *);
+/* Creates an iterator positioned at the smallest key not less than 'key'. 
+   rbtree_iterator_current returns NULL if there is no such key. */
+rbtree_iterator_t *rbtree_iterator_create_from(rbtree_t *, void *key);
 void rbtree_iterator_destroy(rbtree_iterator_t *);
 void *rbtree_iterator_current(rbtree_iterator_t *);
 bool rbtree_iterator_has_next(rbtree_iterator_t *);
@@ -0,0 +1,778 @@
+#include "sql.h"
+#include "frame.h"
+#include "filter.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#define SQL_CACHE_CAPACITY 256 //prepared statements kept by a session, the cache is emptied when full
+#define SQL_VALUE_ALIGN    8   //alignment of the values of a prepared statement
+
+struct SqlSession {
+    char *path;
+    map_t *tables; //name -> Table *, both freed by sql_close
+    map_t *cache;  //normalized text -> struct SqlPlan *
+    size_t hits;
+    size_t misses;
+    bool timing;
+};
+
+static int compare_str(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+static char *str_copy(const char *str) {
+    char *copy = (char *)malloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+/*
+
+  Tokens
+
+*/
+typedef enum {
+    TOKEN_WORD,   //keyword or name
+    TOKEN_VALUE,  //integer, or text between quotes
+    TOKEN_SYMBOL,
+} TokenKind;
+
+struct Token {
+    TokenKind kind;
+    const char *str; //terminated, without the quotes of a value
+    int param;       //parameter of a value, -1 for the value of LIMIT
+};
+
+//One statement, split into tokens
+struct SqlText {
+    struct Token *tokens;
+    size_t num_tokens;
+    size_t num_params;
+    char *strs; //strings of the tokens
+    char *key;  //normalized text, see sql.h
+};
+
+static const char *keywords[] = {
+    "AND", "ASC", "BETWEEN", "BY", "CREATE", "DESC", "FROM", "INDEX", "INSERT", "INTO", "IS",
+    "LAYOUT", "LIMIT", "NOT", "NULL", "ON", "OR", "ORDER", "SELECT", "TABLE", "USING", "VALUES",
+    "WHERE",
+};
+
+static bool is_keyword(const char *word) {
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++)
+        if (strcasecmp(word, keywords[i]) == 0)
+            return true;
+    return false;
+}
+
+//Returns the ';' ending the statement at 'text', or its terminating '\0'
+static const char *statement_end(const char *text) {
+    while (*text != '\0' && *text != ';') {
+        if (*text == '\'') {
+            for (text++; *text != '\0' && *text != '\''; text++)
+                ;
+            if (*text != '\0')
+                text++;
+        }
+        else if (text[0] == '-' && text[1] == '-') {
+            while (*text != '\0' && *text != '\n')
+                text++;
+        }
+        else
+            text++;
+    }
+    return text;
+}
+
+static void sql_text_destroy(struct SqlText *text) {
+    free(text->tokens);
+    free(text->strs);
+    free(text->key);
+}
+
+/* Splits [begin, end) into tokens and builds its normalized text. Returns 0,
+   or EINVAL for an unexpected character or an unterminated quote. */
+static int tokenize(const char *begin, const char *end, struct SqlText *text) {
+    size_t len = end - begin;
+    //a token has one character at least, its string one more
+    text->tokens = (struct Token *)malloc((len ? len : 1) * sizeof(struct Token));
+    text->strs = (char *)malloc(2 * len + 1);
+    text->key = NULL;
+    text->num_tokens = text->num_params = 0;
+    char *out = text->strs;
+    const char *s = begin;
+    while (s < end) {
+        if (isspace((unsigned char)*s)) {
+            s++;
+            continue;
+        }
+        if (s + 1 < end && s[0] == '-' && s[1] == '-') {
+            while (s < end && *s != '\n')
+                s++;
+            continue;
+        }
+        struct Token *token = &text->tokens[text->num_tokens];
+        token->str = out;
+        token->param = -1;
+        if (isalpha((unsigned char)*s) || *s == '_') {
+            token->kind = TOKEN_WORD;
+            while (s < end && (isalnum((unsigned char)*s) || *s == '_'))
+                *out++ = *s++;
+        }
+        else if (isdigit((unsigned char)*s) || ((*s == '-' || *s == '+') && s + 1 < end && isdigit((unsigned char)s[1]))) {
+            token->kind = TOKEN_VALUE;
+            *out++ = *s++;
+            while (s < end && isdigit((unsigned char)*s))
+                *out++ = *s++;
+        }
+        else if (*s == '\'') {
+            token->kind = TOKEN_VALUE;
+            //a quote inside the text is doubled
+            for (s++; s < end && (*s != '\'' || (s + 1 < end && s[1] == '\'')); s++) {
+                if (*s == '\'')
+                    s++;
+                *out++ = *s;
+            }
+            if (s == end) {
+                fprintf(stderr, "Unterminated quote\n");
+                return EINVAL;
+            }
+            s++;
+        }
+        else if (strchr("(),*=<>", *s) != NULL) {
+            token->kind = TOKEN_SYMBOL;
+            *out++ = *s++;
+            if ((out[-1] == '<' || out[-1] == '>') && s < end && *s == '=')
+                *out++ = *s++;
+        }
+        else {
+            fprintf(stderr, "Unexpected character \'%c\'\n", *s);
+            return EINVAL;
+        }
+        *out++ = '\0';
+        text->num_tokens++;
+    }
+
+    //values become parameters, but the LIMIT which may change the plan
+    char *key = text->key = (char *)malloc(2 * len + 1);
+    for (size_t i = 0; i < text->num_tokens; i++) {
+        struct Token *token = &text->tokens[i];
+        if (i > 0)
+            *key++ = ' ';
+        bool limit = i > 0 && text->tokens[i - 1].kind == TOKEN_WORD && strcasecmp(text->tokens[i - 1].str, "LIMIT") == 0;
+        if (token->kind == TOKEN_VALUE && !limit) {
+            token->param = (int)text->num_params++;
+            *key++ = '?';
+            continue;
+        }
+        bool keyword = token->kind == TOKEN_WORD && is_keyword(token->str);
+        for (const char *c = token->str; *c != '\0'; c++)
+            *key++ = keyword ? toupper((unsigned char)*c) : *c;
+    }
+    *key = '\0';
+    return 0;
+}
+
+/*
+
+  Parser
+
+*/
+struct Parser {
+    PSqlSession session;
+    struct SqlText *text;
+    size_t pos; //next token
+};
+
+static int syntax_error(struct Parser *parser) {
+    if (parser->pos < parser->text->num_tokens)
+        fprintf(stderr, "Syntax error near \'%s\'\n", parser->text->tokens[parser->pos].str);
+    else
+        fprintf(stderr, "Syntax error at the end of the statement\n");
+    return EINVAL;
+}
+
+//Skips the next token if it is the keyword or symbol 'str'
+static bool accept(struct Parser *parser, const char *str) {
+    if (parser->pos == parser->text->num_tokens)
+        return false;
+    struct Token *token = &parser->text->tokens[parser->pos];
+    bool match = token->kind == TOKEN_WORD ? strcasecmp(token->str, str) == 0
+                                           : token->kind == TOKEN_SYMBOL && strcmp(token->str, str) == 0;
+    if (match)
+        parser->pos++;
+    return match;
+}
+
+static int expect(struct Parser *parser, const char *str) {
+    return accept(parser, str) ? 0 : syntax_error(parser);
+}
+
+static int expect_end(struct Parser *parser) {
+    return parser->pos == parser->text->num_tokens ? 0 : syntax_error(parser);
+}
+
+//Returns the next token if it is a name, NULL otherwise
+static const char *name(struct Parser *parser) {
+    if (parser->pos == parser->text->num_tokens)
+        return NULL;
+    struct Token *token = &parser->text->tokens[parser->pos];
+    if (token->kind != TOKEN_WORD || is_keyword(token->str))
+        return NULL;
+    parser->pos++;
+    return token->str;
+}
+
+//Returns the next token if it is a value, NULL otherwise
+static struct Token *value(struct Parser *parser) {
+    if (parser->pos == parser->text->num_tokens || parser->text->tokens[parser->pos].kind != TOKEN_VALUE)
+        return NULL;
+    return &parser->text->tokens[parser->pos++];
+}
+
+//Returns the table named 'table_name', opened the first time
+static Table *session_table(PSqlSession session, const char *table_name) {
+    Table *table = map_get(session->tables, (void *)table_name);
+    if (table != NULL)
+        return table;
+    //table_open reports a missing table as an IO error
+    char *frm_pathname = (char *)malloc(strlen(session->path) + strlen(table_name) + strlen(FRAME_SUFFIX) + 1);
+    sprintf(frm_pathname, "%s%s%s", session->path, table_name, FRAME_SUFFIX);
+    FILE *frm = fopen(frm_pathname, "r");
+    free(frm_pathname);
+    if (frm == NULL) {
+        fprintf(stderr, "Unknown table \'%s\'\n", table_name);
+        return NULL;
+    }
+    fclose(frm);
+    table = table_open(session->path, table_name);
+    if (table != NULL)
+        map_put(session->tables, str_copy(table_name), table);
+    return table;
+}
+
+/*
+
+  Prepared statements
+
+*/
+struct SqlPlan {
+    char *key;            //normalized text
+    PStatement stmt;
+    size_t num_params;
+    Column **params;      //column of each value
+    void **slots;         //native value of each parameter, in 'values'
+    char *values;
+    const void **columns; //values of each bound column of an INSERT
+    const uint64_t **nulls; //NULLs of each bound column of an INSERT, NULL if it has none
+    uint64_t *null_bits;  //bitmaps of 'nulls'
+    size_t num_rows;      //rows of an INSERT, 0 for a SELECT
+    bool no_rows;         //LIMIT 0
+};
+
+static void sql_plan_destroy(struct SqlPlan *plan) {
+    if (plan == NULL)
+        return;
+    statement_close(plan->stmt);
+    free(plan->key);
+    free(plan->params);
+    free(plan->slots);
+    free(plan->values);
+    free(plan->columns);
+    free(plan->nulls);
+    free(plan->null_bits);
+    free(plan);
+}
+
+static size_t align_value(size_t size) {
+    return (size + SQL_VALUE_ALIGN - 1) / SQL_VALUE_ALIGN * SQL_VALUE_ALIGN;
+}
+
+static int parse_insert(struct Parser *parser, struct SqlPlan *plan) {
+    if (expect(parser, "INTO") != 0)
+        return EINVAL;
+    const char *table_name = name(parser);
+    if (table_name == NULL)
+        return syntax_error(parser);
+    Table *table = session_table(parser->session, table_name);
+    if (table == NULL)
+        return EINVAL;
+    size_t max_cols = parser->text->num_tokens;
+    const char **col_names = (const char **)malloc(max_cols * sizeof(char *));
+    //row and column of each value, then of each NULL from the end
+    size_t *cells = (size_t *)malloc(max_cols * sizeof(size_t));
+    size_t num_cols = 0, num_rows = 0, num_values = 0, num_nulls = 0;
+    int ret = EINVAL;
+    bool listed = accept(parser, "(");
+    if (listed) {
+        do {
+            if ((col_names[num_cols++] = name(parser)) == NULL) {
+                ret = syntax_error(parser);
+                goto END;
+            }
+        } while (accept(parser, ","));
+        if (expect(parser, ")") != 0)
+            goto END;
+    }
+    if (expect(parser, "VALUES") != 0)
+        goto END;
+    if ((plan->stmt = table_prepare_insert(table, listed ? col_names : NULL, num_cols)) == NULL)
+        goto END;
+    num_cols = statement_num_params(plan->stmt);
+    do {
+        if (expect(parser, "(") != 0)
+            goto END;
+        size_t k;
+        for (k = 0; k < num_cols && (k == 0 || accept(parser, ",")); k++) {
+            size_t cell = num_rows * num_cols + k;
+            if (accept(parser, "NULL"))
+                cells[max_cols - ++num_nulls] = cell;
+            else if (value(parser) != NULL)
+                cells[num_values++] = cell;
+            else {
+                ret = syntax_error(parser);
+                goto END;
+            }
+        }
+        if (k < num_cols || !accept(parser, ")")) {
+            fprintf(stderr, "A row must have %zu values\n", num_cols);
+            goto END;
+        }
+        num_rows++;
+    } while (accept(parser, ","));
+    if (expect_end(parser) != 0)
+        goto END;
+
+    //the values of a bound column are consecutive, as statement_insert takes them
+    plan->num_rows = num_rows;
+    plan->num_params = num_values;
+    plan->params = (Column **)malloc((num_values ? num_values : 1) * sizeof(Column *));
+    plan->slots = (void **)malloc((num_values ? num_values : 1) * sizeof(void *));
+    plan->columns = (const void **)malloc(num_cols * sizeof(void *));
+    Column **bound = (Column **)malloc(num_cols * sizeof(Column *));
+    size_t size = 0;
+    for (size_t k = 0; k < num_cols; k++) {
+        bound[k] = listed ? table_column(table, col_names[k]) : &table->columns[k];
+        size += align_value(num_rows * bound[k]->size);
+    }
+    plan->values = (char *)calloc(1, size); //the cells of NULLs stay zero
+    size_t offset = 0;
+    for (size_t k = 0; k < num_cols; k++) {
+        plan->columns[k] = plan->values + offset;
+        offset += align_value(num_rows * bound[k]->size);
+    }
+    for (size_t p = 0; p < num_values; p++) {
+        Column *column = bound[cells[p] % num_cols];
+        plan->params[p] = column;
+        plan->slots[p] = (char *)plan->columns[cells[p] % num_cols] + cells[p] / num_cols * column->size;
+    }
+    //the NULLs are part of the statement, so of its plan
+    if (num_nulls > 0) {
+        size_t num_words = BITMAP_WORDS(num_rows);
+        plan->nulls = (const uint64_t **)malloc(num_cols * sizeof(uint64_t *));
+        plan->null_bits = (uint64_t *)calloc(num_cols * num_words, sizeof(uint64_t));
+        for (size_t k = 0; k < num_cols; k++)
+            plan->nulls[k] = plan->null_bits + k * num_words;
+        for (size_t i = 0; i < num_nulls; i++) {
+            size_t cell = cells[max_cols - 1 - i], row = cell / num_cols;
+            plan->null_bits[cell % num_cols * num_words + row / 64] |= 1ULL << (row % 64);
+        }
+    }
+    free(bound);
+    ret = 0;
+END:
+    free(col_names);
+    free(cells);
+    return ret;
+}
+
+static int parse_select(struct Parser *parser, struct SqlPlan *plan) {
+    size_t max = parser->text->num_tokens;
+    const char **col_names = (const char **)malloc(max * sizeof(char *));
+    PreparedPredicate *predicates = (PreparedPredicate *)malloc(max * sizeof(PreparedPredicate));
+    OrderBy *order_by = (OrderBy *)malloc(max * sizeof(OrderBy));
+    size_t num_cols = 0, num_predicates = 0, num_order_by = 0, limit = 0;
+    int any = -1; //unknown until the first AND or OR
+    int ret = EINVAL;
+    bool all = accept(parser, "*");
+    if (!all)
+        do {
+            if ((col_names[num_cols++] = name(parser)) == NULL) {
+                ret = syntax_error(parser);
+                goto END;
+            }
+        } while (accept(parser, ","));
+    if (expect(parser, "FROM") != 0)
+        goto END;
+    const char *table_name = name(parser);
+    if (table_name == NULL) {
+        ret = syntax_error(parser);
+        goto END;
+    }
+    Table *table = session_table(parser->session, table_name);
+    if (table == NULL)
+        goto END;
+
+    if (accept(parser, "WHERE"))
+        while (1) {
+            PreparedPredicate *predicate = &predicates[num_predicates++];
+            if ((predicate->col_name = name(parser)) == NULL) {
+                ret = syntax_error(parser);
+                goto END;
+            }
+            if (accept(parser, "=")) predicate->op = OP_EQ;
+            else if (accept(parser, "<")) predicate->op = OP_LT;
+            else if (accept(parser, "<=")) predicate->op = OP_LE;
+            else if (accept(parser, ">")) predicate->op = OP_GT;
+            else if (accept(parser, ">=")) predicate->op = OP_GE;
+            else if (accept(parser, "BETWEEN")) predicate->op = OP_BETWEEN;
+            else if (accept(parser, "IS")) predicate->op = accept(parser, "NOT") ? OP_IS_NOT_NULL : OP_IS_NULL;
+            else {
+                ret = syntax_error(parser);
+                goto END;
+            }
+            if (predicate->op == OP_IS_NULL || predicate->op == OP_IS_NOT_NULL) {
+                if (expect(parser, "NULL") != 0)
+                    goto END;
+            }
+            else if (value(parser) == NULL || (predicate->op == OP_BETWEEN && (!accept(parser, "AND") || value(parser) == NULL))) {
+                ret = syntax_error(parser);
+                goto END;
+            }
+            bool and = accept(parser, "AND"), or = !and && accept(parser, "OR");
+            if (!and && !or)
+                break;
+            if (any != -1 && any != or) {
+                fprintf(stderr, "AND and OR can't be mixed in a WHERE clause\n");
+                goto END;
+            }
+            any = or;
+        }
+    if (accept(parser, "ORDER")) {
+        if (expect(parser, "BY") != 0)
+            goto END;
+        do {
+            OrderBy *order = &order_by[num_order_by++];
+            if ((order->col_name = name(parser)) == NULL) {
+                ret = syntax_error(parser);
+                goto END;
+            }
+            order->descending = accept(parser, "DESC");
+            if (!order->descending)
+                accept(parser, "ASC");
+        } while (accept(parser, ","));
+    }
+    if (accept(parser, "LIMIT")) {
+        struct Token *token = value(parser);
+        char *end = NULL;
+        if (token != NULL && isdigit((unsigned char)token->str[0]))
+            limit = strtoull(token->str, &end, 10);
+        if (end == NULL || *end != '\0') {
+            if (token != NULL)
+                parser->pos--;
+            ret = syntax_error(parser);
+            goto END;
+        }
+        plan->no_rows = limit == 0;
+    }
+    if (expect_end(parser) != 0)
+        goto END;
+
+    plan->stmt = table_prepare_select(table, all ? NULL : col_names, num_cols, predicates, num_predicates, any == 1);
+    if (plan->stmt == NULL)
+        goto END;
+    if ((num_order_by > 0 || limit > 0) && statement_order_by(plan->stmt, order_by, num_order_by, limit, 0) != 0)
+        goto END;
+    plan->num_params = statement_num_params(plan->stmt);
+    plan->params = (Column **)malloc((plan->num_params ? plan->num_params : 1) * sizeof(Column *));
+    plan->slots = (void **)malloc((plan->num_params ? plan->num_params : 1) * sizeof(void *));
+    size_t p = 0, size = 0;
+    for (size_t i = 0; i < num_predicates; i++) {
+        Column *column = table_column(table, predicates[i].col_name);
+        int num_values = predicates[i].op == OP_BETWEEN ? 2 : predicates[i].op == OP_IS_NULL || predicates[i].op == OP_IS_NOT_NULL ? 0 : 1;
+        for (int k = num_values; k > 0; k--) {
+            plan->params[p++] = column;
+            size += align_value(column->size);
+        }
+    }
+    plan->values = (char *)malloc(size ? size : 1);
+    size = 0;
+    for (p = 0; p < plan->num_params; p++) {
+        plan->slots[p] = plan->values + size;
+        size += align_value(plan->params[p]->size);
+    }
+    ret = 0;
+END:
+    free(col_names);
+    free(predicates);
+    free(order_by);
+    return ret;
+}
+
+//Executes 'plan' with the values of 'text'
+static int sql_plan_run(struct SqlPlan *plan, struct SqlText *text) {
+    for (size_t i = 0; i < text->num_tokens; i++) {
+        struct Token *token = &text->tokens[i];
+        if (token->param < 0)
+            continue;
+        Column *column = plan->params[token->param];
+        int ret = column->type->parse(plan->slots[token->param], token->str, strlen(token->str));
+        if (ret != 0) {
+            fprintf(stderr, "Invalid value \'%s\' for column \'%s\'\n", token->str, column->name);
+            return ret;
+        }
+    }
+    if (plan->num_rows > 0)
+        return statement_insert_nulls(plan->stmt, plan->columns, plan->nulls, plan->num_rows);
+    if (plan->no_rows)
+        return 0;
+    PCursor cursor = statement_query(plan->stmt, (const void *const *)plan->slots);
+    if (cursor == NULL)
+        return EINVAL;
+    cursor_print(cursor);
+    cursor_close(cursor);
+    return 0;
+}
+
+static void sql_cache_clear(PSqlSession session) {
+    size_t num = map_size(session->cache);
+    void **keys = (void **)malloc((num ? num : 1) * sizeof(void *));
+    void **plans = (void **)malloc((num ? num : 1) * sizeof(void *));
+    map_sort(session->cache, keys, plans);
+    map_destroy(session->cache);
+    for (size_t i = 0; i < num; i++)
+        sql_plan_destroy((struct SqlPlan *)plans[i]);
+    free(keys);
+    free(plans);
+    session->cache = map_create(compare_str, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
+}
+
+/*
+
+  Data definition, not cached
+
+*/
+static int create_table(struct Parser *parser) {
+    PSqlSession session = parser->session;
+    const char *table_name = name(parser);
+    if (table_name == NULL)
+        return syntax_error(parser);
+    if (strlen(table_name) >= FRM_TABLE_NAME_SIZE) {
+        fprintf(stderr, "Table name \'%s\' is too long\n", table_name);
+        return EINVAL;
+    }
+    char *frm_pathname = (char *)malloc(strlen(session->path) + strlen(table_name) + strlen(FRAME_SUFFIX) + 1);
+    sprintf(frm_pathname, "%s%s%s", session->path, table_name, FRAME_SUFFIX);
+    FILE *frm = fopen(frm_pathname, "r");
+    free(frm_pathname);
+    if (frm != NULL || map_has_key(session->tables, (void *)table_name)) {
+        if (frm != NULL)
+            fclose(frm);
+        fprintf(stderr, "Table \'%s\' already exists\n", table_name);
+        return EEXIST;
+    }
+    if (expect(parser, "(") != 0)
+        return EINVAL;
+
+    //the table owns the names and types once created
+    ColNameList *list = new_list();
+    ColNameTypeMap *map = map_create(compare_str, MAP_KEY_REFERENCE_COPY | MAP_VALUE_SHALLOW_COPY);
+    ColNameList *nullable = new_list(); //names of 'list', columns are NOT NULL by default
+    IndexKind index_kind = INDEX_BTREE;
+    DataLayout layout = LAYOUT_ROW;
+    int ret = EINVAL;
+    do {
+        const char *col_name = name(parser), *type_name = name(parser);
+        if (col_name == NULL || type_name == NULL) {
+            ret = syntax_error(parser);
+            goto ERR;
+        }
+        //the length of a varchar is part of its type name
+        struct Token *len = NULL;
+        if (accept(parser, "(") && ((len = value(parser)) == NULL || expect(parser, ")") != 0)) {
+            if (len == NULL)
+                syntax_error(parser);
+            goto ERR;
+        }
+        char *type = (char *)malloc(strlen(type_name) + (len ? strlen(len->str) + 2 : 0) + 1);
+        sprintf(type, len ? "%s(%s)" : "%s", type_name, len ? len->str : "");
+        for (char *c = type; *c != '\0'; c++)
+            *c = tolower((unsigned char)*c);
+        if (!is_valid_datatype(type)) {
+            fprintf(stderr, "Unknown type \'%s\'\n", type_name);
+            free(type);
+            goto ERR;
+        }
+        if (map_has_key(map, (void *)col_name) || strlen(col_name) >= FRM_COL_NAME_SIZE || list_size(list) == CAPACITY) {
+            fprintf(stderr, "Invalid column \'%s\'\n", col_name);
+            free(type);
+            goto ERR;
+        }
+        char *col = str_copy(col_name);
+        list_add(list, col);
+        map_put(map, col, type);
+        if (accept(parser, "NULL"))
+            list_add(nullable, col);
+        else if (accept(parser, "NOT") && expect(parser, "NULL") != 0)
+            goto ERR;
+    } while (accept(parser, ","));
+    if (expect(parser, ")") != 0)
+        goto ERR;
+    if (accept(parser, "USING")) {
+        if (accept(parser, "BTREE")) index_kind = INDEX_BTREE;
+        else if (accept(parser, "LSM")) index_kind = INDEX_LSM;
+        else if (accept(parser, "COW")) index_kind = INDEX_COW;
+        else {
+            ret = syntax_error(parser);
+            goto ERR;
+        }
+    }
+    if (accept(parser, "LAYOUT")) {
+        if (accept(parser, "ROW")) layout = LAYOUT_ROW;
+        else if (accept(parser, "PAX")) layout = LAYOUT_PAX;
+        else {
+            ret = syntax_error(parser);
+            goto ERR;
+        }
+    }
+    if (expect_end(parser) != 0)
+        goto ERR;
+    List *indices = new_list();
+    Table *table = table_create_with_nulls(session->path, table_name, list, indices, map, index_kind, layout, nullable);
+    list_free(indices);
+    if (table == NULL) {
+        fprintf(stderr, "Can't create table \'%s\'\n", table_name);
+        ret = EIO;
+        goto ERR;
+    }
+    map_put(session->tables, str_copy(table_name), table);
+    list_free(nullable);
+    return 0;
+ERR:
+    for (size_t i = 0; i < list_size(list); i++)
+        free(list_get(list, i));
+    list_free(list);
+    list_free(nullable);
+    map_destroy(map);
+    return ret;
+}
+
+static int create_index(struct Parser *parser) {
+    name(parser); //the index is named after its column
+    if (expect(parser, "ON") != 0)
+        return EINVAL;
+    const char *table_name = name(parser);
+    if (table_name == NULL)
+        return syntax_error(parser);
+    const char *col_name;
+    if (expect(parser, "(") != 0)
+        return EINVAL;
+    if ((col_name = name(parser)) == NULL)
+        return syntax_error(parser);
+    if (expect(parser, ")") != 0 || expect_end(parser) != 0)
+        return EINVAL;
+    Table *table = session_table(parser->session, table_name);
+    if (table == NULL)
+        return EINVAL;
+    return table_create_index(table, col_name);
+}
+
+static int run_statement(PSqlSession session, struct SqlText *text) {
+    struct Parser parser = {session, text, 0};
+    if (accept(&parser, "CREATE")) {
+        if (accept(&parser, "TABLE"))
+            return create_table(&parser);
+        if (accept(&parser, "INDEX"))
+            return create_index(&parser);
+        return syntax_error(&parser);
+    }
+    struct SqlPlan *plan = map_get(session->cache, text->key);
+    if (plan != NULL) {
+        session->hits++;
+        return sql_plan_run(plan, text);
+    }
+    plan = (struct SqlPlan *)calloc(1, sizeof(struct SqlPlan));
+    int ret;
+    if (accept(&parser, "INSERT"))
+        ret = parse_insert(&parser, plan);
+    else if (accept(&parser, "SELECT"))
+        ret = parse_select(&parser, plan);
+    else
+        ret = syntax_error(&parser);
+    if (ret != 0) {
+        sql_plan_destroy(plan);
+        return ret;
+    }
+    session->misses++;
+    if (map_size(session->cache) >= SQL_CACHE_CAPACITY)
+        sql_cache_clear(session);
+    plan->key = text->key;
+    text->key = NULL;
+    map_put(session->cache, plan->key, plan);
+    return sql_plan_run(plan, text);
+}
+
+PSqlSession sql_open(const char *path) {
+    PSqlSession session = (PSqlSession)malloc(sizeof(struct SqlSession));
+    session->path = str_copy(path);
+    session->tables = map_create(compare_str, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
+    session->cache = map_create(compare_str, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
+    session->hits = session->misses = 0;
+    session->timing = false;
+    return session;
+}
+
+int sql_exec(PSqlSession session, const char *text) {
+    int first_ret = 0;
+    while (*text != '\0') {
+        const char *end = statement_end(text);
+        struct SqlText statement;
+        struct timespec start, stop;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int ret = tokenize(text, end, &statement);
+        if (ret == 0 && statement.num_tokens > 0) {
+            ret = run_statement(session, &statement);
+            clock_gettime(CLOCK_MONOTONIC, &stop);
+            if (session->timing)
+                fprintf(stderr, "Time: %.3f ms\n", (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6);
+        }
+        sql_text_destroy(&statement);
+        if (first_ret == 0)
+            first_ret = ret;
+        text = *end == ';' ? end + 1 : end;
+    }
+    return first_ret;
+}
+
+void sql_set_timing(PSqlSession session, bool timing) {
+    session->timing = timing;
+}
+
+void sql_cache_stats(PSqlSession session, size_t *p_hits, size_t *p_misses) {
+    *p_hits = session->hits;
+    *p_misses = session->misses;
+}
+
+void sql_close(PSqlSession session) {
+    if (session == NULL)
+        return;
+    sql_cache_clear(session);
+    map_destroy(session->cache);
+    size_t num = map_size(session->tables);
+    void **names = (void **)malloc((num ? num : 1) * sizeof(void *));
+    void **tables = (void **)malloc((num ? num : 1) * sizeof(void *));
+    map_sort(session->tables, names, tables);
+    map_destroy(session->tables);
+    for (size_t i = 0; i < num; i++) {
+        free(names[i]);
+        table_close((Table *)tables[i]);
+    }
+    free(names);
+    free(tables);
+    free(session->path);
+    free(session);
+}
@@ -0,0 +1,45 @@
+#ifndef SQL_H__
+#define SQL_H__
+
+#include <stdbool.h>
+#include "table.h"
+
+/* A subset of SQL on the tables of a directory:
+
+     CREATE TABLE t (col type [NULL | NOT NULL], ...) [USING BTREE | LSM | COW] [LAYOUT ROW | PAX]
+     CREATE INDEX [name] ON t (col)
+     INSERT INTO t [(col, ...)] VALUES (value, ...), ...
+     SELECT * | col, ... FROM t [WHERE cond AND ... | cond OR ...]
+         [ORDER BY col [ASC | DESC], ...] [LIMIT n]
+
+   where a condition is 'col op value', op one of = < <= > >=,
+   'col BETWEEN value AND value' or 'col IS [NOT] NULL'. Keywords are case
+   insensitive, names are not. Types are int, bigint, text, blob and
+   varchar(n); columns are NOT NULL unless declared NULL. Values are
+   integers, text between quotes ', with a quote inside doubled, or NULL.
+
+   INSERT and SELECT statements are prepared (see table_prepare_insert and
+   table_prepare_select) and kept in a cache keyed by their normalized text:
+   keywords in upper case, one space between tokens and each value but the
+   LIMIT replaced by '?', NULL being kept. A statement found in the cache is executed with the
+   values of its text without being parsed and bound again, so queries that
+   differ only in their values share one entry. */
+
+typedef struct SqlSession *PSqlSession;
+
+/* Opens a session on the tables whose files are prefixed with 'path', e.g.
+   "./". Tables are opened the first time a statement names them. */
+PSqlSession sql_open(const char *path);
+/* Executes the statements of 'text', separated by ';'. Rows of a SELECT are
+   printed one line per row, errors go to stderr. A failed statement does not
+   stop the following ones. Returns 0 if all succeed, otherwise the error of
+   the first failed statement. */
+int sql_exec(PSqlSession session, const char *text);
+/* Prints the time taken by each statement to stderr. */
+void sql_set_timing(PSqlSession session, bool timing);
+/* Statements found in the cache and statements prepared, since sql_open. */
+void sql_cache_stats(PSqlSession session, size_t *p_hits, size_t *p_misses);
+/* Closes the tables of the session. */
+void sql_close(PSqlSession session);
+
+#endif
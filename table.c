@@ -1,8 +1,16 @@
+#define _GNU_SOURCE //qsort_r
 #include "table.h"
 #include "datatype.h"
 #include "frame.h"
 #include "btree.h"
+#include "extsort.h"
+#include "filter.h"
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 static char *get_data_pathname(const char *path, const char *table_name) {
     size_t path_len = strlen(path);
@@ -28,18 +36,19 @@ static char *get_frm_pathname(const char *path, const char *table_name) {
     return frm_pathname;
 }
 
-static void *cpy_to_buffer(const char *table_name, ColNameList *list, map_t *index2btree, ColNameTypeMap *map, size_t *p_buffersize, size_t *p_blocksize) {
+static void *cpy_to_buffer(const char *table_name, ColNameList *list, map_t *col2index, ColNameTypeMap *map, DataLayout layout, const bool *nullable, size_t *p_buffersize, size_t *p_blocksize) {
     size_t table_name_size = strlen(table_name);
     if (table_name_size > FRM_TABLE_NAME_SIZE) {
         fprintf(stderr, "Table name:\'%s\' too long", table_name);
         return NULL;
     }
     size_t num_cols = list_size(list);
-    *p_buffersize = FRM_SIZE(num_cols);
-    void *buffer = malloc(*p_buffersize);
+    *p_buffersize = FRM_SIZE(num_cols) + FRM_LAYOUT_SIZE + FRM_NULLABLE_SIZE(num_cols);
+    void *buffer = calloc(1, *p_buffersize); //names are padded with '\0'
     memcpy(buffer + FRM_TABLE_NAME_OFFSET, (void *)table_name, table_name_size);
     memcpy(buffer + FRM_NUM_COLS_OFFSET, (void *)(&num_cols), FRM_NUM_COLS_SIZE);
     *p_blocksize = 0;
+    size_t num_nullable = 0;
     for (int i = 0; i < num_cols; i++) {
         char *name = list_get(list, i);
         char *type = map_get(map, name);
@@ -54,15 +63,22 @@ static void *cpy_to_buffer(const char *table_name, ColNameList *list, map_t *ind
         }
         memcpy(buffer + FRM_COL_NAME_OFFSET(i), name, name_size);
         memcpy(buffer + FRM_COL_TYPE_OFFSET(i), type, strlen(type));
-        u_int8_t flag_is_index;
-        if (map_has_key(index2btree, name))
-            flag_is_index = 1;
+        u_int8_t flag_is_index; //IndexKind of the column
+        PIndex index = map_get(col2index, name);
+        if (index != NULL)
+            flag_is_index = index->kind;
         else
-            flag_is_index = 0;
+            flag_is_index = INDEX_NONE;
         memcpy(buffer + FRM_COL_INDEX_FLAG_OFFSET(i), &flag_is_index, sizeof(flag_is_index));
          
         *p_blocksize += type_size(type);
+        u_int8_t flag_nullable = nullable[i];
+        memcpy(buffer + FRM_NULLABLE_OFFSET(num_cols) + i, &flag_nullable, sizeof(flag_nullable));
+        num_nullable += nullable[i];
     }
+    *p_blocksize += NULL_BITMAP_SIZE(num_nullable);
+    u_int8_t flag_layout = layout;
+    memcpy(buffer + FRM_LAYOUT_OFFSET(num_cols), &flag_layout, FRM_LAYOUT_SIZE);
     return buffer;
 }
 
@@ -70,19 +86,660 @@ static function_ColNameTypeMap_compare_key(const void *a, const void *b) {
     return strcmp((const char *)a, (const char *)b);
 }
 
+static char *str_copy(const char *str) {
+    char *copy = (char *)malloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+/*
+    PAX pages
+
+    A page of LAYOUT_PAX starts with a PaxHeader, followed by one minipage per
+    column holding the values of the column for the 'page_rows' slots of the
+    page. If a column is nullable, the null bitmaps of the rows take one more
+    minipage, last in the header, so that NULLs are tested without reading
+    any cell. The minipages are placed as if the page were full, so the
+    offsets in the header are the same for all pages. The record of a row is the
+    disk_pointer of its page plus its slot, so records keep the order of the
+    data file.
+*/
+
+struct PaxHeader {
+    uint32_t num_rows;    //slots in use
+    uint32_t num_columns;
+    uint32_t offsets[];   //byte offset of the minipage of each column
+};
+
+#define PAX_HEADER_SIZE(num_cols) (sizeof(struct PaxHeader) + (num_cols) * sizeof(uint32_t))
+
+/* Builds the column descriptors from the frame data of 'table', with the
+   columns flagged in 'nullable' allowed to be NULL. The null bitmap of a row,
+   if any column is nullable, is described by one more cell after the columns. */
+static void build_schema(Table *table, const bool *nullable) {
+    size_t num_columns = list_size(table->list);
+    table->columns = (Column *)malloc((num_columns + 1) * sizeof(Column));
+    table->num_columns = num_columns;
+    size_t num_nullable = 0;
+    for (int i = 0; i < num_columns; i++)
+        num_nullable += nullable[i];
+    table->null_size = NULL_BITMAP_SIZE(num_nullable);
+    table->num_cells = num_columns + (num_nullable > 0);
+    size_t offset = table->null_size;
+    num_nullable = 0;
+    for (int i = 0; i < num_columns; i++) {
+        Column *column = &table->columns[i];
+        column->id = i;
+        column->null_bit = nullable[i] ? (int)num_nullable++ : -1;
+        column->name = list_get(table->list, i);
+        column->type = get_data_type((char *)map_get(table->map, (void *)column->name));
+        column->offset = offset;
+        column->size = column->type->get_type_size();
+        column->index = map_get(table->col2index, (void *)column->name);
+        column->heap = column->type == text_data_type() ? table->heap : NULL;
+        column->max_len = type_max_len((char *)map_get(table->map, (void *)column->name));
+        offset += column->size;
+    }
+    Column *nulls = &table->columns[num_columns];
+    memset(nulls, 0, sizeof(Column));
+    nulls->id = num_columns;
+    nulls->name = "";
+    nulls->size = table->null_size;
+    nulls->null_bit = -1;
+    table->row_size = offset;
+    table->page_rows = 0;
+    table->tail = NULL;
+    table->tail_dp = DNULL;
+    if (table->layout == LAYOUT_PAX && table->row_size > 0) {
+        size_t header_size = PAX_HEADER_SIZE(table->num_cells);
+        table->page_rows = (table->data->block_size - header_size) / table->row_size;
+        for (int i = 0; i < table->num_cells; i++)
+            table->columns[i].page_offset = header_size + table->page_rows * table->columns[i].offset;
+    }
+}
+
+//Decodes the record of a row of LAYOUT_PAX into its page and slot
+static disk_pointer pax_page_of(Table *table, record_t record, size_t *p_slot) {
+    disk_pointer offset = record - data_start_pos();
+    *p_slot = offset % table->data->block_size;
+    return record - *p_slot;
+}
+
+//Reads the last page into table->tail, or starts the first page
+static int pax_load_tail(Table *table) {
+    if (table->tail != NULL)
+        return 0;
+    DISK *data = table->data;
+    void *page = calloc(1, data->block_size);
+    if (page == NULL)
+        return ENOMEM;
+    fflush(data->file);
+    fseek(data->file, 0, SEEK_END);
+    size_t num_pages = ((disk_pointer)ftell(data->file) - data_start_pos()) / data->block_size;
+    struct PaxHeader *header = (struct PaxHeader *)page;
+    if (num_pages == 0) {
+        table->tail_dp = data_start_pos();
+        header->num_rows = 0;
+    }
+    else {
+        table->tail_dp = next_n_pointer(data, data_start_pos(), num_pages - 1);
+        if (copy_to_memory_r(data, table->tail_dp, page) != 1 || header->num_columns != table->num_cells) {
+            free(page);
+            return EIO;
+        }
+    }
+    header->num_columns = table->num_cells;
+    for (size_t i = 0; i < table->num_cells; i++)
+        header->offsets[i] = table->columns[i].page_offset;
+    table->tail = page;
+    return 0;
+}
+
+/* Appends 'rows' to the last pages, filling their slots column by column, and
+   sets the record of each row. A new page is written whole, otherwise only
+   the header and the cells added to each minipage are written. */
+static int pax_append(Table *table, const void *rows, size_t num_rows, record_t *records) {
+    DISK *data = table->data;
+    int ret = pax_load_tail(table);
+    if (ret != 0)
+        return ret;
+    struct PaxHeader *header = (struct PaxHeader *)table->tail;
+    size_t i = 0;
+    while (i < num_rows && ret == 0) {
+        if (header->num_rows == table->page_rows) {
+            //start the next page
+            memset(table->tail + PAX_HEADER_SIZE(table->num_cells), 0, data->block_size - PAX_HEADER_SIZE(table->num_cells));
+            header->num_rows = 0;
+            table->tail_dp = next_pointer(data, table->tail_dp);
+        }
+        size_t first = header->num_rows;
+        size_t num = num_rows - i < table->page_rows - first ? num_rows - i : table->page_rows - first;
+        for (size_t k = 0; k < table->num_cells; k++) {
+            Column *column = &table->columns[k];
+            void *cell = table->tail + column->page_offset + first * column->size;
+            for (size_t j = 0; j < num; j++)
+                memcpy(cell + j * column->size, rows + (i + j) * table->row_size + column->offset, column->size);
+        }
+        for (size_t j = 0; j < num; j++)
+            records[i + j] = table->tail_dp + first + j;
+        header->num_rows += num;
+        if (first == 0) {
+            if (copy_to_disk(table->tail, data->block_size, data, table->tail_dp) < 0)
+                ret = EIO;
+        }
+        else {
+            if (copy_to_disk(table->tail, sizeof(header->num_rows), data, table->tail_dp) < 0)
+                ret = EIO;
+            for (size_t k = 0; k < table->num_cells && ret == 0; k++) {
+                Column *column = &table->columns[k];
+                size_t offset = column->page_offset + first * column->size;
+                if (copy_to_disk(table->tail + offset, num * column->size, data, table->tail_dp + offset) < 0)
+                    ret = EIO;
+            }
+        }
+        i += num;
+    }
+    fflush(data->file); //pages are read with pread
+    return ret;
+}
+
+size_t table_num_rows(Table *table) {
+    DISK *data = table->data;
+    if (table->layout == LAYOUT_PAX) {
+        if (pax_load_tail(table) != 0)
+            return 0;
+        size_t num_pages = (table->tail_dp - data_start_pos()) / data->block_size;
+        return num_pages * table->page_rows + ((struct PaxHeader *)table->tail)->num_rows;
+    }
+    long fp_save = ftell(data->file);
+    fseek(data->file, 0, SEEK_END);
+    size_t num_rows = ((disk_pointer)ftell(data->file) - data_start_pos()) / data->block_size;
+    fseek(data->file, fp_save, SEEK_SET);
+    return num_rows;
+}
+
+//Record of the row 'row_no' of the data file
+static record_t row_record(Table *table, size_t row_no) {
+    if (table->layout == LAYOUT_PAX)
+        return next_n_pointer(table->data, data_start_pos(), row_no / table->page_rows) + row_no % table->page_rows;
+    return next_n_pointer(table->data, data_start_pos(), row_no);
+}
+
+//Reads the row of 'record' into 'row', returns 0 if success
+static int read_row(Table *table, record_t record, void *row) {
+    if (table->layout == LAYOUT_ROW)
+        return copy_to_memory(table->data, record, row) == 1 ? 0 : EIO;
+    size_t slot;
+    disk_pointer page_dp = pax_page_of(table, record, &slot);
+    for (size_t i = 0; i < table->num_cells; i++) {
+        Column *column = &table->columns[i];
+        if (copy_bytes_to_memory_r(table->data, page_dp + column->page_offset + slot * column->size, column->size, row + column->offset) != column->size)
+            return EIO;
+    }
+    return 0;
+}
+
+//Writes 'row' over the row of 'record', the inverse of read_row. Returns 0 if success
+static int write_row(Table *table, record_t record, const void *row) {
+    DISK *data = table->data;
+    if (table->layout == LAYOUT_ROW)
+        return copy_to_disk((void *)row, table->row_size, data, record) < 0 ? EIO : 0;
+    size_t slot;
+    disk_pointer page_dp = pax_page_of(table, record, &slot);
+    for (size_t i = 0; i < table->num_cells; i++) {
+        Column *column = &table->columns[i];
+        size_t offset = column->page_offset + slot * column->size;
+        if (copy_to_disk_r((void *)(row + column->offset), column->size, data, page_dp + offset) < 0)
+            return EIO;
+        //the last page is written again by the next append
+        if (table->tail != NULL && page_dp == table->tail_dp)
+            memcpy(table->tail + offset, row + column->offset, column->size);
+    }
+    return 0;
+}
+
+int table_read_rows(Table *table, size_t first_row, size_t num_rows, void *rows) {
+    DISK *data = table->data;
+    if (table->layout == LAYOUT_ROW)
+        return copy_to_memory_s(data, next_n_pointer(data, data_start_pos(), first_row), num_rows, rows);
+    size_t header_size = PAX_HEADER_SIZE(table->num_cells);
+    struct PaxHeader *header = (struct PaxHeader *)malloc(header_size);
+    if (header == NULL)
+        return -1;
+    size_t num = 0;
+    while (num < num_rows) {
+        size_t row_no = first_row + num;
+        disk_pointer page_dp = next_n_pointer(data, data_start_pos(), row_no / table->page_rows);
+        size_t slot = row_no % table->page_rows;
+        ssize_t size = copy_bytes_to_memory_r(data, page_dp, header_size, header);
+        if (size == 0)
+            break;
+        if (size != header_size || header->num_columns != table->num_cells) {
+            free(header);
+            return -1;
+        }
+        if (slot >= header->num_rows)
+            break;
+        //the rows of the page are gathered from its minipages, one read per column
+        size_t count = header->num_rows - slot < num_rows - num ? header->num_rows - slot : num_rows - num;
+        for (size_t i = 0; i < table->num_cells; i++) {
+            Column *column = &table->columns[i];
+            char cells[count * column->size];
+            if (copy_bytes_to_memory_r(data, page_dp + header->offsets[i] + slot * column->size, sizeof(cells), cells) != sizeof(cells)) {
+                free(header);
+                return -1;
+            }
+            for (size_t j = 0; j < count; j++)
+                memcpy(rows + (num + j) * table->row_size + column->offset, cells + j * column->size, column->size);
+        }
+        num += count;
+        if (slot + count < table->page_rows)
+            break; //last page
+    }
+    free(header);
+    return num;
+}
+
+/*
+    Record fetch
+
+    The records of an index path are fetched a batch at a time. The records of
+    a batch are sorted by file offset, and nearby rows are read with one pread:
+    of LAYOUT_ROW, a run of blocks at most FETCH_GAP_BYTES apart, up to
+    FETCH_IO_BYTES in all, and of LAYOUT_PAX, the cells of the rows of one page
+    with one read per minipage. The rows are returned in the order of the
+    records, so that an index scan still returns them in key order.
+*/
+
+#define FETCH_BATCH_ROWS 1024        //records sorted and fetched together
+#define FETCH_GAP_BYTES  (32 << 10)  //largest gap between two rows read with one IO
+#define FETCH_IO_BYTES   (256 << 10) //bytes read by one IO at most
+
+struct FetchEntry {
+    record_t record;
+    size_t pos; //of the row in the output
+};
+
+static int compare_fetch_entry(const void *a, const void *b) {
+    record_t ra = ((const struct FetchEntry *)a)->record, rb = ((const struct FetchEntry *)b)->record;
+    if (ra == rb)
+        return 0;
+    return ra < rb ? -1 : 1;
+}
+
+//Reads the rows of entries [0, num) of LAYOUT_ROW, in runs of nearby blocks
+static int fetch_blocks(Table *table, const struct FetchEntry *entries, size_t num, void *rows, char *buffer) {
+    DISK *data = table->data;
+    size_t block_size = data->block_size;
+    size_t i = 0;
+    while (i < num) {
+        //the run [i, j) is read with one IO
+        size_t j = i + 1;
+        while (j < num && entries[j].record - entries[j - 1].record <= FETCH_GAP_BYTES + block_size
+               && entries[j].record + block_size - entries[i].record <= FETCH_IO_BYTES)
+            j++;
+        size_t size = entries[j - 1].record + block_size - entries[i].record;
+        if (copy_bytes_to_memory_r(data, entries[i].record, size, buffer) != size)
+            return EIO;
+        for (size_t k = i; k < j; k++)
+            memcpy(rows + entries[k].pos * table->row_size, buffer + (entries[k].record - entries[i].record), table->row_size);
+        i = j;
+    }
+    return 0;
+}
+
+//Reads the 'columns' of the rows of entries [0, num) of LAYOUT_PAX, page by page
+static int fetch_cells(Table *table, const bool *columns, const struct FetchEntry *entries, size_t num, void *rows, char *buffer) {
+    DISK *data = table->data;
+    size_t i = 0;
+    while (i < num) {
+        size_t first_slot, last_slot;
+        disk_pointer page_dp = pax_page_of(table, entries[i].record, &first_slot);
+        size_t j = i + 1;
+        while (j < num && entries[j].record - page_dp < data->block_size)
+            j++;
+        pax_page_of(table, entries[j - 1].record, &last_slot);
+        //the cells of the slots [first_slot, last_slot] of each column
+        for (size_t c = 0; c < table->num_cells; c++) {
+            Column *column = &table->columns[c];
+            if (columns != NULL && c < table->num_columns && !columns[c])
+                continue;
+            size_t size = (last_slot - first_slot + 1) * column->size;
+            if (copy_bytes_to_memory_r(data, page_dp + column->page_offset + first_slot * column->size, size, buffer) != size)
+                return EIO;
+            for (size_t k = i; k < j; k++)
+                memcpy(rows + entries[k].pos * table->row_size + column->offset, buffer + (entries[k].record - page_dp - first_slot) * column->size, column->size);
+        }
+        i = j;
+    }
+    return 0;
+}
+
+/* Reads the rows of the 'num' records, at most FETCH_BATCH_ROWS, into 'rows',
+   the row of records[i] at row i. Only the cells of 'columns' (all columns if
+   it is NULL) are read from a data file of LAYOUT_PAX. Returns 0 if success. */
+static int fetch_rows(Table *table, const bool *columns, const record_t *records, size_t num, void *rows) {
+    if (num == 1 && (table->layout == LAYOUT_ROW || columns == NULL))
+        return read_row(table, records[0], rows);
+    struct FetchEntry entries[FETCH_BATCH_ROWS];
+    bool sorted = true;
+    for (size_t i = 0; i < num; i++) {
+        entries[i].record = records[i];
+        entries[i].pos = i;
+        sorted = sorted && (i == 0 || records[i - 1] <= records[i]);
+    }
+    if (!sorted)
+        qsort(entries, num, sizeof(struct FetchEntry), compare_fetch_entry);
+    size_t buffer_size = table->layout == LAYOUT_PAX ? table->data->block_size : FETCH_IO_BYTES + table->data->block_size;
+    char *buffer = (char *)malloc(buffer_size);
+    if (buffer == NULL)
+        return ENOMEM;
+    fflush(table->data->file); //rows are read with pread
+    int ret = table->layout == LAYOUT_PAX ? fetch_cells(table, columns, entries, num, rows, buffer) : fetch_blocks(table, entries, num, rows, buffer);
+    free(buffer);
+    return ret;
+}
+
+/*
+    Deleted rows
+
+    A deleted row keeps its slot in the data file and its bit is set in the
+    deletion bitmap, one bit per row in the order of the data file. The bitmap
+    is kept in memory and in the file of DELETE_SUFFIX, where only the words
+    changed by a delete are written. Scans clear the bits of deleted rows from
+    their selection bitmaps a word at a time, and do nothing more while no row
+    is deleted.
+*/
+
+static char *get_del_pathname(const char *path, const char *table_name) {
+    size_t path_len = strlen(path);
+    size_t table_name_len = strlen(table_name);
+    size_t del_suffix_len = strlen(DELETE_SUFFIX);
+    size_t EOF_SIZE = 1; //space for '\0'
+    char *del_pathname = (char *)malloc(path_len + table_name_len + del_suffix_len + EOF_SIZE);
+    strcpy(del_pathname, path);
+    strcpy(del_pathname + path_len, table_name);
+    strcpy(del_pathname + path_len + table_name_len, DELETE_SUFFIX);
+    return del_pathname;
+}
+
+//Reads the deletion bitmap of 'table', an empty one if it has no file
+static void deleted_load(Table *table) {
+    table->deleted = NULL;
+    table->deleted_words = table->num_deleted = 0;
+    char *del_pathname = get_del_pathname(table->path, table->name);
+    FILE *file = fopen(del_pathname, "r");
+    free(del_pathname);
+    if (file == NULL)
+        return;
+    fseek(file, 0, SEEK_END);
+    size_t num_words = ftell(file) / sizeof(uint64_t);
+    fseek(file, 0, SEEK_SET);
+    table->deleted = (uint64_t *)calloc(num_words ? num_words : 1, sizeof(uint64_t));
+    if (table->deleted != NULL && fread(table->deleted, sizeof(uint64_t), num_words, file) == num_words) {
+        table->deleted_words = num_words;
+        for (size_t i = 0; i < num_words; i++)
+            table->num_deleted += __builtin_popcountll(table->deleted[i]);
+    }
+    fclose(file);
+}
+
+//Writes the words [first, end) of the deletion bitmap to its file, returns 0 if success
+static int deleted_write(Table *table, size_t first, size_t end) {
+    if (first >= end)
+        return 0;
+    char *del_pathname = get_del_pathname(table->path, table->name);
+    FILE *file = fopen(del_pathname, "r+");
+    if (file == NULL)
+        file = fopen(del_pathname, "w+");
+    free(del_pathname);
+    if (file == NULL) {
+        perror("fopen()");
+        return EIO;
+    }
+    int ret = 0;
+    if (fseek(file, first * sizeof(uint64_t), SEEK_SET) != 0 || fwrite(table->deleted + first, sizeof(uint64_t), end - first, file) != end - first)
+        ret = EIO;
+    fclose(file);
+    return ret;
+}
+
+//Sets the bit of row 'row_no', returns 0 if success
+static int deleted_set(Table *table, size_t row_no) {
+    size_t word = row_no / 64;
+    if (word >= table->deleted_words) {
+        size_t num_words = 2 * table->deleted_words > word + 1 ? 2 * table->deleted_words : word + 1;
+        uint64_t *deleted = (uint64_t *)realloc(table->deleted, num_words * sizeof(uint64_t));
+        if (deleted == NULL)
+            return ENOMEM;
+        memset(deleted + table->deleted_words, 0, (num_words - table->deleted_words) * sizeof(uint64_t));
+        table->deleted = deleted;
+        table->deleted_words = num_words;
+    }
+    if (!(table->deleted[word] >> (row_no % 64) & 1)) {
+        table->deleted[word] |= 1ULL << (row_no % 64);
+        table->num_deleted++;
+    }
+    return 0;
+}
+
+bool table_row_deleted(Table *table, size_t row_no) {
+    return row_no / 64 < table->deleted_words && (table->deleted[row_no / 64] >> (row_no % 64) & 1);
+}
+
+//Row number of 'record' in the data file, the inverse of row_record
+static size_t record_row(Table *table, record_t record) {
+    size_t block_size = table->data->block_size;
+    disk_pointer offset = record - data_start_pos();
+    if (table->layout == LAYOUT_PAX)
+        return offset / block_size * table->page_rows + offset % block_size;
+    return offset / block_size;
+}
+
+//Deletion bits of the 64 rows from 'row_no'
+static uint64_t deleted_word(Table *table, size_t row_no) {
+    size_t word = row_no / 64, shift = row_no % 64;
+    uint64_t bits = word < table->deleted_words ? table->deleted[word] >> shift : 0;
+    if (shift != 0 && word + 1 < table->deleted_words)
+        bits |= table->deleted[word + 1] << (64 - shift);
+    return bits;
+}
+
+//Clears the bits of the deleted rows among the 'num' rows from 'first_row' in 'bitmap'
+static void mask_deleted(Table *table, size_t first_row, size_t num, uint64_t *bitmap) {
+    if (table->num_deleted == 0)
+        return;
+    for (size_t i = 0; i < BITMAP_WORDS(num); i++)
+        bitmap[i] &= ~deleted_word(table, first_row + i * 64);
+}
+
+//Removes the records of deleted rows from 'records', returns how many are left
+static size_t drop_deleted(Table *table, record_t *records, size_t num) {
+    if (table->num_deleted == 0)
+        return num;
+    size_t num_live = 0;
+    for (size_t i = 0; i < num; i++)
+        if (!table_row_deleted(table, record_row(table, records[i])))
+            records[num_live++] = records[i];
+    return num_live;
+}
+
+/*
+    Text columns
+
+    A row holds a cell of TEXT_CELL_SIZE bytes for a value of a text column.
+    Values that do not fit in their cell are kept in the heap file of the
+    table, where they are stored by the functions inserting or updating rows
+    before the rows are written. Rows are compared and printed through the
+    column, which knows the heap of its values.
+*/
+
+static char *get_var_pathname(const char *path, const char *table_name) {
+    size_t path_len = strlen(path);
+    size_t table_name_len = strlen(table_name);
+    size_t var_suffix_len = strlen(VARHEAP_SUFFIX);
+    size_t EOF_SIZE = 1; //space for '\0'
+    char *var_pathname = (char *)malloc(path_len + table_name_len + var_suffix_len + EOF_SIZE);
+    strcpy(var_pathname, path);
+    strcpy(var_pathname + path_len, table_name);
+    strcpy(var_pathname + path_len + table_name_len, VARHEAP_SUFFIX);
+    return var_pathname;
+}
+
+//Returns true if a column of 'map' is of a text type
+static bool has_text_column(ColNameList *list, ColNameTypeMap *map) {
+    for (int i = 0; i < list_size(list); i++)
+        if (get_data_type(map_get(map, list_get(list, i))) == text_data_type())
+            return true;
+    return false;
+}
+
+int column_store(const Column *column, void *value) {
+    if (column->heap == NULL)
+        return 0;
+    if (text_cell_len(value) > column->max_len) {
+        fprintf(stderr, "Value too long for column '%s'\n", column->name);
+        return ERANGE;
+    }
+    return varheap_store(column->heap, value);
+}
+
+//Stores the values of the text columns of 'num_rows' rows, returns 0 if success
+static int store_rows(Table *table, void *rows, size_t num_rows) {
+    if (table->heap == NULL)
+        return 0;
+    int ret = 0;
+    for (size_t k = 0; k < table->num_columns && ret == 0; k++) {
+        Column *column = &table->columns[k];
+        for (size_t i = 0; i < num_rows && ret == 0 && column->heap != NULL; i++)
+            ret = column_store(column, rows + i * table->row_size + column->offset);
+    }
+    return ret;
+}
+
+//Compares two values of 'column'
+static int column_compare(const Column *column, const void *a, const void *b) {
+    return column->heap ? varheap_compare(column->heap, a, b) : column->type->compare(a, b);
+}
+
+/*
+    Null values
+
+    A row of a table with nullable columns starts with a bitmap of null_size
+    bytes, where bit 'null_bit' of a column is set if its value is NULL. The
+    cell of a NULL is zeroed, so that no value is made up for it and rows with
+    the same values and NULLs have the same bytes. A scan tests the bits of
+    64 rows at once (see scan_plan_filter).
+*/
+
+bool column_is_null(const Column *column, const void *row) {
+    return column->null_bit >= 0 && (((const uint8_t *)row)[column->null_bit / 8] >> (column->null_bit % 8) & 1);
+}
+
+void column_set_null(const Column *column, void *row, bool is_null) {
+    if (column->null_bit < 0)
+        return;
+    uint8_t *byte = (uint8_t *)row + column->null_bit / 8;
+    if (is_null) {
+        *byte |= 1 << (column->null_bit % 8);
+        memset(row + column->offset, 0, column->size);
+    }
+    else
+        *byte &= ~(1 << (column->null_bit % 8));
+}
+
+//Sets bit i of 'bitmap' if 'column' is NULL in the i-th of 'num' null bitmaps 'stride' bytes apart
+static void null_gather(const Column *column, const void *nulls, size_t stride, size_t num, uint64_t *bitmap) {
+    memset(bitmap, 0, BITMAP_WORDS(num) * sizeof(uint64_t));
+    if (column->null_bit < 0)
+        return;
+    const uint8_t *byte = (const uint8_t *)nulls + column->null_bit / 8;
+    int shift = column->null_bit % 8;
+    for (size_t i = 0; i < num; i++)
+        bitmap[i / 64] |= (uint64_t)(byte[i * stride] >> shift & 1) << (i % 64);
+}
+
+//Prints the value of 'column' in 'row'
+static void column_print(const Column *column, const void *row) {
+    const void *value = row + column->offset;
+    if (column_is_null(column, row)) {
+        fputs("NULL", stdout);
+        return;
+    }
+    if (column->heap == NULL) {
+        column->type->print(value);
+        return;
+    }
+    size_t len = text_cell_len(value);
+    char local[TEXT_INLINE_LEN];
+    char *buf = len <= TEXT_INLINE_LEN ? local : (char *)malloc(len);
+    if (varheap_load(column->heap, value, buf) == 0)
+        fwrite(buf, 1, len, stdout);
+    if (buf != local)
+        free(buf);
+}
+
+Column *table_column(Table *table, const char *col_name) {
+    for (size_t i = 0; i < table->num_columns; i++)
+        if (strcmp(table->columns[i].name, col_name) == 0)
+            return &table->columns[i];
+    return NULL;
+}
+
 Table *table_create(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map) {
-    
-    map_t *index2btree = map_create(function_ColNameTypeMap_compare_key, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
+    return table_create_with_engine(path, table_name, list, indices, map, INDEX_BTREE);
+}
+
+Table *table_create_with_engine(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind) {
+    return table_create_with_layout(path, table_name, list, indices, map, index_kind, LAYOUT_ROW);
+}
+
+Table *table_create_with_layout(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind, DataLayout layout) {
+    return table_create_with_nulls(path, table_name, list, indices, map, index_kind, layout, NULL);
+}
+
+//Returns true if 'col_name' is in 'nullable', which may be NULL
+static bool is_listed(ColNameList *nullable, const char *col_name) {
+    for (int k = 0; nullable != NULL && k < list_size(nullable); k++)
+        if (strcmp(list_get(nullable, k), col_name) == 0)
+            return true;
+    return false;
+}
+
+Table *table_create_with_nulls(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind, DataLayout layout, ColNameList *nullable) {
+    size_t num_cols = list_size(list);
+    bool is_nullable[num_cols + 1];
+    for (int i = 0; i < num_cols; i++)
+        is_nullable[i] = is_listed(nullable, list_get(list, i));
+    for (int i = 0; i < list_size(indices); i++) {
+        char *col_name = list_get(indices, i);
+        if (get_data_type(map_get(map, col_name)) == text_data_type()) {
+            fprintf(stderr, "Text column '%s' can't be indexed!\n", col_name);
+            return NULL;
+        }
+        if (is_listed(nullable, col_name)) {
+            fprintf(stderr, "Nullable column '%s' can't be indexed!\n", col_name);
+            return NULL;
+        }
+    }
+    map_t *col2index = map_create(function_ColNameTypeMap_compare_key, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
     for (int i = 0; i < list_size(indices); i++) {
         char *col_name = list_get(indices, i);
-        map_put(index2btree, col_name, btree_create(path, table_name, col_name, get_data_type(map_get(map, col_name))));
+        map_put(col2index, col_name, index_create(path, table_name, col_name, get_data_type(map_get(map, col_name)), index_kind));
     }
 
     size_t buffer_size, block_size;
-    void *buffer = cpy_to_buffer(table_name, list, index2btree, map, &buffer_size, &block_size);
+    void *buffer = cpy_to_buffer(table_name, list, col2index, map, layout, is_nullable, &buffer_size, &block_size);
     if (buffer == NULL) {
         return NULL;
     }
+    if (layout == LAYOUT_PAX) {
+        //a page holds one row at least
+        size_t row_size = block_size;
+        block_size = PAX_HEADER_SIZE(num_cols + 1) + row_size;
+        if (block_size < PAX_PAGE_SIZE)
+            block_size = PAX_PAGE_SIZE;
+    }
 
     char *data_pathname = get_data_pathname(path, table_name);
 
@@ -109,16 +766,42 @@ Table *table_create(const char *path, const char *table_name, ColNameList *list,
     fclose(frm);
     free(buffer);
 
+    PVarHeap heap = NULL;
+    if (has_text_column(list, map)) {
+        char *var_pathname = get_var_pathname(path, table_name);
+        heap = varheap_create(var_pathname);
+        free(var_pathname);
+        if (heap == NULL) {
+            fprintf(stderr, "error in varheap_create()!\n");
+            dclose(data);
+            return NULL;
+        }
+    }
+
     //malloc table
     Table *table = (Table *)malloc(sizeof(Table));
+    table->path = str_copy(path);
+    table->name = str_copy(table_name);
     table->map = map;
     table->list = list;
-    table->index2btree = index2btree;
+    table->col2index = col2index;
+    table->index_kind = index_kind;
+    table->layout = layout;
     table->data = data;
+    table->stats = NULL;
+    table->heap = heap;
+    build_schema(table, is_nullable);
+    //a new data file has no deleted row
+    char *del_pathname = get_del_pathname(path, table_name);
+    remove(del_pathname);
+    free(del_pathname);
+    deleted_load(table);
 
     return table;
 }
 
+static int compact_recover(const char *path, const char *table_name, const void *buffer, size_t num_cols);
+
 Table *table_open(const char *path, const char *table_name) {
     char *frm_pathname = get_frm_pathname(path, table_name);
     FILE *frm = fopen(frm_pathname, "r+");
@@ -134,11 +817,25 @@ Table *table_open(const char *path, const char *table_name) {
     void *buffer = malloc(buffer_size);
     fseek(frm, 0, SEEK_SET);
     fread(buffer, buffer_size, 1, frm);
+    u_int8_t flag_layout = LAYOUT_ROW;
+    fread(&flag_layout, FRM_LAYOUT_SIZE, 1, frm);
+    u_int8_t flags_nullable[num_cols + 1];
+    bool is_nullable[num_cols + 1];
+    memset(flags_nullable, 0, sizeof(flags_nullable));
+    fread(flags_nullable, 1, FRM_NULLABLE_SIZE(num_cols), frm);
+    for (int i = 0; i < num_cols; i++)
+        is_nullable[i] = flags_nullable[i] != 0;
     fclose(frm);
+    if (compact_recover(path, table_name, buffer, num_cols) != 0) {
+        fprintf(stderr, "Error in compact_recover() for table '%s'\n", table_name);
+        free(buffer);
+        return NULL;
+    }
     ColNameList *list = new_list();
     ColNameTypeMap *map = map_create(function_ColNameTypeMap_compare_key, MAP_KEY_REFERENCE_COPY | MAP_VALUE_SHALLOW_COPY);
-    map_t *index2btree = map_create(function_ColNameTypeMap_compare_key, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
+    map_t *col2index = map_create(function_ColNameTypeMap_compare_key, MAP_KEY_REFERENCE_COPY | MAP_VALUE_REFERENCE_COPY);
     size_t block_size;
+    IndexKind index_kind = INDEX_NONE;
     for (int i = 0; i < num_cols; i++) {
         char *name = (char *)malloc(FRM_COL_NAME_SIZE);
         memcpy(name, buffer + FRM_COL_NAME_OFFSET(i), FRM_COL_NAME_SIZE);
@@ -148,13 +845,26 @@ Table *table_open(const char *path, const char *table_name) {
         map_put(map, name, type);
         u_int8_t flag_is_index;
         memcpy(&flag_is_index, buffer + FRM_COL_INDEX_FLAG_OFFSET(i), FRM_COL_INDEX_FLAG_SIZE);
-        if (flag_is_index)
-            map_put(index2btree, name, btree_open(path, table_name, name, get_data_type(type)));
+        if (flag_is_index != INDEX_NONE) {
+            map_put(col2index, name, index_open(path, table_name, name, get_data_type(type), flag_is_index));
+            if (index_kind == INDEX_NONE)
+                index_kind = flag_is_index;
+        }
     } 
     free(buffer);
     char *data_pathname = get_data_pathname(path, table_name);
     DISK *data = dopen(data_pathname);
     free(data_pathname);
+    PVarHeap heap = NULL;
+    if (data != NULL && has_text_column(list, map)) {
+        char *var_pathname = get_var_pathname(path, table_name);
+        heap = varheap_open(var_pathname);
+        free(var_pathname);
+        if (heap == NULL) {
+            dclose(data);
+            data = NULL;
+        }
+    }
     if (data == NULL) {
         fprintf(stderr, "error in dopen()!\n");
         for (int i = 0; i < num_cols; i++)
@@ -164,14 +874,31 @@ Table *table_open(const char *path, const char *table_name) {
         return NULL;
     }
     Table *table = (Table *)malloc(sizeof(Table));
+    table->path = str_copy(path);
+    table->name = str_copy(table_name);
     table->map = map;
     table->list = list;
-    table->index2btree = index2btree;
+    table->col2index = col2index;
+    table->index_kind = index_kind != INDEX_NONE ? index_kind : INDEX_BTREE;
+    table->layout = flag_layout == LAYOUT_PAX ? LAYOUT_PAX : LAYOUT_ROW;
     table->data = data;
+    table->stats = NULL;
+    table->heap = heap;
+    build_schema(table, is_nullable);
+    deleted_load(table);
     return table;
 }
 
+static void table_stats_destroy(struct TableStats *stats);
+
 void table_close(Table *table) {
+    for (size_t i = 0; i < table->num_columns; i++)
+        index_close(table->columns[i].index);
+    free(table->columns);
+    free(table->tail);
+    free(table->deleted);
+    table_stats_destroy(table->stats);
+    map_destroy(table->col2index);
     List *list = table->list;
     size_t num_cols = list_size(list);
     map_t *map = table->map;
@@ -179,152 +906,3510 @@ void table_close(Table *table) {
         free(list_get(list, i));
     list_free(list);
     map_destroy(map);
-    map_t *index2btree = table->index2btree;
-    PBTree *btrees = (PBTree *)malloc(map_size(index2btree) * sizeof(PBTree));
-    map_sort(index2btree, NULL, btrees); //replace by map iterator later
-    for (int i = 0; i < map_size(index2btree); i++)
-        btree_close(btrees[i]);
-    free(btrees);
-    map_destroy(index2btree);
     dclose(table->data);
+    varheap_close(table->heap);
+    free(table->path);
+    free(table->name);
     free(table);
 }
 
-void table_insert(Table *table, ColNameValueMap *map) {
-    size_t block_size = table->data->block_size;
-    void *memory = malloc(block_size);
-    ColNameList *list = table->list;
-    ColNameTypeMap *nt_map = table->map;
-    size_t offset = 0;
-    for (int i = 0; i < list_size(list); i++) {
-        char *col_name = list_get(list, i);
-        char *col_type = map_get(nt_map, col_name);
-        DataType *data_type = get_data_type(col_type);
-        char *val = map_get(map, col_name);
-        if (val != NULL) {
-            errno = 0;
-            data_type->cpy_to_memory(memory + offset, val);
-            if (errno != 0) {
-                if (errno == ERANGE) fprintf(stderr, "Out of range value for column \'%s\'", col_name);
-                free(memory);
-                return;
+//Converts the values of 'map' into 'row', returns 0 if success
+static int convert_row(Table *table, ColNameValueMap *map, void *row) {
+    for (size_t i = 0; i < table->num_columns; i++) {
+        Column *column = &table->columns[i];
+        char *val = map_get(map, (void *)column->name);
+        if (val == NULL && column->null_bit >= 0)
+            column_set_null(column, row, true);
+        else if (val != NULL) {
+            column_set_null(column, row, false);
+            void *value = column->type->convert_to_val(val);
+            if (value == NULL) {
+                if (errno == ERANGE) fprintf(stderr, "Out of range value for column \'%s\'", column->name);
+                return errno ? errno : EINVAL;
             }
+            memcpy(row + column->offset, value, column->size);
+            free(value);
+            //the value of a text cell is freed with it
+            int ret = column_store(column, row + column->offset);
+            if (ret != 0)
+                return ret;
         }
         else {
-            //This branch should never be reached at this time
-            //"Not null" is set default for any column at this time
-            fprintf(stderr, "Column \'%s\' can't be null!\n", col_name);
-            free(memory);
-            return;
+            fprintf(stderr, "Column \'%s\' can't be null!\n", column->name);
+            return EINVAL;
         }
-        offset += data_type->get_type_size();
     }
+    return 0;
+}
+
+void table_insert(Table *table, ColNameValueMap *map) {
+    void *memory = malloc(table->row_size);
+    if (convert_row(table, map, memory) != 0) {
+        free(memory);
+        return;
+    }
+    if (table->layout == LAYOUT_PAX) {
+        table_append_rows(table, memory, 1);
+        free(memory);
+        return;
+    }
+    if (table->heap != NULL)
+        varheap_flush(table->heap);
     disk_pointer dp = dalloc(table->data);
-    copy_to_disk(memory, offset, table->data, dp);
+    copy_to_disk(memory, table->row_size, table->data, dp);
+
+    //index keys are taken from the row, already converted
+    for (size_t i = 0; i < table->num_columns; i++) {
+        Column *column = &table->columns[i];
+        if (column->index != NULL)
+            index_insert(column->index, memory + column->offset, dp);
+    }
     free(memory);
-    
-
-    //replace by map iterator later
-    map_t *index2btree = table->index2btree;
-    size_t num_indices = map_size(index2btree);
-    PBTree *btrees = (PBTree *)malloc(num_indices * sizeof(PBTree));
-    char **names = (char **)malloc(num_indices * sizeof(char *));    
-    map_sort(index2btree, names, btrees); 
-    for (int i = 0; i < map_size(index2btree); i++) {
-        void *key = get_data_type(map_get(table->map, names[i]))->convert_to_val(map_get(map, names[i]));
-        btree_insert(btrees[i], key, dp);
-    }
-    free(btrees);
-    free(names);
-}
-
-static void print_row(Table *table, void *memory) {
-    size_t offset = 0;
-    for (int i = 0; i < list_size(table->list); i++) {
-        char *col_name = list_get(table->list, i);
-        DataType *type = get_data_type((char *)map_get(table->map, col_name));
+}
+
+//Appends 'rows' to the data file and sets their records, the indices are left as they are
+static int append_data(Table *table, void *rows, size_t num_rows, record_t *records) {
+    //the values of the rows are written first
+    if (table->heap != NULL && varheap_flush(table->heap) != 0)
+        return EIO;
+    if (table->layout == LAYOUT_PAX)
+        return pax_append(table, rows, num_rows, records);
+    //rows are appended at the end of the data file with one write
+    DISK *data = table->data;
+    disk_pointer dp = dalloc(data);
+    for (size_t i = 0; i < num_rows; i++)
+        records[i] = next_n_pointer(data, dp, i);
+    return copy_to_disk_s(rows, num_rows, data, dp) == num_rows ? 0 : EIO;
+}
+
+int table_append_rows(Table *table, void *rows, size_t num_rows) {
+    if (num_rows == 0)
+        return 0;
+    int ret = store_rows(table, rows, num_rows);
+    if (ret != 0)
+        return ret;
+    record_t *records = (record_t *)malloc(num_rows * sizeof(record_t));
+    if (records == NULL)
+        return ENOMEM;
+    ret = append_data(table, rows, num_rows, records);
+    for (size_t i = 0; i < table->num_columns && ret == 0; i++) {
+        Column *column = &table->columns[i];
+        if (column->index != NULL)
+            ret = index_insert_batch(column->index, rows + column->offset, table->row_size, records, num_rows);
+    }
+    free(records);
+    return ret;
+}
+
+int table_insert_batch(Table *table, ColNameValueMap **maps, size_t num_rows) {
+    if (num_rows == 0)
+        return 0;
+    void *rows = calloc(num_rows, table->row_size);
+    if (rows == NULL)
+        return ENOMEM;
+    int ret = 0;
+    for (size_t i = 0; i < num_rows && ret == 0; i++)
+        ret = convert_row(table, maps[i], rows + i * table->row_size);
+    //no row of the batch is inserted if a value is invalid
+    if (ret == 0)
+        ret = table_append_rows(table, rows, num_rows);
+    free(rows);
+    return ret;
+}
+
+static void print_row(Table *table, const void *memory) {
+    for (size_t i = 0; i < table->num_columns; i++) {
+        Column *column = &table->columns[i];
         if (i) putchar(' ');
-        type->print(memory + offset);    
-        offset += type->get_type_size();
+        column_print(column, memory);
     }
     printf("\n");
 }
 
-static void table_select_noindex(Table *table, ColNameValueMap *example) {
-    DISK *data = table->data;
-    size_t block_size = data->block_size;
-    disk_pointer dp = data_start_pos();
-    static const size_t num_bytes_pre_IO = 4096;
-    size_t num_blocks, num_blocks_read;
-    if (block_size >= num_bytes_pre_IO)
-        num_blocks = 1;
-    else
-        num_blocks = num_bytes_pre_IO / block_size;
-    void *buffer = malloc(num_blocks * block_size);
-    char **keys = (char **)malloc(map_size(example) * sizeof(char *));
-    char **values = (char **)malloc(map_size(example) * sizeof(char *));
-    map_sort(example, (void **)keys, (void **)values);
-    
-    while (1) {
-        num_blocks_read = copy_to_memory_s(data, dp, num_blocks, buffer);
-        if (num_blocks_read < 0) {
-            fprintf(stderr, "Error in copy_to_memory_s\n");
-            free(buffer);
-            free(keys);
-            free(values);
-            return;
-        }
-        for (int i = 0; i < num_blocks_read; i++) {
-            size_t offset = i * block_size;
-            int flag = 1;
-            for (int j = 0; j < map_size(example); j++) {
-                DataType *type = get_data_type((char *)map_get(table->map, keys[j]));
-                void *p_val = malloc(type->get_type_size());
-                size_t key_offset = 0;
-                for (int k = 0; k < list_size(table->list); k++) {
-                    if (strcmp(list_get(table->list, k), keys[j]) == 0) break;
-                    key_offset += type_size((char *)map_get(table->map, list_get(table->list, k)));
-                }
-                memcpy(p_val, buffer + offset + key_offset, type->get_type_size());
-                void *p_example_val = type->convert_to_val(values[j]);
-                int compare_res = type->compare(p_val, p_example_val);                
-                free(p_val);
-                free(p_example_val);
-                if (compare_res != 0) {
-                    flag = 0;
-                    break;
-                }
-            }
-            if (flag) {
-                print_row(table, buffer + offset);
+/*
+    Scan predicates
+*/
+
+//'column op value', with the column located once per query
+struct ScanPredicate {
+    Column *column;
+    size_t offset; //byte offset of the column in a row
+    int (*compare)(const void *, const void *);
+    CompareOp op;
+    void *value;   //parsed constant
+    void *value2;  //upper bound of OP_BETWEEN
+};
+
+typedef struct ScanPlan {
+    size_t num_predicates;
+    struct ScanPredicate *predicates;
+    bool any; //rows match any predicate instead of all of them
+    bool *columns; //columns read for the rows returned, projected or in a predicate, NULL for all
+} *PScanPlan;
+
+static void scan_plan_destroy(PScanPlan plan) {
+    if (plan == NULL)
+        return;
+    for (size_t i = 0; i < plan->num_predicates; i++) {
+        free(plan->predicates[i].value);
+        free(plan->predicates[i].value2);
+    }
+    free(plan->predicates);
+    free(plan->columns);
+    free(plan);
+}
+
+//Returns true for the operators testing the null bitmap, which take no value
+static bool is_null_test(CompareOp op) {
+    return op == OP_IS_NULL || op == OP_IS_NOT_NULL;
+}
+
+/* Compiles 'predicates', so that rows are tested without looking up columns
+   or parsing values again. */
+static PScanPlan scan_plan_compile(Table *table, const Predicate *predicates, size_t num, bool any) {
+    PScanPlan plan = (PScanPlan)malloc(sizeof(struct ScanPlan));
+    plan->num_predicates = 0;
+    plan->any = any;
+    plan->columns = NULL;
+    plan->predicates = (struct ScanPredicate *)malloc((num ? num : 1) * sizeof(struct ScanPredicate));
+    for (size_t i = 0; i < num; i++) {
+        Column *column = table_column(table, predicates[i].col_name);
+        if (column == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", predicates[i].col_name);
+            goto ERR;
+        }
+        struct ScanPredicate *predicate = &plan->predicates[plan->num_predicates];
+        predicate->column = column;
+        predicate->offset = column->offset;
+        predicate->compare = column->type->compare;
+        predicate->op = predicates[i].op;
+        predicate->value = predicate->value2 = NULL;
+        if (is_null_test(predicate->op)) {
+            plan->num_predicates++;
+            continue;
+        }
+        predicate->value = column->type->convert_to_val(predicates[i].value);
+        if (predicate->value == NULL) {
+            fprintf(stderr, "Invalid value \'%s\' for column \'%s\'\n", predicates[i].value, column->name);
+            goto ERR;
+        }
+        plan->num_predicates++;
+        if (predicate->op == OP_BETWEEN) {
+            const char *value2 = predicates[i].value2 ? predicates[i].value2 : "";
+            if ((predicate->value2 = column->type->convert_to_val(value2)) == NULL) {
+                fprintf(stderr, "Invalid value \'%s\' for column \'%s\'\n", value2, column->name);
+                goto ERR;
             }
         }
-        if (num_blocks_read < num_blocks) {
-            break;
+    }
+    return plan;
+ERR:
+    scan_plan_destroy(plan);
+    return NULL;
+}
+
+/* Restricts the rows of 'plan' to the 'num' columns of 'col_names' and the
+   columns of its predicates, the other cells of a row are left unset. Returns
+   0, or EINVAL for an unknown column. */
+static int scan_plan_project(Table *table, PScanPlan plan, const char **col_names, size_t num) {
+    bool *columns = (bool *)calloc(table->num_columns ? table->num_columns : 1, sizeof(bool));
+    if (columns == NULL)
+        return ENOMEM;
+    for (size_t i = 0; i < num; i++) {
+        Column *column = table_column(table, col_names[i]);
+        if (column == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", col_names[i]);
+            free(columns);
+            return EINVAL;
         }
-        dp = next_n_pointer(data, dp, num_blocks);
+        columns[column->id] = true;
     }
+    for (size_t i = 0; i < plan->num_predicates; i++)
+        columns[plan->predicates[i].column->id] = true;
+    free(plan->columns);
+    plan->columns = columns;
+    return 0;
+}
 
-    free(buffer);
-    free(keys);
-    free(values);
+//Tests the value of the column of 'predicate' at 'value'
+static bool predicate_test(struct ScanPredicate *predicate, const void *value) {
+    PVarHeap heap = predicate->column->heap;
+    int cmp = heap ? varheap_compare(heap, value, predicate->value) : predicate->compare(value, predicate->value);
+    switch (predicate->op) {
+        case OP_EQ: return cmp == 0;
+        case OP_LT: return cmp < 0;
+        case OP_LE: return cmp <= 0;
+        case OP_GT: return cmp > 0;
+        case OP_GE: return cmp >= 0;
+        case OP_BETWEEN: return cmp >= 0 && (heap ? varheap_compare(heap, value, predicate->value2) : predicate->compare(value, predicate->value2)) <= 0;
+        default: break; //null tests are answered by predicate_match
+    }
+    return false;
 }
 
-void table_select(Table *table, ColNameValueMap *example) {
-    //Just a simple test for btree
-    //Improve this function later
-    char **keys = (char **)malloc(map_size(example) * sizeof(char *));
-    char **values = (char **)malloc(map_size(example) * sizeof(char *));
-    map_sort(example, (void **)keys, (void **)values);
-    
-    void *ek = get_data_type(map_get(table->map, keys[0]))->convert_to_val(values[0]);
-    vector_t *dps = btree_select(map_get(table->index2btree, keys[0]), ek, ek);
-    free(ek);
+static bool predicate_match(struct ScanPredicate *predicate, const void *row) {
+    bool is_null = column_is_null(predicate->column, row);
+    if (is_null_test(predicate->op))
+        return is_null == (predicate->op == OP_IS_NULL);
+    //a NULL matches no comparison
+    return !is_null && predicate_test(predicate, row + predicate->offset);
+}
+
+static bool scan_plan_match(PScanPlan plan, const void *row) {
+    for (size_t i = 0; i < plan->num_predicates; i++)
+        if (predicate_match(&plan->predicates[i], row) == plan->any)
+            return plan->any;
+    return !plan->any;
+}
+
+/* Sets bit i of 'bitmap' for each of 'num' rows matching 'plan', with one
+   call of the batch filter of its type per predicate. The values of predicate
+   k are at values[k], strides[k] bytes apart, and the null bitmaps of the rows
+   at 'nulls', 'null_stride' bytes apart. The null bits of a predicate on a
+   nullable column are gathered once and applied a word of 64 rows at a time.
+   'scratch' has as many words as 'bitmap'. */
+static void scan_plan_filter(PScanPlan plan, const void **values, const size_t *strides, const void *nulls, size_t null_stride,
+                             size_t num, uint64_t *bitmap, uint64_t *scratch) {
+    size_t num_words = BITMAP_WORDS(num);
+    if (plan->num_predicates == 0) {
+        memset(bitmap, plan->any ? 0 : 0xff, num_words * sizeof(uint64_t));
+        if (num % 64 && !plan->any)
+            bitmap[num_words - 1] = ~0ULL >> (64 - num % 64);
+        return;
+    }
+    uint64_t nullmap[num_words ? num_words : 1];
+    uint64_t last_mask = num % 64 ? ~0ULL >> (64 - num % 64) : ~0ULL;
+    for (size_t k = 0; k < plan->num_predicates; k++) {
+        struct ScanPredicate *predicate = &plan->predicates[k];
+        uint64_t *out = k == 0 ? bitmap : scratch;
+        Column *column = predicate->column;
+        if (column->null_bit >= 0 || is_null_test(predicate->op))
+            null_gather(column, nulls, null_stride, num, nullmap);
+        if (is_null_test(predicate->op)) {
+            bool is_null = predicate->op == OP_IS_NULL;
+            for (size_t i = 0; i < num_words; i++)
+                out[i] = is_null ? nullmap[i] : ~nullmap[i];
+            if (num_words > 0)
+                out[num_words - 1] &= last_mask;
+        }
+        else if (predicate->column->heap != NULL) {
+            //values in the heap file are loaded one at a time
+            memset(out, 0, num_words * sizeof(uint64_t));
+            for (size_t i = 0; i < num; i++)
+                out[i / 64] |= (uint64_t)predicate_test(predicate, values[k] + i * strides[k]) << (i % 64);
+        }
+        else
+            predicate->column->type->filter(values[k], strides[k], num, predicate->op, predicate->value, predicate->value2, out);
+        //a NULL matches no comparison
+        if (column->null_bit >= 0 && !is_null_test(predicate->op))
+            for (size_t i = 0; i < num_words; i++)
+                out[i] &= ~nullmap[i];
+        if (k == 0)
+            continue;
+        if (plan->any)
+            for (size_t i = 0; i < num_words; i++)
+                bitmap[i] |= scratch[i];
+        else
+            for (size_t i = 0; i < num_words; i++)
+                bitmap[i] &= scratch[i];
+    }
+}
+
+//Same as scan_plan_filter for 'num' rows of 'row_size' bytes at 'rows'
+static void scan_plan_filter_rows(PScanPlan plan, const void *rows, size_t row_size, size_t num, uint64_t *bitmap, uint64_t *scratch) {
+    size_t num_predicates = plan->num_predicates ? plan->num_predicates : 1;
+    const void *values[num_predicates];
+    size_t strides[num_predicates];
+    for (size_t k = 0; k < plan->num_predicates; k++) {
+        values[k] = rows + plan->predicates[k].offset;
+        strides[k] = row_size;
+    }
+    scan_plan_filter(plan, values, strides, rows, row_size, num, bitmap, scratch);
+}
+
+//Returns the first set bit of 'bitmap' from bit 'pos', or 'num'
+static size_t bitmap_next(const uint64_t *bitmap, size_t pos, size_t num) {
+    while (pos < num) {
+        uint64_t word = bitmap[pos / 64] >> (pos % 64);
+        if (word != 0)
+            return pos + __builtin_ctzll(word) < num ? pos + __builtin_ctzll(word) : num;
+        pos = (pos / 64 + 1) * 64;
+    }
+    return num;
+}
+
+/* Narrows [*start, *end] to the keys that may satisfy 'predicate'. Strict
+   comparisons keep their bound, rows equal to it are dropped by scan_plan_match. */
+static void predicate_interval(struct ScanPredicate *predicate, const void **start, const void **end) {
+    const void *low = NULL, *high = NULL;
+    switch (predicate->op) {
+        case OP_EQ: low = high = predicate->value; break;
+        case OP_LT: case OP_LE: high = predicate->value; break;
+        case OP_GT: case OP_GE: low = predicate->value; break;
+        case OP_BETWEEN: low = predicate->value; high = predicate->value2; break;
+        case OP_IS_NULL: case OP_IS_NOT_NULL: break; //indexed columns are NOT NULL
+    }
+    if (low != NULL && predicate->compare(low, *start) > 0)
+        *start = low;
+    if (high != NULL && predicate->compare(high, *end) < 0)
+        *end = high;
+}
+
+//Returns true if a predicate of 'plan' is on 'column'
+static bool plan_uses_column(PScanPlan plan, const Column *column) {
+    for (size_t i = 0; plan != NULL && i < plan->num_predicates; i++)
+        if (plan->predicates[i].column == column)
+            return true;
+    return false;
+}
+
+//Returns true if a predicate of 'plan' reads the null bitmap, being on a nullable column
+static bool plan_uses_nulls(PScanPlan plan) {
+    for (size_t i = 0; plan != NULL && i < plan->num_predicates; i++)
+        if (plan->predicates[i].column->null_bit >= 0)
+            return true;
+    return false;
+}
+
+/* Reads the rows of the PAX page at 'page_dp' matching 'plan' (all rows if it
+   is NULL) into 'rows' and their records into 'records'. The minipages of the
+   columns of the predicates are read first, the other columns of the plan
+   only if a row matches. 'page' is a buffer of one page. Returns the number of rows, 0 past
+   the last page, or a negative number on error. */
+static int pax_scan_page(Table *table, PScanPlan plan, disk_pointer page_dp, void *page, void *rows, record_t *records) {
     DISK *data = table->data;
-    void *buffer = malloc(data->block_size);
-    for (int i = 0; i < vector_size(dps); i++) {
-        copy_to_memory(data, *(disk_pointer *)vector_get(dps, i), buffer);
-        print_row(table, buffer);
+    struct PaxHeader *header = (struct PaxHeader *)page;
+    size_t header_size = PAX_HEADER_SIZE(table->num_cells);
+    ssize_t size = copy_bytes_to_memory_r(data, page_dp, header_size, page);
+    if (size == 0)
+        return 0;
+    if (size != header_size || header->num_columns != table->num_cells || header->num_rows > table->page_rows)
+        return -1;
+    size_t num_rows = header->num_rows;
+    bool used[table->num_cells];
+    for (size_t i = 0; i < table->num_cells; i++) {
+        Column *column = &table->columns[i];
+        size_t minipage_size = num_rows * column->size;
+        if (header->offsets[i] != column->page_offset)
+            return -1;
+        used[i] = i < table->num_columns ? plan_uses_column(plan, column) : plan_uses_nulls(plan);
+        if (used[i] && copy_bytes_to_memory_r(data, page_dp + header->offsets[i], minipage_size, page + header->offsets[i]) != minipage_size)
+            return -1;
     }
-    free(buffer);
+    //the predicates are evaluated over the minipages, then the matching rows are assembled
+    size_t num_match = 0;
+    size_t first_row = (page_dp - data_start_pos()) / data->block_size * table->page_rows;
+    if (plan == NULL) {
+        for (size_t slot = 0; slot < num_rows; slot++)
+            if (!table_row_deleted(table, first_row + slot))
+                records[num_match++] = page_dp + slot;
+    }
+    else {
+        size_t num_predicates = plan->num_predicates ? plan->num_predicates : 1;
+        const void *values[num_predicates];
+        size_t strides[num_predicates];
+        uint64_t bitmap[BITMAP_WORDS(num_rows) + 1], scratch[BITMAP_WORDS(num_rows) + 1];
+        for (size_t k = 0; k < plan->num_predicates; k++) {
+            Column *column = plan->predicates[k].column;
+            values[k] = page + header->offsets[column->id];
+            strides[k] = column->size;
+        }
+        scan_plan_filter(plan, values, strides, table->null_size ? page + header->offsets[table->num_columns] : NULL, table->null_size, num_rows, bitmap, scratch);
+        mask_deleted(table, first_row, num_rows, bitmap);
+        for (size_t slot = bitmap_next(bitmap, 0, num_rows); slot < num_rows; slot = bitmap_next(bitmap, slot + 1, num_rows))
+            records[num_match++] = page_dp + slot;
+    }
+    if (num_match == 0)
+        return 0;
+    //the null bitmap is always copied, it tells the NULLs of every column
+    for (size_t i = 0; i < table->num_cells; i++) {
+        Column *column = &table->columns[i];
+        size_t minipage_size = num_rows * column->size;
+        const char *minipage = page + header->offsets[i];
+        if (plan != NULL && plan->columns != NULL && i < table->num_columns && !plan->columns[i])
+            continue;
+        if (!used[i] && copy_bytes_to_memory_r(data, page_dp + header->offsets[i], minipage_size, page + header->offsets[i]) != minipage_size)
+            return -1;
+        for (size_t j = 0; j < num_match; j++)
+            memcpy(rows + j * table->row_size + column->offset, minipage + (records[j] - page_dp) * column->size, column->size);
+    }
+    return num_match;
+}
+
+#define SEQ_SCAN_IO_BYTES 4096 //bytes read by one IO of a sequential scan
+#define SEQ_SCAN_BATCH_BYTES (256 << 10) //bytes of rows read and filtered at once by a sequential scan
+
+//Returns false if the bloom filter of any indexed column with an equality predicate proves that no row matches
+static bool may_match(Table *table, PScanPlan plan) {
+    for (size_t i = 0; i < plan->num_predicates; i++) {
+        PIndex index = plan->predicates[i].column->index;
+        if (index != NULL && plan->predicates[i].op == OP_EQ && !index_may_contain(index, plan->predicates[i].value))
+            return false;
+    }
+    return true;
+}
+
+/* Range scan of the index on 'column' over the keys allowed by the predicates
+   on the column, or by 'only' if it is not NULL. Returns NULL if no key is allowed. */
+static vector_t *index_scan(PScanPlan plan, Column *column, struct ScanPredicate *only) {
+    const void *start = column->type->min_val(), *end = column->type->max_val();
+    if (only != NULL)
+        predicate_interval(only, &start, &end);
+    else
+        for (size_t i = 0; i < plan->num_predicates; i++)
+            if (plan->predicates[i].column == column)
+                predicate_interval(&plan->predicates[i], &start, &end);
+    if (column->type->compare(start, end) > 0)
+        return NULL;
+    return index_select(column->index, start, end);
+}
+
+/*
+    Sets of records, sorted by disk_pointer so that they are merged in linear
+    time and the rows are read in the order of the data file.
+*/
+
+static int compare_disk_pointer(const void *a, const void *b) {
+    disk_pointer x = *(const disk_pointer *)a, y = *(const disk_pointer *)b;
+    return (x > y) - (x < y);
+}
+
+//Returns the sorted records of 'dps' in a new array, destroys 'dps'
+static disk_pointer *record_set_create(vector_t *dps, size_t *p_num) {
+    size_t num = dps ? vector_size(dps) : 0;
+    disk_pointer *records = (disk_pointer *)malloc((num ? num : 1) * sizeof(disk_pointer));
+    for (size_t i = 0; i < num; i++)
+        records[i] = *(disk_pointer *)vector_get(dps, i);
+    if (dps)
+        vector_destroy(dps);
+    qsort(records, num, sizeof(disk_pointer), compare_disk_pointer);
+    *p_num = num;
+    return records;
+}
+
+//Keeps the records of 'a' that are also in 'b', returns the new size of 'a'
+static size_t record_set_intersect(disk_pointer *a, size_t num_a, const disk_pointer *b, size_t num_b) {
+    size_t i = 0, j = 0, num = 0;
+    while (i < num_a && j < num_b) {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else {
+            a[num++] = a[i++];
+            j++;
+        }
+    }
+    return num;
+}
+
+//Removes the duplicates of sorted 'records', returns the new size
+static size_t record_set_unique(disk_pointer *records, size_t num) {
+    size_t n = 0;
+    for (size_t i = 0; i < num; i++)
+        if (n == 0 || records[i] != records[n - 1])
+            records[n++] = records[i];
+    return n;
+}
+
+/*
+    Planner
+
+    The access path of a query is chosen by comparing estimated costs, in
+    units of one sequential read of SEQ_SCAN_IO_BYTES. The number of rows
+    matching a set of predicates is estimated from a sample of the rows of
+    the table, which also accounts for correlated columns.
+*/
+
+#define STATS_SAMPLE_ROWS      1024
+#define RANDOM_READ_COST       4.0   //reading one row by its disk_pointer
+#define INDEX_DESCENT_COST     3.0   //reading the inner nodes down to a leaf
+#define INDEX_ENTRIES_PER_READ 100.0 //entries read from the index by one IO
+
+struct TableStats {
+    size_t num_rows;   //rows in the table when sampled
+    size_t num_sample;
+    void *sample;      //'num_sample' rows spread evenly over the data file
+};
+
+static void table_stats_destroy(struct TableStats *stats) {
+    if (stats == NULL)
+        return;
+    free(stats->sample);
+    free(stats);
+}
+
+//Returns the statistics of 'table', sampled again when the table has grown
+static struct TableStats *table_stats(Table *table) {
+    size_t num_rows = table_num_rows(table);
+    struct TableStats *stats = table->stats;
+    if (stats != NULL && (num_rows == stats->num_rows || (stats->num_sample == STATS_SAMPLE_ROWS && num_rows < 2 * stats->num_rows)))
+        return stats;
+    table_stats_destroy(stats);
+    stats = (struct TableStats *)malloc(sizeof(struct TableStats));
+    stats->num_rows = num_rows;
+    stats->num_sample = num_rows < STATS_SAMPLE_ROWS ? num_rows : STATS_SAMPLE_ROWS;
+    stats->sample = malloc((stats->num_sample ? stats->num_sample : 1) * table->row_size);
+    for (size_t i = 0; i < stats->num_sample; i++)
+        read_row(table, row_record(table, i * num_rows / stats->num_sample), stats->sample + i * table->row_size);
+    table->stats = stats;
+    return stats;
+}
+
+/* Estimated number of rows matching the predicates of 'plan' for which 'use'
+   is true, all of them or any of them as in 'plan'. */
+static double estimate_rows(Table *table, PScanPlan plan, const bool *use) {
+    struct TableStats *stats = table_stats(table);
+    if (stats->num_sample == 0)
+        return 0;
+    size_t num_match = 0;
+    for (size_t i = 0; i < stats->num_sample; i++) {
+        const void *row = stats->sample + i * table->row_size;
+        bool match = !plan->any;
+        for (size_t k = 0; k < plan->num_predicates; k++)
+            if (use[k] && predicate_match(&plan->predicates[k], row) == plan->any) {
+                match = plan->any;
+                break;
+            }
+        if (match)
+            num_match++;
+    }
+    //a value missed by the sample is still expected to match a few rows
+    double fraction = num_match ? (double)num_match / stats->num_sample : 0.5 / stats->num_sample;
+    return fraction * stats->num_rows;
+}
+
+/* Cost of a sequential scan returning 'rows' rows. A scan of LAYOUT_PAX reads
+   the columns of the predicates of all pages, and the other columns of the
+   plan of the pages with matching rows only. */
+static double seq_scan_cost(Table *table, PScanPlan plan, double rows) {
+    size_t num_rows = table_num_rows(table);
+    if (table->layout == LAYOUT_PAX) {
+        double num_pages = (double)((num_rows + table->page_rows - 1) / table->page_rows);
+        size_t used_size = plan_uses_nulls(plan) ? table->null_size : 0, read_size = table->null_size;
+        for (size_t i = 0; i < table->num_columns; i++) {
+            if (plan_uses_column(plan, &table->columns[i]))
+                used_size += table->columns[i].size;
+            if (plan->columns == NULL || plan->columns[i])
+                read_size += table->columns[i].size;
+        }
+        double match_pages = rows < num_pages ? rows : num_pages;
+        double bytes = num_pages * PAX_HEADER_SIZE(table->num_cells) + (double)num_rows * used_size
+            + match_pages * table->page_rows * (read_size - used_size);
+        return bytes / SEQ_SCAN_IO_BYTES;
+    }
+    size_t block_size = table->data->block_size;
+    size_t rows_per_read = block_size >= SEQ_SCAN_IO_BYTES ? 1 : SEQ_SCAN_IO_BYTES / block_size;
+    return (double)((num_rows + rows_per_read - 1) / rows_per_read);
+}
+
+/* Cost of fetching 'rows' rows by their records. The records of a batch of
+   FETCH_BATCH_ROWS are read in file order, so its rows falling in the same
+   read of SEQ_SCAN_IO_BYTES cost one random read: a batch of b rows spread
+   over the n reads of the data file touches about n * b / (n + b) of them. */
+static double fetch_cost(Table *table, double rows) {
+    size_t row_bytes = table->layout == LAYOUT_PAX ? table->row_size : table->data->block_size;
+    double num_reads = (double)table_num_rows(table) * row_bytes / SEQ_SCAN_IO_BYTES;
+    if (num_reads < 1)
+        num_reads = 1;
+    double num_batches = (double)(size_t)(rows / FETCH_BATCH_ROWS);
+    double rest = rows - num_batches * FETCH_BATCH_ROWS;
+    double touched = num_batches * num_reads * FETCH_BATCH_ROWS / (num_reads + FETCH_BATCH_ROWS) + num_reads * rest / (num_reads + rest);
+    return touched * RANDOM_READ_COST;
+}
+
+static double index_probe_cost(double num_entries) {
+    return INDEX_DESCENT_COST + num_entries / INDEX_ENTRIES_PER_READ;
+}
+
+typedef enum {
+    ACCESS_NONE,            //no row can match
+    ACCESS_SEQ_SCAN,
+    ACCESS_INDEX_SCAN,      //one range scan, rows in key order
+    ACCESS_INDEX_INTERSECT, //record sets of several range scans intersected
+    ACCESS_INDEX_UNION,     //record sets of several range scans unioned
+} AccessPath;
+
+static const char *access_path_name(AccessPath path) {
+    switch (path) {
+        case ACCESS_NONE: return "NO ROWS";
+        case ACCESS_SEQ_SCAN: return "SEQ SCAN";
+        case ACCESS_INDEX_SCAN: return "INDEX SCAN";
+        case ACCESS_INDEX_INTERSECT: return "INDEX INTERSECT";
+        case ACCESS_INDEX_UNION: return "INDEX UNION";
+    }
+    return "";
+}
+
+typedef struct AccessPlan {
+    AccessPath path;
+    size_t num_probes;
+    Column **columns;              //column of each index range scan
+    struct ScanPredicate **only;   //predicate of each range scan, NULL for all predicates on the column
+    double rows;                   //estimated rows returned
+    double cost;
+} *PAccessPlan;
+
+static void access_plan_destroy(PAccessPlan access) {
+    free(access->columns);
+    free(access->only);
+    free(access);
+}
+
+static PAccessPlan access_plan_create(PScanPlan plan) {
+    size_t num = plan->num_predicates ? plan->num_predicates : 1;
+    PAccessPlan access = (PAccessPlan)malloc(sizeof(struct AccessPlan));
+    access->path = ACCESS_SEQ_SCAN;
+    access->num_probes = 0;
+    access->columns = (Column **)malloc(num * sizeof(Column *));
+    access->only = (struct ScanPredicate **)malloc(num * sizeof(struct ScanPredicate *));
+    access->rows = access->cost = 0;
+    return access;
+}
+
+//Rows matching all predicates: one index, several intersected, or a sequential scan
+static void plan_all_of(Table *table, PScanPlan plan, PAccessPlan access) {
+    size_t num = plan->num_predicates ? plan->num_predicates : 1;
+    bool *use = (bool *)calloc(num, sizeof(bool));
+    Column **columns = (Column **)malloc(num * sizeof(Column *));
+    double *rows = (double *)malloc(num * sizeof(double));
+    size_t num_columns = 0;
+    //indexed columns with predicates, by estimated rows
+    for (size_t i = 0; i < plan->num_predicates; i++) {
+        Column *column = plan->predicates[i].column;
+        size_t k;
+        if (column->index == NULL || is_null_test(plan->predicates[i].op))
+            continue;
+        for (k = 0; k < num_columns && columns[k] != column; k++)
+            ;
+        if (k < num_columns)
+            continue;
+        for (size_t j = 0; j < plan->num_predicates; j++)
+            use[j] = plan->predicates[j].column == column;
+        double column_rows = estimate_rows(table, plan, use);
+        for (k = num_columns++; k > 0 && rows[k - 1] > column_rows; k--) {
+            columns[k] = columns[k - 1];
+            rows[k] = rows[k - 1];
+        }
+        columns[k] = column;
+        rows[k] = column_rows;
+    }
+    for (size_t j = 0; j < plan->num_predicates; j++)
+        use[j] = true;
+    access->rows = estimate_rows(table, plan, use);
+    access->cost = seq_scan_cost(table, plan, access->rows);
+    //the first k indices, each one pays off if it saves more row reads than its probe costs
+    double probe_cost = 0;
+    for (size_t k = 0; k < num_columns; k++) {
+        probe_cost += index_probe_cost(rows[k]);
+        for (size_t j = 0; j < plan->num_predicates; j++) {
+            use[j] = false;
+            for (size_t c = 0; c <= k; c++)
+                if (plan->predicates[j].column == columns[c])
+                    use[j] = true;
+        }
+        double cost = probe_cost + fetch_cost(table, estimate_rows(table, plan, use));
+        if (cost < access->cost) {
+            access->path = k == 0 ? ACCESS_INDEX_SCAN : ACCESS_INDEX_INTERSECT;
+            access->num_probes = k + 1;
+            access->cost = cost;
+        }
+    }
+    for (size_t k = 0; k < access->num_probes; k++) {
+        access->columns[k] = columns[k];
+        access->only[k] = NULL;
+    }
+    free(use);
+    free(columns);
+    free(rows);
+}
+
+//Rows matching any predicate: the union of one range scan per predicate, or a sequential scan
+static void plan_any_of(Table *table, PScanPlan plan, PAccessPlan access) {
+    size_t num = plan->num_predicates ? plan->num_predicates : 1;
+    bool *use = (bool *)calloc(num, sizeof(bool));
+    double cost = 0;
+    bool indexed = true;
+    for (size_t i = 0; i < plan->num_predicates; i++) {
+        struct ScanPredicate *predicate = &plan->predicates[i];
+        if (predicate->column->index == NULL || is_null_test(predicate->op)) {
+            indexed = false;
+            break;
+        }
+        if (predicate->op == OP_EQ && !index_may_contain(predicate->column->index, predicate->value))
+            continue; //no range scan for this one
+        use[i] = true;
+        cost += index_probe_cost(estimate_rows(table, plan, use));
+        use[i] = false;
+        access->columns[access->num_probes] = predicate->column;
+        access->only[access->num_probes++] = predicate;
+    }
+    for (size_t i = 0; i < plan->num_predicates; i++)
+        use[i] = true;
+    access->rows = estimate_rows(table, plan, use);
+    access->cost = seq_scan_cost(table, plan, access->rows);
+    cost += fetch_cost(table, access->rows);
+    if (indexed && access->num_probes == 0) {
+        access->path = ACCESS_NONE;
+        access->rows = access->cost = 0;
+    }
+    else if (indexed && cost < access->cost) {
+        access->path = ACCESS_INDEX_UNION;
+        access->cost = cost;
+    }
+    else
+        access->num_probes = 0;
+    free(use);
+}
+
+static PAccessPlan plan_access(Table *table, PScanPlan plan) {
+    PAccessPlan access = access_plan_create(plan);
+    if (!plan->any && !may_match(table, plan)) {
+        //answered in memory, no disk reads
+        access->path = ACCESS_NONE;
+        return access;
+    }
+    if (plan->any)
+        plan_any_of(table, plan, access);
+    else
+        plan_all_of(table, plan, access);
+    return access;
+}
+
+/*
+    Parallel scan
+
+    Rows are fixed-size blocks from data_start_pos(), so the data file is split
+    into contiguous block ranges, one per thread. Each thread reads its range
+    with pread in chunks of SCAN_CHUNK_SIZE bytes, or page by page for
+    LAYOUT_PAX, and filters the rows itself.
+*/
+
+#define SCAN_MAX_THREADS 8
+#define SCAN_MIN_ROWS    4096        //rows per scanning thread at least
+#define SCAN_CHUNK_SIZE  (256 << 10) //bytes read by one IO
+
+/* Called by thread 'worker' for each matching row of its range, in the order
+   of the data file. Returns 0 to go on. */
+typedef int (*scan_row_fn)(void *arg, int worker, const void *row, disk_pointer dp);
+
+struct scan_worker {
+    Table *table;
+    PScanPlan plan; //NULL for all rows
+    scan_row_fn fn;
+    void *arg;
+    int id;
+    size_t first;   //first row, or first page of LAYOUT_PAX
+    size_t num;     //rows, or pages of LAYOUT_PAX
+    bool started;   //scanning in its own thread
+    int ret;
+};
+
+static _Atomic int scan_threads; //set by table_set_scan_threads, 0 for the number of processors
+
+void table_set_scan_threads(int num_threads) {
+    atomic_store(&scan_threads, num_threads > 0 ? num_threads : 0);
+}
+
+//Number of threads scanning 'num_rows' rows
+static int scan_num_threads(size_t num_rows) {
+    int num_threads = atomic_load(&scan_threads);
+    if (num_threads == 0)
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > SCAN_MAX_THREADS)
+        num_threads = SCAN_MAX_THREADS;
+    if (num_threads > num_rows / SCAN_MIN_ROWS)
+        num_threads = num_rows / SCAN_MIN_ROWS;
+    return num_threads < 1 ? 1 : num_threads;
+}
+
+//scans the rows [first, first + num) of the data file
+static void scan_rows(struct scan_worker *worker) {
+    DISK *data = worker->table->data;
+    size_t block_size = data->block_size;
+    size_t chunk_rows = block_size >= SCAN_CHUNK_SIZE ? 1 : SCAN_CHUNK_SIZE / block_size;
+    void *buffer = malloc(chunk_rows * block_size);
+    uint64_t *bitmap = (uint64_t *)malloc(2 * BITMAP_WORDS(chunk_rows) * sizeof(uint64_t));
+    if (buffer == NULL || bitmap == NULL) {
+        free(buffer);
+        free(bitmap);
+        worker->ret = ENOMEM;
+        return;
+    }
+    disk_pointer dp = next_n_pointer(data, data_start_pos(), worker->first);
+    size_t num_left = worker->num;
+    while (num_left > 0 && worker->ret == 0) {
+        size_t num = num_left < chunk_rows ? num_left : chunk_rows;
+        int num_read = copy_to_memory_rs(data, dp, num, buffer);
+        if (num_read < 0 || num_read < num) {
+            worker->ret = EIO;
+            break;
+        }
+        size_t row_no = worker->first + worker->num - num_left;
+        if (worker->plan == NULL) {
+            for (size_t i = 0; i < num && worker->ret == 0; i++)
+                if (!table_row_deleted(worker->table, row_no + i))
+                    worker->ret = worker->fn(worker->arg, worker->id, buffer + i * block_size, next_n_pointer(data, dp, i));
+        }
+        else {
+            scan_plan_filter_rows(worker->plan, buffer, block_size, num, bitmap, bitmap + BITMAP_WORDS(chunk_rows));
+            mask_deleted(worker->table, row_no, num, bitmap);
+            for (size_t i = bitmap_next(bitmap, 0, num); i < num && worker->ret == 0; i = bitmap_next(bitmap, i + 1, num))
+                worker->ret = worker->fn(worker->arg, worker->id, buffer + i * block_size, next_n_pointer(data, dp, i));
+        }
+        dp = next_n_pointer(data, dp, num);
+        num_left -= num;
+    }
+    free(buffer);
+    free(bitmap);
+}
+
+//scans the pages [first, first + num) of a data file of LAYOUT_PAX
+static void scan_pages(struct scan_worker *worker) {
+    Table *table = worker->table;
+    void *page = malloc(table->data->block_size);
+    void *rows = malloc(table->page_rows * table->row_size);
+    record_t *records = (record_t *)malloc(table->page_rows * sizeof(record_t));
+    if (page == NULL || rows == NULL || records == NULL)
+        worker->ret = ENOMEM;
+    for (size_t p = 0; p < worker->num && worker->ret == 0; p++) {
+        disk_pointer page_dp = next_n_pointer(table->data, data_start_pos(), worker->first + p);
+        int num = pax_scan_page(table, worker->plan, page_dp, page, rows, records);
+        if (num < 0)
+            worker->ret = EIO;
+        for (int i = 0; i < num && worker->ret == 0; i++)
+            worker->ret = worker->fn(worker->arg, worker->id, rows + i * table->row_size, records[i]);
+    }
+    free(page);
+    free(rows);
+    free(records);
+}
+
+static void *scan_range(void *arg) {
+    struct scan_worker *worker = (struct scan_worker *)arg;
+    if (worker->table->layout == LAYOUT_PAX)
+        scan_pages(worker);
+    else
+        scan_rows(worker);
+    return NULL;
+}
+
+/* Calls 'fn' for the rows of the first 'num_rows' rows of 'table' matching
+   'plan' (all of them if it is NULL) from 'num_threads' threads, see
+   scan_num_threads. Returns 0 or the first error of a thread. */
+static int parallel_scan(Table *table, PScanPlan plan, size_t num_rows, int num_threads, scan_row_fn fn, void *arg) {
+    //LAYOUT_PAX is split into ranges of whole pages
+    size_t num_units = table->layout == LAYOUT_PAX ? (num_rows + table->page_rows - 1) / table->page_rows : num_rows;
+    if (num_threads > num_units)
+        num_threads = num_units ? num_units : 1;
+    struct scan_worker *workers = malloc(num_threads * sizeof(struct scan_worker));
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        free(workers);
+        free(threads);
+        return ENOMEM;
+    }
+    size_t first = 0;
+    int ret = 0;
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].table = table;
+        workers[i].plan = plan;
+        workers[i].fn = fn;
+        workers[i].arg = arg;
+        workers[i].id = i;
+        workers[i].first = first;
+        workers[i].num = num_units / num_threads + (i < num_units % num_threads ? 1 : 0);
+        workers[i].ret = 0;
+        first += workers[i].num;
+        workers[i].started = pthread_create(&threads[i], NULL, scan_range, &workers[i]) == 0;
+        if (!workers[i].started)
+            scan_range(&workers[i]); //scan the range in this thread instead
+    }
+    for (int i = 0; i < num_threads; i++) {
+        if (workers[i].started)
+            pthread_join(threads[i], NULL);
+        if (workers[i].ret != 0 && ret == 0)
+            ret = workers[i].ret;
+    }
+    free(workers);
+    free(threads);
+    return ret;
+}
+
+struct scan_filter {
+    PScanPlan plan;
+    table_row_consumer consume;
+    void *arg;
+};
+
+static int filter_row(void *arg, int worker, const void *row, disk_pointer dp) {
+    struct scan_filter *filter = (struct scan_filter *)arg;
+    return filter->consume(filter->arg, worker, row);
+}
+
+int table_scan_workers(Table *table) {
+    return scan_num_threads(table_num_rows(table));
+}
+
+int table_scan_parallel(Table *table, const Predicate *predicates, size_t num_predicates, bool any, table_row_consumer consume, void *arg) {
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL)
+        return EINVAL;
+    fflush(table->data->file); //rows are read with pread
+    size_t num_rows = table_num_rows(table);
+    struct scan_filter filter = {plan, consume, arg};
+    int ret = parallel_scan(table, plan, num_rows, scan_num_threads(num_rows), filter_row, &filter);
+    scan_plan_destroy(plan);
+    return ret;
+}
+
+/*
+    The cursor of a large sequential scan runs a parallel scan in the
+    background. Each thread collects its matching rows in its own output chunk
+    and queues the chunk once it is full; the cursor hands out the rows of the
+    queued chunks as they come, so partitions are interleaved.
+*/
+
+#define SCAN_OUTPUT_SIZE       (64 << 10) //bytes of rows in an output chunk
+#define SCAN_MAX_QUEUED_CHUNKS 4          //per thread
+
+struct ScanChunk {
+    struct ScanChunk *next;
+    size_t num_rows;
+    char rows[];
+};
+
+struct ParallelScan {
+    Table *table;
+    PScanPlan plan;
+    size_t num_rows;
+    int num_threads;
+    size_t chunk_rows;
+    struct ScanChunk **output; //chunk being filled by each thread
+    pthread_t thread;          //runs parallel_scan
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct ScanChunk *head, *tail; //queued chunks
+    size_t num_queued;
+    bool done;     //all chunks are queued
+    bool cancel;   //the cursor is closed
+    int ret;
+};
+
+//Queues 'chunk', waiting while the queue is full. Returns ECANCELED if the cursor is closed.
+static int queue_chunk(struct ParallelScan *scan, struct ScanChunk *chunk) {
+    int ret = 0;
+    pthread_mutex_lock(&scan->mutex);
+    while (scan->num_queued >= (size_t)scan->num_threads * SCAN_MAX_QUEUED_CHUNKS && !scan->cancel)
+        pthread_cond_wait(&scan->cond, &scan->mutex);
+    if (scan->cancel) {
+        free(chunk);
+        ret = ECANCELED;
+    }
+    else {
+        chunk->next = NULL;
+        if (scan->tail)
+            scan->tail->next = chunk;
+        else
+            scan->head = chunk;
+        scan->tail = chunk;
+        scan->num_queued++;
+        pthread_cond_broadcast(&scan->cond);
+    }
+    pthread_mutex_unlock(&scan->mutex);
+    return ret;
+}
+
+static int collect_row(void *arg, int worker, const void *row, disk_pointer dp) {
+    struct ParallelScan *scan = (struct ParallelScan *)arg;
+    size_t row_size = scan->table->row_size;
+    struct ScanChunk *chunk = scan->output[worker];
+    if (chunk == NULL) {
+        chunk = malloc(sizeof(struct ScanChunk) + scan->chunk_rows * row_size);
+        if (chunk == NULL)
+            return ENOMEM;
+        chunk->num_rows = 0;
+        scan->output[worker] = chunk;
+    }
+    char *out = chunk->rows + chunk->num_rows++ * row_size;
+    if (scan->plan->columns == NULL)
+        memcpy(out, row, row_size);
+    else {
+        //only the cells of the columns read are copied
+        for (size_t i = 0; i < scan->table->num_columns; i++)
+            if (scan->plan->columns[i])
+                memcpy(out + scan->table->columns[i].offset, row + scan->table->columns[i].offset, scan->table->columns[i].size);
+    }
+    if (chunk->num_rows < scan->chunk_rows)
+        return 0;
+    scan->output[worker] = NULL;
+    return queue_chunk(scan, chunk);
+}
+
+static void *run_parallel_scan(void *arg) {
+    struct ParallelScan *scan = (struct ParallelScan *)arg;
+    int ret = parallel_scan(scan->table, scan->plan, scan->num_rows, scan->num_threads, collect_row, scan);
+    //the chunks that are not full
+    for (int i = 0; i < scan->num_threads; i++) {
+        if (scan->output[i] != NULL && ret == 0 && scan->output[i]->num_rows > 0)
+            ret = queue_chunk(scan, scan->output[i]);
+        else
+            free(scan->output[i]);
+        scan->output[i] = NULL;
+    }
+    pthread_mutex_lock(&scan->mutex);
+    scan->ret = ret == ECANCELED ? 0 : ret;
+    scan->done = true;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->mutex);
+    return NULL;
+}
+
+//Starts a parallel scan in the background, NULL if the table is too small to split or out of memory
+static struct ParallelScan *parallel_scan_start(Table *table, PScanPlan plan) {
+    fflush(table->data->file); //rows are read with pread
+    size_t num_rows = table_num_rows(table);
+    int num_threads = scan_num_threads(num_rows);
+    if (num_threads < 2)
+        return NULL;
+    struct ParallelScan *scan = (struct ParallelScan *)malloc(sizeof(struct ParallelScan));
+    if (scan == NULL)
+        return NULL;
+    size_t row_size = table->row_size;
+    scan->table = table;
+    scan->plan = plan;
+    scan->num_rows = num_rows;
+    scan->num_threads = num_threads;
+    scan->chunk_rows = row_size >= SCAN_OUTPUT_SIZE ? 1 : SCAN_OUTPUT_SIZE / row_size;
+    scan->output = (struct ScanChunk **)calloc(num_threads, sizeof(struct ScanChunk *));
+    if (scan->output == NULL) {
+        free(scan);
+        return NULL;
+    }
+    pthread_mutex_init(&scan->mutex, NULL);
+    pthread_cond_init(&scan->cond, NULL);
+    scan->head = scan->tail = NULL;
+    scan->num_queued = 0;
+    scan->done = scan->cancel = false;
+    scan->ret = 0;
+    if (pthread_create(&scan->thread, NULL, run_parallel_scan, scan) != 0) {
+        pthread_mutex_destroy(&scan->mutex);
+        pthread_cond_destroy(&scan->cond);
+        free(scan->output);
+        free(scan);
+        return NULL;
+    }
+    return scan;
+}
+
+//Returns the next queued chunk, NULL after the last one
+static struct ScanChunk *parallel_scan_next(struct ParallelScan *scan) {
+    pthread_mutex_lock(&scan->mutex);
+    while (scan->head == NULL && !scan->done)
+        pthread_cond_wait(&scan->cond, &scan->mutex);
+    struct ScanChunk *chunk = scan->head;
+    if (chunk != NULL) {
+        scan->head = chunk->next;
+        if (scan->head == NULL)
+            scan->tail = NULL;
+        scan->num_queued--;
+        pthread_cond_broadcast(&scan->cond);
+    }
+    else if (scan->ret != 0)
+        fprintf(stderr, "Error %d in parallel scan\n", scan->ret);
+    pthread_mutex_unlock(&scan->mutex);
+    return chunk;
+}
+
+//Stops the threads if they are still scanning
+static void parallel_scan_stop(struct ParallelScan *scan) {
+    pthread_mutex_lock(&scan->mutex);
+    scan->cancel = true;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->mutex);
+    pthread_join(scan->thread, NULL);
+    while (scan->head != NULL) {
+        struct ScanChunk *next = scan->head->next;
+        free(scan->head);
+        scan->head = next;
+    }
+    pthread_mutex_destroy(&scan->mutex);
+    pthread_cond_destroy(&scan->cond);
+    free(scan->output);
+    free(scan);
+}
+
+/*
+    Cursor
+
+    Rows are handed out as pointers into the buffer of the cursor: a chunk of
+    the data file for a sequential scan, the matching rows of a page for a
+    sequential scan of LAYOUT_PAX, an output chunk of a parallel scan, or a
+    batch of rows fetched for an index path.
+*/
+
+struct Cursor {
+    Table *table;
+    PScanPlan plan;
+    PAccessPlan access;
+    void *buffer;
+    size_t num_blocks;    //capacity of 'buffer' in rows
+    size_t num_buffered;  //rows in 'buffer'
+    size_t pos;           //next row of 'buffer'
+    disk_pointer next;    //next block of a sequential scan, or next page of LAYOUT_PAX
+    size_t pages_left;    //pages of LAYOUT_PAX not scanned yet
+    void *page;           //page buffer of LAYOUT_PAX
+    bool filtered;        //the rows in 'buffer' are known to match
+    uint64_t *selection;  //rows of 'buffer' matching the plan, for a sequential scan of LAYOUT_ROW
+    bool end;             //no row left to read into 'buffer'
+    disk_pointer *records; //rows of an index path in the order they are returned, or the records of a page
+    size_t num_records;
+    size_t record_pos;
+    struct ParallelScan *parallel; //NULL unless a large table is scanned
+    struct ScanChunk *chunk;       //output of the parallel scan being returned
+    const char *rows;              //'buffer' or the rows of 'chunk'
+    struct CursorSort *sort;       //NULL unless the rows are returned sorted
+    Column **projection;           //columns printed by cursor_print, NULL for all
+    size_t num_projection;
+};
+
+//Collects the records of the index path of 'access', but those of deleted rows
+static disk_pointer *access_records(Table *table, PScanPlan plan, PAccessPlan access, size_t *p_num) {
+    if (access->path == ACCESS_INDEX_SCAN) {
+        //rows in key order
+        vector_t *dps = index_scan(plan, access->columns[0], NULL);
+        size_t num = dps ? vector_size(dps) : 0;
+        disk_pointer *records = (disk_pointer *)malloc((num ? num : 1) * sizeof(disk_pointer));
+        for (size_t i = 0; i < num; i++)
+            records[i] = *(disk_pointer *)vector_get(dps, i);
+        if (dps)
+            vector_destroy(dps);
+        *p_num = drop_deleted(table, records, num);
+        return records;
+    }
+    //only the records in all sets (intersection) or in any set (union) are read
+    size_t num = 0, capacity = 0;
+    disk_pointer *records = NULL;
+    for (size_t k = 0; k < access->num_probes; k++) {
+        size_t num_other;
+        disk_pointer *other = record_set_create(index_scan(plan, access->columns[k], access->only[k]), &num_other);
+        if (access->path == ACCESS_INDEX_UNION) {
+            if (num + num_other > capacity) {
+                capacity = (num + num_other) * 2;
+                records = (disk_pointer *)realloc(records, capacity * sizeof(disk_pointer));
+            }
+            memcpy(records + num, other, num_other * sizeof(disk_pointer));
+            num += num_other;
+            free(other);
+        }
+        else if (records == NULL) {
+            records = other;
+            num = num_other;
+        }
+        else {
+            num = record_set_intersect(records, num, other, num_other);
+            free(other);
+        }
+        if (num == 0 && access->path == ACCESS_INDEX_INTERSECT)
+            break;
+    }
+    if (access->path == ACCESS_INDEX_UNION) {
+        qsort(records, num, sizeof(disk_pointer), compare_disk_pointer);
+        num = record_set_unique(records, num);
+    }
+    *p_num = drop_deleted(table, records, num);
+    return records;
+}
+
+//Opens a cursor reading the rows of 'plan' by 'access', the cursor owns both
+static PCursor cursor_open(Table *table, PScanPlan plan, PAccessPlan access) {
+    PCursor cursor = (PCursor)malloc(sizeof(struct Cursor));
+    size_t block_size = table->data->block_size;
+    cursor->table = table;
+    cursor->plan = plan;
+    cursor->access = access;
+    cursor->num_buffered = cursor->pos = 0;
+    cursor->next = data_start_pos();
+    cursor->pages_left = 0;
+    cursor->page = NULL;
+    cursor->filtered = false;
+    cursor->selection = NULL;
+    cursor->end = cursor->access->path == ACCESS_NONE;
+    cursor->records = NULL;
+    cursor->num_records = cursor->record_pos = 0;
+    bool seq_scan = cursor->access->path == ACCESS_SEQ_SCAN;
+    if (seq_scan && table->layout == LAYOUT_PAX)
+        cursor->num_blocks = table->page_rows;
+    else if (seq_scan)
+        cursor->num_blocks = block_size >= SEQ_SCAN_BATCH_BYTES ? 1 : SEQ_SCAN_BATCH_BYTES / block_size;
+    else
+        cursor->num_blocks = FETCH_BATCH_ROWS;
+    cursor->buffer = malloc(cursor->num_blocks * table->row_size);
+    cursor->rows = cursor->buffer;
+    cursor->chunk = NULL;
+    cursor->parallel = NULL;
+    cursor->sort = NULL;
+    cursor->projection = NULL;
+    cursor->num_projection = 0;
+    if (seq_scan)
+        cursor->parallel = parallel_scan_start(table, plan);
+    if (seq_scan && cursor->parallel == NULL && table->layout == LAYOUT_PAX) {
+        //pages are filtered as they are read
+        cursor->pages_left = (table_num_rows(table) + table->page_rows - 1) / table->page_rows;
+        cursor->page = malloc(block_size);
+        cursor->records = (disk_pointer *)malloc(table->page_rows * sizeof(disk_pointer));
+    }
+    else if (seq_scan && cursor->parallel == NULL)
+        cursor->selection = (uint64_t *)malloc(2 * BITMAP_WORDS(cursor->num_blocks) * sizeof(uint64_t));
+    else if (!seq_scan && cursor->access->path != ACCESS_NONE)
+        cursor->records = access_records(table, plan, cursor->access, &cursor->num_records);
+    //the rows of a parallel scan are filtered by its threads
+    cursor->filtered = cursor->parallel != NULL || cursor->page != NULL;
+    return cursor;
+}
+
+PCursor table_query(Table *table, const Predicate *predicates, size_t num_predicates, bool any) {
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL)
+        return NULL;
+    return cursor_open(table, plan, plan_access(table, plan));
+}
+
+PCursor table_query_columns(Table *table, const char **col_names, size_t num_cols,
+                            const Predicate *predicates, size_t num_predicates, bool any) {
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL)
+        return NULL;
+    Column **projection = (Column **)malloc((num_cols ? num_cols : 1) * sizeof(Column *));
+    for (size_t i = 0; i < num_cols; i++)
+        projection[i] = table_column(table, col_names[i]);
+    //the projection is known to the planner, a scan of LAYOUT_PAX costs less with fewer columns
+    if (scan_plan_project(table, plan, col_names, num_cols) != 0) {
+        free(projection);
+        scan_plan_destroy(plan);
+        return NULL;
+    }
+    PCursor cursor = cursor_open(table, plan, plan_access(table, plan));
+    cursor->projection = projection;
+    cursor->num_projection = num_cols;
+    return cursor;
+}
+
+//Reads the next rows into the buffer, returns false at the end
+static bool cursor_fill(PCursor cursor) {
+    Table *table = cursor->table;
+    DISK *data = table->data;
+    cursor->pos = cursor->num_buffered = 0;
+    if (cursor->end)
+        return false;
+    if (cursor->parallel != NULL) {
+        free(cursor->chunk);
+        cursor->chunk = parallel_scan_next(cursor->parallel);
+        if (cursor->chunk == NULL) {
+            cursor->end = true;
+            return false;
+        }
+        cursor->rows = cursor->chunk->rows;
+        cursor->num_buffered = cursor->chunk->num_rows;
+        return true;
+    }
+    if (cursor->page != NULL) {
+        //the next page with matching rows
+        while (cursor->num_buffered == 0 && cursor->pages_left > 0) {
+            int num = pax_scan_page(table, cursor->plan, cursor->next, cursor->page, cursor->buffer, cursor->records);
+            if (num < 0) {
+                fprintf(stderr, "Error in pax_scan_page\n");
+                cursor->pages_left = 0;
+                break;
+            }
+            cursor->num_buffered = num;
+            cursor->next = next_pointer(data, cursor->next);
+            cursor->pages_left--;
+        }
+        cursor->end = cursor->pages_left == 0;
+        return cursor->num_buffered > 0;
+    }
+    if (cursor->access->path != ACCESS_SEQ_SCAN) {
+        if (cursor->record_pos == cursor->num_records) {
+            cursor->end = true;
+            return false;
+        }
+        //the next batch of records, fetched in file order
+        size_t num = cursor->num_records - cursor->record_pos < cursor->num_blocks ? cursor->num_records - cursor->record_pos : cursor->num_blocks;
+        if (fetch_rows(table, cursor->plan->columns, cursor->records + cursor->record_pos, num, cursor->buffer) != 0) {
+            fprintf(stderr, "Error in fetch_rows\n");
+            cursor->end = true;
+            return false;
+        }
+        cursor->record_pos += num;
+        cursor->num_buffered = num;
+        return true;
+    }
+    int num_blocks_read = copy_to_memory_s(data, cursor->next, cursor->num_blocks, cursor->buffer);
+    if (num_blocks_read < 0) {
+        fprintf(stderr, "Error in copy_to_memory_s\n");
+        num_blocks_read = 0;
+    }
+    if (num_blocks_read < cursor->num_blocks)
+        cursor->end = true;
+    size_t row_no = record_row(table, cursor->next);
+    cursor->next = next_n_pointer(data, cursor->next, num_blocks_read);
+    cursor->num_buffered = num_blocks_read;
+    scan_plan_filter_rows(cursor->plan, cursor->buffer, table->row_size, num_blocks_read, cursor->selection, cursor->selection + BITMAP_WORDS(cursor->num_blocks));
+    mask_deleted(table, row_no, num_blocks_read, cursor->selection);
+    return num_blocks_read > 0;
+}
+
+//Returns the next row read by the access path
+static const void *cursor_scan_next(PCursor cursor) {
+    size_t row_size = cursor->table->row_size;
+    while (1) {
+        if (cursor->selection != NULL)
+            cursor->pos = bitmap_next(cursor->selection, cursor->pos, cursor->num_buffered);
+        while (cursor->pos < cursor->num_buffered) {
+            const void *row = cursor->rows + cursor->pos++ * row_size;
+            if (cursor->filtered || cursor->selection != NULL || scan_plan_match(cursor->plan, row))
+                return row;
+        }
+        if (!cursor_fill(cursor))
+            return NULL;
+    }
+}
+
+/*
+    Sorted cursors
+
+    The rows of the access path are read and sorted on the first call of
+    cursor_next, by a bounded heap for the first rows only or by an external
+    merge sort for all of them.
+*/
+
+#define SORT_MEMORY_BUDGET (64 << 20) //bytes of rows sorted in memory by default
+
+struct CursorSort {
+    size_t num_columns;
+    Column **columns;
+    bool *descending;
+    size_t limit;         //0 for all rows
+    size_t memory_budget;
+    size_t num_returned;
+    bool presorted;       //the access path returns the rows in order
+    bool sorted;          //the rows were read and sorted
+    PExtSort extsort;     //NULL for a top-N heap
+    char *top;            //max-heap of the first 'limit' rows, sorted once all are read
+    size_t num_top;
+    size_t top_pos;
+    char *swap;           //one row
+};
+
+static void cursor_sort_destroy(struct CursorSort *sort) {
+    if (sort == NULL)
+        return;
+    extsort_destroy(sort->extsort);
+    free(sort->columns);
+    free(sort->descending);
+    free(sort->top);
+    free(sort->swap);
+    free(sort);
+}
+
+static int compare_rows(const void *a, const void *b, void *arg) {
+    struct CursorSort *sort = (struct CursorSort *)arg;
+    for (size_t k = 0; k < sort->num_columns; k++) {
+        Column *column = sort->columns[k];
+        //NULLs come before all values
+        bool null_a = column_is_null(column, a), null_b = column_is_null(column, b);
+        int res = null_a || null_b ? null_b - null_a : column_compare(column, (const char *)a + column->offset, (const char *)b + column->offset);
+        if (res != 0)
+            return sort->descending[k] ? -res : res;
+    }
+    return 0;
+}
+
+static void top_swap(struct CursorSort *sort, size_t i, size_t j, size_t row_size) {
+    memcpy(sort->swap, sort->top + i * row_size, row_size);
+    memcpy(sort->top + i * row_size, sort->top + j * row_size, row_size);
+    memcpy(sort->top + j * row_size, sort->swap, row_size);
+}
+
+//Keeps 'row' if it is among the first 'limit' rows so far, the root of the heap is the last of them
+static void top_add(struct CursorSort *sort, const void *row, size_t row_size) {
+    size_t i;
+    if (sort->num_top < sort->limit) {
+        i = sort->num_top++;
+        memcpy(sort->top + i * row_size, row, row_size);
+        while (i > 0 && compare_rows(sort->top + (i - 1) / 2 * row_size, sort->top + i * row_size, sort) < 0) {
+            top_swap(sort, i, (i - 1) / 2, row_size);
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if (compare_rows(row, sort->top, sort) >= 0)
+        return;
+    memcpy(sort->top, row, row_size);
+    for (i = 0; ; ) {
+        size_t left = 2 * i + 1, right = left + 1, max = i;
+        if (left < sort->num_top && compare_rows(sort->top + left * row_size, sort->top + max * row_size, sort) > 0)
+            max = left;
+        if (right < sort->num_top && compare_rows(sort->top + right * row_size, sort->top + max * row_size, sort) > 0)
+            max = right;
+        if (max == i)
+            break;
+        top_swap(sort, i, max, row_size);
+        i = max;
+    }
+}
+
+//Reads the rows of the access path into the heap or the external sort
+static int cursor_sort_rows(PCursor cursor) {
+    struct CursorSort *sort = cursor->sort;
+    size_t row_size = cursor->table->row_size;
+    const void *row;
+    int ret = 0;
+    sort->sorted = true;
+    if (sort->limit > 0 && sort->limit <= sort->memory_budget / row_size) {
+        sort->top = malloc(sort->limit * row_size);
+        sort->swap = malloc(row_size);
+        if (sort->top == NULL || sort->swap == NULL)
+            return ENOMEM;
+        while ((row = cursor_scan_next(cursor)) != NULL)
+            top_add(sort, row, row_size);
+        qsort_r(sort->top, sort->num_top, row_size, compare_rows, sort);
+        return 0;
+    }
+    sort->extsort = extsort_create(row_size, compare_rows, sort, sort->memory_budget, 1);
+    if (sort->extsort == NULL)
+        return errno ? errno : ENOMEM;
+    while (ret == 0 && (row = cursor_scan_next(cursor)) != NULL)
+        ret = extsort_add(sort->extsort, 0, row);
+    if (ret == 0)
+        ret = extsort_finish(sort->extsort);
+    return ret;
+}
+
+const void *cursor_next(PCursor cursor) {
+    struct CursorSort *sort = cursor->sort;
+    if (sort == NULL)
+        return cursor_scan_next(cursor);
+    if (sort->limit > 0 && sort->num_returned == sort->limit)
+        return NULL;
+    const void *row;
+    int ret;
+    if (sort->presorted)
+        row = cursor_scan_next(cursor);
+    else if (!sort->sorted && (ret = cursor_sort_rows(cursor)) != 0) {
+        fprintf(stderr, "Error %d in sorting rows\n", ret);
+        row = NULL;
+    }
+    else if (sort->extsort == NULL)
+        row = sort->top_pos < sort->num_top ? sort->top + sort->top_pos++ * cursor->table->row_size : NULL;
+    else
+        row = extsort_next(sort->extsort);
+    if (row != NULL)
+        sort->num_returned++;
+    return row;
+}
+
+//Returns the sort of the columns of 'order_by', NULL for an unknown column
+static struct CursorSort *cursor_sort_create(Table *table, const OrderBy *order_by, size_t num_order_by, size_t limit, size_t memory_budget) {
+    struct CursorSort *sort = (struct CursorSort *)calloc(1, sizeof(struct CursorSort));
+    sort->columns = (Column **)malloc((num_order_by ? num_order_by : 1) * sizeof(Column *));
+    sort->descending = (bool *)malloc((num_order_by ? num_order_by : 1) * sizeof(bool));
+    for (size_t k = 0; k < num_order_by; k++) {
+        sort->columns[k] = table_column(table, order_by[k].col_name);
+        sort->descending[k] = order_by[k].descending;
+        if (sort->columns[k] == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", order_by[k].col_name);
+            cursor_sort_destroy(sort);
+            return NULL;
+        }
+    }
+    sort->num_columns = num_order_by;
+    sort->limit = limit;
+    sort->memory_budget = memory_budget ? memory_budget : SORT_MEMORY_BUDGET;
+    return sort;
+}
+
+//Sorts the rows of 'cursor' by 'sort', which the cursor owns
+static void cursor_set_sort(PCursor cursor, struct CursorSort *sort) {
+    //a range scan of an index returns the rows in key order
+    PAccessPlan access = cursor->access;
+    sort->presorted = sort->num_columns == 0 || (sort->num_columns == 1 && !sort->descending[0]
+        && access->path == ACCESS_INDEX_SCAN && access->columns[0] == sort->columns[0]);
+    cursor->sort = sort;
+}
+
+PCursor table_query_sorted(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                           const OrderBy *order_by, size_t num_order_by, size_t limit, size_t memory_budget) {
+    struct CursorSort *sort = cursor_sort_create(table, order_by, num_order_by, limit, memory_budget);
+    if (sort == NULL)
+        return NULL;
+    PCursor cursor = table_query(table, predicates, num_predicates, any);
+    if (cursor == NULL) {
+        cursor_sort_destroy(sort);
+        return NULL;
+    }
+    cursor_set_sort(cursor, sort);
+    return cursor;
+}
+
+void cursor_print(PCursor cursor) {
+    const void *row;
+    if (cursor == NULL)
+        return;
+    while ((row = cursor_next(cursor)) != NULL) {
+        if (cursor->projection == NULL) {
+            print_row(cursor->table, row);
+            continue;
+        }
+        for (size_t i = 0; i < cursor->num_projection; i++) {
+            Column *column = cursor->projection[i];
+            if (i) putchar(' ');
+            column_print(column, row);
+        }
+        printf("\n");
+    }
+}
+
+void cursor_close(PCursor cursor) {
+    if (cursor == NULL)
+        return;
+    if (cursor->parallel != NULL)
+        parallel_scan_stop(cursor->parallel);
+    free(cursor->chunk);
+    cursor_sort_destroy(cursor->sort);
+    access_plan_destroy(cursor->access);
+    scan_plan_destroy(cursor->plan);
+    free(cursor->records);
+    free(cursor->page);
+    free(cursor->selection);
+    free(cursor->buffer);
+    free(cursor->projection);
+    free(cursor);
+}
+
+int column_int(const Column *column, const void *row) {
+    int val;
+    memcpy(&val, row + column->offset, sizeof(int));
+    return val;
+}
+
+long long column_bigint(const Column *column, const void *row) {
+    long long val;
+    memcpy(&val, row + column->offset, sizeof(long long));
+    return val;
+}
+
+size_t column_text(const Column *column, const void *row, char *buf, size_t size) {
+    const void *value = row + column->offset;
+    size_t len = text_cell_len(value);
+    if (len <= size) {
+        if (varheap_load(column->heap, value, buf) != 0)
+            fprintf(stderr, "Can't read a value of column '%s'\n", column->name);
+        return len;
+    }
+    char *copy = (char *)malloc(len);
+    if (varheap_load(column->heap, value, copy) != 0)
+        fprintf(stderr, "Can't read a value of column '%s'\n", column->name);
+    memcpy(buf, copy, size);
+    free(copy);
+    return len;
+}
+
+void table_select_where(Table *table, const Predicate *predicates, size_t num_predicates) {
+    PCursor cursor = table_query(table, predicates, num_predicates, false);
+    cursor_print(cursor);
+    cursor_close(cursor);
+}
+
+void table_select_any(Table *table, const Predicate *predicates, size_t num_predicates) {
+    PCursor cursor = table_query(table, predicates, num_predicates, true);
+    cursor_print(cursor);
+    cursor_close(cursor);
+}
+
+void table_select_columns(Table *table, const char **col_names, size_t num_cols, const Predicate *predicates, size_t num_predicates) {
+    PCursor cursor = table_query_columns(table, col_names, num_cols, predicates, num_predicates, false);
+    cursor_print(cursor);
+    cursor_close(cursor);
+}
+
+void table_explain(Table *table, const Predicate *predicates, size_t num_predicates, bool any) {
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL)
+        return;
+    PAccessPlan access = plan_access(table, plan);
+    printf("%s", access_path_name(access->path));
+    for (size_t k = 0; k < access->num_probes; k++)
+        printf("%s%s", k ? ", " : " on ", access->columns[k]->name);
+    if (access->path != ACCESS_NONE)
+        printf(" (rows=%.0f, cost=%.1f)", access->rows, access->cost);
+    printf("\n");
+    access_plan_destroy(access);
+    scan_plan_destroy(plan);
+}
+
+void table_select(Table *table, ColNameValueMap *example) {
+    size_t num = map_size(example);
+    char **keys = (char **)malloc((num ? num : 1) * sizeof(char *));
+    char **values = (char **)malloc((num ? num : 1) * sizeof(char *));
+    Predicate *predicates = (Predicate *)malloc((num ? num : 1) * sizeof(Predicate));
+    map_sort(example, (void **)keys, (void **)values);
+    for (size_t i = 0; i < num; i++) {
+        predicates[i].col_name = keys[i];
+        predicates[i].op = OP_EQ;
+        predicates[i].value = values[i];
+        predicates[i].value2 = NULL;
+    }
+    table_select_where(table, predicates, num);
+    free(predicates);
+    free(keys);
+    free(values);
+}
+
+/*
+    Prepared statements
+
+    Columns are looked up once, when a statement is prepared. Its values are
+    native, so an execution parses no string and builds no map.
+*/
+
+#define STATEMENT_BATCH_ROWS 1024 //rows appended at a time by statement_insert
+
+struct Statement {
+    Table *table;
+    size_t num_params;
+    Column **params;     //column of each parameter
+    void *rows;          //STATEMENT_BATCH_ROWS rows being inserted, NULL for a select
+    record_t *records;
+    PScanPlan plan;      //predicates without values for a select, NULL for an insert
+    Column **projection; //NULL for all columns
+    size_t num_projection;
+    struct CursorSort *sort; //order of the rows of a select, NULL for any order
+};
+
+static PStatement statement_create(Table *table, size_t num_params) {
+    PStatement stmt = (PStatement)calloc(1, sizeof(struct Statement));
+    stmt->table = table;
+    stmt->num_params = num_params;
+    stmt->params = (Column **)malloc((num_params ? num_params : 1) * sizeof(Column *));
+    return stmt;
+}
+
+void statement_close(PStatement stmt) {
+    if (stmt == NULL)
+        return;
+    free(stmt->params);
+    free(stmt->rows);
+    free(stmt->records);
+    scan_plan_destroy(stmt->plan);
+    free(stmt->projection);
+    cursor_sort_destroy(stmt->sort);
+    free(stmt);
+}
+
+size_t statement_num_params(PStatement stmt) {
+    return stmt->num_params;
+}
+
+PStatement table_prepare_insert(Table *table, const char **col_names, size_t num_cols) {
+    if (col_names == NULL)
+        num_cols = table->num_columns;
+    PStatement stmt = statement_create(table, num_cols);
+    bool *bound = (bool *)calloc(table->num_columns ? table->num_columns : 1, sizeof(bool));
+    for (size_t i = 0; i < num_cols; i++) {
+        Column *column = col_names ? table_column(table, col_names[i]) : &table->columns[i];
+        if (column == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", col_names[i]);
+            goto ERR;
+        }
+        if (bound[column->id]) {
+            fprintf(stderr, "Column \'%s\' is bound twice!\n", column->name);
+            goto ERR;
+        }
+        bound[column->id] = true;
+        stmt->params[i] = column;
+    }
+    for (size_t i = 0; i < table->num_columns; i++)
+        if (!bound[i] && table->columns[i].null_bit < 0) {
+            fprintf(stderr, "Column \'%s\' can't be null!\n", table->columns[i].name);
+            goto ERR;
+        }
+    //the columns left unbound are NULL in every row
+    stmt->rows = calloc(STATEMENT_BATCH_ROWS, table->row_size);
+    for (size_t i = 0; i < table->num_columns; i++)
+        for (size_t j = 0; j < STATEMENT_BATCH_ROWS && !bound[i]; j++)
+            column_set_null(&table->columns[i], stmt->rows + j * table->row_size, true);
+    free(bound);
+    stmt->records = (record_t *)malloc(STATEMENT_BATCH_ROWS * sizeof(record_t));
+    return stmt;
+ERR:
+    free(bound);
+    statement_close(stmt);
+    return NULL;
+}
+
+int statement_insert(PStatement stmt, const void *const *values, size_t num_rows) {
+    return statement_insert_nulls(stmt, values, NULL, num_rows);
+}
+
+int statement_insert_nulls(PStatement stmt, const void *const *values, const uint64_t *const *nulls, size_t num_rows) {
+    if (stmt->rows == NULL)
+        return EINVAL;
+    Table *table = stmt->table;
+    size_t row_size = table->row_size;
+    int ret = 0;
+    //no row is inserted if a NOT NULL column has a NULL
+    size_t num_words = BITMAP_WORDS(num_rows);
+    for (size_t k = 0; k < stmt->num_params && nulls != NULL; k++) {
+        if (nulls[k] == NULL || stmt->params[k]->null_bit >= 0)
+            continue;
+        for (size_t w = 0; w < num_words; w++) {
+            uint64_t word = nulls[k][w];
+            if (w == num_words - 1 && num_rows % 64)
+                word &= ~0ULL >> (64 - num_rows % 64);
+            if (word != 0) {
+                fprintf(stderr, "Column \'%s\' can't be null!\n", stmt->params[k]->name);
+                return EINVAL;
+            }
+        }
+    }
+    for (size_t first = 0; first < num_rows && ret == 0; first += STATEMENT_BATCH_ROWS) {
+        size_t num = num_rows - first < STATEMENT_BATCH_ROWS ? num_rows - first : STATEMENT_BATCH_ROWS;
+        //the values of each column are scattered into the rows
+        for (size_t k = 0; k < stmt->num_params; k++) {
+            Column *column = stmt->params[k];
+            const char *src = (const char *)values[k] + first * column->size;
+            char *dst = (char *)stmt->rows + column->offset;
+            for (size_t i = 0; i < num; i++)
+                memcpy(dst + i * row_size, src + i * column->size, column->size);
+            const uint64_t *null_bits = nulls != NULL ? nulls[k] : NULL;
+            for (size_t i = 0; i < num && column->null_bit >= 0; i++) {
+                size_t row_no = first + i;
+                column_set_null(column, stmt->rows + i * row_size, null_bits != NULL && (null_bits[row_no / 64] >> (row_no % 64) & 1));
+            }
+        }
+        ret = store_rows(table, stmt->rows, num);
+        if (ret == 0)
+            ret = append_data(table, stmt->rows, num, stmt->records);
+        for (size_t i = 0; i < table->num_columns && ret == 0; i++) {
+            Column *column = &table->columns[i];
+            if (column->index == NULL)
+                continue;
+            if (num == 1)
+                ret = index_insert(column->index, stmt->rows + column->offset, stmt->records[0]);
+            else
+                ret = index_insert_batch(column->index, stmt->rows + column->offset, row_size, stmt->records, num);
+        }
+    }
+    return ret;
+}
+
+PStatement table_prepare_select(Table *table, const char **col_names, size_t num_cols,
+                                const PreparedPredicate *predicates, size_t num_predicates, bool any) {
+    size_t num_params = 0;
+    for (size_t i = 0; i < num_predicates; i++)
+        num_params += predicates[i].op == OP_BETWEEN ? 2 : !is_null_test(predicates[i].op);
+    PStatement stmt = statement_create(table, num_params);
+    PScanPlan plan = (PScanPlan)malloc(sizeof(struct ScanPlan));
+    plan->num_predicates = 0;
+    plan->any = any;
+    plan->columns = NULL;
+    plan->predicates = (struct ScanPredicate *)malloc((num_predicates ? num_predicates : 1) * sizeof(struct ScanPredicate));
+    stmt->plan = plan;
+    size_t k = 0;
+    for (size_t i = 0; i < num_predicates; i++) {
+        Column *column = table_column(table, predicates[i].col_name);
+        if (column == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", predicates[i].col_name);
+            goto ERR;
+        }
+        struct ScanPredicate *predicate = &plan->predicates[plan->num_predicates++];
+        predicate->column = column;
+        predicate->offset = column->offset;
+        predicate->compare = column->type->compare;
+        predicate->op = predicates[i].op;
+        predicate->value = predicate->value2 = NULL; //set by statement_query
+        if (is_null_test(predicate->op))
+            continue;
+        stmt->params[k++] = column;
+        if (predicate->op == OP_BETWEEN)
+            stmt->params[k++] = column;
+    }
+    if (col_names != NULL) {
+        if (scan_plan_project(table, plan, col_names, num_cols) != 0)
+            goto ERR;
+        stmt->projection = (Column **)malloc((num_cols ? num_cols : 1) * sizeof(Column *));
+        for (size_t i = 0; i < num_cols; i++)
+            stmt->projection[i] = table_column(table, col_names[i]);
+        stmt->num_projection = num_cols;
+    }
+    return stmt;
+ERR:
+    statement_close(stmt);
+    return NULL;
+}
+
+int statement_order_by(PStatement stmt, const OrderBy *order_by, size_t num_order_by, size_t limit, size_t memory_budget) {
+    if (stmt->plan == NULL)
+        return EINVAL;
+    struct CursorSort *sort = cursor_sort_create(stmt->table, order_by, num_order_by, limit, memory_budget);
+    if (sort == NULL)
+        return EINVAL;
+    //the rows are compared on the sort columns, read even if not projected
+    for (size_t k = 0; k < sort->num_columns && stmt->plan->columns != NULL; k++)
+        stmt->plan->columns[sort->columns[k]->id] = true;
+    cursor_sort_destroy(stmt->sort);
+    stmt->sort = sort;
+    return 0;
+}
+
+//Returns a sort of the same columns as 'sort', with no row read yet
+static struct CursorSort *cursor_sort_copy(const struct CursorSort *sort) {
+    size_t num = sort->num_columns ? sort->num_columns : 1;
+    struct CursorSort *copy = (struct CursorSort *)calloc(1, sizeof(struct CursorSort));
+    copy->columns = (Column **)malloc(num * sizeof(Column *));
+    copy->descending = (bool *)malloc(num * sizeof(bool));
+    memcpy(copy->columns, sort->columns, sort->num_columns * sizeof(Column *));
+    memcpy(copy->descending, sort->descending, sort->num_columns * sizeof(bool));
+    copy->num_columns = sort->num_columns;
+    copy->limit = sort->limit;
+    copy->memory_budget = sort->memory_budget;
+    return copy;
+}
+
+PCursor statement_query(PStatement stmt, const void *const *values) {
+    if (stmt->plan == NULL)
+        return NULL;
+    Table *table = stmt->table;
+    PScanPlan prepared = stmt->plan;
+    //the cursor owns its plan, a copy with the values of this execution
+    PScanPlan plan = (PScanPlan)malloc(sizeof(struct ScanPlan));
+    *plan = *prepared;
+    plan->predicates = (struct ScanPredicate *)malloc((plan->num_predicates ? plan->num_predicates : 1) * sizeof(struct ScanPredicate));
+    plan->columns = NULL;
+    if (prepared->columns != NULL) {
+        plan->columns = (bool *)malloc(table->num_columns * sizeof(bool));
+        memcpy(plan->columns, prepared->columns, table->num_columns * sizeof(bool));
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < plan->num_predicates; i++) {
+        struct ScanPredicate *predicate = &plan->predicates[i];
+        *predicate = prepared->predicates[i];
+        if (is_null_test(predicate->op))
+            continue;
+        predicate->value = malloc(predicate->column->size);
+        memcpy(predicate->value, values[k++], predicate->column->size);
+        if (predicate->op == OP_BETWEEN) {
+            predicate->value2 = malloc(predicate->column->size);
+            memcpy(predicate->value2, values[k++], predicate->column->size);
+        }
+    }
+    PCursor cursor = cursor_open(table, plan, plan_access(table, plan));
+    if (stmt->projection != NULL) {
+        cursor->projection = (Column **)malloc((stmt->num_projection ? stmt->num_projection : 1) * sizeof(Column *));
+        memcpy(cursor->projection, stmt->projection, stmt->num_projection * sizeof(Column *));
+        cursor->num_projection = stmt->num_projection;
+    }
+    if (stmt->sort != NULL)
+        cursor_set_sort(cursor, cursor_sort_copy(stmt->sort));
+    return cursor;
+}
+
+int table_enable_bloom(Table *table, const char *col_name, size_t expected_keys) {
+    Column *column = table_column(table, col_name);
+    PIndex index = column ? column->index : NULL;
+    if (index == NULL || index->kind != INDEX_BTREE) {
+        fprintf(stderr, "Column \'%s\' has no B+ tree index!\n", col_name);
+        return EINVAL;
+    }
+    return btree_enable_bloom((PBTree)index->impl, expected_keys);
+}
+
+/*
+    Aggregates
+
+    The groups of a query are kept in an open-addressing hash table with
+    linear probing. An entry holds the state of each aggregate, followed by
+    the values of the group columns, which are its key. The value of a
+    nullable column is followed by a byte set for NULL, so that NULLs make a
+    group of their own. Aggregates of a column skip its NULLs.
+*/
+
+#define GROUP_TABLE_MIN_CAPACITY 64
+
+struct AggregateState {
+    long long count; //rows aggregated
+    long long sum;
+    long long min;
+    long long max;
+};
+
+struct AggregateColumn {
+    AggregateFn fn;
+    Column *column; //NULL for COUNT(*)
+};
+
+struct AggregateResult {
+    Column **group_columns;
+    size_t *key_offsets;   //offset of each group column in a key, its null flag follows if it is nullable
+    size_t num_group_by;
+    struct AggregateColumn *aggregates;
+    size_t num_aggregates;
+    size_t key_size;
+    size_t entry_size;
+    size_t num_groups;
+    char *entries;         //sorted by key
+};
+
+struct GroupTable {
+    size_t capacity;   //power of two
+    size_t num_groups;
+    uint64_t *hashes;  //0 for an empty slot
+    char *entries;
+};
+
+//state of the scanning threads, with one table of groups per thread
+struct aggregate_scan {
+    PAggregateResult result;
+    struct GroupTable *tables;
+};
+
+static uint64_t hash_group(const void *key, size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, (const char *)key + i, size - i < sizeof(uint64_t) ? size - i : sizeof(uint64_t));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash | 1; //never 0, the mark of an empty slot
+}
+
+static int group_table_init(struct GroupTable *groups, size_t entry_size, size_t capacity) {
+    groups->capacity = capacity;
+    groups->num_groups = 0;
+    groups->hashes = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    groups->entries = (char *)malloc(capacity * entry_size);
+    if (groups->hashes == NULL || groups->entries == NULL) {
+        free(groups->hashes);
+        free(groups->entries);
+        groups->hashes = NULL;
+        groups->entries = NULL;
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static void group_table_destroy(struct GroupTable *groups) {
+    free(groups->hashes);
+    free(groups->entries);
+}
+
+//Returns the slot of 'key' in 'groups', or the empty slot where it belongs
+static size_t group_slot(PAggregateResult result, struct GroupTable *groups, const void *key, uint64_t hash) {
+    size_t mask = groups->capacity - 1;
+    size_t slot = hash & mask;
+    size_t states_size = result->num_aggregates * sizeof(struct AggregateState);
+    while (groups->hashes[slot] != 0) {
+        if (groups->hashes[slot] == hash && memcmp(groups->entries + slot * result->entry_size + states_size, key, result->key_size) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+//Doubles the capacity of 'groups', returns 0 if success
+static int group_table_grow(PAggregateResult result, struct GroupTable *groups) {
+    struct GroupTable bigger;
+    if (group_table_init(&bigger, result->entry_size, groups->capacity * 2) != 0)
+        return ENOMEM;
+    size_t states_size = result->num_aggregates * sizeof(struct AggregateState);
+    for (size_t i = 0; i < groups->capacity; i++) {
+        if (groups->hashes[i] == 0)
+            continue;
+        const char *entry = groups->entries + i * result->entry_size;
+        size_t slot = group_slot(result, &bigger, entry + states_size, groups->hashes[i]);
+        bigger.hashes[slot] = groups->hashes[i];
+        memcpy(bigger.entries + slot * result->entry_size, entry, result->entry_size);
+    }
+    bigger.num_groups = groups->num_groups;
+    group_table_destroy(groups);
+    *groups = bigger;
+    return 0;
+}
+
+//Returns the aggregate states of the group of 'key', added if it is new; NULL if out of memory
+static struct AggregateState *group_find(PAggregateResult result, struct GroupTable *groups, const void *key) {
+    uint64_t hash = hash_group(key, result->key_size);
+    size_t slot = group_slot(result, groups, key, hash);
+    struct AggregateState *states = (struct AggregateState *)(groups->entries + slot * result->entry_size);
+    if (groups->hashes[slot] != 0)
+        return states;
+    //the table is kept at most half full
+    if (2 * (groups->num_groups + 1) > groups->capacity) {
+        if (group_table_grow(result, groups) != 0)
+            return NULL;
+        slot = group_slot(result, groups, key, hash);
+        states = (struct AggregateState *)(groups->entries + slot * result->entry_size);
+    }
+    groups->hashes[slot] = hash;
+    groups->num_groups++;
+    for (size_t k = 0; k < result->num_aggregates; k++) {
+        states[k].count = states[k].sum = 0;
+        states[k].min = LLONG_MAX;
+        states[k].max = LLONG_MIN;
+    }
+    memcpy((char *)(states + result->num_aggregates), key, result->key_size);
+    return states;
+}
+
+//Value of an int or bigint 'column' stored at 'value'
+static long long column_value(const Column *column, const void *value) {
+    if (column->size == sizeof(int)) {
+        int x;
+        memcpy(&x, value, sizeof(x));
+        return x;
+    }
+    long long x;
+    memcpy(&x, value, sizeof(x));
+    return x;
+}
+
+//sums wrap around on overflow
+static long long add_wrap(long long a, long long b) {
+    return (long long)((unsigned long long)a + (unsigned long long)b);
+}
+
+static void aggregate_states_merge(PAggregateResult result, struct AggregateState *states, const struct AggregateState *other) {
+    for (size_t k = 0; k < result->num_aggregates; k++) {
+        states[k].count += other[k].count;
+        states[k].sum = add_wrap(states[k].sum, other[k].sum);
+        if (other[k].min < states[k].min)
+            states[k].min = other[k].min;
+        if (other[k].max > states[k].max)
+            states[k].max = other[k].max;
+    }
+}
+
+//Adds 'row' to its group in the table of thread 'worker'
+static int aggregate_row(void *arg, int worker, const void *row, disk_pointer dp) {
+    struct aggregate_scan *scan = (struct aggregate_scan *)arg;
+    PAggregateResult result = scan->result;
+    char key[result->key_size + 1];
+    for (size_t k = 0; k < result->num_group_by; k++) {
+        Column *column = result->group_columns[k];
+        memcpy(key + result->key_offsets[k], row + column->offset, column->size);
+        if (column->null_bit >= 0)
+            key[result->key_offsets[k] + column->size] = column_is_null(column, row);
+    }
+    struct AggregateState *states = group_find(result, &scan->tables[worker], key);
+    if (states == NULL)
+        return ENOMEM;
+    for (size_t k = 0; k < result->num_aggregates; k++) {
+        struct AggregateColumn *aggregate = &result->aggregates[k];
+        if (aggregate->column != NULL && column_is_null(aggregate->column, row))
+            continue;
+        states[k].count++;
+        if (aggregate->column == NULL || aggregate->fn == AGG_COUNT)
+            continue;
+        long long value = column_value(aggregate->column, row + aggregate->column->offset);
+        switch (aggregate->fn) {
+            case AGG_SUM: case AGG_AVG: states[k].sum = add_wrap(states[k].sum, value); break;
+            case AGG_MIN: if (value < states[k].min) states[k].min = value; break;
+            case AGG_MAX: if (value > states[k].max) states[k].max = value; break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+static void aggregate_destroy_all(PAggregateResult result) {
+    free(result->group_columns);
+    free(result->key_offsets);
+    free(result->aggregates);
+    free(result->entries);
+    free(result);
+}
+
+void aggregate_destroy(PAggregateResult result) {
+    if (result != NULL)
+        aggregate_destroy_all(result);
+}
+
+//Resolves the columns of the groups and the aggregates, NULL if one is unknown
+static PAggregateResult aggregate_compile(Table *table, const char **group_by, size_t num_group_by, const Aggregate *aggregates, size_t num_aggregates) {
+    PAggregateResult result = (PAggregateResult)calloc(1, sizeof(struct AggregateResult));
+    result->group_columns = (Column **)malloc((num_group_by ? num_group_by : 1) * sizeof(Column *));
+    result->key_offsets = (size_t *)malloc((num_group_by ? num_group_by : 1) * sizeof(size_t));
+    result->aggregates = (struct AggregateColumn *)malloc((num_aggregates ? num_aggregates : 1) * sizeof(struct AggregateColumn));
+    for (size_t k = 0; k < num_group_by; k++) {
+        Column *column = table_column(table, group_by[k]);
+        if (column == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", group_by[k]);
+            goto ERR;
+        }
+        if (column->heap != NULL) {
+            fprintf(stderr, "Can't group by text column \'%s\'\n", column->name);
+            goto ERR;
+        }
+        result->group_columns[k] = column;
+        result->key_offsets[k] = result->key_size;
+        result->key_size += column->size + (column->null_bit >= 0);
+    }
+    result->num_group_by = num_group_by;
+    for (size_t k = 0; k < num_aggregates; k++) {
+        Column *column = NULL;
+        if (aggregates[k].col_name != NULL && (column = table_column(table, aggregates[k].col_name)) == NULL) {
+            fprintf(stderr, "Unknown column \'%s\'\n", aggregates[k].col_name);
+            goto ERR;
+        }
+        if (column == NULL && aggregates[k].fn != AGG_COUNT) {
+            fprintf(stderr, "Aggregate %d needs a column\n", (int)k);
+            goto ERR;
+        }
+        if (column != NULL && column->heap != NULL && aggregates[k].fn != AGG_COUNT) {
+            fprintf(stderr, "Aggregate %d of text column \'%s\' is not a count\n", (int)k, column->name);
+            goto ERR;
+        }
+        result->aggregates[k].fn = aggregates[k].fn;
+        result->aggregates[k].column = column;
+    }
+    result->num_aggregates = num_aggregates;
+    size_t entry_size = num_aggregates * sizeof(struct AggregateState) + result->key_size;
+    result->entry_size = (entry_size + sizeof(long long) - 1) / sizeof(long long) * sizeof(long long);
+    if (result->entry_size == 0)
+        result->entry_size = sizeof(long long);
+    return result;
+ERR:
+    aggregate_destroy_all(result);
+    return NULL;
+}
+
+/* Answers the aggregates of a query without groups from the size of the data
+   file and the indices, if they all can be. Returns false otherwise. */
+static bool aggregate_from_indices(Table *table, PScanPlan plan, PAggregateResult result) {
+    if (result->num_group_by > 0 || (plan->any && plan->num_predicates > 0))
+        return false;
+    //COUNT(*) of the predicates if they are all on one indexed column
+    Column *column = plan->num_predicates > 0 ? plan->predicates[0].column : NULL;
+    for (size_t i = 0; i < plan->num_predicates; i++)
+        if (plan->predicates[i].column != column || column->index == NULL || is_null_test(plan->predicates[i].op))
+            return false;
+    struct AggregateState *states = (struct AggregateState *)calloc(1, result->entry_size);
+    bool answered = true;
+    long long count = -1;
+    for (size_t k = 0; k < result->num_aggregates && answered; k++) {
+        struct AggregateColumn *aggregate = &result->aggregates[k];
+        if (aggregate->fn == AGG_COUNT && aggregate->column != NULL && aggregate->column->null_bit >= 0)
+            answered = false; //NULLs are not counted
+        else if (aggregate->fn == AGG_COUNT) {
+            //the column is NOT NULL, COUNT(column) is COUNT(*)
+            if (count < 0 && plan->num_predicates == 0)
+                count = table_num_rows(table) - table->num_deleted;
+            else if (count < 0 && table->num_deleted > 0) {
+                answered = false; //the index may hold entries of deleted rows
+                break;
+            }
+            else if (count < 0) {
+                vector_t *dps = may_match(table, plan) ? index_scan(plan, column, NULL) : NULL;
+                count = dps ? vector_size(dps) : 0;
+                if (dps)
+                    vector_destroy(dps);
+            }
+            states[k].count = count;
+        }
+        else if ((aggregate->fn == AGG_MIN || aggregate->fn == AGG_MAX) && plan->num_predicates == 0 && aggregate->column->index != NULL) {
+            char key[aggregate->column->size];
+            PIndex index = aggregate->column->index;
+            int ret = aggregate->fn == AGG_MIN ? index_first_key(index, key) : index_last_key(index, key);
+            if (ret == 0) {
+                states[k].count = 1;
+                states[k].min = states[k].max = column_value(aggregate->column, key);
+            }
+            else
+                answered = ret == ENOENT; //no row, the aggregate is NULL
+        }
+        else
+            answered = false;
+    }
+    if (answered) {
+        result->entries = (char *)states;
+        result->num_groups = 1;
+    }
+    else
+        free(states);
+    return answered;
+}
+
+static int compare_group(const void *a, const void *b, void *arg) {
+    PAggregateResult result = (PAggregateResult)arg;
+    size_t states_size = result->num_aggregates * sizeof(struct AggregateState);
+    for (size_t k = 0; k < result->num_group_by; k++) {
+        Column *column = result->group_columns[k];
+        const char *x = (const char *)a + states_size + result->key_offsets[k];
+        const char *y = (const char *)b + states_size + result->key_offsets[k];
+        //the group of NULLs comes first
+        bool null_x = column->null_bit >= 0 && x[column->size], null_y = column->null_bit >= 0 && y[column->size];
+        int res = null_x || null_y ? null_y - null_x : column->type->compare(x, y);
+        if (res != 0)
+            return res;
+    }
+    return 0;
+}
+
+//Aggregates the rows read by the access path of 'plan' into 'result'
+static int aggregate_scan(Table *table, PScanPlan plan, PAggregateResult result) {
+    PAccessPlan access = plan_access(table, plan);
+    size_t num_rows = 0;
+    int num_tables = 1, ret = 0;
+    if (access->path == ACCESS_SEQ_SCAN) {
+        fflush(table->data->file); //rows are read with pread
+        num_rows = table_num_rows(table);
+        num_tables = scan_num_threads(num_rows);
+    }
+    struct aggregate_scan scan;
+    scan.result = result;
+    scan.tables = (struct GroupTable *)calloc(num_tables, sizeof(struct GroupTable));
+    for (int i = 0; i < num_tables && ret == 0; i++)
+        ret = group_table_init(&scan.tables[i], result->entry_size, GROUP_TABLE_MIN_CAPACITY);
+    if (ret == 0 && access->path == ACCESS_SEQ_SCAN)
+        ret = parallel_scan(table, plan, num_rows, num_tables, aggregate_row, &scan);
+    else if (ret == 0 && access->path != ACCESS_NONE) {
+        size_t num_records;
+        disk_pointer *records = access_records(table, plan, access, &num_records);
+        void *rows = malloc(FETCH_BATCH_ROWS * table->row_size);
+        for (size_t i = 0; i < num_records && ret == 0; i += FETCH_BATCH_ROWS) {
+            size_t num = num_records - i < FETCH_BATCH_ROWS ? num_records - i : FETCH_BATCH_ROWS;
+            ret = fetch_rows(table, NULL, records + i, num, rows);
+            for (size_t k = 0; k < num && ret == 0; k++) {
+                const void *row = rows + k * table->row_size;
+                if (scan_plan_match(plan, row))
+                    ret = aggregate_row(&scan, 0, row, records[i + k]);
+            }
+        }
+        free(rows);
+        free(records);
+    }
+    access_plan_destroy(access);
+
+    //the partial aggregates of the threads are merged into the first table
+    struct GroupTable *groups = &scan.tables[0];
+    size_t states_size = result->num_aggregates * sizeof(struct AggregateState);
+    for (int i = 1; i < num_tables && ret == 0; i++) {
+        for (size_t j = 0; j < scan.tables[i].capacity && ret == 0; j++) {
+            if (scan.tables[i].hashes[j] == 0)
+                continue;
+            struct AggregateState *other = (struct AggregateState *)(scan.tables[i].entries + j * result->entry_size);
+            struct AggregateState *states = group_find(result, groups, (const char *)other + states_size);
+            if (states == NULL)
+                ret = ENOMEM;
+            else
+                aggregate_states_merge(result, states, other);
+        }
+    }
+    //without groups, the aggregates of no row are one group
+    if (ret == 0 && result->num_group_by == 0 && groups->num_groups == 0 && group_find(result, groups, "") == NULL)
+        ret = ENOMEM;
+    if (ret == 0) {
+        result->entries = (char *)malloc((groups->num_groups ? groups->num_groups : 1) * result->entry_size);
+        for (size_t j = 0; j < groups->capacity; j++)
+            if (groups->hashes[j] != 0)
+                memcpy(result->entries + result->num_groups++ * result->entry_size, groups->entries + j * result->entry_size, result->entry_size);
+        qsort_r(result->entries, result->num_groups, result->entry_size, compare_group, result);
+    }
+    for (int i = 0; i < num_tables; i++)
+        group_table_destroy(&scan.tables[i]);
+    free(scan.tables);
+    return ret;
+}
+
+PAggregateResult table_aggregate(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                                 const char **group_by, size_t num_group_by, const Aggregate *aggregates, size_t num_aggregates) {
+    PAggregateResult result = aggregate_compile(table, group_by, num_group_by, aggregates, num_aggregates);
+    if (result == NULL)
+        return NULL;
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL) {
+        aggregate_destroy_all(result);
+        return NULL;
+    }
+    int ret = 0;
+    if (!aggregate_from_indices(table, plan, result))
+        ret = aggregate_scan(table, plan, result);
+    scan_plan_destroy(plan);
+    if (ret != 0) {
+        fprintf(stderr, "Error %d in table_aggregate\n", ret);
+        aggregate_destroy_all(result);
+        return NULL;
+    }
+    return result;
+}
+
+size_t aggregate_num_groups(PAggregateResult result) {
+    return result->num_groups;
+}
+
+static const struct AggregateState *aggregate_state(PAggregateResult result, size_t g, size_t k) {
+    return (const struct AggregateState *)(result->entries + g * result->entry_size) + k;
+}
+
+const void *aggregate_group_value(PAggregateResult result, size_t g, size_t k) {
+    Column *column = result->group_columns[k];
+    const char *value = result->entries + g * result->entry_size + result->num_aggregates * sizeof(struct AggregateState) + result->key_offsets[k];
+    return column->null_bit >= 0 && value[column->size] ? NULL : value;
+}
+
+bool aggregate_is_null(PAggregateResult result, size_t g, size_t k) {
+    return result->aggregates[k].fn != AGG_COUNT && aggregate_state(result, g, k)->count == 0;
+}
+
+long long aggregate_int(PAggregateResult result, size_t g, size_t k) {
+    const struct AggregateState *state = aggregate_state(result, g, k);
+    switch (result->aggregates[k].fn) {
+        case AGG_COUNT: return state->count;
+        case AGG_SUM: return state->sum;
+        case AGG_MIN: return state->min;
+        case AGG_MAX: return state->max;
+        case AGG_AVG: return state->count ? state->sum / state->count : 0;
+    }
+    return 0;
+}
+
+double aggregate_double(PAggregateResult result, size_t g, size_t k) {
+    const struct AggregateState *state = aggregate_state(result, g, k);
+    if (result->aggregates[k].fn == AGG_AVG)
+        return state->count ? (double)state->sum / state->count : 0;
+    return (double)aggregate_int(result, g, k);
+}
+
+void aggregate_print(PAggregateResult result) {
+    if (result == NULL)
+        return;
+    for (size_t g = 0; g < result->num_groups; g++) {
+        for (size_t k = 0; k < result->num_group_by; k++) {
+            if (k) putchar(' ');
+            const void *value = aggregate_group_value(result, g, k);
+            if (value == NULL)
+                printf("NULL");
+            else
+                result->group_columns[k]->type->print(value);
+        }
+        for (size_t k = 0; k < result->num_aggregates; k++) {
+            if (k || result->num_group_by) putchar(' ');
+            if (aggregate_is_null(result, g, k))
+                printf("NULL");
+            else if (result->aggregates[k].fn == AGG_AVG)
+                printf("%.2f", aggregate_double(result, g, k));
+            else
+                printf("%lld", aggregate_int(result, g, k));
+        }
+        printf("\n");
+    }
+}
+
+/*
+    Joins
+
+    Join values are compared as long long, whatever the integer types of the
+    two columns. The side read into the hash table of a hash join, or probed
+    through its index by a nested-loop join, is the inner side.
+*/
+
+#define JOIN_MEMORY_BUDGET (64 << 20) //bytes of inner rows in memory by default
+#define JOIN_PARTITIONS    64         //partitions of a hash join too large for memory
+#define JOIN_SPOOL_BLOCK   (64 << 10) //block size of the temporary disk of a partition
+#define JOIN_BATCH_ROWS    4096       //outer rows sorted together by a nested-loop join
+
+struct JoinSide {
+    const JoinInput *input;
+    Column *column;
+    PScanPlan plan;     //NULL once handed to a cursor
+    PAccessPlan access;
+};
+
+typedef struct JoinPlan {
+    JoinMethod method;
+    bool right_inner; //the right side is the inner side
+    bool spill;       //the inner side of a hash join is expected to need partitions
+    double rows;      //estimated rows of the inner side of a hash join, of the outer side of a nested loop
+    double cost;
+} JoinPlan;
+
+struct JoinOutput {
+    table_join_consumer consume;
+    void *arg;
+    bool inner_left;
+};
+
+static int join_emit(struct JoinOutput *out, const void *inner_row, const void *outer_row) {
+    return out->inner_left ? out->consume(out->arg, inner_row, outer_row) : out->consume(out->arg, outer_row, inner_row);
+}
+
+static long long join_key(const Column *column, const void *row) {
+    return column_value(column, row + column->offset);
+}
+
+static uint64_t hash_join_key(long long key) {
+    uint64_t hash = (uint64_t)key;
+    hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdULL;
+    hash = (hash ^ (hash >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 33);
+}
+
+//the high bits choose the partition, the low bits the bucket
+static size_t join_partition(long long key) {
+    return (hash_join_key(key) >> 32) % JOIN_PARTITIONS;
+}
+
+static int join_side_open(struct JoinSide *side, const JoinInput *input) {
+    side->input = input;
+    side->column = table_column(input->table, input->col_name);
+    if (side->column == NULL) {
+        fprintf(stderr, "Unknown column \'%s\'\n", input->col_name);
+        return EINVAL;
+    }
+    if (side->column->heap != NULL) {
+        fprintf(stderr, "Can't join on text column \'%s\'\n", input->col_name);
+        return EINVAL;
+    }
+    side->plan = scan_plan_compile(input->table, input->predicates, input->num_predicates, false);
+    if (side->plan == NULL)
+        return EINVAL;
+    if (side->column->null_bit >= 0) {
+        //a NULL joins no row
+        PScanPlan plan = side->plan;
+        plan->predicates = (struct ScanPredicate *)realloc(plan->predicates, (plan->num_predicates + 1) * sizeof(struct ScanPredicate));
+        struct ScanPredicate *predicate = &plan->predicates[plan->num_predicates++];
+        predicate->column = side->column;
+        predicate->offset = side->column->offset;
+        predicate->compare = side->column->type->compare;
+        predicate->op = OP_IS_NOT_NULL;
+        predicate->value = predicate->value2 = NULL;
+    }
+    side->access = plan_access(input->table, side->plan);
+    return 0;
+}
+
+static void join_side_close(struct JoinSide *side) {
+    if (side->access != NULL)
+        access_plan_destroy(side->access);
+    scan_plan_destroy(side->plan);
+}
+
+//Cursor over the rows of 'side', which hands its plans over
+static PCursor join_side_cursor(struct JoinSide *side) {
+    PCursor cursor = cursor_open(side->input->table, side->plan, side->access);
+    side->plan = NULL;
+    side->access = NULL;
+    return cursor;
+}
+
+/* A hash join costs a scan of each side, plus writing and reading both of
+   them again when they are partitioned. A nested-loop join costs a scan of
+   the outer side and, for each outer row, a descent of the inner index and
+   the read of a row. */
+static int join_plan(struct JoinSide *left, struct JoinSide *right, JoinMethod method, size_t memory_budget, JoinPlan *plan) {
+    plan->method = JOIN_HASH;
+    plan->right_inner = right->access->rows <= left->access->rows;
+    struct JoinSide *inner = plan->right_inner ? right : left;
+    plan->rows = inner->access->rows;
+    plan->spill = plan->rows * inner->input->table->row_size > memory_budget;
+    plan->cost = left->access->cost + right->access->cost;
+    if (plan->spill)
+        plan->cost += 2 * (left->access->rows * left->input->table->row_size
+                           + right->access->rows * right->input->table->row_size) / SEQ_SCAN_IO_BYTES;
+    if (method == JOIN_HASH)
+        return 0;
+    JoinPlan nested;
+    bool found = false;
+    for (int i = 0; i < 2; i++) {
+        struct JoinSide *inner = i ? left : right, *outer = i ? right : left;
+        if (inner->column->index == NULL)
+            continue;
+        double cost = outer->access->cost + outer->access->rows * (INDEX_DESCENT_COST + RANDOM_READ_COST);
+        if (!found || cost < nested.cost) {
+            nested.method = JOIN_INDEX_NESTED_LOOP;
+            nested.right_inner = inner == right;
+            nested.spill = false;
+            nested.rows = outer->access->rows;
+            nested.cost = cost;
+            found = true;
+        }
+    }
+    if (method == JOIN_INDEX_NESTED_LOOP && !found) {
+        fprintf(stderr, "No index on the join columns\n");
+        return EINVAL;
+    }
+    if (found && (method == JOIN_INDEX_NESTED_LOOP || nested.cost < plan->cost))
+        *plan = nested;
+    return 0;
+}
+
+static int join_open(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget,
+                     struct JoinSide *sides, JoinPlan *plan) {
+    memset(sides, 0, 2 * sizeof(struct JoinSide));
+    int ret = join_side_open(&sides[0], left);
+    if (ret == 0)
+        ret = join_side_open(&sides[1], right);
+    if (ret == 0)
+        ret = join_plan(&sides[0], &sides[1], method, memory_budget, plan);
+    return ret;
+}
+
+/* Hash table of inner rows, chained through row numbers. Rows are added
+   first, then join_table_build links them into the buckets. */
+struct JoinHashTable {
+    size_t row_size;
+    size_t num_rows;
+    size_t capacity;
+    char *rows;
+    long long *keys;
+    size_t *next;       //next row of the same bucket, SIZE_MAX at the end
+    size_t *buckets;    //first row of each bucket
+    size_t num_buckets; //power of two
+};
+
+static void join_table_init(struct JoinHashTable *table, size_t row_size) {
+    memset(table, 0, sizeof(struct JoinHashTable));
+    table->row_size = row_size;
+}
+
+static void join_table_destroy(struct JoinHashTable *table) {
+    free(table->rows);
+    free(table->keys);
+    free(table->next);
+    free(table->buckets);
+}
+
+//Memory used by the rows of 'table'
+static size_t join_table_bytes(struct JoinHashTable *table) {
+    return table->num_rows * (table->row_size + sizeof(long long) + 2 * sizeof(size_t));
+}
+
+//Removes all rows, keeping the memory
+static void join_table_clear(struct JoinHashTable *table) {
+    table->num_rows = 0;
+}
+
+static int join_table_add(struct JoinHashTable *table, long long key, const void *row) {
+    if (table->num_rows == table->capacity) {
+        size_t capacity = table->capacity ? 2 * table->capacity : 1024;
+        char *rows = (char *)realloc(table->rows, capacity * table->row_size);
+        if (rows == NULL)
+            return ENOMEM;
+        table->rows = rows;
+        long long *keys = (long long *)realloc(table->keys, capacity * sizeof(long long));
+        if (keys == NULL)
+            return ENOMEM;
+        table->keys = keys;
+        table->capacity = capacity;
+    }
+    memcpy(table->rows + table->num_rows * table->row_size, row, table->row_size);
+    table->keys[table->num_rows++] = key;
+    return 0;
+}
+
+static int join_table_build(struct JoinHashTable *table) {
+    size_t num_buckets = 16;
+    while (num_buckets < 2 * table->num_rows)
+        num_buckets *= 2;
+    free(table->buckets);
+    free(table->next);
+    table->buckets = (size_t *)malloc(num_buckets * sizeof(size_t));
+    table->next = (size_t *)malloc((table->num_rows ? table->num_rows : 1) * sizeof(size_t));
+    if (table->buckets == NULL || table->next == NULL)
+        return ENOMEM;
+    table->num_buckets = num_buckets;
+    for (size_t i = 0; i < num_buckets; i++)
+        table->buckets[i] = SIZE_MAX;
+    for (size_t i = 0; i < table->num_rows; i++) {
+        size_t bucket = hash_join_key(table->keys[i]) & (num_buckets - 1);
+        table->next[i] = table->buckets[bucket];
+        table->buckets[bucket] = i;
+    }
+    return 0;
+}
+
+//Joins 'outer_row' with the rows of 'table' with key 'key'
+static int join_table_probe(struct JoinHashTable *table, long long key, const void *outer_row, struct JoinOutput *out) {
+    size_t bucket = hash_join_key(key) & (table->num_buckets - 1);
+    for (size_t i = table->buckets[bucket]; i != SIZE_MAX; i = table->next[i]) {
+        int ret;
+        if (table->keys[i] == key && (ret = join_emit(out, table->rows + i * table->row_size, outer_row)) != 0)
+            return ret;
+    }
+    return 0;
+}
+
+/* Rows of a partition, written block by block to a temporary disk and read
+   back with join_spool_next after join_spool_rewind. */
+struct JoinSpool {
+    DISK *disk;          //NULL until the first block is written
+    char *block;
+    size_t block_size;
+    size_t row_size;
+    size_t num_rows;
+    size_t num_buffered; //rows in 'block' not written yet
+    disk_pointer next;   //next block to read
+    size_t num_read;
+    size_t pos;          //next row of 'block' to read
+    size_t num_loaded;   //rows of 'block' read from the disk
+};
+
+static struct JoinSpool *join_spools_create(size_t row_size) {
+    struct JoinSpool *spools = (struct JoinSpool *)calloc(JOIN_PARTITIONS, sizeof(struct JoinSpool));
+    for (size_t i = 0; spools != NULL && i < JOIN_PARTITIONS; i++) {
+        spools[i].row_size = row_size;
+        spools[i].block_size = row_size > JOIN_SPOOL_BLOCK ? row_size : JOIN_SPOOL_BLOCK;
+    }
+    return spools;
+}
+
+static void join_spools_destroy(struct JoinSpool *spools) {
+    if (spools == NULL)
+        return;
+    for (size_t i = 0; i < JOIN_PARTITIONS; i++) {
+        if (spools[i].disk != NULL)
+            dclose(spools[i].disk);
+        free(spools[i].block);
+    }
+    free(spools);
+}
+
+static int join_spool_write(struct JoinSpool *spool) {
+    if (spool->disk == NULL && (spool->disk = dtmp(spool->block_size)) == NULL)
+        return EIO;
+    //whole blocks, so that the next block starts at the next block size
+    disk_pointer dp = dalloc(spool->disk);
+    if (copy_to_disk(spool->block, spool->block_size, spool->disk, dp) < 0)
+        return EIO;
+    spool->num_buffered = 0;
+    return 0;
+}
+
+static int join_spool_add(struct JoinSpool *spool, const void *row) {
+    if (spool->block == NULL && (spool->block = (char *)malloc(spool->block_size)) == NULL)
+        return ENOMEM;
+    memcpy(spool->block + spool->num_buffered * spool->row_size, row, spool->row_size);
+    spool->num_rows++;
+    if (++spool->num_buffered == spool->block_size / spool->row_size)
+        return join_spool_write(spool);
+    return 0;
+}
+
+//Writes the rows left in memory and reads the spool again from its first row
+static int join_spool_rewind(struct JoinSpool *spool) {
+    int ret;
+    if (spool->num_buffered > 0 && (ret = join_spool_write(spool)) != 0)
+        return ret;
+    if (spool->disk != NULL) {
+        fflush(spool->disk->file);
+        spool->next = first_block(spool->disk);
+    }
+    spool->num_read = spool->pos = spool->num_loaded = 0;
+    return 0;
+}
+
+//Returns the next row, NULL after the last one or on error
+static const void *join_spool_next(struct JoinSpool *spool) {
+    if (spool->num_read == spool->num_rows)
+        return NULL;
+    if (spool->pos == spool->num_loaded) {
+        //the last block may be partial, copy_to_memory then returns 0
+        if (copy_to_memory(spool->disk, spool->next, spool->block) < 0)
+            return NULL;
+        spool->next = next_pointer(spool->disk, spool->next);
+        spool->pos = 0;
+        spool->num_loaded = spool->block_size / spool->row_size;
+    }
+    spool->num_read++;
+    return spool->block + spool->pos++ * spool->row_size;
+}
+
+/* Joins the partitions of the inner and outer rows one by one. A partition
+   with more inner rows than 'memory_budget' is joined in several passes over
+   its outer rows, each with as many inner rows as fit. */
+static int join_partitions(struct JoinSide *inner, struct JoinSide *outer, struct JoinHashTable *table,
+                           struct JoinSpool *inner_parts, struct JoinSpool *outer_parts, size_t memory_budget, struct JoinOutput *out) {
+    int ret = 0;
+    for (size_t p = 0; p < JOIN_PARTITIONS && ret == 0; p++) {
+        if (inner_parts[p].num_rows == 0 || outer_parts[p].num_rows == 0)
+            continue;
+        if ((ret = join_spool_rewind(&inner_parts[p])) != 0)
+            break;
+        while (ret == 0 && inner_parts[p].num_read < inner_parts[p].num_rows) {
+            const void *row;
+            join_table_clear(table);
+            while (ret == 0 && join_table_bytes(table) <= memory_budget && (row = join_spool_next(&inner_parts[p])) != NULL)
+                ret = join_table_add(table, join_key(inner->column, row), row);
+            if (ret == 0)
+                ret = join_table_build(table);
+            if (ret == 0)
+                ret = join_spool_rewind(&outer_parts[p]);
+            while (ret == 0 && (row = join_spool_next(&outer_parts[p])) != NULL)
+                ret = join_table_probe(table, join_key(outer->column, row), row, out);
+            if (ret == 0 && outer_parts[p].num_read < outer_parts[p].num_rows)
+                ret = EIO;
+        }
+    }
+    return ret;
+}
+
+/* The inner rows are read into the hash table until it needs more than
+   'memory_budget' bytes. From then on both sides are written to partitions. */
+static int hash_join(struct JoinSide *inner, struct JoinSide *outer, size_t memory_budget, struct JoinOutput *out) {
+    struct JoinHashTable table;
+    join_table_init(&table, inner->input->table->row_size);
+    struct JoinSpool *inner_parts = NULL, *outer_parts = NULL;
+    int ret = 0;
+    const void *row;
+    PCursor cursor = join_side_cursor(inner);
+    while (ret == 0 && (row = cursor_next(cursor)) != NULL) {
+        long long key = join_key(inner->column, row);
+        if (inner_parts != NULL)
+            ret = join_spool_add(&inner_parts[join_partition(key)], row);
+        else if ((ret = join_table_add(&table, key, row)) == 0 && join_table_bytes(&table) > memory_budget) {
+            if ((inner_parts = join_spools_create(table.row_size)) == NULL)
+                ret = ENOMEM;
+            for (size_t i = 0; i < table.num_rows && ret == 0; i++)
+                ret = join_spool_add(&inner_parts[join_partition(table.keys[i])], table.rows + i * table.row_size);
+            join_table_clear(&table);
+        }
+    }
+    cursor_close(cursor);
+
+    if (ret == 0 && inner_parts == NULL) {
+        //the inner side fits in memory
+        ret = join_table_build(&table);
+        cursor = join_side_cursor(outer);
+        while (ret == 0 && table.num_rows > 0 && (row = cursor_next(cursor)) != NULL)
+            ret = join_table_probe(&table, join_key(outer->column, row), row, out);
+        cursor_close(cursor);
+    }
+    else if (ret == 0) {
+        if ((outer_parts = join_spools_create(outer->input->table->row_size)) == NULL)
+            ret = ENOMEM;
+        cursor = join_side_cursor(outer);
+        while (ret == 0 && (row = cursor_next(cursor)) != NULL)
+            ret = join_spool_add(&outer_parts[join_partition(join_key(outer->column, row))], row);
+        cursor_close(cursor);
+        if (ret == 0)
+            ret = join_partitions(inner, outer, &table, inner_parts, outer_parts, memory_budget, out);
+    }
+    join_spools_destroy(inner_parts);
+    join_spools_destroy(outer_parts);
+    join_table_destroy(&table);
+    return ret;
+}
+
+struct JoinProbe {
+    long long key;
+    size_t row; //row of the batch
+};
+
+static int compare_join_probe(const void *a, const void *b) {
+    long long x = ((const struct JoinProbe *)a)->key, y = ((const struct JoinProbe *)b)->key;
+    return (x > y) - (x < y);
+}
+
+//Joins the 'num' outer rows of 'probes', all with key 'key', with the inner rows found by the index
+static int join_probe_index(struct JoinSide *inner, long long key, const struct JoinProbe *probes, size_t num,
+                            const char *rows, size_t row_size, void *inner_row, struct JoinOutput *out) {
+    Column *column = inner->column;
+    Table *table = inner->input->table;
+    char value[sizeof(long long)];
+    if (column->size == sizeof(int)) {
+        if (key < INT_MIN || key > INT_MAX)
+            return 0;
+        int x = (int)key;
+        memcpy(value, &x, sizeof(x));
+    }
+    else
+        memcpy(value, &key, sizeof(key));
+    if (!index_may_contain(column->index, value))
+        return 0;
+    vector_t *records = index_select(column->index, value, value);
+    size_t num_records = records ? vector_size(records) : 0;
+    int ret = 0;
+    for (size_t i = 0; i < num_records && ret == 0; i++) {
+        record_t record = *(record_t *)vector_get(records, i);
+        if (table_row_deleted(table, record_row(table, record)))
+            continue;
+        if ((ret = read_row(table, record, inner_row)) != 0 || !scan_plan_match(inner->plan, inner_row))
+            continue;
+        for (size_t k = 0; k < num && ret == 0; k++)
+            ret = join_emit(out, inner_row, rows + probes[k].row * row_size);
+    }
+    if (records)
+        vector_destroy(records);
+    return ret;
+}
+
+/* The outer rows are read in batches of JOIN_BATCH_ROWS. The keys of a batch
+   are sorted, so that the inner index is probed in key order and once for
+   all the outer rows with the same key. */
+static int index_nested_loop_join(struct JoinSide *inner, struct JoinSide *outer, struct JoinOutput *out) {
+    if (inner->access->path == ACCESS_NONE)
+        return 0;
+    size_t row_size = outer->input->table->row_size;
+    char *rows = (char *)malloc(JOIN_BATCH_ROWS * row_size);
+    struct JoinProbe *probes = (struct JoinProbe *)malloc(JOIN_BATCH_ROWS * sizeof(struct JoinProbe));
+    void *inner_row = malloc(inner->input->table->row_size);
+    int ret = rows && probes && inner_row ? 0 : ENOMEM;
+    PCursor cursor = join_side_cursor(outer);
+    bool end = false;
+    while (ret == 0 && !end) {
+        size_t num = 0;
+        const void *row;
+        while (num < JOIN_BATCH_ROWS && (row = cursor_next(cursor)) != NULL) {
+            memcpy(rows + num * row_size, row, row_size);
+            probes[num].key = join_key(outer->column, row);
+            probes[num].row = num;
+            num++;
+        }
+        end = num < JOIN_BATCH_ROWS;
+        qsort(probes, num, sizeof(struct JoinProbe), compare_join_probe);
+        for (size_t i = 0, j; i < num && ret == 0; i = j) {
+            for (j = i + 1; j < num && probes[j].key == probes[i].key; j++)
+                ;
+            ret = join_probe_index(inner, probes[i].key, probes + i, j - i, rows, row_size, inner_row, out);
+        }
+    }
+    cursor_close(cursor);
+    free(rows);
+    free(probes);
+    free(inner_row);
+    return ret;
+}
+
+int table_join(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget,
+               table_join_consumer consume, void *arg) {
+    struct JoinSide sides[2];
+    JoinPlan plan;
+    if (memory_budget == 0)
+        memory_budget = JOIN_MEMORY_BUDGET;
+    int ret = join_open(left, right, method, memory_budget, sides, &plan);
+    if (ret == 0) {
+        struct JoinSide *inner = plan.right_inner ? &sides[1] : &sides[0];
+        struct JoinSide *outer = plan.right_inner ? &sides[0] : &sides[1];
+        struct JoinOutput out = {consume, arg, !plan.right_inner};
+        if (plan.method == JOIN_HASH)
+            ret = hash_join(inner, outer, memory_budget, &out);
+        else
+            ret = index_nested_loop_join(inner, outer, &out);
+    }
+    join_side_close(&sides[0]);
+    join_side_close(&sides[1]);
+    return ret;
+}
+
+void table_join_explain(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget) {
+    struct JoinSide sides[2];
+    JoinPlan plan;
+    if (join_open(left, right, method, memory_budget ? memory_budget : JOIN_MEMORY_BUDGET, sides, &plan) == 0) {
+        const char *inner = plan.right_inner ? "right" : "left";
+        if (plan.method == JOIN_HASH)
+            printf("HASH JOIN build %s%s", inner, plan.spill ? " partitioned" : "");
+        else
+            printf("INDEX NESTED LOOP JOIN inner %s on %s", inner, sides[plan.right_inner ? 1 : 0].column->name);
+        printf(" (rows=%.0f, cost=%.1f)\n", plan.rows, plan.cost);
+    }
+    join_side_close(&sides[0]);
+    join_side_close(&sides[1]);
+}
+
+/*
+    Index build
+*/
+
+#define INDEX_BUILD_MEMORY (64 << 20) //bytes of entries sorted in memory
+
+struct index_build {
+    DataType *key_type;
+    size_t key_offset;
+    size_t key_size;
+    PExtSort sort;
+};
+
+//entry: key followed by its record, ordered by key and then newest (largest) record first
+static int compare_index_entry(const void *a, const void *b, void *arg) {
+    struct index_build *build = (struct index_build *)arg;
+    int res = build->key_type->compare(a, b);
+    if (res != 0)
+        return res;
+    record_t ra, rb;
+    memcpy(&ra, a + build->key_size, sizeof(record_t));
+    memcpy(&rb, b + build->key_size, sizeof(record_t));
+    if (ra == rb)
+        return 0;
+    return ra < rb ? 1 : -1;
+}
+
+//Adds the entry of a row to the sort, from the scanning thread 'worker'
+static int add_index_entry(void *arg, int worker, const void *row, disk_pointer dp) {
+    struct index_build *build = (struct index_build *)arg;
+    char entry[build->key_size + sizeof(record_t)];
+    memcpy(entry, row + build->key_offset, build->key_size);
+    memcpy(entry + build->key_size, &dp, sizeof(record_t));
+    return extsort_add(build->sort, worker, entry);
+}
+
+static bool next_index_entry(void *arg, const void **key, record_t *record) {
+    struct index_build *build = (struct index_build *)arg;
+    const void *entry = extsort_next(build->sort);
+    if (entry == NULL)
+        return false;
+    *key = entry;
+    memcpy(record, entry + build->key_size, sizeof(record_t));
+    return true;
+}
+
+//Sets the index flag of column 'col_no' in the frame file
+static int write_index_flag(Table *table, int col_no, IndexKind kind) {
+    char *frm_pathname = get_frm_pathname(table->path, table->name);
+    FILE *frm = fopen(frm_pathname, "r+");
+    free(frm_pathname);
+    if (frm == NULL) {
+        perror("fopen()");
+        return EIO;
+    }
+    u_int8_t flag_is_index = kind;
+    int ret = 0;
+    if (fseek(frm, FRM_COL_INDEX_FLAG_OFFSET(col_no), SEEK_SET) != 0 || fwrite(&flag_is_index, sizeof(flag_is_index), 1, frm) != 1)
+        ret = EIO;
+    fclose(frm);
+    return ret;
+}
+
+/* Bulk loads an index of 'kind' on 'column' from the rows of the data file,
+   with the files of table 'table_name'. Returns 0 if success. */
+static int build_index(Table *table, const Column *column, const char *table_name, IndexKind kind, PIndex *p_index) {
+    DISK *data = table->data;
+    fflush(data->file); //rows are read with pread
+    size_t num_rows = table_num_rows(table);
+
+    int num_threads = scan_num_threads(num_rows);
+    struct index_build build;
+    build.key_type = column->type;
+    build.key_offset = column->offset;
+    build.key_size = column->size;
+    build.sort = extsort_create(build.key_size + sizeof(record_t), compare_index_entry, &build, INDEX_BUILD_MEMORY, num_threads);
+    if (build.sort == NULL)
+        return ENOMEM;
+
+    //each thread sorts the entries of its range of rows with its own writer
+    int ret = parallel_scan(table, NULL, num_rows, num_threads, add_index_entry, &build);
+    if (ret == 0)
+        ret = extsort_finish(build.sort);
+    if (ret != 0) {
+        extsort_destroy(build.sort);
+        return ret;
+    }
+
+    *p_index = index_bulk_load(table->path, table_name, column->name, build.key_type, kind, next_index_entry, &build, extsort_size(build.sort));
+    extsort_destroy(build.sort);
+    if (*p_index == NULL) {
+        fprintf(stderr, "Error in index_bulk_load() for column '%s'\n", column->name);
+        return errno ? errno : EIO;
+    }
+    return 0;
+}
+
+int table_create_index(Table *table, const char *col_name) {
+    Column *column = table_column(table, col_name);
+    if (column == NULL) {
+        fprintf(stderr, "Unknown column '%s'\n", col_name);
+        return EINVAL;
+    }
+    if (column->index != NULL) {
+        fprintf(stderr, "Column '%s' is already indexed!\n", col_name);
+        return EEXIST;
+    }
+    if (column->heap != NULL) {
+        fprintf(stderr, "Text column '%s' can't be indexed!\n", col_name);
+        return EINVAL;
+    }
+    if (column->null_bit >= 0) {
+        fprintf(stderr, "Nullable column '%s' can't be indexed!\n", col_name);
+        return EINVAL;
+    }
+
+    PIndex index;
+    int ret = build_index(table, column, table->name, table->index_kind, &index);
+    if (ret != 0)
+        return ret;
+    if ((ret = write_index_flag(table, column->id, index->kind)) != 0) {
+        index_close(index);
+        return ret;
+    }
+    map_put(table->col2index, (void *)column->name, index);
+    column->index = index;
+    return 0;
+}
+
+/*
+    Delete and update
+
+    The matching rows are collected first, with their records, by the access
+    path the planner chooses, and changed afterwards. A deleted row is set in
+    the deletion bitmap and its entries are removed from the indices that can
+    remove entries; the others keep stale entries, dropped by access_records,
+    until the table is compacted. An updated row is written in place, and its
+    entries in the indices of the changed columns are removed and inserted
+    again. If one of these indices cannot remove entries, the updated rows are
+    deleted and appended again instead.
+*/
+
+//Rows of a delete or an update, in the row layout, with their records
+struct RowSet {
+    char *rows;
+    record_t *records;
+    size_t num;
+    size_t capacity;
+};
+
+static int row_set_add(struct RowSet *set, size_t row_size, const void *row, record_t record) {
+    if (set->num == set->capacity) {
+        size_t capacity = set->capacity ? 2 * set->capacity : 64;
+        char *rows = (char *)realloc(set->rows, capacity * row_size);
+        if (rows == NULL)
+            return ENOMEM;
+        set->rows = rows;
+        record_t *records = (record_t *)realloc(set->records, capacity * sizeof(record_t));
+        if (records == NULL)
+            return ENOMEM;
+        set->records = records;
+        set->capacity = capacity;
+    }
+    memcpy(set->rows + set->num * row_size, row, row_size);
+    set->records[set->num++] = record;
+    return 0;
+}
+
+static void row_set_destroy(struct RowSet *set) {
+    free(set->rows);
+    free(set->records);
+}
+
+struct row_collect {
+    size_t row_size;
+    struct RowSet *sets; //one per scanning thread
+};
+
+static int collect_match(void *arg, int worker, const void *row, disk_pointer dp) {
+    struct row_collect *collect = (struct row_collect *)arg;
+    return row_set_add(&collect->sets[worker], collect->row_size, row, dp);
+}
+
+/* Collects the rows matching 'plan' into 'set', in the order of the data file
+   for a sequential scan. Returns 0 if success. */
+static int collect_matches(Table *table, PScanPlan plan, struct RowSet *set) {
+    PAccessPlan access = plan_access(table, plan);
+    size_t row_size = table->row_size;
+    int ret = 0;
+    memset(set, 0, sizeof(*set));
+    fflush(table->data->file); //rows are read with pread
+    if (access->path == ACCESS_SEQ_SCAN) {
+        size_t num_rows = table_num_rows(table);
+        int num_threads = scan_num_threads(num_rows);
+        struct row_collect collect;
+        collect.row_size = row_size;
+        collect.sets = (struct RowSet *)calloc(num_threads, sizeof(struct RowSet));
+        ret = collect.sets == NULL ? ENOMEM : parallel_scan(table, plan, num_rows, num_threads, collect_match, &collect);
+        //the threads scan consecutive ranges, their rows are concatenated
+        for (int i = 0; collect.sets != NULL && i < num_threads; i++) {
+            struct RowSet *part = &collect.sets[i];
+            for (size_t j = 0; j < part->num && ret == 0; j++)
+                ret = row_set_add(set, row_size, part->rows + j * row_size, part->records[j]);
+            row_set_destroy(part);
+        }
+        free(collect.sets);
+    }
+    else if (access->path != ACCESS_NONE) {
+        size_t num_records;
+        disk_pointer *records = access_records(table, plan, access, &num_records);
+        void *rows = malloc(FETCH_BATCH_ROWS * row_size);
+        for (size_t i = 0; i < num_records && ret == 0; i += FETCH_BATCH_ROWS) {
+            size_t num = num_records - i < FETCH_BATCH_ROWS ? num_records - i : FETCH_BATCH_ROWS;
+            ret = fetch_rows(table, NULL, records + i, num, rows);
+            for (size_t k = 0; k < num && ret == 0; k++)
+                if (scan_plan_match(plan, rows + k * row_size))
+                    ret = row_set_add(set, row_size, rows + k * row_size, records[i + k]);
+        }
+        free(rows);
+        free(records);
+    }
+    access_plan_destroy(access);
+    return ret;
+}
+
+/* Deletes the rows of 'set', which are not deleted yet, and removes their
+   index entries. Returns 0 if success. */
+static int delete_rows(Table *table, const struct RowSet *set) {
+    size_t first = SIZE_MAX, end = 0; //words of the bitmap to write
+    int ret = 0;
+    for (size_t i = 0; i < set->num && ret == 0; i++) {
+        size_t row_no = record_row(table, set->records[i]);
+        if ((ret = deleted_set(table, row_no)) != 0)
+            break;
+        if (row_no / 64 < first)
+            first = row_no / 64;
+        if (row_no / 64 + 1 > end)
+            end = row_no / 64 + 1;
+        const char *row = set->rows + i * table->row_size;
+        //an index that cannot remove entries keeps a stale one, skipped by the deletion bitmap
+        for (size_t k = 0; k < table->num_columns && ret == 0; k++) {
+            Column *column = &table->columns[k];
+            if (column->index != NULL && column->index->remove != NULL)
+                ret = index_remove(column->index, row + column->offset, set->records[i]);
+        }
+    }
+    int write_ret = deleted_write(table, first, end);
+    return ret != 0 ? ret : write_ret;
+}
+
+ssize_t table_delete(Table *table, const Predicate *predicates, size_t num_predicates, bool any) {
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL)
+        return -1;
+    struct RowSet set;
+    int ret = collect_matches(table, plan, &set);
+    scan_plan_destroy(plan);
+    if (ret == 0)
+        ret = delete_rows(table, &set);
+    size_t num = set.num;
+    row_set_destroy(&set);
+    if (ret != 0) {
+        fprintf(stderr, "Error in table_delete(): %s\n", strerror(ret));
+        return -1;
+    }
+    return num;
+}
+
+ssize_t table_update(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                     const Assignment *assignments, size_t num_assignments) {
+    //the new values are converted once
+    bool set_column[table->num_columns];
+    char *values = (char *)calloc(1, table->row_size ? table->row_size : 1);
+    memset(set_column, 0, sizeof(set_column));
+    bool in_place = true;
+    for (size_t i = 0; i < num_assignments; i++) {
+        Column *column = table_column(table, assignments[i].col_name);
+        if (column != NULL && assignments[i].value == NULL) {
+            if (column->null_bit < 0) {
+                fprintf(stderr, "Column '%s' can't be null!\n", column->name);
+                free(values);
+                return -1;
+            }
+            column_set_null(column, values, true);
+            set_column[column->id] = true;
+            continue;
+        }
+        void *value = column ? column->type->convert_to_val((char *)assignments[i].value) : NULL;
+        if (value == NULL) {
+            if (column == NULL)
+                fprintf(stderr, "Unknown column '%s'\n", assignments[i].col_name);
+            else
+                fprintf(stderr, "Invalid value '%s' for column '%s'\n", assignments[i].value, column->name);
+            free(values);
+            return -1;
+        }
+        memcpy(values + column->offset, value, column->size);
+        column_set_null(column, values, false);
+        int ret = column_store(column, values + column->offset);
+        free(value);
+        if (ret != 0) {
+            free(values);
+            return -1;
+        }
+        set_column[column->id] = true;
+        if (column->index != NULL && column->index->remove == NULL)
+            in_place = false;
+    }
+    if (table->heap != NULL && varheap_flush(table->heap) != 0) {
+        free(values);
+        return -1;
+    }
+    PScanPlan plan = scan_plan_compile(table, predicates, num_predicates, any);
+    if (plan == NULL) {
+        free(values);
+        return -1;
+    }
+    struct RowSet set;
+    int ret = collect_matches(table, plan, &set);
+    scan_plan_destroy(plan);
+    size_t row_size = table->row_size;
+    char *rows = (char *)malloc(set.num ? set.num * row_size : 1);
+    if (ret == 0 && rows == NULL)
+        ret = ENOMEM;
+    if (ret == 0)
+        memcpy(rows, set.rows, set.num * row_size);
+    for (size_t i = 0; i < set.num && ret == 0; i++)
+        for (size_t k = 0; k < table->num_columns; k++)
+            if (set_column[k]) {
+                memcpy(rows + i * row_size + table->columns[k].offset, values + table->columns[k].offset, table->columns[k].size);
+                column_set_null(&table->columns[k], rows + i * row_size, column_is_null(&table->columns[k], values));
+            }
+    if (ret == 0 && !in_place) {
+        ret = delete_rows(table, &set);
+        if (ret == 0)
+            ret = table_append_rows(table, rows, set.num);
+    }
+    for (size_t i = 0; i < set.num && ret == 0 && in_place; i++) {
+        const char *old_row = set.rows + i * row_size, *row = rows + i * row_size;
+        record_t record = set.records[i];
+        if ((ret = write_row(table, record, row)) != 0)
+            break;
+        for (size_t k = 0; k < table->num_columns && ret == 0; k++) {
+            Column *column = &table->columns[k];
+            if (!set_column[k] || column->index == NULL || column->type->compare(old_row + column->offset, row + column->offset) == 0)
+                continue;
+            if ((ret = index_remove(column->index, old_row + column->offset, record)) == 0)
+                ret = index_insert(column->index, (void *)(row + column->offset), record);
+        }
+    }
+    fflush(table->data->file); //rows are read with pread
+    size_t num = set.num;
+    row_set_destroy(&set);
+    free(rows);
+    free(values);
+    if (ret != 0) {
+        fprintf(stderr, "Error in table_update(): %s\n", strerror(ret));
+        return -1;
+    }
+    return num;
+}
+
+/*
+    Compaction
+
+    The live rows are copied, in the order of the data file, to a new data
+    file, and every index is bulk loaded again from it, as by
+    table_create_index. The new files are built with the table name plus
+    COMPACT_NAME_SUFFIX, next to the files of the table, which are not
+    changed. Once they are complete, a marker file (COMPACT_SUFFIX) commits
+    the compaction: the old index files are removed, the marker is renamed
+    (COMPACTED_SUFFIX), the new files take the names of the old ones and the
+    deletion bitmap is cleared. table_open finishes a compaction that was
+    committed before a crash and removes the files of one that was not.
+*/
+
+//An index whose files a compaction moves
+struct IndexFile {
+    const char *col_name;
+    IndexKind kind;
+};
+
+static char *get_compact_name(const char *table_name) {
+    char *name = (char *)malloc(strlen(table_name) + strlen(COMPACT_NAME_SUFFIX) + 1);
+    strcpy(name, table_name);
+    strcat(name, COMPACT_NAME_SUFFIX);
+    return name;
+}
+
+static char *get_marker_pathname(const char *path, const char *table_name, const char *suffix) {
+    char *pathname = (char *)malloc(strlen(path) + strlen(table_name) + strlen(suffix) + 1);
+    sprintf(pathname, "%s%s%s", path, table_name, suffix);
+    return pathname;
+}
+
+//Removes the files of a compaction that was not committed
+static int compact_rollback(const char *path, const char *table_name, const struct IndexFile *indices, size_t num_indices) {
+    char *compact_name = get_compact_name(table_name);
+    int ret = 0;
+    for (size_t i = 0; i < num_indices && ret == 0; i++)
+        ret = index_move(path, compact_name, indices[i].col_name, indices[i].kind, NULL);
+    //the data file is created first and removed last
+    char *data_pathname = get_data_pathname(path, compact_name);
+    if (ret == 0)
+        ret = dmove(data_pathname, NULL);
+    free(data_pathname);
+    free(compact_name);
+    return ret;
+}
+
+/* Replaces the files of the table by those of a committed compaction. Every
+   step can be done again, a crash is finished by calling it again. The
+   indices must be closed. Returns 0 if success. */
+static int compact_commit(const char *path, const char *table_name, const struct IndexFile *indices, size_t num_indices) {
+    char *compact_name = get_compact_name(table_name);
+    char *marker_pathname = get_marker_pathname(path, table_name, COMPACT_SUFFIX);
+    char *done_pathname = get_marker_pathname(path, table_name, COMPACTED_SUFFIX);
+    int ret = 0;
+    if (access(marker_pathname, F_OK) == 0) {
+        for (size_t i = 0; i < num_indices && ret == 0; i++)
+            ret = index_move(path, table_name, indices[i].col_name, indices[i].kind, NULL);
+        if (ret == 0 && rename(marker_pathname, done_pathname) != 0) {
+            perror("rename()");
+            ret = EIO;
+        }
+    }
+    //no old index file is left, the new ones can take their names
+    for (size_t i = 0; i < num_indices && ret == 0; i++)
+        ret = index_move(path, compact_name, indices[i].col_name, indices[i].kind, table_name);
+    char *data_pathname = get_data_pathname(path, table_name);
+    char *compact_data_pathname = get_data_pathname(path, compact_name);
+    char *del_pathname = get_del_pathname(path, table_name);
+    if (ret == 0)
+        ret = dmove(compact_data_pathname, data_pathname);
+    //no row is deleted in the new data file
+    FILE *file = ret == 0 ? fopen(del_pathname, "w") : NULL;
+    if (ret == 0 && (file == NULL || fclose(file) != 0)) {
+        perror("fopen()");
+        ret = EIO;
+    }
+    if (ret == 0)
+        ret = dmove(done_pathname, NULL);
+    free(data_pathname);
+    free(compact_data_pathname);
+    free(del_pathname);
+    free(marker_pathname);
+    free(done_pathname);
+    free(compact_name);
+    return ret;
+}
+
+//Finishes or removes a compaction left by a crash, the indices of the frame 'buffer' are not open yet
+static int compact_recover(const char *path, const char *table_name, const void *buffer, size_t num_cols) {
+    char *compact_name = get_compact_name(table_name);
+    char *compact_data_pathname = get_data_pathname(path, compact_name);
+    char *marker_pathname = get_marker_pathname(path, table_name, COMPACT_SUFFIX);
+    char *done_pathname = get_marker_pathname(path, table_name, COMPACTED_SUFFIX);
+    bool committed = access(marker_pathname, F_OK) == 0 || access(done_pathname, F_OK) == 0;
+    bool started = committed || access(compact_data_pathname, F_OK) == 0;
+    free(compact_name);
+    free(compact_data_pathname);
+    free(marker_pathname);
+    free(done_pathname);
+    if (!started)
+        return 0;
+    struct IndexFile indices[num_cols + 1];
+    size_t num_indices = 0;
+    for (size_t i = 0; i < num_cols; i++) {
+        u_int8_t flag_is_index;
+        memcpy(&flag_is_index, buffer + FRM_COL_INDEX_FLAG_OFFSET(i), FRM_COL_INDEX_FLAG_SIZE);
+        if (flag_is_index == INDEX_NONE)
+            continue;
+        indices[num_indices].col_name = (const char *)buffer + FRM_COL_NAME_OFFSET(i);
+        indices[num_indices++].kind = flag_is_index;
+    }
+    if (committed)
+        return compact_commit(path, table_name, indices, num_indices);
+    return compact_rollback(path, table_name, indices, num_indices);
+}
+
+//Copies the live rows of 'old', which has the schema of 'table', to the data file of 'table'
+static int copy_live_rows(Table *table, Table *old, size_t num_rows) {
+    size_t row_size = table->row_size;
+    size_t chunk_rows = SCAN_CHUNK_SIZE / row_size ? SCAN_CHUNK_SIZE / row_size : 1;
+    void *rows = malloc(chunk_rows * row_size);
+    record_t *records = (record_t *)malloc(chunk_rows * sizeof(record_t));
+    int ret = rows == NULL || records == NULL ? ENOMEM : 0;
+    for (size_t row_no = 0; row_no < num_rows && ret == 0; row_no += chunk_rows) {
+        int num_read = table_read_rows(old, row_no, chunk_rows, rows);
+        if (num_read < 0) {
+            ret = EIO;
+            break;
+        }
+        size_t num_live = 0;
+        for (int i = 0; i < num_read; i++)
+            if (!table_row_deleted(old, row_no + i))
+                memmove(rows + num_live++ * row_size, rows + i * row_size, row_size);
+        if (num_live > 0)
+            ret = append_data(table, rows, num_live, records);
+    }
+    free(rows);
+    free(records);
+    return ret;
+}
+
+int table_compact(Table *table) {
+    if (table->num_deleted == 0)
+        return 0;
+    DISK *data = table->data;
+    fflush(data->file);
+    size_t num_rows = table_num_rows(table);
+    char *compact_name = get_compact_name(table->name);
+    char *compact_data_pathname = get_data_pathname(table->path, compact_name);
+    DISK *compacted = dcreate(compact_data_pathname, data->block_size);
+    free(compact_data_pathname);
+    if (compacted == NULL) {
+        fprintf(stderr, "error in dcreate()!\n");
+        free(compact_name);
+        return EIO;
+    }
+    //the old data file is read through a copy of the table, no row is deleted in the new one
+    Table old = *table;
+    table->data = compacted;
+    table->tail = NULL;
+    table->tail_dp = DNULL;
+    table->deleted = NULL;
+    table->deleted_words = table->num_deleted = 0;
+    int ret = copy_live_rows(table, &old, num_rows);
+    if (ret == 0 && fflush(compacted->file) != 0)
+        ret = EIO;
+
+    //the records have changed, every index is built again from the new data file
+    struct IndexFile indices[table->num_columns + 1];
+    size_t num_indices = 0;
+    for (size_t i = 0; i < table->num_columns && ret == 0; i++) {
+        Column *column = &table->columns[i];
+        if (column->index == NULL)
+            continue;
+        bool bloom = column->index->kind == INDEX_BTREE && ((PBTree)column->index->impl)->bloom != NULL;
+        indices[num_indices].col_name = column->name;
+        indices[num_indices++].kind = column->index->kind;
+        PIndex index = NULL;
+        ret = build_index(table, column, compact_name, column->index->kind, &index);
+        if (ret == 0 && bloom)
+            ret = btree_enable_bloom((PBTree)index->impl, 0);
+        index_close(index);
+    }
+
+    //the marker commits the compaction
+    char *marker_pathname = get_marker_pathname(table->path, table->name, COMPACT_SUFFIX);
+    FILE *marker = ret == 0 ? fopen(marker_pathname, "w") : NULL;
+    free(marker_pathname);
+    if (ret == 0 && (marker == NULL || fclose(marker) != 0)) {
+        perror("fopen()");
+        ret = EIO;
+    }
+    free(compact_name);
+    if (ret != 0) {
+        //the table is left as it was
+        free(table->tail);
+        dclose(compacted);
+        table->data = old.data;
+        table->tail = old.tail;
+        table->tail_dp = old.tail_dp;
+        table->deleted = old.deleted;
+        table->deleted_words = old.deleted_words;
+        table->num_deleted = old.num_deleted;
+        compact_rollback(table->path, table->name, indices, num_indices);
+        return ret;
+    }
+    dclose(old.data);
+    free(old.tail);
+    free(old.deleted);
+    for (size_t i = 0; i < num_indices; i++) {
+        Column *column = table_column(table, indices[i].col_name);
+        map_remove(table->col2index, (void *)column->name);
+        index_close(column->index);
+        column->index = NULL;
+    }
+    ret = compact_commit(table->path, table->name, indices, num_indices);
+    table_stats_destroy(table->stats);
+    table->stats = NULL;
+    for (size_t i = 0; i < num_indices && ret == 0; i++) {
+        Column *column = table_column(table, indices[i].col_name);
+        column->index = index_open(table->path, table->name, column->name, column->type, indices[i].kind);
+        if (column->index == NULL)
+            ret = EIO;
+        else
+            map_put(table->col2index, (void *)column->name, column->index);
+    }
+    if (ret != 0)
+        fprintf(stderr, "Error in table_compact(), the table must be opened again\n");
+    return ret;
 }
@@ -3,27 +3,398 @@
 
 #include "disk.h"
 #include "util.h"
+#include "index.h"
+#include "varheap.h"
 
 #define FRAME_SUFFIX ".frm"
 #define DATA_SUFFIX  ".dat"
 #define INDEX_SUFFIX ".idx"
+#define DELETE_SUFFIX ".del" //deletion bitmap of the data file
+#define VARHEAP_SUFFIX ".var" //values of variable-length columns, see varheap.h
+#define COMPACT_NAME_SUFFIX ".cmp"    //added to the table name for the files table_compact builds
+#define COMPACT_SUFFIX ".compact"     //marker of a committed compaction
+#define COMPACTED_SUFFIX ".compacted" //marker of a committed compaction whose old indices are removed
+
+#define PAX_PAGE_SIZE (64 << 10) //bytes of a data page of LAYOUT_PAX
+#define NULL_BITMAP_SIZE(num_nullable) (((num_nullable) + 7) / 8) //bytes of the null bitmap of a row
 
 typedef map_t ColNameTypeMap;
 typedef map_t ColNameValueMap;
 
+/* Column of a table, resolved once by table_create and table_open so that
+   row-level code needs no map lookups. */
 typedef struct {
+    int id;           //position of the column in a row
+    const char *name;
+    DataType *type;
+    size_t offset;    //byte offset of the column in a row
+    size_t size;
+    PIndex index;     //NULL if the column is not indexed
+    size_t page_offset; //byte offset of the column in a page of LAYOUT_PAX
+    PVarHeap heap;    //heap file of the values of a text column, NULL for other types
+    size_t max_len;   //longest value of a text column
+    int null_bit;     //bit of the column in the null bitmap of a row, -1 if it is NOT NULL
+} Column;
+
+/* Layout of the data file. */
+typedef enum {
+    LAYOUT_ROW = 0, //one row per block
+    LAYOUT_PAX = 1, //pages of rows grouped column by column
+} DataLayout;
+
+typedef struct {
+    char *path;
+    char *name;
     ColNameList *list;
     ColNameTypeMap *map;
-    map_t *index2btree;
+    map_t *col2index; //column name -> PIndex
+    IndexKind index_kind; //storage engine for new indices
+    Column *columns; //schema, in row order, then the null bitmap as one more cell
+    size_t num_columns;
+    size_t num_cells; //columns plus the null bitmap, if any column is nullable
+    size_t null_size; //bytes of the null bitmap at the front of a row, 0 if no column is nullable
+    size_t row_size;
+    DataLayout layout;
+    size_t page_rows; //rows in a full page of LAYOUT_PAX
+    void *tail;       //last page of LAYOUT_PAX, NULL until rows are appended
+    disk_pointer tail_dp;
     DISK *data;
+    struct TableStats *stats; //sampled by the planner, NULL until the first query
+    uint64_t *deleted;    //bit i is set if row i is deleted, see table_delete
+    size_t deleted_words; //words of 'deleted'
+    size_t num_deleted;   //rows deleted since the last table_compact
+    PVarHeap heap;        //NULL if the table has no text column
 } Table;
 
 Table *table_create(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map);
+/* Same as table_create, with the storage engine used for all 'indices'.
+   INDEX_LSM turns random index updates into sequential writes for tables
+   that are mostly inserted into. */
+Table *table_create_with_engine(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind);
+/* Same as table_create_with_engine, with the layout of the data file.
+   LAYOUT_PAX stores rows in pages of PAX_PAGE_SIZE bytes, each holding a batch
+   of rows grouped column by column behind a header with the offset of each
+   column. A scan reads only the columns of its predicates from a page, and
+   the other columns only for pages with matching rows, so scans of a few
+   columns of a wide table read far less. Rows are best appended in batches,
+   a single insert rewrites the cells it adds to the last page. */
+Table *table_create_with_layout(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind, DataLayout layout);
+/* Same as table_create_with_layout, with the columns of 'nullable' allowed to
+   be NULL; the other columns are NOT NULL. A row starts with a null bitmap,
+   one bit per nullable column, stored in LAYOUT_PAX as a minipage of its own,
+   and the cell of a NULL is zeroed. Nullable columns can't be indexed. */
+Table *table_create_with_nulls(const char *path, const char *table_name, ColNameList *list, List *indices, ColNameTypeMap *map, IndexKind index_kind, DataLayout layout, ColNameList *nullable);
 Table *table_open(const char *path, const char *table_name);
 void table_close(Table *table);
+/* Returns the column named 'col_name', NULL if there is none. */
+Column *table_column(Table *table, const char *col_name);
 
 void table_insert(Table *table, ColNameValueMap *map);
+/* Inserts 'num_rows' rows. The rows are converted into one buffer and appended
+   to the data file with one write, then each index is updated with one
+   index_insert_batch call. A nullable column missing from a map is NULL. If
+   a value is invalid or missing, no row is inserted. Returns 0 if success. */
+int table_insert_batch(Table *table, ColNameValueMap **maps, size_t num_rows);
+/* Same as table_insert_batch for rows already in the row layout, each row
+   taking table->row_size bytes of 'rows'. Returns 0 if success. */
+int table_append_rows(Table *table, void *rows, size_t num_rows);
+/* Stores a value of a text column held in memory (see text_cell_set) in
+   the heap file of the table, so that the row it is copied to no longer
+   refers to memory. Values of rows inserted by the functions above are
+   stored by them. Returns 0, or ERANGE if the value is longer than the
+   column allows. */
+int column_store(const Column *column, void *value);
+/* Number of rows in the table. */
+size_t table_num_rows(Table *table);
+/* Copies the rows [first_row, first_row + num_rows) of the data file, in the
+   row layout, to 'rows'. Returns the number of rows copied, less at the end
+   of the table, or a negative number on error. */
+int table_read_rows(Table *table, size_t first_row, size_t num_rows, void *rows);
+/* Returns true if the row 'row_no' of the data file was deleted. Deleted rows
+   keep their slot until table_compact and are skipped by every query. */
+bool table_row_deleted(Table *table, size_t row_no);
+
+/* Builds an index on 'col_name' for the rows already in the table. The data
+   file is scanned by several threads in parallel, the (key, record) entries are
+   sorted by an external merge sort within a fixed memory budget and the index
+   is bulk loaded from the sorted entries. Returns 0 if success. */
+int table_create_index(Table *table, const char *col_name);
 
 void table_select(Table *table, ColNameValueMap *example);
 
+/* A comparison never matches a NULL; OP_IS_NULL and OP_IS_NOT_NULL take no
+   value and test the null bitmap of the rows. */
+typedef struct {
+    const char *col_name;
+    CompareOp op;
+    const char *value;
+    const char *value2; //only for OP_BETWEEN
+} Predicate;
+
+/* Prints the rows matching all 'predicates'. The planner (see table_explain)
+   chooses between a sequential scan, a range scan of one index, where the
+   predicates on the column are merged into a key interval and the rows come
+   in key order, and the intersection of the record sets of several indices,
+   where the rows come in the order of the data file. All predicates are
+   checked on the fetched rows. The records of an index path are fetched in
+   batches sorted by file offset, nearby rows with one read, and the rows are
+   returned in the order of the records. */
+void table_select_where(Table *table, const Predicate *predicates, size_t num_predicates);
+/* Prints the rows matching any of 'predicates'. If all of them are on indexed
+   columns, the record sets of the range scans may be unioned, so that each
+   row is read once in the order of the data file. Otherwise, or if that costs
+   more, the data file is scanned. */
+void table_select_any(Table *table, const Predicate *predicates, size_t num_predicates);
+/* Cursor over the rows of a query, see table_query. */
+typedef struct Cursor *PCursor;
+
+/* Opens a cursor over the rows matching all 'predicates', or any of them if
+   'any' is true, read by the access path the planner chooses. Returns NULL if
+   a predicate is invalid. table_select_where and table_select_any are
+   table_query followed by cursor_print. */
+PCursor table_query(Table *table, const Predicate *predicates, size_t num_predicates, bool any);
+/* Same as table_query for the columns of 'col_names' only. The predicates are
+   evaluated first and the other columns are read only for the rows that
+   match: a scan of LAYOUT_PAX reads their minipages only for pages with
+   matching rows, and the cells of the columns of no predicate and no name of
+   'col_names' are never read or copied, their bytes in a returned row are
+   undefined. cursor_print prints the columns in the order of 'col_names'.
+   Returns NULL if a column or predicate is invalid. */
+PCursor table_query_columns(Table *table, const char **col_names, size_t num_cols,
+                            const Predicate *predicates, size_t num_predicates, bool any);
+/* Prints the columns of 'col_names' of the rows matching all 'predicates',
+   see table_query_columns. */
+void table_select_columns(Table *table, const char **col_names, size_t num_cols, const Predicate *predicates, size_t num_predicates);
+/* Returns the next row, in the row layout of table->columns, NULL after the
+   last one. The row points into the buffer of the cursor and is valid until
+   the next call. A sequential scan of a large table runs on several threads
+   in the background, its rows do not come in the order of the data file. */
+const void *cursor_next(PCursor cursor);
+/* Prints the rows left, one line per row. */
+void cursor_print(PCursor cursor);
+void cursor_close(PCursor cursor);
+
+/* A sort column of table_query_sorted. */
+typedef struct {
+    const char *col_name;
+    bool descending;
+} OrderBy;
+
+/* Opens a cursor like table_query over the rows sorted by the columns of
+   'order_by', compared in turn. If 'limit' is not 0, only the first 'limit'
+   rows are returned; if they fit in 'memory_budget' bytes (0 for a default
+   of 64MB), they are kept in a bounded heap while the rows are read and the
+   other rows are never sorted. Otherwise all rows go through an external
+   merge sort (see extsort.h) holding at most 'memory_budget' bytes, the runs
+   spilled to temporary disks. NULLs come before all values. Nothing is
+   sorted if the planner chooses a range scan of the index on the only sort
+   column, in ascending order. Returns NULL if a column or predicate is
+   invalid. */
+PCursor table_query_sorted(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                           const OrderBy *order_by, size_t num_order_by, size_t limit, size_t memory_budget);
+
+/* Prepared insert or select, bound to its columns once. */
+typedef struct Statement *PStatement;
+
+/* Prepares an insert of the columns of 'col_names', or of all columns in row
+   order if it is NULL. Nullable columns may be left unbound, they are NULL in
+   every row. Returns NULL if a column is unknown, bound twice or missing. */
+PStatement table_prepare_insert(Table *table, const char **col_names, size_t num_cols);
+/* Inserts 'num_rows' rows. values[k] points to 'num_rows' native values of
+   the k-th bound column, consecutive and in the format of its type (int,
+   long long or, for text, a cell set by text_cell_set). No value is parsed and nothing is allocated per row: rows are
+   assembled in a buffer of the statement and appended like
+   table_append_rows, up to 1024 at a time. Returns 0 if success. */
+int statement_insert(PStatement stmt, const void *const *values, size_t num_rows);
+/* Same as statement_insert, with bit i of nulls[k] set if the k-th bound
+   column is NULL in row i, whatever values[k] holds there. 'nulls' or nulls[k]
+   may be NULL for no NULL. Returns EINVAL, with no row inserted, if a NOT
+   NULL column has one. */
+int statement_insert_nulls(PStatement stmt, const void *const *values, const uint64_t *const *nulls, size_t num_rows);
+
+/* A predicate of a prepared select, its value given at each execution. */
+typedef struct {
+    const char *col_name;
+    CompareOp op;
+} PreparedPredicate;
+
+/* Prepares a select of the columns of 'col_names' (all columns if it is NULL,
+   see table_query_columns) of the rows matching all 'predicates', or any of
+   them if 'any' is true. Each predicate takes one parameter, two for
+   OP_BETWEEN and none for OP_IS_NULL and OP_IS_NOT_NULL, in the order of
+   'predicates'. Returns NULL if a column is
+   unknown. */
+PStatement table_prepare_select(Table *table, const char **col_names, size_t num_cols,
+                                const PreparedPredicate *predicates, size_t num_predicates, bool any);
+/* Opens a cursor like table_query with values[k] pointing to the native value
+   of parameter k. The values are copied, the access path is planned for them;
+   the text a cell refers to must be kept until the cursor is closed.
+   Returns NULL if 'stmt' is not a select. */
+PCursor statement_query(PStatement stmt, const void *const *values);
+/* Returns the rows of the select 'stmt' sorted by the columns of 'order_by',
+   the first 'limit' of them if it is not 0, see table_query_sorted. Returns
+   0, or EINVAL for an unknown column or a statement that is not a select. */
+int statement_order_by(PStatement stmt, const OrderBy *order_by, size_t num_order_by, size_t limit, size_t memory_budget);
+/* Number of values taken by statement_insert or statement_query. */
+size_t statement_num_params(PStatement stmt);
+/* Closes 'stmt'. Cursors opened by statement_query stay valid. */
+void statement_close(PStatement stmt);
+
+/* Called for each matching row by thread 'worker' of a parallel scan, see
+   table_scan_parallel. Returns 0 to go on. */
+typedef int (*table_row_consumer)(void *arg, int worker, const void *row);
+
+/* Number of threads table_scan_parallel would use, 1 for small tables. */
+int table_scan_workers(Table *table);
+/* Sets the number of threads of parallel scans and cursors, at most 8 and
+   still fewer for small tables. 0, the default, uses the number of online
+   processors. */
+void table_set_scan_threads(int num_threads);
+/* Scans the data file with several threads, each filtering its own range of
+   blocks, and calls 'consume' for every row matching all 'predicates' (any of
+   them if 'any'). 'consume' is called from several threads at once, with
+   'worker' in [0, table_scan_workers()), so per-worker state such as partial
+   aggregates needs no locking. Returns 0 or the first error. */
+int table_scan_parallel(Table *table, const Predicate *predicates, size_t num_predicates, bool any, table_row_consumer consume, void *arg);
+
+/* Returns true if the value of 'column' in 'row' is NULL. */
+bool column_is_null(const Column *column, const void *row);
+/* Sets the value of a nullable 'column' in 'row' to NULL, zeroing its cell, or
+   marks it as not NULL, the cell being set by the caller. Does nothing for a
+   NOT NULL column. */
+void column_set_null(const Column *column, void *row, bool is_null);
+/* Values of 'column' in 'row', for columns of type int and bigint, 0 for NULL. */
+int column_int(const Column *column, const void *row);
+long long column_bigint(const Column *column, const void *row);
+/* Copies at most 'size' bytes of the value of a text column in 'row' to
+   'buf', not terminated, and returns the length of the value. Values longer
+   than TEXT_INLINE_LEN bytes are read from the heap file of the table. */
+size_t column_text(const Column *column, const void *row, char *buf, size_t size);
+
+/* Prints the access path the planner chooses for table_select_where, or for
+   table_select_any if 'any' is true, with the estimated rows and cost, e.g.
+   "INDEX SCAN on id (rows=4, cost=19.0)". The path with the lowest cost is
+   taken among a sequential scan, a range scan of one index and the
+   intersection (or union) of several; the rows matching the predicates are
+   estimated from a sample of the table. */
+void table_explain(Table *table, const Predicate *predicates, size_t num_predicates, bool any);
+
+typedef enum {
+    AGG_COUNT, //COUNT(column), or COUNT(*) if the column is NULL
+    AGG_SUM,
+    AGG_MIN,
+    AGG_MAX,
+    AGG_AVG,
+} AggregateFn;
+
+typedef struct {
+    AggregateFn fn;
+    const char *col_name;
+} Aggregate;
+
+/* Groups and aggregate values computed by table_aggregate. */
+typedef struct AggregateResult *PAggregateResult;
+
+/* Computes 'aggregates' over the rows matching all 'predicates' (any of them
+   if 'any'), for each group of rows with equal values in the 'num_group_by'
+   columns of 'group_by', or for all rows as one group if there is none. Rows
+   are aggregated inside the scan: each thread of a sequential scan adds them
+   to its own open-addressing hash table of groups, and the tables are merged
+   at the end. Some queries do not read the data file: COUNT(*) without
+   predicates comes from its size, COUNT(*) with predicates on one indexed
+   column from the index, and MIN/MAX of a column with a B+ tree index from
+   its first and last leaf. Rows with NULL in a group column make a group of
+   their own, sorted first; the other groups are sorted by their values.
+   Aggregates of a column skip its NULLs. Returns NULL if a column or
+   predicate is invalid. */
+PAggregateResult table_aggregate(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                                 const char **group_by, size_t num_group_by, const Aggregate *aggregates, size_t num_aggregates);
+size_t aggregate_num_groups(PAggregateResult result);
+/* Value of the group column 'k' of group 'g', in the format of its type, or
+   NULL for the group of NULLs. */
+const void *aggregate_group_value(PAggregateResult result, size_t g, size_t k);
+/* Aggregate 'k' of group 'g'. It is NULL, except for COUNT, if the group has
+   no row. AVG is the only aggregate that is not an integer. */
+bool aggregate_is_null(PAggregateResult result, size_t g, size_t k);
+long long aggregate_int(PAggregateResult result, size_t g, size_t k);
+double aggregate_double(PAggregateResult result, size_t g, size_t k);
+/* Prints one line per group: the group values, then the aggregates. */
+void aggregate_print(PAggregateResult result);
+void aggregate_destroy(PAggregateResult result);
+
+/* Algorithms of table_join. */
+typedef enum {
+    JOIN_AUTO,              //the cheaper of the two below
+    JOIN_HASH,
+    JOIN_INDEX_NESTED_LOOP, //needs an index on the join column of one side
+} JoinMethod;
+
+/* One side of a join: the rows of 'table' matching all 'predicates', joined
+   on the values of column 'col_name'. */
+typedef struct {
+    Table *table;
+    const char *col_name;
+    const Predicate *predicates;
+    size_t num_predicates;
+} JoinInput;
+
+/* Called for each pair of joined rows, in the row layouts of the left and
+   right tables. The rows are valid during the call only. Returns 0 to go on. */
+typedef int (*table_join_consumer)(void *arg, const void *left_row, const void *right_row);
+
+/* Calls 'consume' for each pair of rows of 'left' and 'right' with equal join
+   values. Predicates are parsed once and keys are compared as integers.
+   A hash join reads the side with fewer estimated rows into a hash table and
+   probes it with the rows of the other side. If the build side needs more
+   than 'memory_budget' bytes (0 for a default of 64MB), both sides are split
+   by hash into partitions on temporary disks, which are joined one by one.
+   An index nested-loop join reads the other side in batches, sorts each
+   batch by key and probes the index once per distinct key, so that the index
+   is read in key order. A row with a NULL join value joins no row. Returns
+   0, EINVAL for an invalid input or a join method that cannot be used, or
+   the first non-zero value of 'consume'. */
+int table_join(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget,
+               table_join_consumer consume, void *arg);
+/* Prints the join algorithm table_join chooses, e.g. "HASH JOIN build right
+   (rows=10, cost=4.0)". */
+void table_join_explain(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget);
+
+/* A column set by table_update, to a value in the format of its type. */
+typedef struct {
+    const char *col_name;
+    const char *value; //NULL to set a nullable column to NULL
+} Assignment;
+
+/* Deletes the rows matching all 'predicates' (any of them if 'any'), found by
+   the access path the planner chooses. A deleted row is set in the deletion
+   bitmap of the table and its entries are removed from the B+ tree indices.
+   LSM and copy-on-write indices cannot remove entries: theirs stay, and every
+   lookup through them skips the rows set in the bitmap. The slot and the
+   stale entries are reclaimed by table_compact, which is never run on its own.
+   Returns the number of rows deleted, or -1 if a predicate is invalid or on
+   error. */
+ssize_t table_delete(Table *table, const Predicate *predicates, size_t num_predicates, bool any);
+/* Sets the columns of 'assignments' in the rows matching all 'predicates'
+   (any of them if 'any'). The rows are written in place and the entries of
+   the changed indexed columns are replaced, or, if an index of a changed
+   column cannot remove entries (LSM and copy-on-write indices), the rows are
+   deleted and appended again. Returns the number of rows updated, or -1 if a
+   column, value or predicate is invalid or on error. */
+ssize_t table_update(Table *table, const Predicate *predicates, size_t num_predicates, bool any,
+                     const Assignment *assignments, size_t num_assignments);
+/* Copies the live rows to a new data file, in the same order, and builds
+   every index again, so that scans and indices no longer hold deleted rows.
+   The new files are built aside and replace the old ones once complete; a
+   crash leaves the old table or is finished by table_open. Records of rows
+   change and the indices are opened again: no cursor, prepared statement or
+   record may be in use on the table. table_num_rows and num_deleted tell
+   when it is worth calling. Returns 0 if success. */
+int table_compact(Table *table);
+
+/* Adds a bloom filter to the B+ tree index on 'col_name', so that equality
+   lookups of missing keys are answered without reading the index. LSM indices
+   always keep one filter per run. 'expected_keys' sizes
+   the filter, 0 sizes it for the keys already in the index. */
+int table_enable_bloom(Table *table, const char *col_name, size_t expected_keys);
+
 #endif 
@@ -1,5 +1,12 @@
 #include "../table.h"
+#include "../csv.h"
+#include "../sql.h"
+#include "../btree.h"
+#include "../cowbtree.h"
+#include "../lsm.h"
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 static char * char_pointer(const char *str) {
     char *result = (char *)malloc(strlen(str) + 1);
@@ -65,6 +72,952 @@ static void select_2(Table *table) {
     map_free_all(example);
 }
 
+static void select_3(Table *table) {
+    ColNameValueMap *example = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(example, char_pointer("num"), char_pointer("1"));
+    table_select(table, example);
+    map_free_all(example);
+}
+
+static void select_num(Table *table, const char *num) {
+    ColNameValueMap *example = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(example, char_pointer("num"), char_pointer(num));
+    table_select(table, example);
+    map_free_all(example);
+}
+
+//counts the records of keys in [start, end] and checks that each one was inserted with its key
+static size_t btree_count(PBTree btree, int start, int end) {
+    vector_t *records = btree_select(btree, &start, &end);
+    if (records == NULL)
+        return 0;
+    size_t count = vector_size(records);
+    for (size_t i = 0; i < count; i++) {
+        record_t record = *(record_t *)vector_get(records, i);
+        if ((int)(record % 100000) < start || (int)(record % 100000) > end)
+            printf("btree: record %lu out of [%d, %d]\n", (unsigned long)record, start, end);
+    }
+    vector_destroy(records);
+    return count;
+}
+
+static void btree_insert_n(PBTree btree, int key, int n, int *seq) {
+    for (int i = 0; i < n; i++, (*seq)++)
+        btree_insert(btree, &key, (record_t)*seq * 100000 + key);
+}
+
+//regression tests of B+ tree splits and range selects
+static void test_btree() {
+    DataType *type = int_data_type();
+    int seq = 1;
+    //ascending keys split non-leaf nodes at their last position
+    errno = ENOENT; //left set by a failing call before btree_create
+    PBTree btree = btree_create("./", "tmp_btree", "asc", type);
+    for (int key = 0; key < 30000; key++)
+        btree_insert_n(btree, key, 1, &seq);
+    size_t found = 0;
+    for (int key = 0; key < 30000; key++)
+        found += btree_count(btree, key, key);
+    printf("btree ascending: %zu of 30000 keys, %zu in range\n", found, btree_count(btree, 0, 29999));
+    btree_close(btree);
+    //a leaf root split with only duplicates, then ranges starting after a run of duplicates
+    btree = btree_create("./", "tmp_btree", "dup", type);
+    btree_insert_n(btree, 7, 500, &seq);
+    btree_insert_n(btree, 9, 10, &seq);
+    btree_insert_n(btree, 3, 20, &seq);
+    printf("btree duplicates: %zu %zu %zu %zu %zu\n", btree_count(btree, 7, 7), btree_count(btree, 8, 9),
+        btree_count(btree, 9, 100), btree_count(btree, 0, 7), btree_count(btree, 10, 100));
+    btree_close(btree);
+    //duplicates of the key whose bytes equal those of the infinity key
+    btree = btree_create("./", "tmp_btree", "zero", type);
+    btree_insert_n(btree, 0, 300, &seq);
+    btree_insert_n(btree, 1, 5, &seq);
+    printf("btree zero keys: %zu %zu %zu\n", btree_count(btree, 0, 0), btree_count(btree, 1, 1), btree_count(btree, 0, 1));
+    btree_close(btree);
+}
+
+//table of a bigint "id" and an int "num", indexed on 'index_col'
+static Table *create_id_num_table(const char *table_name, const char *index_col, IndexKind index_kind) {
+    ColNameList *list = new_list();
+    char *id = char_pointer("id");
+    char *num = char_pointer("num");
+    list_add(list, id);
+    list_add(list, num);
+    ColNameValueMap *map = map_create(cmp, MAP_KEY_REFERENCE_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(map, id, char_pointer("bigint"));
+    map_put(map, num, char_pointer("int"));
+    List *indices = new_list();
+    list_add(indices, strcmp(index_col, "id") == 0 ? id : num);
+    Table *table = table_create_with_engine("./", table_name, list, indices, map, index_kind);
+    list_free(indices);
+    return table;
+}
+
+static void test_engine(const char *table_name, IndexKind index_kind) {
+    Table *table = create_id_num_table(table_name, "num", index_kind);
+    //enough rows for several memtable flushes and a compaction
+    for (int i = 1; i <= 70000; i++) {
+        ColNameValueMap *row = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+        map_put(row, char_pointer("id"), itoa(2000000 + i));
+        map_put(row, char_pointer("num"), itoa(70001 - i));
+        table_insert(table, row);
+        map_free_all(row);
+    }
+    select_num(table, "12345");
+    select_num(table, "3"); //still in the memtable of INDEX_LSM
+    select_num(table, "70001"); //no item
+    table_close(table);
+    table = table_open("./", table_name);
+    select_num(table, "68000");
+    //num is in the reverse order of the data file, the records are fetched in batches sorted by offset
+    Predicate range = {"num", OP_BETWEEN, "138", "197"};
+    table_explain(table, &range, 1, false);
+    PCursor cursor = table_query(table, &range, 1, false);
+    Column *id_column = table_column(table, "id"), *num_column = table_column(table, "num");
+    const void *row;
+    long long count = 0, sum = 0, out_of_order = 0, last_num = 0;
+    while ((row = cursor_next(cursor)) != NULL) {
+        out_of_order += column_int(num_column, row) < last_num;
+        last_num = column_int(num_column, row);
+        sum += column_bigint(id_column, row);
+        count++;
+    }
+    cursor_close(cursor);
+    printf("fetch: %lld rows sum %lld, %lld out of order\n", count, sum, out_of_order);
+    table_close(table);
+}
+
+struct cow_reader {
+    PCowBTree btree;
+    _Atomic int state; //0: starting, 1: snapshot pinned, 2: stop reading
+    _Atomic size_t reads;
+    size_t changed;
+};
+
+//reads the pinned snapshot until told to stop, the 1000 entries it saw first must not change
+static void *cow_read(void *arg) {
+    struct cow_reader *reader = (struct cow_reader *)arg;
+    PCowSnapshot snapshot = cowbtree_snapshot(reader->btree);
+    int start = 0, end = 1 << 30;
+    atomic_store(&reader->state, 1);
+    do {
+        vector_t *records = cowbtree_snapshot_select(snapshot, &start, &end);
+        bool same = vector_size(records) == 1000;
+        for (size_t i = 0; same && i < vector_size(records); i++)
+            same = *(record_t *)vector_get(records, i) == i;
+        reader->changed += !same;
+        reader->reads++;
+        vector_destroy(records);
+    } while (atomic_load(&reader->state) == 1);
+    cowbtree_release(snapshot);
+    return NULL;
+}
+
+//a snapshot held by another thread while inserts commit new versions
+static void test_cow_snapshot() {
+    PCowBTree btree = cowbtree_create("./", "tmp_cow_snapshot", "key", int_data_type());
+    for (int key = 0; key < 1000; key++)
+        cowbtree_insert(btree, &key, key);
+    struct cow_reader reader = { btree, 0, 0, 0 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, cow_read, &reader);
+    while (atomic_load(&reader.state) == 0)
+        ;
+    size_t freed = 0;
+    for (int key = 1000; key < 5000; key++) {
+        size_t num_retired = btree->num_retired;
+        cowbtree_insert(btree, &key, key);
+        freed += btree->num_retired < num_retired; //retired pages are kept while the snapshot is pinned
+    }
+    atomic_store(&reader.state, 2);
+    pthread_join(thread, NULL);
+    printf("cow snapshot: changed %zu times, retired pages freed %zu times while pinned\n", reader.changed, freed);
+    int key = 5000;
+    cowbtree_insert(btree, &key, key); //reclaims the pages retired while the snapshot was pinned
+    size_t num_free = btree->num_free;
+    disk_pointer end = btree->end;
+    for (key = 5001; key < 5100; key++)
+        cowbtree_insert(btree, &key, key);
+    int start = 0, last = 1 << 30;
+    vector_t *records = cowbtree_select(btree, &start, &last);
+    printf("cow released: %s free pages, file %s, %zu keys, %s reads\n", num_free > 0 ? "has" : "no",
+        btree->end == end ? "not grown" : "grown", vector_size(records), reader.reads > 0 ? "some" : "no");
+    vector_destroy(records);
+    cowbtree_close(btree);
+}
+
+static size_t lsm_count(PLsm lsm) {
+    int start = 0, end = 1 << 30;
+    vector_t *records = lsm_select(lsm, &start, &end);
+    size_t count = vector_size(records);
+    vector_destroy(records);
+    return count;
+}
+
+//a crash after the manifest of a flush is written but before the log is truncated
+static void test_lsm_log() {
+    PLsm lsm = lsm_create("./", "tmp_lsm_log", "key", int_data_type());
+    for (int key = 0; key < 100; key++)
+        lsm_insert(lsm, &key, key);
+    FILE *file = fopen("./tmp_lsm_log_key" LSM_LOG_SUFFIX, "r"); //every insert is flushed to the log
+    char log[4096];
+    size_t size = fread(log, 1, sizeof(log), file);
+    fclose(file);
+    lsm_flush(lsm);
+    lsm_close(lsm);
+    file = fopen("./tmp_lsm_log_key" LSM_LOG_SUFFIX, "w");
+    fwrite(log, 1, size, file);
+    fclose(file);
+    lsm = lsm_open("./", "tmp_lsm_log", "key", int_data_type());
+    printf("lsm log: %s entries flushed, %zu records after replay", size >= 100 * lsm->entry_size ? "all" : "not all", lsm_count(lsm));
+    int key = 100;
+    lsm_insert(lsm, &key, key);
+    lsm_close(lsm);
+    lsm = lsm_open("./", "tmp_lsm_log", "key", int_data_type());
+    printf(", %zu after reopen\n", lsm_count(lsm));
+    lsm_close(lsm);
+}
+
+static void insert_row(Table *table, long long id, long long num) {
+    ColNameValueMap *row = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(row, char_pointer("id"), itoa(id));
+    map_put(row, char_pointer("num"), itoa(num));
+    table_insert(table, row);
+    map_free_all(row);
+}
+
+static void test_create_index() {
+    Table *table = create_id_num_table("tmp_build", "id", INDEX_BTREE);
+    for (int i = 1; i <= 30000; i++)
+        insert_row(table, 3000000 + i, i % 10000 + 1); //3 rows for each num
+    select_num(table, "1234"); //full scan, "num" is not indexed
+    table_create_index(table, "num");
+    select_num(table, "1234");
+    select_num(table, "10001"); //no item
+    Predicate selective = {"num", OP_EQ, "1234", NULL};
+    table_explain(table, &selective, 1, false);
+    Predicate unselective = {"num", OP_GE, "100", NULL};
+    table_explain(table, &unselective, 1, false); //most rows match, cheaper to scan
+    Predicate both[] = {
+        {"num", OP_LE, "20", NULL},
+        {"id", OP_BETWEEN, "3010001", "3010100"},
+    };
+    table_explain(table, both, 2, false);
+    table_select_where(table, both, 2);
+    table_explain(table, both, 2, true);
+    table_close(table);
+    table = table_open("./", "tmp_build"); //the new index is in the frame file
+    insert_row(table, 3030001, 1234);
+    select_num(table, "1234");
+    table_close(table);
+}
+
+static void select_where(Table *table, const char *col_name, CompareOp op, const char *value, const char *value2) {
+    Predicate predicate = {col_name, op, value, value2};
+    table_select_where(table, &predicate, 1);
+    printf("\n");
+}
+
+static void test_range() {
+    Table *table = create_id_num_table("tmp_range", "id", INDEX_BTREE);
+    for (int i = 1; i <= 1000; i++)
+        insert_row(table, i, i % 7 + 1);
+    select_where(table, "id", OP_GE, "997", NULL);
+    Predicate small = {"id", OP_GE, "997", NULL};
+    table_explain(table, &small, 1, false); //the table fits in a few reads
+    select_where(table, "id", OP_LT, "3", NULL);
+    select_where(table, "id", OP_BETWEEN, "500", "503");
+    select_where(table, "id", OP_BETWEEN, "503", "500"); //no item
+    //range scan on "id", "num" and the strict bound are checked on the rows
+    Predicate predicates[] = {
+        {"num", OP_EQ, "1", NULL},
+        {"id", OP_GT, "21", NULL},
+        {"id", OP_LE, "42", NULL},
+    };
+    table_select_where(table, predicates, 3);
+    printf("\n");
+    select_where(table, "num", OP_GT, "7", NULL); //full scan, no item
+    table_create_index(table, "num");
+    //both indices are probed and the record sets intersected
+    Predicate both[] = {
+        {"id", OP_BETWEEN, "100", "130"},
+        {"num", OP_EQ, "3", NULL},
+    };
+    table_select_where(table, both, 2);
+    printf("\n");
+    Predicate any[] = {
+        {"id", OP_GE, "998", NULL},
+        {"id", OP_EQ, "5", NULL},
+        {"id", OP_LE, "2", NULL},
+        {"num", OP_EQ, "8", NULL},
+    };
+    table_select_any(table, any, 4);
+    table_close(table);
+}
+
+static void test_insert_batch() {
+    Table *table = create_id_num_table("tmp_batch", "id", INDEX_BTREE);
+    ColNameValueMap *rows[1000];
+    for (int i = 1; i <= 1000; i++) {
+        rows[i - 1] = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+        map_put(rows[i - 1], char_pointer("id"), itoa(i));
+        map_put(rows[i - 1], char_pointer("num"), itoa(i % 7 + 1));
+    }
+    table_insert_batch(table, rows, 1000);
+    ColNameValueMap *invalid = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(invalid, char_pointer("id"), itoa(1001));
+    map_put(invalid, char_pointer("num"), char_pointer("x"));
+    ColNameValueMap *batch[] = {rows[0], invalid};
+    if (table_insert_batch(table, batch, 2) == 0) //nothing is inserted
+        printf("Invalid batch inserted\n");
+    map_free_all(invalid);
+    for (int i = 0; i < 1000; i++)
+        map_free_all(rows[i]);
+    select_where(table, "id", OP_GE, "997", NULL);
+    select_where(table, "id", OP_EQ, "1", NULL); //once, the invalid batch left no copy
+    select_where(table, "num", OP_EQ, "8", NULL); //full scan, no item
+    table_close(table);
+}
+
+static void test_csv() {
+    Table *table = create_id_num_table("tmp_csv", "id", INDEX_BTREE);
+    //columns in another order, quotes, CRLF, a blank line and no line break at the end
+    FILE *file = fopen("tmp_csv.csv", "w");
+    fprintf(file, "num,id\r\n7,1\r\n\"-8\",2\n\n9,\"3\"");
+    fclose(file);
+    file = fopen("tmp_csv.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, true));
+    fclose(file);
+    file = fopen("tmp_csv.csv", "w");
+    fprintf(file, "4,10\n5,x\n");
+    fclose(file);
+    file = fopen("tmp_csv.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, false) != 0); //the first line is kept
+    fclose(file);
+    file = fopen("tmp_csv.csv", "w");
+    fprintf(file, "6,11\n12,\"13\n");
+    fclose(file);
+    file = fopen("tmp_csv.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, false) != 0); //unterminated quote, the first line is kept
+    fclose(file);
+    table_export_csv(table, stdout, true);
+    fflush(stdout);
+    table_close(table);
+
+    //several chunks, exported back to the same text
+    table = create_id_num_table("tmp_csv_big", "id", INDEX_BTREE);
+    file = fopen("tmp_csv.csv", "w");
+    fprintf(file, "id,num\n");
+    for (int i = 0; i < 200000; i++)
+        fprintf(file, "%d,%d\n", 4000000 + i, i % 1000 - 500);
+    fclose(file);
+    file = fopen("tmp_csv.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, true));
+    fclose(file);
+    select_where(table, "id", OP_BETWEEN, "4123455", "4123456");
+    FILE *out = fopen("tmp_csv.out", "w");
+    table_export_csv(table, out, true);
+    fclose(out);
+    file = fopen("tmp_csv.csv", "r");
+    out = fopen("tmp_csv.out", "r");
+    int a, b;
+    while ((a = fgetc(file)) == (b = fgetc(out)) && a != EOF)
+        ;
+    printf("export %s import\n", a == b ? "matches" : "differs from");
+    fclose(file);
+    fclose(out);
+    remove("tmp_csv.csv");
+    remove("tmp_csv.out");
+
+    //rows consumed through a cursor, without printing
+    Predicate predicates[] = {
+        {"id", OP_GE, "4100000", NULL},
+        {"num", OP_EQ, "7", NULL},
+    };
+    PCursor cursor = table_query(table, predicates, 2, false);
+    Column *id = table_column(table, "id"), *num = table_column(table, "num");
+    const void *row;
+    long long count = 0, sum = 0;
+    while ((row = cursor_next(cursor)) != NULL) {
+        count++;
+        sum += column_bigint(id, row) + column_int(num, row);
+    }
+    cursor_close(cursor);
+    printf("count %lld sum %lld\n", count, sum);
+    table_close(table);
+}
+
+struct worker_sums {
+    Column *id;
+    int num_workers;
+    long long count[8], sum[8];
+    _Atomic int bad_workers;
+};
+
+static int sum_worker_row(void *arg, int worker, const void *row) {
+    struct worker_sums *sums = (struct worker_sums *)arg;
+    if (worker < 0 || worker >= sums->num_workers) {
+        atomic_fetch_add(&sums->bad_workers, 1);
+        return 0;
+    }
+    //each worker only touches its own sums
+    sums->count[worker]++;
+    sums->sum[worker] += column_bigint(sums->id, row);
+    return 0;
+}
+
+//parallel scans with a fixed number of threads, whatever the processors of the machine
+static void test_scan_parallel() {
+    Table *table = create_id_num_table("tmp_parallel", "id", INDEX_BTREE);
+    FILE *file = fopen("tmp_parallel.csv", "w");
+    for (int i = 1; i <= 200000; i++)
+        fprintf(file, "%d,%d\n", i, i % 100);
+    fclose(file);
+    file = fopen("tmp_parallel.csv", "r");
+    table_import_csv(table, file, false);
+    fclose(file);
+    remove("tmp_parallel.csv");
+    table_set_scan_threads(4);
+    struct worker_sums sums = {table_column(table, "id"), table_scan_workers(table)};
+    Predicate predicate = {"num", OP_LT, "10", NULL};
+    int ret = table_scan_parallel(table, &predicate, 1, false, sum_worker_row, &sums);
+    long long count = 0, sum = 0;
+    int busy = 0;
+    for (int i = 0; i < sums.num_workers; i++) {
+        count += sums.count[i];
+        sum += sums.sum[i];
+        busy += sums.count[i] > 0;
+    }
+    printf("parallel scan: %d, %d workers, %d with rows, %lld rows sum %lld, %d bad workers\n",
+        ret, sums.num_workers, busy, count, sum, atomic_load(&sums.bad_workers));
+    //the cursor of a sequential scan reads the chunks queued by the threads
+    PCursor cursor = table_query(table, &predicate, 1, false);
+    const void *row;
+    count = sum = 0;
+    while ((row = cursor_next(cursor)) != NULL) {
+        count++;
+        sum += column_bigint(sums.id, row);
+    }
+    cursor_close(cursor);
+    printf("parallel cursor: %lld rows sum %lld\n", count, sum);
+    //closed while the threads wait for room in the full queue
+    Predicate all = {"num", OP_GE, "0", NULL};
+    cursor = table_query(table, &all, 1, false);
+    for (count = 0; count < 10 && cursor_next(cursor) != NULL; count++)
+        ;
+    cursor_close(cursor);
+    printf("parallel cursor closed after %lld rows\n", count);
+    table_set_scan_threads(0);
+    table_close(table);
+}
+
+static void insert_pax_row(Table *table, long long id, long long num, long long val) {
+    ColNameValueMap *row = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(row, char_pointer("id"), itoa(id));
+    map_put(row, char_pointer("num"), itoa(num));
+    map_put(row, char_pointer("val"), itoa(val));
+    table_insert(table, row);
+    map_free_all(row);
+}
+
+static void test_pax() {
+    ColNameList *list = new_list();
+    char *id = char_pointer("id"), *num = char_pointer("num"), *val = char_pointer("val");
+    list_add(list, id);
+    list_add(list, num);
+    list_add(list, val);
+    ColNameValueMap *map = map_create(cmp, MAP_KEY_REFERENCE_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(map, id, char_pointer("bigint"));
+    map_put(map, num, char_pointer("int"));
+    map_put(map, val, char_pointer("bigint"));
+    List *indices = new_list();
+    list_add(indices, id);
+    Table *table = table_create_with_layout("./", "tmp_pax", list, indices, map, INDEX_BTREE, LAYOUT_PAX);
+    list_free(indices);
+
+    //single rows go to the last page, batches fill several pages
+    insert_pax_row(table, 30000, 7, 3);
+    size_t num_rows = 20000;
+    char *rows = malloc(num_rows * table->row_size);
+    Column *id_column = table_column(table, "id"), *num_column = table_column(table, "num"), *val_column = table_column(table, "val");
+    for (size_t i = 0; i < num_rows; i++) {
+        long long id_value = i, val_value = 3 * i;
+        int num_value = i % 1000;
+        memcpy(rows + i * table->row_size + id_column->offset, &id_value, sizeof(id_value));
+        memcpy(rows + i * table->row_size + num_column->offset, &num_value, sizeof(num_value));
+        memcpy(rows + i * table->row_size + val_column->offset, &val_value, sizeof(val_value));
+    }
+    printf("append: %d\n", table_append_rows(table, rows, num_rows));
+    free(rows);
+    table_close(table);
+
+    table = table_open("./", "tmp_pax");
+    printf("layout %d rows %zu\n", table->layout, table_num_rows(table));
+    insert_pax_row(table, 20000, 7, 60000);
+    select_where(table, "num", OP_EQ, "7", NULL);
+    table_explain(table, (Predicate[]){{"num", OP_EQ, "7", NULL}}, 1, false);
+    select_where(table, "id", OP_BETWEEN, "9998", "10000");
+    select_where(table, "num", OP_GT, "2147483647", NULL); //empty intervals
+    select_where(table, "num", OP_LT, "-2147483648", NULL);
+    table_create_index(table, "val");
+    select_where(table, "val", OP_LT, "6", NULL);
+
+    FILE *out = fopen("tmp_pax.csv", "w");
+    table_export_csv(table, out, false);
+    fclose(out);
+    FILE *file = fopen("tmp_pax.csv", "r");
+    long long lines = 0, sum = 0, a, b, c;
+    while (fscanf(file, "%lld,%lld,%lld", &a, &b, &c) == 3) {
+        lines++;
+        sum += a + b + c;
+    }
+    fclose(file);
+    remove("tmp_pax.csv");
+    printf("export: %lld rows sum %lld\n", lines, sum);
+    table_close(table);
+}
+
+static void aggregate(Table *table, const Predicate *predicates, size_t num_predicates,
+                      const char **group_by, size_t num_group_by, const Aggregate *aggregates, size_t num_aggregates) {
+    PAggregateResult result = table_aggregate(table, predicates, num_predicates, false, group_by, num_group_by, aggregates, num_aggregates);
+    aggregate_print(result);
+    aggregate_destroy(result);
+}
+
+static void test_aggregate() {
+    Table *table = table_open("./", "tmp_pax");
+    //from the indices on id and val
+    Aggregate from_index[] = {{AGG_COUNT, NULL}, {AGG_MIN, "id"}, {AGG_MAX, "id"}, {AGG_MIN, "val"}, {AGG_MAX, "val"}};
+    aggregate(table, NULL, 0, NULL, 0, from_index, 5);
+    aggregate(table, (Predicate[]){{"id", OP_BETWEEN, "100", "199"}}, 1, NULL, 0, from_index, 1);
+    //by a scan
+    Aggregate all[] = {{AGG_COUNT, NULL}, {AGG_SUM, "val"}, {AGG_MIN, "num"}, {AGG_MAX, "num"}, {AGG_AVG, "num"}};
+    aggregate(table, NULL, 0, NULL, 0, all, 5);
+    const char *group_by[] = {"num"};
+    aggregate(table, (Predicate[]){{"num", OP_LT, "3", NULL}}, 1, group_by, 1, all, 5);
+    aggregate(table, (Predicate[]){{"id", OP_LT, "2", NULL}}, 1, group_by, 1, all, 2);
+    aggregate(table, (Predicate[]){{"num", OP_GT, "5000", NULL}}, 1, NULL, 0, all, 5); //no row
+    table_close(table);
+}
+
+struct join_sum {
+    Column *left, *right;
+    long long count, sum;
+};
+
+static int sum_joined(void *arg, const void *left_row, const void *right_row) {
+    struct join_sum *sum = (struct join_sum *)arg;
+    sum->count++;
+    sum->sum += column_bigint(sum->left, left_row) + column_bigint(sum->right, right_row);
+    return 0;
+}
+
+static void join(const JoinInput *left, const JoinInput *right, JoinMethod method, size_t memory_budget) {
+    struct join_sum sum = {table_column(left->table, "id"), table_column(right->table, "weight"), 0, 0};
+    table_join_explain(left, right, method, memory_budget);
+    int ret = table_join(left, right, method, memory_budget, sum_joined, &sum);
+    printf("join: %d count %lld sum %lld\n", ret, sum.count, sum.sum);
+}
+
+static void test_join() {
+    ColNameList *list = new_list();
+    char *key = char_pointer("key"), *weight = char_pointer("weight");
+    list_add(list, key);
+    list_add(list, weight);
+    ColNameValueMap *map = map_create(cmp, MAP_KEY_REFERENCE_COPY | MAP_VALUE_SHALLOW_COPY);
+    map_put(map, key, char_pointer("int"));
+    map_put(map, weight, char_pointer("bigint"));
+    List *indices = new_list();
+    list_add(indices, key);
+    Table *dim = table_create("./", "tmp_dim", list, indices, map);
+    list_free(indices);
+    for (int k = 1; k <= 10; k++) {
+        ColNameValueMap *row = map_create(cmp, MAP_KEY_SHALLOW_COPY | MAP_VALUE_SHALLOW_COPY);
+        map_put(row, char_pointer("key"), itoa(k));
+        map_put(row, char_pointer("weight"), itoa(100 * k));
+        table_insert(dim, row);
+        map_free_all(row);
+    }
+    Table *pax = table_open("./", "tmp_pax");
+
+    //pax.num = dim.key: 20 rows of tmp_pax per key, 22 for key 7, 142 in all
+    JoinInput facts = {pax, "num", NULL, 0};
+    JoinInput keys = {dim, "key", (Predicate[]){{"weight", OP_LE, "700", NULL}}, 1};
+    join(&facts, &keys, JOIN_AUTO, 0);
+    join(&facts, &keys, JOIN_HASH, 64); //partitioned
+    join(&facts, &keys, JOIN_INDEX_NESTED_LOOP, 0);
+    //pax.id = dim.key, both sides indexed
+    JoinInput ids = {pax, "id", (Predicate[]){{"val", OP_LT, "15", NULL}}, 1};
+    join(&ids, &keys, JOIN_AUTO, 0);
+    join(&ids, &keys, JOIN_HASH, 0);
+    JoinInput none = {dim, "weight", (Predicate[]){{"key", OP_GT, "100", NULL}}, 1};
+    join(&ids, &none, JOIN_AUTO, 0);
+    printf("join: %d\n", table_join(&ids, &(JoinInput){dim, "missing", NULL, 0}, JOIN_AUTO, 0, sum_joined, NULL));
+    table_close(pax);
+    table_close(dim);
+}
+
+static void test_order() {
+    Table *table = table_open("./", "tmp_pax");
+    //top-N heap
+    OrderBy by_num[] = {{"num", true}, {"id", false}};
+    PCursor cursor = table_query_sorted(table, (Predicate[]){{"id", OP_LT, "3000", NULL}}, 1, false, by_num, 2, 4, 0);
+    cursor_print(cursor);
+    cursor_close(cursor);
+    //in index order, no sort
+    OrderBy by_val[] = {{"val", false}};
+    cursor = table_query_sorted(table, (Predicate[]){{"val", OP_LT, "9", NULL}}, 1, false, by_val, 1, 0, 0);
+    cursor_print(cursor);
+    cursor_close(cursor);
+    //external sort with runs on disk
+    OrderBy by_num_id[] = {{"num", false}, {"id", true}};
+    cursor = table_query_sorted(table, NULL, 0, false, by_num_id, 2, 0, 4096);
+    Column *id = table_column(table, "id"), *num = table_column(table, "num");
+    const void *row;
+    long long count = 0, out_of_order = 0, last_num = -1, last_id = 0;
+    while ((row = cursor_next(cursor)) != NULL) {
+        if (column_int(num, row) < last_num || (column_int(num, row) == last_num && column_bigint(id, row) > last_id))
+            out_of_order++;
+        last_num = column_int(num, row);
+        last_id = column_bigint(id, row);
+        count++;
+    }
+    cursor_close(cursor);
+    printf("sorted: %lld rows, %lld out of order\n", count, out_of_order);
+    //a limit too large for the budget
+    OrderBy by_id[] = {{"id", true}};
+    cursor = table_query_sorted(table, (Predicate[]){{"num", OP_EQ, "7", NULL}}, 1, false, by_id, 1, 3, 16);
+    cursor_print(cursor);
+    cursor_close(cursor);
+    table_close(table);
+}
+
+static void test_projection() {
+    Table *table = table_open("./", "tmp_pax");
+    //by the index on id, then by a scan reading the minipages of val for the pages with matches only
+    const char *val_id[] = {"val", "id"}, *val[] = {"val"};
+    table_select_columns(table, val_id, 2, (Predicate[]){{"id", OP_BETWEEN, "9998", "10001"}}, 1);
+    PCursor cursor = table_query_columns(table, val, 1, (Predicate[]){{"num", OP_EQ, "7", NULL}}, 1, false);
+    Column *val_column = table_column(table, "val");
+    const void *row;
+    long long count = 0, sum = 0;
+    while ((row = cursor_next(cursor)) != NULL) {
+        sum += column_bigint(val_column, row);
+        count++;
+    }
+    cursor_close(cursor);
+    printf("projection: %lld rows sum %lld\n", count, sum);
+    const char *missing[] = {"missing"};
+    printf("projection: %s\n", table_query_columns(table, missing, 1, NULL, 0, false) == NULL ? "NULL" : "cursor");
+    table_close(table);
+
+    table = table_open("./", "tmp_range");
+    const char *num[] = {"num"};
+    table_select_columns(table, num, 1, (Predicate[]){{"id", OP_LT, "4", NULL}}, 1);
+    table_close(table);
+}
+
+static void copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "r"), *out = fopen(to, "w");
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, size, out);
+    fclose(in);
+    fclose(out);
+}
+
+static void count_rows(Table *table, const Predicate *predicates, size_t num_predicates) {
+    Aggregate count[] = {{AGG_COUNT, NULL}};
+    aggregate(table, predicates, num_predicates, NULL, 0, count, 1);
+}
+
+static void test_delete() {
+    Table *table = create_id_num_table("tmp_del", "id", INDEX_BTREE);
+    size_t num_rows = 10000;
+    char *rows = malloc(num_rows * table->row_size);
+    Column *id = table_column(table, "id"), *num = table_column(table, "num");
+    for (size_t i = 0; i < num_rows; i++) {
+        long long id_value = i + 1;
+        int num_value = (i + 1) % 10;
+        memcpy(rows + i * table->row_size + id->offset, &id_value, sizeof(id_value));
+        memcpy(rows + i * table->row_size + num->offset, &num_value, sizeof(num_value));
+    }
+    table_append_rows(table, rows, num_rows);
+    free(rows);
+    //by a sequential scan, then by the index on id
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"num", OP_EQ, "3", NULL}}, 1, false));
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"id", OP_LE, "5", NULL}}, 1, false));
+    count_rows(table, NULL, 0);
+    count_rows(table, (Predicate[]){{"id", OP_LE, "20", NULL}}, 1);
+    //in place, the entry of id is replaced
+    Assignment set_num[] = {{"num", "42"}}, set_id[] = {{"id", "20001"}};
+    printf("update: %zd\n", table_update(table, (Predicate[]){{"id", OP_BETWEEN, "6", "8"}}, 1, false, set_num, 1));
+    printf("update: %zd\n", table_update(table, (Predicate[]){{"id", OP_EQ, "10", NULL}}, 1, false, set_id, 1));
+    printf("update: %zd\n", table_update(table, NULL, 0, false, (Assignment[]){{"num", "x"}}, 1));
+    table_close(table);
+
+    table = table_open("./", "tmp_del"); //the deletion bitmap is loaded from disk
+    select_where(table, "id", OP_LE, "12", NULL);
+    select_where(table, "id", OP_EQ, "20001", NULL);
+    printf("compact: %d\n", table_compact(table));
+    printf("rows %zu deleted %zu\n", table_num_rows(table), table->num_deleted);
+    select_where(table, "id", OP_LE, "12", NULL);
+    count_rows(table, (Predicate[]){{"num", OP_EQ, "3", NULL}}, 1);
+    //most rows are deleted, the table is compacted when asked
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"num", OP_LE, "7", NULL}}, 1, false));
+    printf("rows %zu deleted %zu\n", table_num_rows(table), table->num_deleted);
+    printf("compact: %d\n", table_compact(table));
+    printf("rows %zu deleted %zu\n", table_num_rows(table), table->num_deleted);
+    select_where(table, "id", OP_BETWEEN, "9990", "10000");
+    table_close(table);
+
+    //compactions left by a crash, before and after the marker
+    copy_file("tmp_del.dat", "tmp_del" COMPACT_NAME_SUFFIX DATA_SUFFIX);
+    table = table_open("./", "tmp_del");
+    printf("not committed: new data file %s\n", access("tmp_del" COMPACT_NAME_SUFFIX DATA_SUFFIX, F_OK) == 0 ? "left" : "removed");
+    table_close(table);
+    copy_file("tmp_del.dat", "tmp_del" COMPACT_NAME_SUFFIX DATA_SUFFIX);
+    copy_file("tmp_del_id.idx", "tmp_del" COMPACT_NAME_SUFFIX "_id.idx");
+    rename("tmp_del_id.idx", "tmp_del" COMPACTED_SUFFIX); //the marker once the old index is removed
+    table = table_open("./", "tmp_del");
+    printf("committed: marker %s, new index %s\n", access("tmp_del" COMPACTED_SUFFIX, F_OK) == 0 ? "left" : "removed",
+        access("tmp_del_id.idx", F_OK) == 0 ? "in place" : "missing");
+    select_where(table, "id", OP_BETWEEN, "9990", "10000");
+    table_close(table);
+
+    //LAYOUT_PAX, with indices on id and val
+    table = table_open("./", "tmp_pax");
+    Aggregate all[] = {{AGG_COUNT, NULL}, {AGG_SUM, "val"}, {AGG_MIN, "val"}, {AGG_MAX, "id"}};
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"id", OP_BETWEEN, "100", "199"}}, 1, false));
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"num", OP_EQ, "999", NULL}}, 1, false));
+    printf("update: %zd\n", table_update(table, (Predicate[]){{"id", OP_LT, "3", NULL}}, 1, false, (Assignment[]){{"val", "100000"}}, 1));
+    aggregate(table, NULL, 0, NULL, 0, all, 4);
+    select_where(table, "val", OP_LT, "12", NULL);
+    printf("compact: %d\n", table_compact(table));
+    aggregate(table, NULL, 0, NULL, 0, all, 4);
+    select_where(table, "val", OP_GE, "100000", NULL);
+    table_close(table);
+
+    //an index that cannot remove entries, the row is deleted and appended again
+    table = table_open("./", "tmp_lsm");
+    printf("update: %zd\n", table_update(table, (Predicate[]){{"num", OP_EQ, "12345", NULL}}, 1, false, (Assignment[]){{"num", "0"}}, 1));
+    select_num(table, "12345"); //no item
+    select_num(table, "0");
+    //the entry stays in the LSM index, the lookup skips the deleted row
+    printf("delete: %zd\n", table_delete(table, (Predicate[]){{"num", OP_EQ, "68000", NULL}}, 1, false));
+    select_num(table, "68000"); //no item
+    printf("compact: %d\n", table_compact(table)); //the runs of the new index replace the old ones
+    select_num(table, "0");
+    select_num(table, "68000"); //no item
+    table_close(table);
+}
+
+static void test_prepared() {
+    Table *table = create_id_num_table("tmp_prep", "id", INDEX_BTREE);
+    //columns bound in another order, values in native arrays
+    const char *num_id[] = {"num", "id"};
+    PStatement insert = table_prepare_insert(table, num_id, 2);
+    size_t num_rows = 3000;
+    int *nums = malloc(num_rows * sizeof(int));
+    long long *ids = malloc(num_rows * sizeof(long long));
+    for (size_t i = 0; i < num_rows; i++) {
+        ids[i] = i + 1;
+        nums[i] = (i + 1) % 7;
+    }
+    printf("prepared insert: %d\n", statement_insert(insert, (const void *[]){nums, ids}, num_rows));
+    for (int i = 0; i < 3; i++) {
+        int num = 100 + i;
+        long long id = 5000 + i;
+        statement_insert(insert, (const void *[]){&num, &id}, 1);
+    }
+    statement_close(insert);
+    free(nums);
+    free(ids);
+    const char *id_only[] = {"id"};
+    printf("prepared insert: %s\n", table_prepare_insert(table, id_only, 1) == NULL ? "NULL" : "statement");
+
+    //the same statement executed with other values
+    PreparedPredicate where[] = {{"id", OP_BETWEEN}, {"num", OP_GE}};
+    PStatement select = table_prepare_select(table, NULL, 0, where, 2, false);
+    printf("params: %zu\n", statement_num_params(select));
+    long long low = 10, high = 20;
+    int min_num = 5;
+    PCursor cursor = statement_query(select, (const void *[]){&low, &high, &min_num});
+    cursor_print(cursor);
+    cursor_close(cursor);
+    low = 4990;
+    high = 6000;
+    min_num = 101;
+    cursor = statement_query(select, (const void *[]){&low, &high, &min_num});
+    cursor_print(cursor);
+    cursor_close(cursor);
+    statement_close(select);
+
+    const char *num_only[] = {"num"};
+    select = table_prepare_select(table, num_only, 1, (PreparedPredicate[]){{"id", OP_LT}}, 1, false);
+    long long below = 4;
+    cursor = statement_query(select, (const void *[]){&below});
+    cursor_print(cursor);
+    cursor_close(cursor);
+    statement_close(select);
+    table_close(table);
+}
+
+static void test_sql() {
+    PSqlSession session = sql_open("./");
+    printf("sql: %d\n", sql_exec(session,
+        "CREATE TABLE tmp_sql (id bigint, num int) LAYOUT PAX;"
+        "create index on tmp_sql (id);"
+        "INSERT INTO tmp_sql VALUES (1, 10), (2, 20), (3, 30);"
+        "insert into tmp_sql (num, id) values (40, 4);"
+        "insert into tmp_sql (num, id) values ('50', 5);"
+        "SELECT * FROM tmp_sql WHERE id >= 2 AND num < 50;"
+        "select num from tmp_sql where id = 1 or id = 5; -- a comment\n"
+        "select id from tmp_sql order by num desc limit 2"));
+    //the same statements with other values are found in the cache
+    for (int i = 6; i <= 8; i++) {
+        char text[128];
+        sprintf(text, "insert into tmp_sql (num, id) values (%d, %d)", i * 10, i);
+        sql_exec(session, text);
+    }
+    sql_exec(session, "select * from tmp_sql where id between 6 and 7;  SELECT   *  FROM tmp_sql WHERE id BETWEEN 8 AND 9");
+    size_t hits, misses;
+    sql_cache_stats(session, &hits, &misses);
+    printf("cache: %zu hits %zu misses\n", hits, misses);
+    printf("sql: %d\n", sql_exec(session, "select * from tmp_sql where id = 1 and num = 1 or id = 2") != 0);
+    printf("sql: %d\n", sql_exec(session, "insert into tmp_sql values (1)") != 0);
+    printf("sql: %d\n", sql_exec(session, "select * from missing") != 0);
+    sql_close(session);
+}
+
+static void test_text() {
+    PSqlSession session = sql_open("./");
+    printf("sql: %d\n", sql_exec(session,
+        "CREATE TABLE tmp_text (id int, name varchar(8), body text) LAYOUT PAX;"
+        "INSERT INTO tmp_text VALUES (1, 'ann', 'short'), (2, 'bob', 'a body of more than twelve bytes'),"
+        "    (3, 'o''hara', 'say \"hi\" to a longer value'), (4, 'dee', '');"
+        "SELECT * FROM tmp_text WHERE body >= 'a body' ORDER BY name DESC;"
+        "select id from tmp_text where name between 'b' and 'p' order by name"));
+    printf("sql: %d\n", sql_exec(session, "insert into tmp_text values (5, 'too long', 'x'), (6, 'too long!', 'x')") != 0);
+    printf("sql: %d\n", sql_exec(session, "create index on tmp_text (name)") != 0);
+    sql_exec(session, "create table tmp_text_csv (id int, name varchar(8), body text)");
+    sql_close(session);
+
+    //exported with quotes and imported back
+    Table *table = table_open("./", "tmp_text");
+    FILE *file = fopen("tmp_text.csv", "w");
+    table_export_csv(table, file, false);
+    fclose(file);
+    table_close(table);
+    table = table_open("./", "tmp_text_csv");
+    file = fopen("tmp_text.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, false));
+    fclose(file);
+    remove("tmp_text.csv");
+    table_export_csv(table, stdout, false);
+    fflush(stdout);
+    table_close(table);
+
+    //values of 100 bytes fill several slotted pages, the last one of 10000 bytes takes overflow pages
+    table = table_open("./", "tmp_text");
+    enum {NUM_ROWS = 100, LONG_LEN = 10000};
+    int ids[NUM_ROWS];
+    char names[NUM_ROWS * TEXT_CELL_SIZE], bodies[NUM_ROWS * TEXT_CELL_SIZE];
+    char *texts = (char *)malloc(NUM_ROWS * 100 + LONG_LEN);
+    for (int i = 0; i < NUM_ROWS; i++) {
+        size_t len = i == NUM_ROWS - 1 ? LONG_LEN : 100;
+        ids[i] = 100 + i;
+        memset(texts + i * 100, 'a' + i % 26, len);
+        text_cell_set(names + i * TEXT_CELL_SIZE, "bulk", 4);
+        text_cell_set(bodies + i * TEXT_CELL_SIZE, texts + i * 100, len);
+    }
+    PStatement stmt = table_prepare_insert(table, NULL, 0);
+    const void *values[] = {ids, names, bodies};
+    printf("insert: %d\n", statement_insert(stmt, values, NUM_ROWS));
+    statement_close(stmt);
+    free(texts); //the values were copied
+    table_close(table);
+
+    table = table_open("./", "tmp_text");
+    char expected[100];
+    memset(expected, 'c', sizeof(expected));
+    expected[99] = '\0';
+    Predicate predicates[] = {{"body", OP_GT, expected, NULL}, {"body", OP_LT, "d", NULL}};
+    PCursor cursor = table_query(table, predicates, 2, false);
+    Column *id = table_column(table, "id"), *body = table_column(table, "body");
+    const void *row;
+    char buf[LONG_LEN];
+    while ((row = cursor_next(cursor)) != NULL) {
+        size_t len = column_text(body, row, buf, 8);
+        printf("%d %zu %.8s\n", column_int(id, row), len, buf);
+    }
+    cursor_close(cursor);
+    Predicate last = {"id", OP_EQ, "199", NULL};
+    cursor = table_query(table, &last, 1, false);
+    row = cursor_next(cursor);
+    size_t len = column_text(body, row, buf, sizeof(buf)), same = 0;
+    while (same < len && buf[same] == 'a' + (NUM_ROWS - 1) % 26)
+        same++;
+    printf("long: %zu of %zu\n", same, len);
+    cursor_close(cursor);
+    Assignment assignment = {"body", "a new body, stored in the heap"};
+    Predicate first = {"id", OP_LE, "100", NULL};
+    printf("update: %zd\n", table_update(table, &first, 1, false, &assignment, 1));
+    Predicate updated = {"body", OP_EQ, "a new body, stored in the heap", NULL};
+    table_select_where(table, &updated, 1);
+    table_close(table);
+
+    //a value is only read with its heap, the type has no function that could miss the heap
+    DataType *text = text_data_type();
+    printf("text type: compare %s, print %s, format %s\n", text->compare ? "set" : "NULL", text->print ? "set" : "NULL",
+        text->format ? "set" : "NULL");
+}
+
+static void test_null() {
+    PSqlSession session = sql_open("./");
+    printf("sql: %d\n", sql_exec(session,
+        "CREATE TABLE tmp_null (id int NOT NULL, score int NULL, note text NULL) LAYOUT PAX;"
+        "INSERT INTO tmp_null VALUES (1, 10, 'a'), (2, NULL, 'b'), (3, 30, NULL), (4, NULL, NULL);"
+        "INSERT INTO tmp_null (id, note) VALUES (5, 'e');"
+        "SELECT * FROM tmp_null WHERE score IS NULL;"
+        "SELECT id FROM tmp_null WHERE score >= 0 ORDER BY score DESC;"
+        "SELECT id, score FROM tmp_null WHERE note IS NOT NULL ORDER BY score, id"));
+    printf("sql: %d\n", sql_exec(session, "insert into tmp_null values (6, 1, 'f'), (NULL, 2, 'g')") != 0);
+    sql_exec(session, "create table tmp_null_csv (id int, score int null, note text null)");
+    sql_close(session);
+
+    //NULLs are grouped together and skipped by the aggregates of their column
+    Table *table = table_open("./", "tmp_null");
+    const char *group_by[] = {"score"};
+    Aggregate counts[] = {{AGG_COUNT, NULL}, {AGG_COUNT, "note"}, {AGG_SUM, "id"}};
+    aggregate(table, NULL, 0, group_by, 1, counts, 3);
+    Aggregate scores[] = {{AGG_COUNT, "score"}, {AGG_SUM, "score"}, {AGG_AVG, "score"}};
+    aggregate(table, NULL, 0, NULL, 0, scores, 3);
+    Assignment assignment = {"score", NULL};
+    Predicate first = {"id", OP_EQ, "1", NULL};
+    printf("update: %zd\n", table_update(table, &first, 1, false, &assignment, 1));
+    Predicate is_null = {"score", OP_IS_NULL, NULL, NULL};
+    table_select_where(table, &is_null, 1);
+
+    //NULLs are empty fields, an empty quoted text is not NULL
+    FILE *file = fopen("tmp_null.csv", "w");
+    table_export_csv(table, file, false);
+    fputs("6,,\"\"\n", file);
+    fclose(file);
+    table_close(table);
+    table = table_open("./", "tmp_null_csv");
+    file = fopen("tmp_null.csv", "r");
+    printf("import: %d\n", table_import_csv(table, file, false));
+    fclose(file);
+    remove("tmp_null.csv");
+    table_export_csv(table, stdout, false);
+    fflush(stdout);
+    Predicate empty = {"note", OP_EQ, "", NULL};
+    table_select_where(table, &empty, 1);
+    table_close(table);
+}
+
 int main() {
     ColNameList *list = new_list();
 
@@ -90,12 +1043,39 @@ int main() {
     }
     select_1(table); //10 items with id = 1000001
     select_2(table); //9 items with num = 8887
+    table_enable_bloom(table, "num", 0);
+    select_3(table); //no item with num = 1
 //    insert_1(table, 1024004);
     insert_1(table, 1024);
     insert_2(table);
     insert_1(table, 1024);
     select_2(table); //10 items with num = 8887
+    table_close(table);
+    table = table_open("./", "tmp_table"); //bloom filter is loaded from disk
+    select_2(table); //10 items with num = 8887
+    select_3(table);
 
     table_close(table);
+
+    test_engine("tmp_lsm", INDEX_LSM);
+    test_engine("tmp_cow", INDEX_COW);
+    test_lsm_log();
+    test_create_index();
+    test_range();
+    test_insert_batch();
+    test_csv();
+    test_pax();
+    test_aggregate();
+    test_join();
+    test_order();
+    test_projection();
+    test_delete();
+    test_prepared();
+    test_sql();
+    test_text();
+    test_null();
+    test_btree();
+    test_cow_snapshot();
+    test_scan_parallel();
     exit(0);
 }
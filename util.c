@@ -3,6 +3,7 @@
 List *new_list() {
     List *list = (List *)malloc(sizeof(List));
     list->size = 0;
+    return list;
 }
 
 size_t list_size(List *list) {
@@ -0,0 +1,234 @@
+#include "varheap.h"
+#include "datatype.h"
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#define VARHEAP_MAGIC     0x50485256 //"VRHP"
+#define VARHEAP_OVERFLOW  (1ULL << 63) //flag of a reference to overflow pages
+#define VARHEAP_LOCAL_LEN 256 //values compared without malloc
+
+/*
+
+  The first page of the file holds a VarHeapHeader. A reference to a value
+  in a slotted page is the number of the page shifted by 16 bits plus its
+  slot, a reference to overflow pages is the number of the first one with
+  VARHEAP_OVERFLOW.
+
+*/
+struct VarHeapHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t num_pages;
+    uint64_t page_no;
+};
+
+struct Slot {
+    uint16_t offset; //byte offset of the value in the page
+    uint16_t len;
+};
+
+struct SlotPage {
+    uint16_t num_slots;
+    uint16_t data_start; //values fill [data_start, VARHEAP_PAGE_SIZE)
+    struct Slot slots[];
+};
+
+static disk_pointer page_dp(PVarHeap heap, uint64_t page_no) {
+    return next_n_pointer(heap->disk, first_block(heap->disk), page_no);
+}
+
+static int write_header(PVarHeap heap) {
+    struct VarHeapHeader header = {VARHEAP_MAGIC, 0, heap->num_pages, heap->page_no};
+    return copy_to_disk_r(&header, sizeof(header), heap->disk, page_dp(heap, 0)) == 1 ? 0 : EIO;
+}
+
+PVarHeap varheap_create(const char *pathname) {
+    DISK *disk = dcreate(pathname, VARHEAP_PAGE_SIZE);
+    if (disk == NULL)
+        return NULL;
+    fflush(disk->file); //pages are written with pwrite
+    PVarHeap heap = (PVarHeap)malloc(sizeof(struct VarHeap));
+    heap->disk = disk;
+    heap->num_pages = 1;
+    heap->page_no = 0;
+    heap->page = (char *)malloc(VARHEAP_PAGE_SIZE);
+    heap->dirty = false;
+    if (write_header(heap) != 0) {
+        varheap_close(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+PVarHeap varheap_open(const char *pathname) {
+    DISK *disk = dopen(pathname);
+    if (disk == NULL)
+        return NULL;
+    PVarHeap heap = (PVarHeap)malloc(sizeof(struct VarHeap));
+    heap->disk = disk;
+    heap->page = (char *)malloc(VARHEAP_PAGE_SIZE);
+    heap->dirty = false;
+    heap->num_pages = 1;
+    heap->page_no = 0;
+    struct VarHeapHeader header;
+    if (disk->block_size != VARHEAP_PAGE_SIZE
+        || copy_bytes_to_memory_r(disk, page_dp(heap, 0), sizeof(header), &header) != sizeof(header)
+        || header.magic != VARHEAP_MAGIC) {
+        fprintf(stderr, "Invalid heap file \'%s\'\n", pathname);
+        varheap_close(heap);
+        return NULL;
+    }
+    heap->num_pages = header.num_pages;
+    //new values keep filling the last slotted page
+    if (header.page_no != 0 && copy_to_memory_r(disk, page_dp(heap, header.page_no), heap->page) == 1)
+        heap->page_no = header.page_no;
+    return heap;
+}
+
+void varheap_close(PVarHeap heap) {
+    if (heap == NULL)
+        return;
+    varheap_flush(heap);
+    dclose(heap->disk);
+    free(heap->page);
+    free(heap);
+}
+
+int varheap_flush(PVarHeap heap) {
+    if (!heap->dirty)
+        return 0;
+    if (heap->page_no != 0 && copy_to_disk_r(heap->page, VARHEAP_PAGE_SIZE, heap->disk, page_dp(heap, heap->page_no)) != 1)
+        return EIO;
+    if (write_header(heap) != 0)
+        return EIO;
+    heap->dirty = false;
+    return 0;
+}
+
+//Adds the value to the slotted page being filled, or to a new one if it has no room
+static int store_slot(PVarHeap heap, const char *data, size_t len, uint64_t *p_ref) {
+    struct SlotPage *page = (struct SlotPage *)heap->page;
+    if (heap->page_no == 0 || page->data_start - sizeof(struct SlotPage) - page->num_slots * sizeof(struct Slot) < len + sizeof(struct Slot)) {
+        int ret = varheap_flush(heap);
+        if (ret != 0)
+            return ret;
+        heap->page_no = heap->num_pages++;
+        memset(heap->page, 0, VARHEAP_PAGE_SIZE);
+        page->num_slots = 0;
+        page->data_start = VARHEAP_PAGE_SIZE;
+    }
+    page->data_start -= len;
+    memcpy(heap->page + page->data_start, data, len);
+    page->slots[page->num_slots].offset = page->data_start;
+    page->slots[page->num_slots].len = len;
+    *p_ref = heap->page_no << 16 | page->num_slots++;
+    heap->dirty = true;
+    return 0;
+}
+
+//Writes the value to new overflow pages, one write per page
+static int store_overflow(PVarHeap heap, const char *data, size_t len, uint64_t *p_ref) {
+    uint64_t first = heap->num_pages;
+    size_t num_pages = (len + VARHEAP_PAGE_SIZE - 1) / VARHEAP_PAGE_SIZE;
+    for (size_t i = 0; i < num_pages; i++) {
+        size_t size = len - i * VARHEAP_PAGE_SIZE < VARHEAP_PAGE_SIZE ? len - i * VARHEAP_PAGE_SIZE : VARHEAP_PAGE_SIZE;
+        if (copy_to_disk_r((void *)(data + i * VARHEAP_PAGE_SIZE), size, heap->disk, page_dp(heap, first + i)) != 1)
+            return EIO;
+    }
+    heap->num_pages += num_pages;
+    *p_ref = VARHEAP_OVERFLOW | first;
+    heap->dirty = true;
+    return 0;
+}
+
+int varheap_store(PVarHeap heap, void *memory) {
+    TextCell cell;
+    memcpy(&cell, memory, sizeof(cell));
+    if (!(cell.len & TEXT_IN_MEMORY))
+        return 0;
+    size_t len = cell.len & ~TEXT_IN_MEMORY;
+    const char *data = (const char *)(uintptr_t)cell.ref;
+    if (len <= TEXT_INLINE_LEN) {
+        text_cell_set(memory, data, len);
+        return 0;
+    }
+    uint64_t ref;
+    int ret = len <= VARHEAP_MAX_SLOT_LEN ? store_slot(heap, data, len, &ref) : store_overflow(heap, data, len, &ref);
+    if (ret != 0)
+        return ret;
+    cell.len = len;
+    cell.ref = ref;
+    memcpy(memory, &cell, sizeof(cell));
+    return 0;
+}
+
+int varheap_load(PVarHeap heap, const void *memory, void *buf) {
+    TextCell cell;
+    memcpy(&cell, memory, sizeof(cell));
+    size_t len = cell.len & ~TEXT_IN_MEMORY;
+    if (cell.len & TEXT_IN_MEMORY) {
+        memcpy(buf, (const void *)(uintptr_t)cell.ref, len);
+        return 0;
+    }
+    if (len <= TEXT_INLINE_LEN) {
+        memcpy(buf, (const char *)memory + offsetof(TextCell, prefix), len);
+        return 0;
+    }
+    if (cell.ref & VARHEAP_OVERFLOW)
+        return copy_bytes_to_memory_r(heap->disk, page_dp(heap, cell.ref & ~VARHEAP_OVERFLOW), len, buf) == len ? 0 : EIO;
+    uint64_t page_no = cell.ref >> 16;
+    size_t slot_no = cell.ref & 0xffff;
+    char local[VARHEAP_PAGE_SIZE];
+    const char *content = heap->page;
+    if (page_no != heap->page_no) {
+        if (copy_to_memory_r(heap->disk, page_dp(heap, page_no), local) != 1)
+            return EIO;
+        content = local;
+    }
+    const struct SlotPage *page = (const struct SlotPage *)content;
+    if (slot_no >= page->num_slots || page->slots[slot_no].len != len)
+        return EIO;
+    memcpy(buf, content + page->slots[slot_no].offset, len);
+    return 0;
+}
+
+/* Returns the bytes of the value of 'memory', in 'local' or, if it is too
+   small, in memory returned in *p_alloc for the caller to free. */
+static const char *cell_value(PVarHeap heap, const void *memory, const TextCell *cell, char *local, char **p_alloc) {
+    size_t len = cell->len & ~TEXT_IN_MEMORY;
+    if (cell->len & TEXT_IN_MEMORY)
+        return (const char *)(uintptr_t)cell->ref;
+    if (len <= TEXT_INLINE_LEN)
+        return (const char *)memory + offsetof(TextCell, prefix);
+    char *buf = len <= VARHEAP_LOCAL_LEN ? local : (*p_alloc = (char *)malloc(len));
+    if (varheap_load(heap, memory, buf) != 0) {
+        fprintf(stderr, "Can't load a value of %zu bytes from the heap file\n", len);
+        memset(buf, 0, len);
+    }
+    return buf;
+}
+
+int varheap_compare(PVarHeap heap, const void *a, const void *b) {
+    TextCell x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    size_t len_a = x.len & ~TEXT_IN_MEMORY, len_b = y.len & ~TEXT_IN_MEMORY;
+    size_t len = len_a < len_b ? len_a : len_b;
+    //the prefix is the start of the value in every cell
+    int res = memcmp(x.prefix, y.prefix, len < sizeof(x.prefix) ? len : sizeof(x.prefix));
+    if (res != 0)
+        return res;
+    if (len > sizeof(x.prefix)) {
+        char local_a[VARHEAP_LOCAL_LEN], local_b[VARHEAP_LOCAL_LEN];
+        char *alloc_a = NULL, *alloc_b = NULL;
+        const char *value_a = cell_value(heap, a, &x, local_a, &alloc_a);
+        const char *value_b = cell_value(heap, b, &y, local_b, &alloc_b);
+        res = memcmp(value_a, value_b, len);
+        free(alloc_a);
+        free(alloc_b);
+        if (res != 0)
+            return res;
+    }
+    return (len_a > len_b) - (len_a < len_b);
+}
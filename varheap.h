@@ -0,0 +1,48 @@
+#ifndef VARHEAP_H__
+#define VARHEAP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "disk.h"
+
+#define VARHEAP_PAGE_SIZE    4096
+#define VARHEAP_MAX_SLOT_LEN 1024 //longer values take overflow pages of their own
+
+/* Heap file of the values of variable-length columns that do not fit in
+   their cell (see TextCell in datatype.h). A value of at most
+   VARHEAP_MAX_SLOT_LEN bytes is packed with others in a slotted page: a slot
+   directory grows from the start of the page and the values from its end,
+   so a page holds as many values as their actual lengths allow. A longer
+   value takes a run of overflow pages, read with one IO. The cell of a value
+   refers to its page and slot, or to its first overflow page.
+
+   Values are only appended; the space of a value no longer referred to by a
+   row is not reused. Values may be loaded and compared by several threads at
+   once, but not while others are stored. */
+typedef struct VarHeap {
+    DISK *disk;
+    uint64_t num_pages; //pages of the file, the header page included
+    uint64_t page_no;   //slotted page being filled, 0 if none
+    char *page;         //content of 'page_no'
+    bool dirty;         //'page' or the header are newer than the file
+} *PVarHeap;
+
+PVarHeap varheap_create(const char *pathname);
+PVarHeap varheap_open(const char *pathname);
+/* Flushes the heap to disk and frees it. */
+void varheap_close(PVarHeap heap);
+/* Writes the page being filled and the header. Returns 0 if success. */
+int varheap_flush(PVarHeap heap);
+
+/* Moves the value of a cell referring to memory into the heap, or into the
+   cell itself if it fits, and sets the cell to refer to it. Other cells are
+   left as they are. Returns 0 if success. */
+int varheap_store(PVarHeap heap, void *cell);
+/* Copies the text_cell_len(cell) bytes of the value of 'cell' to 'buf'.
+   Returns 0 if success. */
+int varheap_load(PVarHeap heap, const void *cell, void *buf);
+/* Compares the values of two cells as the text type does. The values are
+   only loaded if their first bytes and lengths do not decide. */
+int varheap_compare(PVarHeap heap, const void *a, const void *b);
+
+#endif